@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace libblackmagic {
+
+  // Fixed-capacity FIFO with a selectable policy for when it is full.
+  //
+  // Items are exchanged with std::swap rather than copied, and the slots
+  // are allocated up front, so if T recycles its own storage (e.g. keeps a
+  // vector's capacity) a steady stream of push()/pop() does not allocate.
+  //
+  template <typename T>
+  class BoundedQueue {
+  public:
+
+    enum Policy {
+      DropOldest,     // discard the oldest queued item to make room
+      DropNewest,     // refuse the new item
+      Block           // wait for the consumer
+    };
+
+    struct Stats {
+      unsigned long enqueued, dropped;
+      unsigned int size, highWater, depth;
+    };
+
+    BoundedQueue( unsigned int depth = 4, Policy policy = Block )
+      : _slots( std::max( 1u, depth ) ), _policy( policy ),
+        _head(0), _count(0), _closed(false), _noWait(false),
+        _enqueued(0), _dropped(0), _highWater(0)
+    {;}
+
+    BoundedQueue( const BoundedQueue & ) = delete;
+    BoundedQueue &operator=( const BoundedQueue & ) = delete;
+
+    // Changes depth and policy.  Anything queued is discarded.
+    void configure( unsigned int depth, Policy policy )
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _slots = std::vector<T>( std::max( 1u, depth ) );
+      _policy = policy;
+      _head = _count = 0;
+    }
+
+    Policy policy() const   { return _policy; }
+
+    // Swaps item into the queue.  On return item holds whatever should be
+    // disposed of:  an empty slot, the evicted oldest item (DropOldest),
+    // or the caller's own item if it was refused (DropNewest, or closed).
+    //
+    // Returns false if the new item was not queued.
+    bool push( T &item )
+    {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if( _policy == Block ) {
+          while( _count == _slots.size() && !_closed && !_noWait ) _notFull.wait(lock);
+        }
+
+        if( _closed ) return false;
+
+        if( _count == _slots.size() ) {
+          ++_dropped;
+
+          // Block only gets here after stopWaiting()
+          if( _policy != DropOldest ) return false;
+
+          // When full the oldest item's slot is also the next free one
+          _head = (_head + 1) % _slots.size();
+          --_count;
+        }
+
+        std::swap( _slots[ (_head + _count) % _slots.size() ], item );
+        ++_count;
+        ++_enqueued;
+        _highWater = std::max( _highWater, _count );
+      }
+
+      _notEmpty.notify_one();
+      return true;
+    }
+
+    // Swaps the oldest item into item.  Blocks until one is available;
+    // returns false once the queue is closed and empty.
+    bool pop( T &item )
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while( _count == 0 && !_closed ) _notEmpty.wait(lock);
+      return popLocked( item, lock );
+    }
+
+    // As pop(), but gives up after timeout
+    template< class Rep, class Period >
+    bool pop_for( T &item, const std::chrono::duration<Rep, Period> &timeout )
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if( !_notEmpty.wait_for( lock, timeout, [this]{ return _count > 0 || _closed; } ) ) return false;
+      return popLocked( item, lock );
+    }
+
+    bool try_pop( T &item )
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      return popLocked( item, lock );
+    }
+
+    // Wakes everyone;  pushes fail and pops drain what is left
+    void close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+      }
+      _notEmpty.notify_all();
+      _notFull.notify_all();
+    }
+
+    // Blocked pushes, and any to come, stop waiting for room and refuse
+    // their item instead, as DropNewest would.  Pops carry on as before.
+    // For shutting down producers when there may be no consumer.
+    void stopWaiting()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _noWait = true;
+      }
+      _notFull.notify_all();
+    }
+
+    // Undoes close() and stopWaiting()
+    void open()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = false;
+      _noWait = false;
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      Stats s;
+      s.enqueued = _enqueued;
+      s.dropped = _dropped;
+      s.size = _count;
+      s.highWater = _highWater;
+      s.depth = _slots.size();
+      return s;
+    }
+
+  protected:
+
+    bool popLocked( T &item, std::unique_lock<std::mutex> &lock )
+    {
+      if( _count == 0 ) return false;
+
+      std::swap( _slots[_head], item );
+      _head = (_head + 1) % _slots.size();
+      --_count;
+
+      lock.unlock();
+      _notFull.notify_one();
+      return true;
+    }
+
+  private:
+
+    std::vector<T> _slots;
+    Policy _policy;
+    unsigned int _head, _count;
+    bool _closed, _noWait;
+
+    unsigned long _enqueued, _dropped;
+    unsigned int _highWater;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmpty, _notFull;
+  };
+
+}
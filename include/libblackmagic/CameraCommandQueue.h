@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "libbmsdi/bmsdi_message.h"
+
+namespace libblackmagic {
+
+  // Camera control commands on their way to the output, from any number
+  // of threads.
+  //
+  // Producers build messages with the libbmsdi helpers, exactly as they
+  // would into a BMSDIBuffer:
+  //
+  //   queue( []( BMSDIBuffer *buffer ){ bmAddSensorGain( buffer, CamNum, 4 ); } );
+  //
+  // and each message is copied into a bounded lock-free ring, so producers
+  // never wait on each other or on the output.  A full ring refuses
+  // messages (counted in Stats::dropped) rather than blocking.
+  //
+  // The output callback calls fill() for each packet of a frame.  It
+  // drains the ring into a pending list, where a command which sets a
+  // value (operation "assign") replaces any pending command for the same
+  // camera and parameter:  the latest focus, gain or exposure wins, and
+  // keeps its place in line.  Offsets and other operations are sent as they came.
+  // As many pending messages as fit go in the frame's packets, oldest
+  // first;  the rest wait for the next frame.  They're only counted as
+  // sent once the output confirm()s that the frame was scheduled.
+  //
+  class CameraCommandQueue {
+  public:
+
+    // Longest single message accepted, header and padding included
+    static const size_t kMaxMessageBytes = 64;
+
+    // A packet's payload
+    static const size_t kMaxPacketBytes = 255;
+
+    struct Stats {
+      uint64_t queued,      // messages taken from producers
+               coalesced,   // of those, replaced by a later one before being sent
+               dropped,     // refused because the ring was full, malformed, or abandoned
+               sent,        // in a packet of a frame which was scheduled
+               packets;
+      unsigned int pending;
+    };
+
+    // Capacity of the ring, and of the pending list, in messages
+    CameraCommandQueue( size_t capacity = 256 );
+
+    CameraCommandQueue( const CameraCommandQueue & ) = delete;
+    CameraCommandQueue &operator=( const CameraCommandQueue & ) = delete;
+
+    //== Producers, any thread ==
+
+    // Queues each message in buffer.  False if any were dropped.
+    bool push( const BMSDIBuffer &buffer );
+
+    // Calls f with an empty BMSDIBuffer, then queues what it added
+    template< typename Func >
+    bool operator()( Func f ) {
+      BMSDIBuffer buffer;
+      bmResetBuffer( &buffer );
+      f( &buffer );
+      return push( buffer );
+    }
+
+    //== Consumer, one thread ==
+
+    // True if anything is waiting to be sent
+    bool pending() const;
+
+    // Appends as many pending messages to packet as fit in maxBytes (at
+    // most kMaxPacketBytes).  Returns the number of messages added.
+    size_t fill( BMSDIBuffer *packet, size_t maxBytes = kMaxPacketBytes );
+
+    // The messages fill() has taken since the last confirm() or abandon()
+    // went out, so count them as sent
+    void confirm();
+
+    // They never will, so count them as dropped.  Returns how many.
+    size_t abandon();
+
+    Stats stats() const;
+
+  protected:
+
+    struct Message {
+      uint8_t len;
+      uint8_t bytes[kMaxMessageBytes];
+
+      // Destination camera, category and parameter
+      uint32_t key() const;
+
+      // Sets a value, so supersedes earlier messages with the same key
+      bool isAssign() const;
+    };
+
+    bool tryPush( const Message &msg );
+    bool tryPop( Message &msg );
+
+    // Moves what's in the ring to _pending, coalescing
+    void drain();
+
+  private:
+
+    // Bounded MPMC ring after Dmitry Vyukov:  each cell's sequence says
+    // whether it's free for the producer at that position, or full for
+    // the consumer
+    struct Cell {
+      std::atomic<size_t> sequence;
+      Message message;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    std::atomic<size_t> _enqueuePos;
+    size_t _dequeuePos;
+
+    // Consumer only, preallocated to the ring's capacity
+    std::vector<Message> _pending;
+
+    // Taken by fill(), but not yet confirm()ed
+    size_t _taken, _takenPackets;
+
+    std::atomic<uint64_t> _queued, _coalesced, _dropped, _sent, _packets;
+    std::atomic<unsigned int> _pendingCount;
+  };
+
+}
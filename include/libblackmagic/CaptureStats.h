@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "libblackmagic/LatencyHistogram.h"
+
+namespace libblackmagic {
+
+  // Counters and timing histograms for the capture path.  Every record
+  // function is lock-free, so they can be called from the SDK callback;
+  // snapshot() can be called from any thread at any time.
+  //
+  class CaptureStats {
+  public:
+
+    struct Snapshot {
+      // Frames from the card, including those without input or dropped
+      uint64_t frames;
+
+      // Frames dropped because processing couldn't keep up
+      uint64_t dropped;
+      uint64_t noInput;
+
+      // Frames dropped because their bytes couldn't be read to convert them
+      uint64_t failed;
+
+      // Frames handed to the consumer callbacks
+      uint64_t delivered;
+
+      // GetAvailableVideoFrameCount() at the last frame, and the largest seen
+      uint32_t backlog, maxBacklog;
+
+      // Time spent in VideoInputFrameArrived(), on the driver's thread
+      LatencyHistogram::Snapshot driverCallbackTime;
+
+      // From VideoInputFrameArrived() to the start of the consumer callback
+      LatencyHistogram::Snapshot deliveryLatency;
+
+      // Time to convert each eye to a Mat
+      LatencyHistogram::Snapshot conversionTime[2];
+
+      // Time spent in the consumer callbacks
+      LatencyHistogram::Snapshot callbackTime;
+    };
+
+    CaptureStats();
+
+    CaptureStats( const CaptureStats & ) = delete;
+    CaptureStats &operator=( const CaptureStats & ) = delete;
+
+    void countFrame()      { _frames.fetch_add( 1, std::memory_order_relaxed ); }
+    void countDropped()    { _dropped.fetch_add( 1, std::memory_order_relaxed ); }
+    void countNoInput()    { _noInput.fetch_add( 1, std::memory_order_relaxed ); }
+    void countFailed()     { _failed.fetch_add( 1, std::memory_order_relaxed ); }
+    void countDelivered()  { _delivered.fetch_add( 1, std::memory_order_relaxed ); }
+
+    void recordBacklog( uint32_t frames );
+
+    LatencyHistogram &driverCallbackTime()                   { return _driverCallbackTime; }
+    LatencyHistogram &deliveryLatency()                      { return _deliveryLatency; }
+    LatencyHistogram &conversionTime( unsigned int eye )     { return _conversionTime[ eye ? 1 : 0 ]; }
+    LatencyHistogram &callbackTime()                         { return _callbackTime; }
+
+    uint64_t frames() const    { return _frames.load( std::memory_order_relaxed ); }
+    uint64_t dropped() const   { return _dropped.load( std::memory_order_relaxed ); }
+    uint64_t noInput() const   { return _noInput.load( std::memory_order_relaxed ); }
+    uint64_t failed() const    { return _failed.load( std::memory_order_relaxed ); }
+
+    Snapshot snapshot() const;
+    void reset();
+
+  private:
+
+    std::atomic<uint64_t> _frames, _dropped, _noInput, _failed, _delivered;
+    std::atomic<uint32_t> _backlog, _maxBacklog;
+
+    LatencyHistogram _driverCallbackTime;
+    LatencyHistogram _deliveryLatency;
+    LatencyHistogram _conversionTime[2];
+    LatencyHistogram _callbackTime;
+  };
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "DeckLinkAPI.h"
+
+namespace libblackmagic {
+
+  class DeckLink;
+
+  // Per-stream resources for converting input frames to BGRA with the
+  // SDK's IDeckLinkVideoConversion.
+  //
+  // Holds the IDeckLinkOutput used to create frames and a small pool of
+  // destination frames (each with its own converter) sized for the
+  // current mode.   Slots are handed out round-robin and are safe to use
+  // from several threads at once, so steady-state conversion creates no
+  // SDK objects.
+  //
+  class ConversionContext {
+  public:
+
+    ConversionContext( DeckLink &deckLink, unsigned int poolSize = 4 );
+    ~ConversionContext();
+
+    ConversionContext( const ConversionContext & ) = delete;
+    ConversionContext &operator=( const ConversionContext & ) = delete;
+
+    // (Re)builds the destination pool for frames of the given size.
+    // Must not be called while a conversion is in progress.
+    bool configure( long width, long height );
+
+    // Releases all SDK resources
+    void reset();
+
+    bool configured() const   { return !_slots.empty(); }
+
+    // Converts src to BGRA and copies the result into out
+    bool convert( IDeckLinkVideoFrame *src, cv::Mat &out );
+
+    // Number of SDK objects (frames, converters) created since construction
+    unsigned long sdkObjectsCreated() const    { return _sdkObjectsCreated; }
+
+    // Number of conversions which could not use the pool (pool exhausted or
+    // wrong frame size) and had to create temporary SDK objects
+    unsigned long fallbackConversions() const  { return _fallbackConversions; }
+
+  protected:
+
+    IDeckLinkOutput *deckLinkOutput();
+
+    bool convertInto( IDeckLinkVideoConversion *converter, IDeckLinkVideoFrame *src,
+                      IDeckLinkMutableVideoFrame *dst, cv::Mat &out );
+
+    bool convertTemporary( IDeckLinkVideoFrame *src, cv::Mat &out );
+
+  private:
+
+    struct Slot {
+      Slot() : frame(nullptr), converter(nullptr), busy(false) {;}
+
+      IDeckLinkMutableVideoFrame *frame;
+      IDeckLinkVideoConversion *converter;
+      std::atomic<bool> busy;
+    };
+
+    DeckLink &_deckLink;
+    IDeckLinkOutput *_deckLinkOutput;
+
+    unsigned int _poolSize;
+    long _width, _height;
+
+    std::vector< std::unique_ptr<Slot> > _slots;
+    std::atomic<unsigned int> _next;
+
+    std::atomic<unsigned long> _sdkObjectsCreated;
+    std::atomic<unsigned long> _fallbackConversions;
+  };
+
+}
@@ -17,6 +17,9 @@ namespace libblackmagic {
   //== Pixel format to string ==
   const std::string pixelFormatToString( BMDPixelFormat pixFmt );
 
+  //== Bytes per row the SDK uses for a pixel format (0 if unknown) ==
+  unsigned int rowBytesForPixelFormat( BMDPixelFormat pixFmt, unsigned int width );
+
 
   struct ModeParams {
     BMDDisplayMode mode;
@@ -16,6 +16,9 @@ namespace libblackmagic {
   public:
 
   	DeckLink( int cardno = 0 );
+
+    // Wraps an existing device (e.g. a SimulatedDeckLink);  takes a reference
+    explicit DeckLink( IDeckLink *deckLink );
     ~DeckLink();
 
     // Delete the copy operators
@@ -35,6 +38,10 @@ namespace libblackmagic {
 
     IDeckLink *deckLink() { return _deckLink; }
 
+    // NUMA node the card is attached to, found from the PCI address in its
+    // device handle.  -1 if it can't be determined.
+    int numaNode();
+
   protected:
 
     static IDeckLink *CreateDeckLink( int cardNo );
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+
+#include <opencv2/core/core.hpp>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/FrameMetadata.h"
+
+namespace libblackmagic {
+
+  // Move-only owner of the SDK frame(s) for one capture:  the left eye
+  // (or the only eye) and optionally the right eye.
+  //
+  // The handle holds one SDK reference per frame and Release()s them when
+  // it is destroyed or reset.   Frames held by handles are not available to
+  // the card for capture, so consumers should not hold on to more than a
+  // few;  checkedOut() reports how many are currently outstanding.
+  //
+  class FrameHandle {
+  public:
+
+    FrameHandle();
+
+    // Takes ownership of one reference on each frame
+    FrameHandle( IDeckLinkVideoFrame *left, IDeckLinkVideoFrame *right = nullptr,
+                 const FrameMetadata &metadata = FrameMetadata() );
+
+    FrameHandle( FrameHandle &&other );
+    FrameHandle &operator=( FrameHandle &&other );
+
+    FrameHandle( const FrameHandle & ) = delete;
+    FrameHandle &operator=( const FrameHandle & ) = delete;
+
+    ~FrameHandle();
+
+    // Releases the frames now
+    void reset();
+
+    bool valid() const            { return _frames[0] != nullptr; }
+    unsigned int size() const     { return (_frames[0] ? 1 : 0) + (_frames[1] ? 1 : 0); }
+
+    IDeckLinkVideoFrame *frame( unsigned int eye = 0 ) const
+      { return eye < 2 ? _frames[eye] : nullptr; }
+
+    BMDPixelFormat pixelFormat( unsigned int eye = 0 ) const;
+
+    const FrameMetadata &metadata() const   { return _metadata; }
+
+    // Returns a cv::Mat header over the SDK's buffer (no copy).
+    //
+    // 8-bit YUV is CV_8UC2, BGRA/ARGB are CV_8UC4.   Other formats are
+    // returned as CV_8UC1 rows of raw bytes, GetRowBytes() wide.
+    //
+    // The Mat is only valid while this handle holds the frame.
+    cv::Mat mat( unsigned int eye = 0 ) const;
+
+    // Total number of SDK frames currently held by FrameHandles
+    static int checkedOut()       { return _checkedOut; }
+
+  private:
+
+    IDeckLinkVideoFrame *_frames[2];
+    FrameMetadata _metadata;
+
+    static std::atomic<int> _checkedOut;
+  };
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include "DeckLinkAPI.h"
+
+namespace libblackmagic {
+
+  struct FrameTimecode {
+    FrameTimecode()
+      : valid(false), format(0), flags(0), hours(0), minutes(0), seconds(0), frames(0)
+      {;}
+
+    bool valid;
+
+    // Which timecode was found, e.g. bmdTimecodeRP188Any or bmdTimecodeVITC
+    BMDTimecodeFormat format;
+    BMDTimecodeFlags flags;
+
+    uint8_t hours, minutes, seconds, frames;
+
+    bool isDropFrame() const   { return flags & bmdTimecodeIsDropFrame; }
+
+    // "hh:mm:ss:ff" (";ff" for drop frame), or an empty string if not valid
+    std::string toString() const;
+  };
+
+  // Describes one capture.  Plain data, so it can be copied around the
+  // pipeline without allocating.
+  struct FrameMetadata {
+    FrameMetadata()
+      : sequence(0), timeScale(kTimeScale),
+        streamTime(0), streamDuration(0),
+        hardwareTime(0), hardwareDuration(0),
+        hostTime(), timecode(),
+        noInput(false), is3D(false)
+      {;}
+
+    // Stream and hardware times are in units of 1/timeScale seconds
+    static const BMDTimeScale kTimeScale = 1000000;
+
+    // Counts every frame the card delivers, including those dropped or
+    // without input, so gaps in the sequence are skipped frames
+    uint64_t sequence;
+
+    BMDTimeScale timeScale;
+    BMDTimeValue streamTime, streamDuration;
+    BMDTimeValue hardwareTime, hardwareDuration;
+
+    // When VideoInputFrameArrived() was called
+    std::chrono::steady_clock::time_point hostTime;
+
+    // RP188 if present, otherwise VITC
+    FrameTimecode timecode;
+
+    bool noInput;
+    bool is3D;
+  };
+
+  // Fills in the stream time, hardware time, timecode and no-input flag
+  // from the frame.  Sequence number, host time and is3D are left to the
+  // caller.
+  void readFrameMetadata( IDeckLinkVideoInputFrame *frame, FrameMetadata &meta );
+
+}
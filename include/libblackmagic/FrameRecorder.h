@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/FrameMetadata.h"
+#include "libblackmagic/RecordingFormat.h"
+#include "libblackmagic/SpscRing.h"
+
+namespace libblackmagic {
+
+  // Streams captured frames to disk in their native pixel format, before
+  // any conversion, in the layout described in RecordingFormat.h.
+  //
+  // Frames are written with O_DIRECT straight out of the capture buffers,
+  // so nothing is copied and nothing passes through the page cache.  Each
+  // frame is held until its write completes.  Frame buffers which aren't
+  // block aligned (PooledFrameAllocator's always are) are copied to an
+  // aligned staging buffer instead.  Writes go through io_uring, or, where
+  // the kernel doesn't allow it, pwritev() on a writer thread.
+  //
+  // record() never waits on the disk:  if every slot is still being
+  // written the frame is left out of the recording and counted as
+  // dropped.  That is the disk falling behind, and it is logged once per
+  // episode and passed to the backpressure callback.
+  //
+  // record() and close() must be called from one thread at a time;
+  // InputHandler calls record() on its dispatch thread.
+  //
+  class FrameRecorder {
+  public:
+
+    struct Options {
+      Options()
+        : framesInFlight( 4 ), directIO( true ), useIoUring( true )
+        {;}
+
+      // Frames (each of one or two eyes) which may be queued for the disk
+      // at once.  The capture buffers behind them are held too, so the
+      // card needs this many spare.
+      unsigned int framesInFlight;
+
+      // Bypass the page cache.  Filesystems which don't support O_DIRECT
+      // (e.g. tmpfs) fall back to buffered writes with a warning.
+      bool directIO;
+
+      bool useIoUring;
+    };
+
+    struct Stats {
+      // Eye records written, and the bytes they took on disk
+      uint64_t records, bytes;
+
+      // Frames left out because the disk had fallen behind
+      uint64_t dropped;
+
+      // Records lost to write errors
+      uint64_t errors;
+
+      unsigned int inFlight, highWater;
+    };
+
+    FrameRecorder( const Options &opts = Options() );
+    ~FrameRecorder();
+
+    FrameRecorder( const FrameRecorder & ) = delete;
+    FrameRecorder &operator=( const FrameRecorder & ) = delete;
+
+    // Creates (or truncates) path and writes the file header
+    bool open( const std::string &path );
+
+    // Waits for queued writes to finish, appends the index, then closes
+    // the file
+    void close();
+
+    bool isOpen() const   { return _fd >= 0; }
+
+    // How writes are actually being made, once open
+    bool usingIoUring() const   { return _ring != nullptr; }
+    bool usingDirectIO() const  { return _direct; }
+
+    // Queues a frame, and its right eye if it has one, to be written.
+    // Takes its own references to the frames.  Returns false if the frame
+    // was dropped or the recorder isn't open.
+    bool record( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye,
+                 const FrameMetadata &meta, BMDDisplayMode mode );
+
+    // Waits up to timeout for the disk to have room for a frame of this
+    // many eyes, so the next record() of one won't be dropped.  False on
+    // timeout, or if the recorder isn't recording.  From the thread which
+    // calls record().
+    bool waitForSpace( unsigned int eyes, std::chrono::milliseconds timeout );
+
+    Stats stats() const;
+
+    // Called on the recording thread when frames start being dropped,
+    // with the total dropped so far
+    typedef std::function< void( uint64_t dropped ) > BackpressureCallback;
+    void setBackpressureCallback( BackpressureCallback callback )   { _backpressureCallback = callback; }
+
+    class IoUring;
+
+  protected:
+
+    // One eye record on its way to disk
+    struct Slot {
+      Slot() : frame( nullptr ), block( nullptr ), staging( nullptr ),
+               stagingSize( 0 ), iovcnt( 0 ), offset( 0 ), length( 0 ) {;}
+
+      IDeckLinkVideoFrame *frame;
+
+      // Two aligned blocks:  the record header, then the frame's tail
+      uint8_t *block;
+
+      // Aligned copy of frames which can't be written in place
+      uint8_t *staging;
+      size_t stagingSize;
+
+      struct iovec iov[3];
+      int iovcnt;
+      uint64_t offset;
+      size_t length;
+    };
+
+    // Fills in slot to write one eye.  False if the frame can't be read.
+    bool prepare( Slot &slot, IDeckLinkVideoFrame *frame, unsigned int eye,
+                  const FrameMetadata &meta, BMDDisplayMode mode );
+
+    // Hands a prepared slot to the kernel or the writer thread
+    bool submit( unsigned int index );
+
+    // Called on the writer thread as each write finishes
+    void completed( unsigned int index, long result );
+
+    void writerThread();
+    void freeSlots();
+
+    bool writeFileHeader( uint64_t indexOffset );
+
+    // Appends the index once every record has been written
+    bool writeIndex();
+
+  private:
+
+    Options _opts;
+
+    int _fd;
+    bool _direct;
+    uint64_t _offset;
+    int64_t _created;
+
+    std::unique_ptr<IoUring> _ring;
+    std::thread _writerThread;
+
+    std::vector<Slot> _slots;
+
+    // Slots the recording thread can fill
+    std::vector<unsigned int> _spare;
+
+    // One entry per frame queued, written out by close().  Kept in
+    // fixed-size chunks so adding an entry never copies those before it,
+    // however long the recording runs
+    std::vector< std::unique_ptr<RecordingIndexEntry[]> > _index;
+    size_t _indexSize;
+
+    // Slots handed back by the writer thread, and (without io_uring)
+    // slots waiting to be written
+    SpscRing<unsigned int> _free;
+    SpscRing<unsigned int> _pending;
+
+    std::atomic<uint64_t> _records, _bytes, _dropped, _errors;
+    std::atomic<unsigned int> _inFlight, _highWater;
+
+    // Set once a write fails;  nothing more is recorded
+    std::atomic<bool> _failed;
+
+    bool _behind, _warnedUnaligned;
+    BackpressureCallback _backpressureCallback;
+  };
+
+}
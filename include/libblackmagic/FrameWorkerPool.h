@@ -0,0 +1,113 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/FrameMetadata.h"
+
+namespace libblackmagic {
+
+  // Fixed-size pool of persistent threads which process incoming frames.
+  //
+  // Frames are handed to the workers through a preallocated ring of job
+  // slots, so submit() does not allocate.   Jobs may finish out of order, but
+  // the deliver function is always called one job at a time, in the order the
+  // jobs were submitted.
+  //
+  class FrameWorkerPool {
+  public:
+
+    typedef std::vector<cv::Mat> MatVector;
+    typedef std::vector<IDeckLinkVideoFrame *> FrameVector;
+
+    // One or two frames (left, right eye) and the images made from them
+    struct Job {
+      Job() : frames(), images(), metadata(), failed( false ) {;}
+
+      FrameVector frames;
+      MatVector images;
+      FrameMetadata metadata;
+
+      // Set by the process function if the images couldn't be made, e.g.
+      // a frame's bytes couldn't be read.  Cleared by submit().
+      bool failed;
+    };
+
+    // Called (concurrently) on the worker threads to convert frames to images
+    typedef std::function< void( Job & ) > ProcessFunc;
+
+    // Called on the worker threads in submission order.  Responsible for
+    // releasing the job's frames.
+    typedef std::function< void( Job & ) > DeliverFunc;
+
+    FrameWorkerPool( unsigned int numWorkers = 2, unsigned int queueDepth = 4 );
+    ~FrameWorkerPool();
+
+    FrameWorkerPool( const FrameWorkerPool & ) = delete;
+    FrameWorkerPool &operator=( const FrameWorkerPool & ) = delete;
+
+    // Called first thing on each worker thread, with the worker's index,
+    // e.g. to set its name, affinity and scheduling
+    typedef std::function< void( unsigned int ) > ThreadInitFunc;
+
+    void setProcessFunc( ProcessFunc func )        { _process = func; }
+    void setDeliverFunc( DeliverFunc func )        { _deliver = func; }
+    void setThreadInitFunc( ThreadInitFunc func )  { _threadInit = func; }
+
+    // Takes effect at the next start()
+    void resize( unsigned int numWorkers, unsigned int queueDepth );
+
+    unsigned int numWorkers() const   { return _numWorkers; }
+    unsigned int queueDepth() const   { return _slots.size(); }
+
+    // Spawns the worker threads (if not already running)
+    void start();
+
+    // Waits for every submitted job to be delivered, then joins the workers.
+    void stop();
+
+    // Waits for every submitted job to be delivered.  Workers keep running.
+    void drain();
+
+    // Hands one (mono) or two (stereo) frames to the pool.   The pool
+    // takes ownership of the references.   Returns false if every slot is
+    // busy or the pool is not running;  the frames are not touched and the
+    // caller remains responsible for releasing them.
+    bool submit( IDeckLinkVideoFrame *left, IDeckLinkVideoFrame *right = nullptr,
+                 const FrameMetadata &metadata = FrameMetadata() );
+
+  protected:
+
+    void workerLoop( unsigned int index );
+
+  private:
+
+    unsigned int _numWorkers;
+
+    // Ring of job slots.  Slots in [_deliverIdx, _submitIdx) are in use,
+    // slots in [_dispatchIdx, _submitIdx) are waiting for a worker.
+    std::vector<Job> _slots;
+    unsigned int _submitIdx, _dispatchIdx, _deliverIdx;
+    unsigned int _inUse, _pending;
+
+    bool _running, _stopping;
+
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _jobDelivered;
+
+    std::vector<std::thread> _workers;
+
+    ProcessFunc _process;
+    DeliverFunc _deliver;
+    ThreadInitFunc _threadInit;
+  };
+
+}
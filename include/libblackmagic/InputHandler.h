@@ -1,14 +1,15 @@
 #pragma once
 
 //#include <queue>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
-#include "active_object/bounded_shared_queue.h"
 #include "DeckLinkAPI.h"
 
 #include "ThreadSynchronizer.h"
@@ -19,7 +20,20 @@
 #include "SDICameraControl.h"
 #include "SDIMessageBuffer.h"
 
+#include "libblackmagic/BoundedQueue.h"
+#include "libblackmagic/CaptureStats.h"
+#include "libblackmagic/ConversionContext.h"
 #include "libblackmagic/DeckLink.h"
+#include "libblackmagic/FrameHandle.h"
+#include "libblackmagic/FrameMetadata.h"
+#include "libblackmagic/FrameRecorder.h"
+#include "libblackmagic/MatBufferPool.h"
+#include "libblackmagic/PooledFrameAllocator.h"
+#include "libblackmagic/PreTriggerBuffer.h"
+#include "libblackmagic/SpscRing.h"
+#include "libblackmagic/ThreadPolicy.h"
+#include "libblackmagic/FrameWorkerPool.h"
+#include "libblackmagic/V210.h"
 
 namespace libblackmagic {
 
@@ -29,10 +43,18 @@ namespace libblackmagic {
   {
   public:
 
-    typedef std::vector<cv::Mat> MatVector;
-    typedef std::vector<IDeckLinkVideoFrame *> FrameVector;
+    typedef FrameWorkerPool::MatVector MatVector;
+    typedef FrameWorkerPool::FrameVector FrameVector;
 
-    typedef active_object::bounded_shared_queue< MatVector, 10 > Queue;
+    // One capture on its way from the workers to the consumer callbacks
+    struct QueuedFrame {
+      MatVector images;
+      FrameHandle frames;
+      FrameMetadata metadata;
+    };
+
+    typedef BoundedQueue< QueuedFrame > Queue;
+    typedef Queue::Policy QueuePolicy;
 
     InputHandler( DeckLink &deckLink );
     virtual ~InputHandler();
@@ -44,6 +66,69 @@ namespace libblackmagic {
     bool startStreams();
     bool stopStreams();
 
+    // Sets the number of frame processing threads and the number of frames
+    // which may be queued for them.  Takes effect at the next startStreams()
+    void setProcessingThreads( unsigned int numThreads, unsigned int queueDepth = 4 );
+
+    // Processed frames wait in a bounded queue for the thread which runs
+    // the callbacks.  Sets its depth and what happens when a slow consumer
+    // lets it fill:  Queue::Block (the default) stalls the processing
+    // threads, so new frames are dropped on arrival;  Queue::DropOldest and
+    // Queue::DropNewest discard a queued or the incoming frame instead.
+    // Takes effect at the next startStreams()
+    void setDeliveryQueue( unsigned int depth, QueuePolicy policy = Queue::Block );
+    Queue::Stats deliveryQueueStats() const  { return _queue.stats(); }
+
+    // Pull-style alternative to the callbacks, for consumers with their
+    // own event loop or real-time thread.  With GrabInOrder, processed
+    // frames wait in the delivery queue (see setDeliveryQueue()) to be
+    // taken in order;  with GrabLatest, each new frame replaces any not
+    // yet taken, so a consumer running below the frame rate always gets
+    // the freshest one.  The callbacks are not called while grabbing.
+    // Takes effect at the next startStreams()
+    enum GrabMode { GrabOff, GrabInOrder, GrabLatest };
+    void setGrabMode( GrabMode mode )   { _grabMode = mode; }
+    GrabMode grabMode() const           { return _grabMode; }
+
+    // Swaps the next frame into frame, waiting up to timeout for one.
+    // frame's previous images are released first, but its vector is kept,
+    // so grabbing in a loop neither copies nor allocates.  Returns false on
+    // timeout, or once streams are stopped and every frame has been taken.
+    // frame.frames is always empty.
+    bool grab( QueuedFrame &frame, std::chrono::milliseconds timeout );
+    bool tryGrab( QueuedFrame &frame );
+
+    // Names, CPU affinity and scheduling for the dispatch, worker and
+    // delivery threads, and for the SDK's callback thread.  By default
+    // they are kept on the card's NUMA node.  Takes effect at the next
+    // startStreams()
+    void setThreading( const ThreadingOptions &opts )   { _threading = opts; }
+    const ThreadingOptions &threading() const            { return _threading; }
+
+    // Sets the pixel format to capture in.  Defaults to bmdFormat10BitYUV.
+    // Takes effect at the next enable()
+    void setPixelFormat( BMDPixelFormat pixFmt )   { _pixelFormat = pixFmt; }
+    BMDPixelFormat pixelFormat() const             { return _pixelFormat; }
+
+    // Sets the image format produced from bmdFormat10BitYUV input.
+    // Defaults to BGRA.
+    void setDecodeFormat( V210Output fmt )   { _decodeFormat = fmt; }
+    V210Output decodeFormat() const          { return _decodeFormat; }
+
+    // Decode 10- and 8-bit YUV input straight to a reduced size, for
+    // previews.  Scaled frames are always produced in decodeFormat(),
+    // which must not be V210_UYVY.  Defaults to 1.0 (full size).
+    void setDecodeScale( double scale )       { _decodeScale = scale; }
+    double decodeScale() const                { return _decodeScale; }
+
+    // Capture into a PooledFrameAllocator rather than the driver's own
+    // buffers.  The pool is sized from the mode at the next enable();  for
+    // 3D input each eye takes one buffer.
+    void useFrameAllocator( const PooledFrameAllocator::Options &opts = PooledFrameAllocator::Options() );
+
+    // nullptr unless useFrameAllocator() has been called and input enabled
+    PooledFrameAllocator *frameAllocator()   { return _frameAllocator; }
+
     //== IDeckLinkInterfaces callbacks ==
     virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
     virtual ULONG STDMETHODCALLTYPE AddRef(void);
@@ -54,9 +139,52 @@ namespace libblackmagic {
     virtual HRESULT STDMETHODCALLTYPE VideoInputFrameArrived(IDeckLinkVideoInputFrame*, IDeckLinkAudioInputPacket*);
 
 
+    // Receives a converted copy of each frame
     typedef std::function< void( const MatVector & ) > NewImagesCallback;
     void setNewImagesCallback( NewImagesCallback callback );
 
+    // As above, with the frame's capture metadata
+    typedef std::function< void( const MatVector &, const FrameMetadata & ) > NewImagesMetadataCallback;
+    void setNewImagesWithMetadataCallback( NewImagesMetadataCallback callback );
+
+    // Receives the SDK frames themselves, without conversion or copying.
+    // If only this callback is set, frames are not converted at all.
+    // The handle carries the frame's metadata.
+    typedef std::function< void( FrameHandle ) > NewFramesCallback;
+    void setNewFramesCallback( NewFramesCallback callback );
+
+    // Writes every frame, in the card's pixel format, to recorder before it
+    // is converted or delivered.  The recorder stays the caller's;  set or
+    // clear it only while streams are stopped.
+    void setRecorder( FrameRecorder *recorder )   { _recorder = recorder; }
+    FrameRecorder *recorder()                     { return _recorder; }
+
+    // Keeps a copy of the last few seconds of frames, in the card's pixel
+    // format, in buffer, which is sized for the mode at each enable().
+    // The buffer stays the caller's;  set or clear it only while streams
+    // are stopped.
+    void setPreTrigger( PreTriggerBuffer *buffer )   { _preTrigger = buffer; }
+    PreTriggerBuffer *preTrigger()                    { return _preTrigger; }
+
+    // Frames flagged bmdFrameHasNoInputSource are normally discarded.  If
+    // set, they are delivered with FrameMetadata::noInput set instead.
+    void setDeliverNoInputFrames( bool deliver )   { _deliverNoInputFrames = deliver; }
+
+    // Counters and latency histograms for the capture path.  Cheap enough
+    // to leave on;  take a snapshot() to read them.
+    CaptureStats &stats()   { return _stats; }
+
+    // Images are made in recycled buffers, which return to the pool when
+    // the consumer's last cv::Mat referring to them goes.  The pool is
+    // sized for the mode at each enable().
+    MatBufferPool::Stats imageBufferStats() const   { return _imagePool->stats(); }
+
+    // SDK conversion resources, for formats other than 8-bit and v210
+    const ConversionContext &conversion() const   { return _conversion; }
+
+    // Number of SDK frames currently held by consumers' FrameHandles
+    int framesCheckedOut() const   { return FrameHandle::checkedOut(); }
+
     typedef std::function< void(BMDDisplayMode mode) > InputFormatChangedCallback;
     void setInputFormatChangedCallback( InputFormatChangedCallback );
 
@@ -65,17 +193,54 @@ namespace libblackmagic {
 
   protected:
 
+    // What VideoInputFrameArrived() hands to the dispatch thread
+    struct Arrival {
+      IDeckLinkVideoInputFrame *frame;
+      std::chrono::steady_clock::time_point hostTime;
+      uint64_t sequence;
+    };
+
+    // Takes arrivals off the ring and hands them to the workers
+    void dispatchThread();
+    void dispatch( const Arrival &arrival );
+    void startDispatch();
+    void stopDispatch();
+
+    // Applies _threading.driverCallback the first time each SDK thread calls
+    void checkCallbackThread();
+
     // Process input frames
-    void process( FrameVector frames );
-    void frameToMat( IDeckLinkVideoFrame *videoFrame, cv::Mat &mat, int i );
+    void process( FrameWorkerPool::Job &job );
+    void deliver( FrameWorkerPool::Job &job );
+    void deliveryThread();
+    void stopWorkers();
+    void stopDelivery();
+    void grabbed( QueuedFrame &frame );
+    // False if the frame's bytes couldn't be read
+    bool frameToMat( IDeckLinkVideoFrame *videoFrame, cv::Mat &mat, int i );
+
+    // Row-band decode of v210 frames
+    int v210Bands( FrameWorkerPool::Job &job );
+    bool decodeBand( IDeckLinkVideoFrame *videoFrame, cv::Mat &out, int band, int bands );
+
+    // True if frames in this pixel format go through the SDK converter
+    static bool needsSDKConversion( BMDPixelFormat pixFmt );
+
+    // Size of the images made from width x height frames in the current
+    // pixel and decode formats
+    size_t imageBytes( int width, int height ) const;
 
 
   private:
 
-    unsigned long _frameCount;
-    unsigned long _noInputCount;
+    CaptureStats _stats;
+    uint64_t _sequence;
+    uint64_t _noInputAtLastFrame;
+    bool _deliverNoInputFrames;
 
     BMDPixelFormat _pixelFormat;
+    V210Output _decodeFormat;
+    double _decodeScale;
     ModeConfig _currentConfig;
     bool _enabled;
 
@@ -85,12 +250,39 @@ namespace libblackmagic {
     IDeckLinkConfiguration *_dlConfiguration;
 
     // == input member related variables ==
+    SpscRing< Arrival > _arrivals;
+    std::thread _dispatchThread;
+
+    FrameRecorder *_recorder;
+    PreTriggerBuffer *_preTrigger;
+
+    ThreadingOptions _threading;
+    std::vector<int> _threadCpus;
+    std::thread::id _callbackThread;
+
     MatVector _grabbedImages;
-    //Queue _queue;
+    Queue _queue;
+    QueuedFrame _pending;
+    std::thread _deliveryThread;
+    bool _queueOpen;
+    GrabMode _grabMode;
+
+    unsigned int _queueDepth;
+    QueuePolicy _queuePolicy;
 
-    NewImagesCallback _newImagesCallback;
+    NewImagesMetadataCallback _newImagesCallback;
+    NewFramesCallback _newFramesCallback;
     InputFormatChangedCallback _inputFormatChangedCallback;
 
+    ConversionContext _conversion;
+    MatBufferPool *_imagePool;
+
+    bool _useFrameAllocator;
+    PooledFrameAllocator::Options _frameAllocatorOptions;
+    PooledFrameAllocator *_frameAllocator;
+
+    FrameWorkerPool _workers;
+
   };
 
 }
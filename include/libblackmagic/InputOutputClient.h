@@ -21,6 +21,7 @@ namespace libblackmagic {
   public:
 
   	InputOutputClient( int cardno = 0 );
+    explicit InputOutputClient( IDeckLink *deckLink );
     ~InputOutputClient();
 
     // Delete the copy operators
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace libblackmagic {
+
+  // Log-linear histogram of durations in nanoseconds, in the style of
+  // HdrHistogram:  values below 32ns are counted exactly, above that each
+  // power of two is split into 16 buckets, so any recorded value is
+  // reported to within ~6%.   Values above ~17s land in the top bucket.
+  //
+  // record() is a couple of relaxed atomic adds and is safe to call from
+  // any number of threads.
+  //
+  class LatencyHistogram {
+  public:
+
+    static const unsigned int kSubBucketBits = 4;
+    static const unsigned int kSubBuckets = 1u << kSubBucketBits;
+    static const unsigned int kMaxBit = 34;
+    static const unsigned int kNumBuckets = (kMaxBit - kSubBucketBits + 2) * kSubBuckets;
+
+    // Copy of the histogram at one instant
+    struct Snapshot {
+      Snapshot();
+
+      std::array<uint64_t, kNumBuckets> counts;
+      uint64_t count, sum, max;
+
+      double mean() const   { return count ? double(sum) / count : 0.0; }
+
+      // Upper bound of the bucket holding the q'th quantile (0 <= q <= 1)
+      uint64_t percentile( double q ) const;
+
+      // Adds another snapshot's counts to this one
+      void merge( const Snapshot &other );
+    };
+
+    LatencyHistogram();
+
+    LatencyHistogram( const LatencyHistogram & ) = delete;
+    LatencyHistogram &operator=( const LatencyHistogram & ) = delete;
+
+    void record( uint64_t ns )
+    {
+      _counts[ bucketFor(ns) ].fetch_add( 1, std::memory_order_relaxed );
+      _sum.fetch_add( ns, std::memory_order_relaxed );
+
+      uint64_t prev = _max.load( std::memory_order_relaxed );
+      while( ns > prev && !_max.compare_exchange_weak( prev, ns, std::memory_order_relaxed ) ) {;}
+    }
+
+    template< class Rep, class Period >
+    void record( const std::chrono::duration<Rep, Period> &d )
+    {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+      record( ns > 0 ? uint64_t(ns) : 0 );
+    }
+
+    Snapshot snapshot() const;
+    void reset();
+
+    static unsigned int bucketFor( uint64_t ns );
+
+    // Largest value which falls in bucket
+    static uint64_t bucketUpperBound( unsigned int bucket );
+
+  private:
+
+    std::atomic<uint64_t> _counts[kNumBuckets];
+    std::atomic<uint64_t> _sum, _max;
+  };
+
+}
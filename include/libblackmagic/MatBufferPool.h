@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace libblackmagic {
+
+  // cv::MatAllocator which recycles image buffers rather than returning
+  // them to the heap.
+  //
+  // An image uses the pool if its allocator is set before it is created:
+  //
+  //   cv::Mat image;
+  //   image.allocator = pool;
+  //   image.create( rows, cols, type );   // or copyTo( image ), etc.
+  //
+  // The buffer comes back to the pool when the last cv::Mat referring to it
+  // is released, on whichever thread that happens.  Buffers are all
+  // bufferSize() bytes and are made the first time they are needed, up to
+  // maxBuffers, so once capture has warmed up creating an image does not
+  // allocate.  Requests larger than bufferSize(), or made while maxBuffers
+  // are in use, fall back to ordinary allocations and are counted.
+  //
+  // The pool is reference counted and starts with one reference, which
+  // belongs to the caller.  Each outstanding image holds another, so
+  // images may outlive whoever made the pool.
+  //
+  class MatBufferPool : public cv::MatAllocator {
+  public:
+
+#if CV_VERSION_MAJOR >= 4
+    typedef cv::AccessFlag AccessFlag;
+#else
+    typedef int AccessFlag;
+#endif
+
+    struct Stats {
+      unsigned long allocations, fallbackAllocations;
+      unsigned int buffers, inUse, highWater, maxBuffers;
+      size_t bufferSize;
+    };
+
+    MatBufferPool( size_t bufferSize = 0, unsigned int maxBuffers = 16 );
+
+    MatBufferPool( const MatBufferPool & ) = delete;
+    MatBufferPool &operator=( const MatBufferPool & ) = delete;
+
+    // Changes the buffer size and limit, e.g. for a new video mode.  Free
+    // buffers which no longer fit are released now, those in use when
+    // their images are.
+    void configure( size_t bufferSize, unsigned int maxBuffers );
+    size_t bufferSize() const;
+
+    Stats stats() const;
+
+    void AddRef() const;
+    void Release() const;
+
+    //== cv::MatAllocator ==
+    virtual cv::UMatData *allocate( int dims, const int *sizes, int type, void *data,
+                                    size_t *step, AccessFlag flags,
+                                    cv::UMatUsageFlags usageFlags ) const;
+    virtual bool allocate( cv::UMatData *data, AccessFlag accessFlags,
+                           cv::UMatUsageFlags usageFlags ) const;
+    virtual void deallocate( cv::UMatData *data ) const;
+
+  protected:
+
+    virtual ~MatBufferPool();
+
+  private:
+
+    // A pooled buffer carries the storage for its own UMatData, so handing
+    // one out doesn't touch the heap either.  Buffer is the UMatData's
+    // userdata while the image is alive.
+    struct Buffer {
+      std::aligned_storage< sizeof(cv::UMatData), alignof(cv::UMatData) >::type header;
+      unsigned char *data;
+      size_t size;
+    };
+
+    // Both called with _mutex held
+    Buffer *takeBuffer( size_t size ) const;
+    void destroyBuffer( Buffer *buffer ) const;
+
+    mutable std::atomic<int32_t> _refCount;
+
+    mutable std::mutex _mutex;
+    size_t _bufferSize;
+    unsigned int _maxBuffers;
+    mutable std::vector<Buffer *> _free;
+
+    mutable unsigned long _allocations, _fallbackAllocations;
+    mutable unsigned int _buffers, _inUse, _highWater;
+  };
+
+}
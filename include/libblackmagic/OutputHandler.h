@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "DeckLinkAPI.h"
 #include <active_object/active.h>
@@ -9,6 +12,8 @@
 
 #include "SDIMessageBuffer.h"
 
+#include "libblackmagic/ThreadPolicy.h"
+
 namespace libblackmagic {
 
 	class DeckLink;
@@ -25,11 +30,45 @@ namespace libblackmagic {
 		bool enable( BMDDisplayMode mode = bmdModeHD1080p2997, bool do3D = false );
 		bool disable();
 
+		// Camera control commands, sent in the VANC of output frames
+		const std::shared_ptr<CameraCommandQueue> &commandQueue()
+			{ return _commands; }
+
+		// Deprecated, for callers written against the old shared buffer.
+		// What's written to it joins commandQueue() at the next frame.
 		const std::shared_ptr<SharedBMSDIBuffer> &sdiProtocolBuffer()
-			{ return _buffer; }
+			{ return _sdiBuffer; }
+
+		// Frames which carry SDI commands.  They are made (and filled blue) by
+		// enable(), and reused as ScheduledFrameCompleted() hands them back, so
+		// a command frame costs no more than a blank one:  only the packets on
+		// the VANC lines are rewritten.  If every one is still scheduled, the
+		// commands wait for the next frame.  One which can't be scheduled is
+		// tried again, commands and all, at the next completion.
+		static const unsigned int kNumCommandFrames = 4;
+
+		// VANC lines for SDI commands and tally.  Each frame carries as many
+		// packets as fit on them, one after another, so a large batch of
+		// commands goes out in a frame or two rather than one 255-byte packet
+		// per frame.  Line 16 alone by default.  Takes effect at the next
+		// enable()
+		void setVancLines( const std::vector<uint32_t> &lines )		{ _vancLines = lines; }
+		const std::vector<uint32_t> &vancLines() const						{ return _vancLines; }
+
+		// Tally for a camera (from 1 to kMaxTallyCameras), sent with every
+		// frame from then on, in a packet ahead of any commands.  Any thread.
+		static const unsigned int kMaxTallyCameras = 64;
+		bool setTally( unsigned int camera, bool program, bool preview );
 
 		void inputFormatChanged( BMDDisplayMode mode );
 
+		// Name, CPU affinity and scheduling for the SDK's playback callback
+		// thread (ThreadingOptions::driverCallback), applied the first time it
+		// calls.  By default it is kept on the card's NUMA node.  Takes effect
+		// at the next startStreams()
+		void setThreading( const ThreadingOptions &opts )		{ _threading = opts; }
+		const ThreadingOptions &threading() const						{ return _threading; }
+
 		HRESULT	STDMETHODCALLTYPE ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
 		HRESULT	STDMETHODCALLTYPE ScheduledPlaybackHasStopped(void);
 
@@ -45,12 +84,39 @@ namespace libblackmagic {
 
 	protected:
 
-		// Lazy initializer
+		// Lazy initializer, for the mode last enabled
 		IDeckLinkMutableVideoFrame *blankFrame()
-			{		if( !_blankFrame ) _blankFrame = makeBlueFrame(deckLinkOutput(), true ); return _blankFrame; }
+			{		if( !_blankFrame ) _blankFrame = makeBlueFrame(deckLinkOutput(), true, _mode ); return _blankFrame; }
 
 		void scheduleFrame( IDeckLinkVideoFrame *frame, uint8_t numRepeats = 1 );
 
+		struct CommandFrame {
+			IDeckLinkMutableVideoFrame *frame;
+			std::vector<uint32_t *> vancLines;
+
+			// Each VANC line as it was made, and how many words of it the
+			// last use wrote over
+			std::vector< std::vector<uint32_t> > blankVanc;
+			std::vector<size_t> usedWords;
+		};
+
+		bool makeCommandFrames();
+		void releaseCommandFrames();
+
+		// A free command frame holding the tally and as many queued commands
+		// as fit, or nullptr if they're all scheduled or there's nothing to
+		// send.  Called from the playback callback.
+		IDeckLinkMutableVideoFrame *commandFrame();
+
+		// Frees frame for reuse if it's a command frame
+		bool recycleCommandFrame( IDeckLinkVideoFrame *frame );
+
+		// Schedules frame, a command frame, or keeps it for the next
+		// completion and schedules a blank frame in its place
+		HRESULT scheduleCommandFrame( IDeckLinkMutableVideoFrame *frame, BMDTimeValue streamTime );
+
+		void checkCallbackThread();
+
 	private:
 
 		bool _enabled, _running;
@@ -59,15 +125,34 @@ namespace libblackmagic {
 		IDeckLinkOutput *_deckLinkOutput;
 
 		// Cached values
+		BMDDisplayMode _mode;
 		BMDTimeValue _frameDuration;
 		BMDTimeScale _timeScale;
 
 		unsigned int _totalFramesScheduled;
 
-		std::shared_ptr<SharedBMSDIBuffer> _buffer;
+		std::shared_ptr<CameraCommandQueue> _commands;
+		std::shared_ptr<SharedBMSDIBuffer> _sdiBuffer;
 		IDeckLinkMutableVideoFrame *_blankFrame;
 
+		std::vector<uint32_t> _vancLines;
+		std::vector<CommandFrame> _commandFrames;
+		std::vector<unsigned int> _freeCommandFrames;
+
+		// A command frame which couldn't be scheduled.  Its commands have
+		// been taken from _commands, but not confirmed.
+		IDeckLinkMutableVideoFrame *_retryFrame;
+
+		// One byte per camera;  _tallyCameras is the highest set
+		std::atomic<uint8_t> _tally[kMaxTallyCameras];
+		std::atomic<unsigned int> _tallyCameras;
+
+		ThreadingOptions _threading;
+		std::vector<int> _threadCpus;
+		std::thread::id _callbackThread;
+
 		// Condition variables
+		bool _playbackStopped;
 		std::condition_variable _scheduledPlaybackStoppedCond;
 		std::mutex _scheduledPlaybackStoppedMutex;
 
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+
+namespace libblackmagic {
+
+  // IDeckLinkMemoryAllocator which serves capture buffers from a fixed,
+  // preallocated pool.
+  //
+  // The pool is one page-aligned arena, backed by 2MB hugepages when the
+  // system has them (falling back to transparent hugepages), optionally
+  // mlock()ed and bound to a NUMA node.  Pages are faulted in when the
+  // pool is committed rather than on first touch of each frame.
+  //
+  // Requests larger than the pool's buffer size, or made while the pool
+  // is empty, fall back to ordinary aligned allocations and are counted.
+  //
+  // An arena is only unmapped once every buffer in it has come back:  a
+  // Decommit() with buffers outstanding finishes when the last is
+  // released, and an arena outgrown by setBufferSize() is retired, to be
+  // unmapped the same way, while a new one takes its place.
+  //
+  class PooledFrameAllocator : public IDeckLinkMemoryAllocator {
+  public:
+
+    struct Options {
+      Options()
+        : numBuffers(16), useHugePages(true), lockMemory(true), numaNode(-1)
+        {;}
+
+      unsigned int numBuffers;
+      bool useHugePages;
+      bool lockMemory;
+
+      // Bind the pool to this NUMA node;  -1 leaves placement to the kernel
+      int numaNode;
+    };
+
+    struct Stats {
+      unsigned long allocations, frees, fallbackAllocations;
+      unsigned int inUse, highWater, numBuffers;
+      size_t bufferSize;
+      bool hugePages, locked;
+
+      // Mapped now, retired arenas included, and how many are retired
+      size_t arenaBytes;
+      unsigned int retiredArenas;
+    };
+
+    // The allocator is reference counted and starts with one reference,
+    // which belongs to the caller.
+    PooledFrameAllocator( size_t bufferSize, const Options &opts = Options() );
+
+    PooledFrameAllocator( const PooledFrameAllocator & ) = delete;
+    PooledFrameAllocator &operator=( const PooledFrameAllocator & ) = delete;
+
+    // Changes the buffer size.  If the current buffers are too small, or
+    // none are outstanding, the arena is replaced at once, otherwise at the
+    // next Commit().
+    void setBufferSize( size_t bufferSize );
+    size_t bufferSize() const  { return _bufferSize; }
+
+    Stats stats() const;
+
+    //== IUnknown ==
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv );
+    virtual ULONG STDMETHODCALLTYPE AddRef( void );
+    virtual ULONG STDMETHODCALLTYPE Release( void );
+
+    //== IDeckLinkMemoryAllocator ==
+    virtual HRESULT STDMETHODCALLTYPE AllocateBuffer( uint32_t bufferSize, void **allocatedBuffer );
+    virtual HRESULT STDMETHODCALLTYPE ReleaseBuffer( void *buffer );
+    virtual HRESULT STDMETHODCALLTYPE Commit( void );
+    virtual HRESULT STDMETHODCALLTYPE Decommit( void );
+
+  protected:
+
+    virtual ~PooledFrameAllocator();
+
+    // All called with _mutex held
+    bool mapArena();
+    void unmapArena();
+
+    // Unmaps the arena, or if any of its buffers are out, sets it aside to
+    // be unmapped when the last comes back
+    void retireArena();
+
+    bool allFree() const
+      { return _free.size() == _opts.numBuffers; }
+
+    bool bufferFits( size_t bufferSize ) const;
+
+    bool inArena( void *buffer ) const
+      { return buffer >= _arena && buffer < (void *)((uint8_t *)_arena + _arenaSize); }
+
+  private:
+
+    std::atomic<int32_t> _refCount;
+
+    Options _opts;
+    size_t _bufferSize;
+
+    // Buffer size rounded up to a page, so each buffer starts on a page
+    // boundary;  only the arena itself is hugepage-aligned
+    size_t _bufferStride;
+
+    void *_arena;
+    size_t _arenaSize;
+    bool _hugePages, _locked;
+
+    // Decommit() was called with buffers outstanding
+    bool _decommitPending;
+
+    struct RetiredArena {
+      void *base;
+      size_t size;
+      bool locked;
+      unsigned int outstanding;
+    };
+    std::vector<RetiredArena> _retired;
+
+    mutable std::mutex _mutex;
+    std::vector<void *> _free;
+
+    unsigned long _allocations, _frees, _fallbackAllocations;
+    unsigned int _inUse, _highWater;
+  };
+
+}
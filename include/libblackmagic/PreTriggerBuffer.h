@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/FrameMetadata.h"
+#include "libblackmagic/FrameRecorder.h"
+#include "libblackmagic/ModeConfig.h"
+#include "libblackmagic/PooledFrameAllocator.h"
+
+namespace libblackmagic {
+
+  // Keeps the last few seconds of captured frames, in the card's pixel
+  // format, so that when something happens the frames from before it can
+  // still be recorded.
+  //
+  // Frames are copied into a ring of buffers preallocated (and by default
+  // mlock()ed) in a PooledFrameAllocator arena, the oldest being
+  // overwritten by each new one;  capture buffers are never held, so the
+  // card doesn't run short.  Kept as v210, a second of 1080p takes less
+  // than half the memory it would as BGRA.
+  //
+  // dump() hands a window of the ring to a sink, e.g. a FrameRecorder,
+  // while capture carries on.  Frames are written straight out of the
+  // ring and aren't overwritten while the sink has them;  frames the dump
+  // hasn't reached yet can be, if the sink is slower than capture.  A
+  // window which ends in the future carries on with frames as they
+  // arrive, so one dump records both sides of a trigger:
+  //
+  //   PreTriggerBuffer preTrigger;
+  //   input.setPreTrigger( &preTrigger );
+  //   ...
+  //   const auto now = std::chrono::steady_clock::now();
+  //   preTrigger.dump( now - std::chrono::seconds(5), now + std::chrono::seconds(10), recorder );
+  //
+  class PreTriggerBuffer {
+  public:
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Options {
+      Options()
+        : seconds( 5 ), useHugePages( true ), lockMemory( true ), numaNode( -1 )
+        {;}
+
+      // How much history to keep
+      float seconds;
+
+      // As PooledFrameAllocator::Options
+      bool useHugePages;
+      bool lockMemory;
+      int numaNode;
+    };
+
+    struct Stats {
+      // Frames copied in, and those which weren't because they didn't fit
+      // or every buffer was being dumped
+      uint64_t retained, skipped;
+
+      // Frames handed to sinks, and those overwritten before a dump
+      // reached them
+      uint64_t dumped, missed;
+
+      unsigned int frames, capacity;
+      size_t bytes;
+      bool locked;
+    };
+
+    PreTriggerBuffer( const Options &opts = Options() );
+    ~PreTriggerBuffer();
+
+    PreTriggerBuffer( const PreTriggerBuffer & ) = delete;
+    PreTriggerBuffer &operator=( const PreTriggerBuffer & ) = delete;
+
+    // Sizes the ring for Options::seconds of the mode's frame rate, one
+    // buffer per eye if 3D.  Whatever was kept is discarded.  Fails while
+    // a dump is in progress.  InputHandler calls this from enable().
+    bool configure( const ModeConfig &config, BMDPixelFormat pixFmt );
+
+    // Copies a frame (and its right eye) in, in place of the oldest.
+    // From one thread at a time;  InputHandler calls it on its dispatch
+    // thread.
+    bool push( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye, const FrameMetadata &meta );
+
+    // Called with each frame to dump, oldest first.  The frames may be
+    // AddRef()ed to hold them past the call.  Return false to stop.
+    typedef std::function< bool( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye,
+                                 const FrameMetadata &meta ) > Sink;
+
+    // Hands the frames which arrived (FrameMetadata::hostTime) between
+    // from and to to sink.  If to is yet to come, waits for the frames
+    // arriving until then, and returns once one arrives after it, or
+    // shortly after to if none does (e.g. capture has stopped).  Returns
+    // the number of frames dumped.
+    size_t dump( TimePoint from, TimePoint to, Sink sink );
+
+    // As above, writing to an open recorder.  Waits for the disk rather
+    // than let the recorder drop frames.
+    size_t dump( TimePoint from, TimePoint to, FrameRecorder &recorder );
+
+    // Ends the dump in progress, if any, once the sink has returned
+    void cancel();
+
+    // Arrival times of the oldest and newest frames kept;  false if empty
+    bool window( TimePoint &oldest, TimePoint &newest ) const;
+
+    void clear();
+
+    Stats stats() const;
+
+    class RetainedFrame;
+
+  protected:
+
+    struct Slot;
+
+    // The dump in progress, if any
+    struct DumpState {
+      DumpState() : active( false ), started( false ), passed( false ), cancelled( false ),
+                    sequence( 0 ), from(), to() {;}
+
+      bool active, started;
+
+      // A frame which arrived after to has been kept, so no more are due
+      bool passed;
+
+      bool cancelled;
+
+      // The last frame handed to the sink
+      uint64_t sequence;
+
+      TimePoint from, to;
+
+      // True if the dump has yet to reach meta's frame
+      bool pending( const FrameMetadata &meta ) const {
+        return active && meta.hostTime >= from && meta.hostTime <= to &&
+               ( !started || meta.sequence > sequence );
+      }
+    };
+
+    void freeSlots();
+
+    // The oldest slot the dump has yet to reach, pinned, or nullptr.
+    // Called with _mutex held.  Sets _dump.passed.
+    Slot *next();
+
+  private:
+
+    Options _opts;
+    ModeConfig _config;
+
+    PooledFrameAllocator *_arena;
+    size_t _bufferSize;
+
+    std::vector< std::unique_ptr<Slot> > _slots;
+
+    // Guards _order, _free and _dump, and the slots' contents while in
+    // _order.  push() copies without it, into a slot in neither.
+    mutable std::mutex _mutex;
+
+    // Slots holding frames, oldest first, and empty slots
+    std::vector<unsigned int> _order;
+    std::vector<unsigned int> _free;
+
+    DumpState _dump;
+
+    // Notified as push() adds a frame, and on cancel()
+    std::condition_variable _arrived;
+
+    // Held by push() and configure(), so buffers aren't freed under a
+    // copy, and by dump(), one at a time
+    std::mutex _pushMutex, _dumpMutex;
+
+    std::atomic<uint64_t> _retained, _skipped, _dumped, _missed;
+  };
+
+}
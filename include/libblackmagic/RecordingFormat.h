@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace libblackmagic {
+
+  // Layout of the raw recordings written by FrameRecorder.
+  //
+  // A recording is a RecordingFileHeader in the first block, followed by
+  // one record per eye of each captured frame.  Every record starts on a
+  // block boundary with a RecordedFrameHeader, padded to a full block;  the
+  // frame's native buffer (v210 etc.) follows, padded to the next block.
+  // Records can be walked with RecordedFrameHeader::recordSize, and the
+  // two eyes of a 3D frame are consecutive records with the same sequence.
+  //
+  // When a recording is closed cleanly, a RecordingIndexHeader and one
+  // RecordingIndexEntry per frame follow the last record, and the file
+  // header's indexOffset points at them.  A recording without an index
+  // (e.g. one cut short by a crash) can still be read by walking it.
+  //
+  // All fields are little-endian, as written by x86 and ARM hosts.
+  //
+  struct RecordingFileHeader {
+    static const uint32_t kVersion = 1;
+    static const uint32_t kBlockSize = 4096;
+
+    RecordingFileHeader()
+      : version( kVersion ), blockSize( kBlockSize ), created( 0 ), indexOffset( 0 )
+      {
+        memcpy( magic, kMagic(), sizeof(magic) );
+        memset( reserved, 0, sizeof(reserved) );
+      }
+
+    static const char *kMagic()   { return "BMRAWREC"; }
+    bool valid() const            { return memcmp( magic, kMagic(), sizeof(magic) ) == 0; }
+
+    char magic[8];
+    uint32_t version;
+
+    // Records start, and frame data is padded, to multiples of this
+    uint32_t blockSize;
+
+    // Wall clock time the recording was opened, in ns since the epoch
+    int64_t created;
+
+    // Where the index starts, or 0 if there isn't one
+    uint64_t indexOffset;
+
+    uint8_t reserved[32];
+  };
+
+  struct RecordedFrameHeader {
+    static const uint32_t kMagic = 0x52464d42;   // "BMFR"
+
+    enum Flags {
+      Is3D = 0x1,
+      NoInput = 0x2,
+      TimecodeValid = 0x4,
+      DropFrameTimecode = 0x8
+    };
+
+    RecordedFrameHeader()
+    { memset( this, 0, sizeof(*this) );  magic = kMagic; }
+
+    bool valid() const   { return magic == kMagic; }
+
+    uint32_t magic;
+
+    // From the start of this record to the frame data
+    uint32_t headerSize;
+
+    // From the start of this record to the next
+    uint64_t recordSize;
+
+    // FrameMetadata::sequence;  gaps are frames which weren't recorded
+    uint64_t sequence;
+
+    // steady_clock and wall clock (ns since the epoch) at arrival
+    int64_t hostTime, wallTime;
+
+    // Stream and hardware times, in units of 1/timeScale seconds
+    int64_t timeScale;
+    int64_t streamTime, streamDuration;
+    int64_t hardwareTime, hardwareDuration;
+
+    uint32_t displayMode;       // BMDDisplayMode
+    uint32_t pixelFormat;       // BMDPixelFormat
+    uint32_t width, height, rowBytes;
+
+    // 0 for the left (or only) eye, 1 for the right
+    uint32_t eye;
+    uint32_t flags;
+
+    uint8_t timecodeHours, timecodeMinutes, timecodeSeconds, timecodeFrames;
+
+    // rowBytes * height
+    uint64_t dataSize;
+
+    uint8_t reserved[24];
+  };
+
+  struct RecordingIndexEntry {
+    static const uint32_t kNoTimecode = 0xffffffff;
+
+    // Timecode packed as 0xhhmmssff
+    static uint32_t packTimecode( uint8_t h, uint8_t m, uint8_t s, uint8_t f )
+    { return (uint32_t(h) << 24) | (uint32_t(m) << 16) | (uint32_t(s) << 8) | f; }
+
+    // Of the frame's first (left eye) record
+    uint64_t offset;
+    uint64_t sequence;
+
+    // In the record's timeScale
+    int64_t streamTime;
+
+    uint32_t timecode;
+
+    // 1, or 2 for a 3D frame
+    uint32_t eyes;
+  };
+
+  struct RecordingIndexHeader {
+    static const uint32_t kMagic = 0x58494d42;   // "BMIX"
+
+    RecordingIndexHeader()
+    { memset( this, 0, sizeof(*this) );  magic = kMagic;  entrySize = sizeof(RecordingIndexEntry); }
+
+    bool valid() const   { return magic == kMagic && entrySize == sizeof(RecordingIndexEntry); }
+
+    uint32_t magic;
+    uint32_t entrySize;
+    uint64_t numEntries;
+
+    uint8_t reserved[48];
+  };
+
+  static_assert( sizeof(RecordingFileHeader) == 64, "RecordingFileHeader layout changed" );
+  static_assert( sizeof(RecordedFrameHeader) == 144, "RecordedFrameHeader layout changed" );
+  static_assert( sizeof(RecordingIndexHeader) == 64, "RecordingIndexHeader layout changed" );
+  static_assert( sizeof(RecordingIndexEntry) == 32, "RecordingIndexEntry layout changed" );
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/FrameMetadata.h"
+#include "libblackmagic/RecordingFormat.h"
+
+namespace libblackmagic {
+
+  // Reads recordings made by FrameRecorder by mapping them into memory,
+  // so frames are used in place without being read or copied.
+  //
+  // Frames are found through the recording's index, or, if it doesn't
+  // have one, by walking the records once when it is opened.  Either way
+  // finding a frame by its position or its timecode takes constant time.
+  //
+  // To play a recording through InputHandler, give it to
+  // SimulatedDeckLink::Options::recording.
+  //
+  class RecordingReader {
+  public:
+
+    // One frame, both eyes if it is 3D.  Points into the mapping, so is
+    // only good while the reader is open.
+    struct Frame {
+      Frame() : numEyes( 0 )
+        { eyes[0] = eyes[1] = nullptr;  data[0] = data[1] = nullptr; }
+
+      bool valid() const   { return numEyes > 0; }
+
+      const RecordedFrameHeader &header() const   { return *eyes[0]; }
+
+      // As recorded.  hostTime is left unset as it meant nothing outside
+      // the recording process.
+      FrameMetadata metadata() const;
+
+      const RecordedFrameHeader *eyes[2];
+
+      // The mapping is private, so writes here never reach the file
+      uint8_t *data[2];
+
+      unsigned int numEyes;
+    };
+
+    RecordingReader();
+    ~RecordingReader();
+
+    RecordingReader( const RecordingReader & ) = delete;
+    RecordingReader &operator=( const RecordingReader & ) = delete;
+
+    bool open( const std::string &path );
+    void close();
+
+    bool isOpen() const   { return _map != nullptr; }
+
+    // False if the frames were found by walking the records
+    bool hasIndex() const   { return _hasIndex; }
+
+    size_t size() const     { return _entries.size(); }
+
+    // Invalid if index is out of range or the record is damaged
+    Frame frame( size_t index ) const;
+
+    // Index of the first frame with the timecode, or -1
+    long findTimecode( const FrameTimecode &timecode ) const;
+
+    // Of the first frame;  a recording is made in one format
+    BMDDisplayMode displayMode() const;
+    BMDPixelFormat pixelFormat() const;
+    bool is3D() const;
+
+  protected:
+
+    bool readIndex( uint64_t offset );
+    void walkRecords();
+
+    // The record at offset, or nullptr if it isn't whole
+    const RecordedFrameHeader *record( uint64_t offset ) const;
+
+  private:
+
+    uint8_t *_map;
+    size_t _size;
+
+    bool _hasIndex;
+    std::vector<RecordingIndexEntry> _entries;
+
+    // Packed timecode to the first frame carrying it
+    std::unordered_map<uint32_t, size_t> _byTimecode;
+  };
+
+}
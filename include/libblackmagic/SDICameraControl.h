@@ -1,11 +1,24 @@
 #pragma once
 
+#include <vector>
+
 #include "DeckLinkAPI.h"
 
 #include "libbmsdi/bmsdi_message.h"
 
+#include "libblackmagic/CameraCommandQueue.h"
+
 namespace libblackmagic {
 
+  // Ancillary packets Blackmagic cameras listen for:  camera control, and
+  // tally (one byte per camera, from camera 1)
+  const uint8_t kSDIRemoteControlDID = 0x51;
+  const uint8_t kSDIRemoteControlSDID = 0x53;
+  const uint8_t kSDITallySDID = 0x52;
+
+  // The VANC line camera control goes on, unless told otherwise
+  const uint32_t kSDIRemoteControlLine = 16;
+
   // Makes an empty (blue) frame and inserts SDI protocol info
   IDeckLinkMutableVideoFrame* makeFrameWithSDIProtocol( IDeckLinkOutput *deckLinkOutput, BMSDIBuffer *buffer, bool do3D=false );
 
@@ -13,8 +26,97 @@ namespace libblackmagic {
   IDeckLinkMutableVideoFrame* addSDIProtocolToFrame( IDeckLinkOutput *deckLinkOutput,
                                                         IDeckLinkMutableVideoFrame* frame, BMSDIBuffer *buffer );
 
-  // Make a blank frame
-  IDeckLinkMutableVideoFrame* makeBlueFrame( IDeckLinkOutput *deckLinkOutput, bool do3D=false );
+  // Add as many of queue's commands as fit to an existing frame, in as
+  // many packets as it takes, across the given VANC lines.  confirm() the
+  // queue once the frame is scheduled.
+  IDeckLinkMutableVideoFrame* addSDIProtocolToFrame( IDeckLinkOutput *deckLinkOutput,
+                                                        IDeckLinkMutableVideoFrame* frame, CameraCommandQueue &queue,
+                                                        const std::vector<uint32_t> &lines = std::vector<uint32_t>( 1, kSDIRemoteControlLine ) );
+
+  // Make a blank frame in the given mode, from TemplateFrameCache::shared()
+  IDeckLinkMutableVideoFrame* makeBlueFrame( IDeckLinkOutput *deckLinkOutput, bool do3D=false,
+                                             BMDDisplayMode mode=bmdModeHD1080p2997 );
+
+  // Words of a v210 VANC line which an ancillary packet with len bytes of
+  // data occupies:  a four-word header, then the data and checksum, three
+  // samples to every two words
+  constexpr size_t ancillaryPacketWords( size_t len )
+    { return 4 + 2 * ((len + 1 + 2) / 3); }
+
+  // Words of a v210 VANC line within the picture, for a frame width pixels
+  // wide.  Any further words in the row are padding.
+  constexpr size_t vancLineWords( long width )
+    { return (width / 6) * 4; }
+
+  // Ancillary packets (SMPTE 291) in the luma samples of a v210 VANC line.
+  // Each byte is sent as a 10-bit sample:  the byte, its even parity bit,
+  // and the inverse of that.
+  //
+  // encodeAncillaryPacket() looks samples up in a table and writes three at
+  // a time to each pair of words;  encodeAncillaryPacketScalar() is the
+  // byte-at-a-time encoder from Blackmagic's VancOutput example, kept as
+  // the reference.  Both write a packet at line, which must start a pair of
+  // words, and return the words written, or 0 if len isn't 1-255.  Only the
+  // table-driven encoder zeroes the samples after the checksum.
+  size_t encodeAncillaryPacket( uint32_t *line, uint8_t did, uint8_t sdid, const uint8_t *data, size_t len );
+  size_t encodeAncillaryPacketScalar( uint32_t *line, uint8_t did, uint8_t sdid, const uint8_t *data, size_t len );
+
+  struct AncillaryPacket {
+    uint8_t did, sdid, len;
+    uint8_t data[255];
+  };
+
+  // Reads the packet at line, which has words words left.  Returns the
+  // words it occupies, or 0 if there isn't a whole packet with good parity
+  // and checksum there.
+  size_t decodeAncillaryPacket( const uint32_t *line, size_t words, AncillaryPacket &packet );
+
+  // Bytes at the start of the VANC line which an SDI protocol packet of up
+  // to 255 bytes can occupy
+  const size_t kSDIProtocolMaxBytes = ancillaryPacketWords( 255 ) * 4;
+
+  // A VANC line in ancillary data, or nullptr.  It stays valid as long as
+  // the ancillary data does.
+  uint32_t *sdiProtocolLine( IDeckLinkVideoFrameAncillary *ancillary, uint32_t lineNumber = kSDIRemoteControlLine );
+
+  // Writes SDI protocol info to the start of that line, in place.
+  // Whatever an earlier packet left beyond the end of this one isn't
+  // cleared.
+  void writeSDIProtocol( uint32_t *line, BMSDIBuffer *buffer );
+
+  // Lays ancillary packets end to end along a set of VANC lines, in place,
+  // going on to the next line when the next packet doesn't fit on this
+  // one.  As with writeSDIProtocol(), nothing past the last packet on a
+  // line is cleared;  used says how far each line was written.
+  class VancWriter {
+  public:
+    // width is the frame's, in pixels.  used is resized to one count per
+    // line, in words, and zeroed.
+    VancWriter( const std::vector<uint32_t *> &lines, long width, std::vector<size_t> &used );
+
+    // The most data the next packet can carry, at most 255 bytes;  0 once
+    // the lines are full
+    size_t room() const;
+
+    // False, and nothing written, if it doesn't fit
+    bool write( uint8_t did, uint8_t sdid, const uint8_t *data, size_t len );
+
+    unsigned int packets() const  { return _packets; }
+    size_t bytes() const          { return _bytes; }
+
+  private:
+    const std::vector<uint32_t *> &_lines;
+    size_t _lineWords;
+    std::vector<size_t> &_used;
+
+    size_t _line;
+    unsigned int _packets;
+    size_t _bytes;
+  };
+
+  // Writes as many of queue's commands as fit with writer, a packet at a
+  // time.  Returns the number of packets.
+  unsigned int writeSDIProtocol( VancWriter &writer, CameraCommandQueue &queue );
 
 
 }
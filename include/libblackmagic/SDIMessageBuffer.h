@@ -1,28 +1,41 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 
 #include "libbmsdi/bmsdi_message.h"
 
-namespace libblackmagic {
+#include "libblackmagic/CameraCommandQueue.h"
 
+namespace libblackmagic {
 
+  // Deprecated:  the single shared buffer camera commands used to be
+  // written to, from OutputHandler::sdiProtocolBuffer().  Kept so existing
+  // callers build;  new code should use OutputHandler::commandQueue().
+  //
+  // Whatever is written to buffer (under writeMutex(), as before) is
+  // moved to the queue by an SDIBufferGuard straight away, or otherwise
+  // by the output at its next frame.
   class SharedBMSDIBuffer {
   public:
 
-
     typedef std::lock_guard<std::mutex> lock_guard;
 
-    SharedBMSDIBuffer()
-    : buffer( bmNewBuffer() ),
+    SharedBMSDIBuffer( const std::shared_ptr<CameraCommandQueue> &queue )
+    : buffer( &_storage ),
     _writeMutex(),
     _readLockMutex(),
-    _readLockCount(0)
-    {;}
+    _readLockCount(0),
+    _queue( queue )
+    { bmResetBuffer( buffer ); }
+
+    SharedBMSDIBuffer( const SharedBMSDIBuffer & ) = delete;
+    SharedBMSDIBuffer &operator=( const SharedBMSDIBuffer & ) = delete;
 
     std::mutex &writeMutex()
     { return _writeMutex; }
 
+    // Hold off flush() while buffer is read
     void getReadLock()
     {
       std::lock_guard<std::mutex> guard(_readLockMutex);
@@ -36,6 +49,23 @@ namespace libblackmagic {
       if( --_readLockCount==0 ) _writeMutex.unlock();
     }
 
+    // Moves the messages in buffer to the queue.  Called with writeMutex()
+    // held.  False if the queue refused any.
+    bool flushLocked()
+    {
+      if( buffer->len == 0 ) return true;
+
+      const bool ok = _queue->push( *buffer );
+      bmResetBuffer( buffer );
+      return ok;
+    }
+
+    // As above, unless a writer or reader holds the buffer
+    bool flush()
+    {
+      std::unique_lock<std::mutex> lock( _writeMutex, std::try_to_lock );
+      return !lock.owns_lock() || flushLocked();
+    }
 
     BMSDIBuffer *buffer;
 
@@ -43,23 +73,38 @@ namespace libblackmagic {
 
     std::mutex _readLockMutex;
     uint8_t _readLockCount;
+
+  private:
+    BMSDIBuffer _storage;
+    std::shared_ptr<CameraCommandQueue> _queue;
   };
 
 
+  // Adds commands to an OutputHandler's CameraCommandQueue, e.g.
+  //
+  //   SDIBufferGuard guard( output.commandQueue() );
+  //   guard( []( BMSDIBuffer *buffer ){ bmAddSensorGain( buffer, CamNum, 4 ); } );
+  //
+  // Kept for existing callers;  the queue itself can be called the same
+  // way.  Also takes the deprecated sdiProtocolBuffer().
   class SDIBufferGuard {
   public:
-    SDIBufferGuard( const std::shared_ptr<SharedBMSDIBuffer> &buffer )
-    : _buffer(buffer) {}
-
-    //void operator()( void (*f)( BMSDIBuffer * ) ) {
+    SDIBufferGuard( const std::shared_ptr<CameraCommandQueue> &queue )
+    : _queue(queue), _buffer() {}
 
+    SDIBufferGuard( const std::shared_ptr<SharedBMSDIBuffer> &buffer )
+    : _queue(), _buffer(buffer) {}
 
     template<typename Func>
-    void operator()( Func f ) {
+    bool operator()( Func f ) {
+      if( _queue ) return (*_queue)( f );
+
       SharedBMSDIBuffer::lock_guard lock( _buffer->writeMutex() );
       f( _buffer->buffer );
+      return _buffer->flushLocked();
     }
 
+    std::shared_ptr<CameraCommandQueue> _queue;
     std::shared_ptr<SharedBMSDIBuffer> _buffer;
   };
 
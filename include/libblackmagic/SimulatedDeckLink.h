@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "DeckLinkAPI.h"
+
+#include "libblackmagic/RecordingReader.h"
+
+namespace libblackmagic {
+
+  // In-process stand-in for a DeckLink card, so the library can be run and
+  // measured without hardware.  It implements IDeckLink and hands out
+  // IDeckLinkInput, IDeckLinkOutput, IDeckLinkProfileAttributes and
+  // IDeckLinkConfiguration through QueryInterface().
+  //
+  // The input side plays a synthetic source:  colour bars (mirrored in the
+  // right eye of a 3D source) in v210, 2vuy, r210 or BGRA, with stream time,
+  // hardware timestamps and RP188 timecode.  Frames arrive either at the
+  // mode's frame rate or as fast as the application takes them, from a
+  // fixed set of "card" buffers, so an application which holds on to
+  // frames sees drops as it would with hardware.  Format changes and loss
+  // of signal can be injected at any time.
+  //
+  // Given a recording, the input plays it back instead:  frames come
+  // straight out of the RecordingReader's mapping, paced by their
+  // recorded stream times (or as fast as possible), with their recorded
+  // timecode, and can be sought to or stepped through one at a time.
+  //
+  // The output side creates frames and ancillary data and runs scheduled
+  // playback, completing one frame per frame period.
+  //
+  //   SimulatedDeckLink *sim = new SimulatedDeckLink();
+  //   InputOutputClient client( sim );
+  //   sim->Release();
+  //
+  class SimulatedDeckLink : public IDeckLink {
+  public:
+
+    struct Options {
+      Options()
+        : mode( bmdModeHD1080p2997 ), is3D( false ), realTime( true ),
+          numBuffers( 8 ), formatDetection( true )
+        {;}
+
+      // What the simulated source is sending
+      BMDDisplayMode mode;
+      bool is3D;
+
+      // Deliver frames at the mode's frame rate, otherwise as fast as possible
+      bool realTime;
+
+      // Capture buffers on the "card"
+      unsigned int numBuffers;
+
+      // Reported through BMDDeckLinkSupportsInputFormatDetection
+      bool formatDetection;
+
+      // Play this, in its own mode and pixel format, in place of the
+      // colour bars
+      std::shared_ptr<const RecordingReader> recording;
+    };
+
+    struct Stats {
+      unsigned long framesDelivered, framesDropped, noInputFrames, formatChanges;
+      unsigned long outputFramesScheduled, outputFramesCompleted;
+    };
+
+    // Starts with one reference, which belongs to the caller
+    SimulatedDeckLink( const Options &opts = Options() );
+
+    SimulatedDeckLink( const SimulatedDeckLink & ) = delete;
+    SimulatedDeckLink &operator=( const SimulatedDeckLink & ) = delete;
+
+    // Changes what the source is sending.  With format detection enabled
+    // the application gets VideoInputFormatChanged() before the next frame;
+    // otherwise frames are flagged bmdFrameHasNoInputSource until input is
+    // enabled in the new mode.
+    void injectFormatChange( BMDDisplayMode mode, bool is3D );
+
+    // The next n frames are black and flagged bmdFrameHasNoInputSource
+    void injectNoInput( unsigned int frames );
+
+    void setRealTime( bool realTime );
+
+    // Playback of Options::recording.  The next frame played is at
+    // playbackPosition();  once it reaches the end, the input goes quiet.
+    void seek( size_t frame );
+    size_t playbackPosition() const;
+
+    // In single step mode, frames are only played as step() allows
+    void setSingleStep( bool singleStep );
+    void step( unsigned int frames = 1 );
+
+    // Called on the playback thread with each output frame as it is
+    // displayed, before it is completed.  Takes effect at the next
+    // StartScheduledPlayback()
+    typedef std::function< void( IDeckLinkVideoFrame * ) > OutputFrameCallback;
+    void setOutputFrameCallback( OutputFrameCallback callback );
+
+    Stats stats() const;
+
+    //== IUnknown ==
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv );
+    virtual ULONG STDMETHODCALLTYPE AddRef( void );
+    virtual ULONG STDMETHODCALLTYPE Release( void );
+
+    //== IDeckLink ==
+    virtual HRESULT STDMETHODCALLTYPE GetModelName( const char **modelName );
+    virtual HRESULT STDMETHODCALLTYPE GetDisplayName( const char **displayName );
+
+    class Input;
+    class Output;
+    class Attributes;
+    class Configuration;
+
+  protected:
+
+    virtual ~SimulatedDeckLink();
+
+  private:
+
+    std::atomic<int32_t> _refCount;
+
+    std::unique_ptr<Input> _input;
+    std::unique_ptr<Output> _output;
+    std::unique_ptr<Attributes> _attributes;
+    std::unique_ptr<Configuration> _configuration;
+  };
+
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace libblackmagic {
+
+  // Lock-free ring for exactly one producer thread and one consumer thread.
+  //
+  // push() and try_pop() are a handful of atomic loads and stores and never
+  // block, so push() is safe to call from the SDK's callback thread.  The
+  // consumer may instead sleep in pop();  it is woken through a futex, and
+  // the producer only makes that syscall when the consumer is actually
+  // asleep.
+  //
+  // The capacity is rounded up to a power of two.  T is copied in and out
+  // of preallocated slots, so it should be small and cheap to copy.
+  //
+  template <typename T>
+  class SpscRing {
+  public:
+
+    SpscRing( size_t capacity = 8 )
+      : _head(0), _tail(0), _waiting(false), _wakeups(0), _closed(false)
+    { resize( capacity ); }
+
+    SpscRing( const SpscRing & ) = delete;
+    SpscRing &operator=( const SpscRing & ) = delete;
+
+    // Discards anything queued.  Neither thread may be using the ring.
+    void resize( size_t capacity )
+    {
+      size_t size = 1;
+      while( size < capacity ) size <<= 1;
+
+      _slots = std::vector<T>( size );
+      _mask = size - 1;
+      _head.store( 0, std::memory_order_relaxed );
+      _tail.store( 0, std::memory_order_relaxed );
+    }
+
+    size_t capacity() const   { return _slots.size(); }
+
+    size_t size() const
+    { return _tail.load( std::memory_order_acquire ) - _head.load( std::memory_order_acquire ); }
+
+    //== Producer ==
+
+    // Returns false, without waiting, if the ring is full or closed
+    bool push( const T &item )
+    {
+      const size_t tail = _tail.load( std::memory_order_relaxed );
+      if( tail - _head.load( std::memory_order_acquire ) == _slots.size() ) return false;
+      if( _closed.load( std::memory_order_relaxed ) ) return false;
+
+      _slots[ tail & _mask ] = item;
+
+      // Sequentially consistent, as in park():  either the consumer sees
+      // the new tail, or we see that it is waiting
+      _tail.store( tail + 1, std::memory_order_seq_cst );
+      if( _waiting.load( std::memory_order_seq_cst ) ) wake();
+
+      return true;
+    }
+
+    //== Consumer ==
+
+    bool try_pop( T &item )
+    {
+      const size_t head = _head.load( std::memory_order_relaxed );
+      if( head == _tail.load( std::memory_order_acquire ) ) return false;
+
+      item = _slots[ head & _mask ];
+      _head.store( head + 1, std::memory_order_release );
+      return true;
+    }
+
+    // Waits for an item.  Returns false once the ring is closed and empty.
+    bool pop( T &item )
+    {
+      while( !try_pop( item ) ) {
+        if( _closed.load( std::memory_order_acquire ) ) return try_pop( item );
+        park( nullptr );
+      }
+      return true;
+    }
+
+    // As pop(), but gives up after timeout
+    template< class Rep, class Period >
+    bool pop_for( T &item, const std::chrono::duration<Rep, Period> &timeout )
+    {
+      const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+      while( !try_pop( item ) ) {
+        if( _closed.load( std::memory_order_acquire ) ) return try_pop( item );
+
+        const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>( deadline - std::chrono::steady_clock::now() );
+        if( left.count() <= 0 ) return false;
+
+        struct timespec ts;
+        ts.tv_sec = left.count() / 1000000000;
+        ts.tv_nsec = left.count() % 1000000000;
+        park( &ts );
+      }
+      return true;
+    }
+
+    //== Either thread ==
+
+    // Pushes fail;  the consumer drains what is left, then pop() returns false
+    void close()
+    {
+      _closed.store( true, std::memory_order_release );
+      wake();
+    }
+
+    void open()
+    {
+      _closed.store( false, std::memory_order_release );
+    }
+
+  protected:
+
+    void park( const struct timespec *timeout )
+    {
+      const uint32_t wakeups = _wakeups.load( std::memory_order_acquire );
+
+      _waiting.store( true, std::memory_order_seq_cst );
+
+      // Anything pushed before this is seen here;  anything after wakes us
+      if( _head.load( std::memory_order_relaxed ) == _tail.load( std::memory_order_seq_cst ) &&
+          !_closed.load( std::memory_order_acquire ) ) {
+        syscall( SYS_futex, reinterpret_cast<uint32_t *>( &_wakeups ), FUTEX_WAIT_PRIVATE,
+                 wakeups, timeout, nullptr, 0 );
+      }
+
+      _waiting.store( false, std::memory_order_relaxed );
+    }
+
+    void wake()
+    {
+      _wakeups.fetch_add( 1, std::memory_order_release );
+      syscall( SYS_futex, reinterpret_cast<uint32_t *>( &_wakeups ), FUTEX_WAKE_PRIVATE,
+               1, nullptr, nullptr, 0 );
+    }
+
+  private:
+
+    // A cache line of padding, so each side's index is on its own line.
+    // Padding rather than alignas(64), which plain new doesn't honour
+    // before C++17, so a ring in a heap-allocated object would be
+    // misaligned.
+    static const size_t kCacheLine = 64;
+
+    std::vector<T> _slots;
+    size_t _mask;
+
+    char _padHead[kCacheLine];
+    std::atomic<size_t> _head;
+    char _padTail[kCacheLine];
+    std::atomic<size_t> _tail;
+    char _padWaiting[kCacheLine];
+
+    std::atomic<bool> _waiting;
+    std::atomic<uint32_t> _wakeups;
+    std::atomic<bool> _closed;
+  };
+
+}
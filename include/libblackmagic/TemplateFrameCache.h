@@ -0,0 +1,78 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+
+namespace libblackmagic {
+
+  // Whole frames of a fixed pattern, rendered once per display mode, pixel
+  // format and pattern and kept, so that making an output frame is a
+  // single copy rather than a fill.
+  //
+  // Frame sizes come from the output's IDeckLinkDisplayMode, so any mode
+  // the card supports works, 2160p included.  Only the YUV formats SDI
+  // output uses (v210 and 2vuy) can be rendered.
+  //
+  //   IDeckLinkMutableVideoFrame *frame =
+  //       TemplateFrameCache::shared().makeFrame( output, mode, bmdFormat10BitYUV,
+  //                                               TemplateFrameCache::Blue );
+  //
+  class TemplateFrameCache {
+  public:
+
+    enum Pattern {
+      Blue,       // as the SDK's VancOutput example
+      Black,
+      Bars        // 75% colour bars
+    };
+
+    struct Template {
+      BMDDisplayMode mode;
+      BMDPixelFormat pixelFormat;
+      Pattern pattern;
+      long width, height, rowBytes;
+
+      std::vector<uint8_t> bytes;
+    };
+
+    typedef std::shared_ptr<const Template> TemplatePtr;
+
+    TemplateFrameCache();
+
+    TemplateFrameCache( const TemplateFrameCache & ) = delete;
+    TemplateFrameCache &operator=( const TemplateFrameCache & ) = delete;
+
+    // The template, rendered the first time it's asked for.  nullptr if
+    // output doesn't know the mode or the format can't be rendered.
+    TemplatePtr get( IDeckLinkOutput *output, BMDDisplayMode mode,
+                     BMDPixelFormat pixFmt, Pattern pattern );
+
+    // A new frame from output, holding a copy of the template
+    IDeckLinkMutableVideoFrame *makeFrame( IDeckLinkOutput *output, BMDDisplayMode mode,
+                                           BMDPixelFormat pixFmt, Pattern pattern );
+
+    // Drops every template;  those still in use are freed as they're let go
+    void clear();
+    size_t size() const;
+
+    // Fills one row of pattern, or returns false if pixFmt isn't supported
+    static bool renderRow( uint8_t *row, long width, long rowBytes,
+                           BMDPixelFormat pixFmt, Pattern pattern );
+
+    // The cache makeBlueFrame() uses
+    static TemplateFrameCache &shared();
+
+  private:
+
+    typedef std::tuple<BMDDisplayMode, BMDPixelFormat, Pattern> Key;
+
+    mutable std::mutex _mutex;
+    std::map<Key, TemplatePtr> _templates;
+  };
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace libblackmagic {
+
+  class DeckLink;
+
+  // How one of the library's threads (or the SDK's callback thread) should
+  // be named, placed and scheduled.
+  struct ThreadPolicy {
+    ThreadPolicy( const std::string &name_ = "", int priority = 0 )
+      : name( name_ ), cpus(), realtimePriority( priority )
+      {;}
+
+    // Shown by top, ps, gdb etc.  At most 15 characters are kept.
+    std::string name;
+
+    // CPUs the thread may run on.  If empty, ThreadingOptions::numaNode
+    // decides.
+    std::vector<int> cpus;
+
+    // 1-99 runs the thread SCHED_FIFO at that priority, which needs
+    // CAP_SYS_NICE or an RLIMIT_RTPRIO;  0 leaves it SCHED_OTHER.
+    int realtimePriority;
+  };
+
+  // Policies for each kind of thread behind an InputHandler or
+  // OutputHandler.  OutputHandler only uses driverCallback.
+  struct ThreadingOptions {
+
+    enum {
+      AnyNode = -2,       // leave placement to the kernel
+      LocalToCard = -1    // the NUMA node the card is attached to
+    };
+
+    ThreadingOptions()
+      : driverCallback( "bm-callback" ), dispatch( "bm-dispatch" ),
+        workers( "bm-worker" ), delivery( "bm-deliver" ),
+        numaNode( LocalToCard )
+      {;}
+
+    // The SDK's thread, set up the first time it calls us
+    ThreadPolicy driverCallback;
+
+    ThreadPolicy dispatch;
+
+    // Each worker's name gets its index appended
+    ThreadPolicy workers;
+
+    ThreadPolicy delivery;
+
+    // Threads without their own cpus are kept on this NUMA node's CPUs.
+    // Ignored on machines with a single node.
+    int numaNode;
+  };
+
+  // Applies policy to the calling thread.  CPUs come from policy.cpus, or
+  // else defaultCpus;  if both are empty affinity is left alone.  Anything
+  // which can't be done is logged as a warning, and false is returned.
+  bool applyThreadPolicy( const ThreadPolicy &policy,
+                          const std::vector<int> &defaultCpus = std::vector<int>() );
+
+  // The CPUs of the NUMA node opts.numaNode names, looking up the card's
+  // node for LocalToCard.  Empty for AnyNode, on machines with a single
+  // node, or (with a warning) if the node can't be found.
+  std::vector<int> numaNodeCpus( const ThreadingOptions &opts, DeckLink &deckLink );
+
+  // From sysfs.  numNumaNodes() is 1 on machines without NUMA;
+  // cpusOnNumaNode() is empty if node doesn't exist.
+  int numNumaNodes();
+  std::vector<int> cpusOnNumaNode( int node );
+
+  // NUMA node of a PCI device, given its address (e.g. "0000:3b:00.0" or
+  // "3b:00.0") anywhere in the string.  -1 if it can't be found.
+  int pciNumaNode( const std::string &pciAddress );
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+namespace libblackmagic {
+
+  // Decoder for the packed 10-bit 4:2:2 format used by bmdFormat10BitYUV.
+  //
+  // Each 16-byte group holds six pixels as four little-endian words of
+  // three 10-bit components:
+  //
+  //   word 0:  Cb0  Y0   Cr0
+  //   word 1:  Y1   Cb2  Y2
+  //   word 2:  Cr2  Y3   Cb4
+  //   word 3:  Y4   Cr4  Y5
+  //
+  // and rows are padded to a multiple of 128 bytes.
+
+  enum V210Output {
+    V210_BGR = 0,     // CV_8UC3, BT.709 video range to full range RGB
+    V210_BGRA,        // CV_8UC4, as above with alpha = 255
+    V210_UYVY,        // CV_8UC2, same layout as bmdFormat8BitYUV
+    V210_Y            // CV_8UC1, luma only
+  };
+
+  // Instruction sets the decoder may use.  V210_AUTO picks the best
+  // one supported by the running CPU.
+  enum V210Isa {
+    V210_SCALAR = 0,
+    V210_SSE41,
+    V210_AVX2,
+    V210_AVX512,
+    V210_AUTO
+  };
+
+  V210Isa v210BestIsa();
+  bool v210IsaSupported( V210Isa isa );
+  const std::string v210IsaToString( V210Isa isa );
+
+  // OpenCV type produced for a given output
+  int v210OutputType( V210Output fmt );
+
+  // Minimum row stride of a v210 image of the given width
+  size_t v210RowBytes( unsigned int width );
+
+  // Number of row bands worth splitting a decode of this size into:
+  // about one per quarter megapixel, no more than OpenCV has threads.
+  int v210DecodeBands( int width, int height );
+
+  // Decodes a v210 image into out, which is (re)allocated if it does not
+  // already have the right size and type.
+  //
+  // The image is split into bands of whole rows, which are decoded in
+  // parallel with cv::parallel_for_.  Rows are padded to whole 6-pixel
+  // groups, so every band starts on a group boundary.  bands = 0 picks
+  // v210DecodeBands(), 1 decodes on the calling thread.
+  bool decodeV210( const void *src, size_t srcRowBytes,
+                    int width, int height,
+                    cv::Mat &out, V210Output fmt = V210_BGRA,
+                    V210Isa isa = V210_AUTO, int bands = 0 );
+
+  // Packed 4:2:2 layouts accepted by decodeScaled()
+  enum PackedYUV {
+    PACKED_V210 = 0,  // bmdFormat10BitYUV
+    PACKED_UYVY       // bmdFormat8BitYUV ("2vuy")
+  };
+
+  // Size of the image decodeScaled() produces
+  cv::Size scaledSize( int width, int height, double scale );
+
+  // Decodes and downscales a packed 4:2:2 image in one pass, for previews.
+  // Power-of-two scales (0.5, 0.25, ...) which divide the image evenly
+  // average whole blocks;  any other scale in (0,1] uses an area filter.
+  // Averaging happens in YUV, so only output pixels are converted to RGB.
+  //
+  // fmt may be V210_BGR, V210_BGRA or V210_Y.
+  bool decodeScaled( const void *src, size_t srcRowBytes, PackedYUV layout,
+                     int width, int height, double scale,
+                     cv::Mat &out, V210Output fmt = V210_BGRA,
+                     V210Isa isa = V210_AUTO );
+
+  // Decodes rows [rowBegin, rowEnd) of a v210 image into the same rows of
+  // out, which must already be allocated (height x width, of type
+  // v210OutputType(fmt)).  For callers doing their own banding.
+  bool decodeV210Rows( const void *src, size_t srcRowBytes,
+                       int width, int rowBegin, int rowEnd,
+                       cv::Mat &out, V210Output fmt = V210_BGRA,
+                       V210Isa isa = V210_AUTO );
+
+}
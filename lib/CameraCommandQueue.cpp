@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/CameraCommandQueue.h"
+
+namespace libblackmagic {
+
+// A message is a four byte header (destination, length of the command,
+// command id, reserved), the command (category, parameter, data type,
+// operation, then data), and padding to a multiple of four bytes
+static const size_t kHeaderBytes = 4;
+static const size_t kCommandHeaderBytes = 4;
+static const uint8_t kOperationAssign = 0;
+
+//== CameraCommandQueue::Message ==
+
+uint32_t CameraCommandQueue::Message::key() const
+{
+  // Never the same as a command's
+  if( len < kHeaderBytes + kCommandHeaderBytes ) return UINT32_MAX;
+  return (uint32_t( bytes[0] ) << 16) | (uint32_t( bytes[4] ) << 8) | bytes[5];
+}
+
+bool CameraCommandQueue::Message::isAssign() const
+{
+  return len >= kHeaderBytes + kCommandHeaderBytes && bytes[7] == kOperationAssign;
+}
+
+//== CameraCommandQueue ==
+
+CameraCommandQueue::CameraCommandQueue( size_t capacity )
+  : _cells(), _mask(0),
+    _enqueuePos(0), _dequeuePos(0),
+    _pending(),
+    _taken(0), _takenPackets(0),
+    _queued(0), _coalesced(0), _dropped(0), _sent(0), _packets(0),
+    _pendingCount(0)
+{
+  size_t size = 2;
+  while( size < capacity ) size <<= 1;
+
+  _cells.reset( new Cell[size] );
+  _mask = size - 1;
+  for( size_t i = 0; i < size; ++i ) _cells[i].sequence.store( i, std::memory_order_relaxed );
+
+  _pending.reserve( size );
+}
+
+bool CameraCommandQueue::push( const BMSDIBuffer &buffer )
+{
+  bool ok = true;
+
+  size_t offset = 0;
+  while( offset + kHeaderBytes <= buffer.len ) {
+    const size_t size = kHeaderBytes + buffer.data[offset + 1];
+    const size_t padded = std::min( (size + 3) & ~size_t(3), size_t( buffer.len ) - offset );
+
+    if( size > padded || padded > kMaxMessageBytes ) {
+      LOG(WARNING) << "Dropping a malformed or oversized camera command";
+      ++_dropped;
+      return false;
+    }
+
+    Message msg;
+    msg.len = padded;
+    memcpy( msg.bytes, buffer.data + offset, padded );
+
+    if( tryPush( msg ) ) {
+      ++_queued;
+    } else {
+      ++_dropped;
+      ok = false;
+    }
+
+    offset += padded;
+  }
+
+  LOG_IF(WARNING, !ok) << "Camera command queue is full, dropped commands";
+  return ok;
+}
+
+bool CameraCommandQueue::tryPush( const Message &msg )
+{
+  size_t pos = _enqueuePos.load( std::memory_order_relaxed );
+  Cell *cell;
+
+  while( true ) {
+    cell = &_cells[ pos & _mask ];
+    const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+    const intptr_t diff = intptr_t( sequence ) - intptr_t( pos );
+
+    if( diff == 0 ) {
+      // Free, if no other producer claims it first
+      if( _enqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) break;
+    } else if( diff < 0 ) {
+      // Still holds what the consumer hasn't taken a lap ago
+      return false;
+    } else {
+      pos = _enqueuePos.load( std::memory_order_relaxed );
+    }
+  }
+
+  cell->message = msg;
+  cell->sequence.store( pos + 1, std::memory_order_release );
+  return true;
+}
+
+bool CameraCommandQueue::tryPop( Message &msg )
+{
+  Cell &cell( _cells[ _dequeuePos & _mask ] );
+  if( cell.sequence.load( std::memory_order_acquire ) != _dequeuePos + 1 ) return false;
+
+  msg = cell.message;
+  cell.sequence.store( _dequeuePos + _mask + 1, std::memory_order_release );
+  ++_dequeuePos;
+  return true;
+}
+
+bool CameraCommandQueue::pending() const
+{
+  if( !_pending.empty() ) return true;
+
+  const Cell &cell( _cells[ _dequeuePos & _mask ] );
+  return cell.sequence.load( std::memory_order_acquire ) == _dequeuePos + 1;
+}
+
+void CameraCommandQueue::drain()
+{
+  Message msg;
+  while( _pending.size() < _pending.capacity() && tryPop( msg ) ) {
+    if( msg.isAssign() ) {
+      // Everything pending for this parameter is older, so superseded;
+      // the new value takes the place of the first
+      const uint32_t key = msg.key();
+      auto first = std::find_if( _pending.begin(), _pending.end(),
+                                 [key]( const Message &m ){ return m.key() == key; } );
+
+      if( first != _pending.end() ) {
+        *first = msg;
+        auto end = std::remove_if( first + 1, _pending.end(),
+                                   [key]( const Message &m ){ return m.key() == key; } );
+
+        _coalesced += 1 + (_pending.end() - end);
+        _pending.erase( end, _pending.end() );
+        continue;
+      }
+    }
+
+    _pending.push_back( msg );
+  }
+
+  _pendingCount.store( _pending.size(), std::memory_order_relaxed );
+}
+
+size_t CameraCommandQueue::fill( BMSDIBuffer *packet, size_t maxBytes )
+{
+  drain();
+  if( maxBytes > kMaxPacketBytes ) maxBytes = kMaxPacketBytes;
+
+  // In order, so stop at the first which doesn't fit
+  size_t count = 0;
+  while( count < _pending.size() && packet->len + _pending[count].len <= maxBytes ) {
+    const Message &msg( _pending[count] );
+    memcpy( packet->data + packet->len, msg.bytes, msg.len );
+    packet->len += msg.len;
+    ++count;
+  }
+
+  _pending.erase( _pending.begin(), _pending.begin() + count );
+  _pendingCount.store( _pending.size(), std::memory_order_relaxed );
+
+  if( count > 0 ) {
+    _taken += count;
+    ++_takenPackets;
+  }
+
+  return count;
+}
+
+void CameraCommandQueue::confirm()
+{
+  _sent += _taken;
+  _packets += _takenPackets;
+  _taken = _takenPackets = 0;
+}
+
+size_t CameraCommandQueue::abandon()
+{
+  const size_t messages = _taken;
+  _dropped += messages;
+  _taken = _takenPackets = 0;
+  return messages;
+}
+
+CameraCommandQueue::Stats CameraCommandQueue::stats() const
+{
+  Stats s;
+  s.queued = _queued.load( std::memory_order_relaxed );
+  s.coalesced = _coalesced.load( std::memory_order_relaxed );
+  s.dropped = _dropped.load( std::memory_order_relaxed );
+  s.sent = _sent.load( std::memory_order_relaxed );
+  s.packets = _packets.load( std::memory_order_relaxed );
+  s.pending = _pendingCount.load( std::memory_order_relaxed );
+  return s;
+}
+
+}
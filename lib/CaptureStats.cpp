@@ -0,0 +1,57 @@
+
+#include "libblackmagic/CaptureStats.h"
+
+namespace libblackmagic {
+
+CaptureStats::CaptureStats()
+{
+  reset();
+}
+
+void CaptureStats::recordBacklog( uint32_t frames )
+{
+  _backlog.store( frames, std::memory_order_relaxed );
+
+  uint32_t prev = _maxBacklog.load( std::memory_order_relaxed );
+  while( frames > prev && !_maxBacklog.compare_exchange_weak( prev, frames, std::memory_order_relaxed ) ) {;}
+}
+
+CaptureStats::Snapshot CaptureStats::snapshot() const
+{
+  Snapshot s;
+
+  s.frames = _frames.load( std::memory_order_relaxed );
+  s.dropped = _dropped.load( std::memory_order_relaxed );
+  s.noInput = _noInput.load( std::memory_order_relaxed );
+  s.failed = _failed.load( std::memory_order_relaxed );
+  s.delivered = _delivered.load( std::memory_order_relaxed );
+  s.backlog = _backlog.load( std::memory_order_relaxed );
+  s.maxBacklog = _maxBacklog.load( std::memory_order_relaxed );
+
+  s.driverCallbackTime = _driverCallbackTime.snapshot();
+  s.deliveryLatency = _deliveryLatency.snapshot();
+  s.conversionTime[0] = _conversionTime[0].snapshot();
+  s.conversionTime[1] = _conversionTime[1].snapshot();
+  s.callbackTime = _callbackTime.snapshot();
+
+  return s;
+}
+
+void CaptureStats::reset()
+{
+  _frames.store( 0, std::memory_order_relaxed );
+  _dropped.store( 0, std::memory_order_relaxed );
+  _noInput.store( 0, std::memory_order_relaxed );
+  _failed.store( 0, std::memory_order_relaxed );
+  _delivered.store( 0, std::memory_order_relaxed );
+  _backlog.store( 0, std::memory_order_relaxed );
+  _maxBacklog.store( 0, std::memory_order_relaxed );
+
+  _driverCallbackTime.reset();
+  _deliveryLatency.reset();
+  _conversionTime[0].reset();
+  _conversionTime[1].reset();
+  _callbackTime.reset();
+}
+
+}
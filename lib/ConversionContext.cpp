@@ -0,0 +1,166 @@
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/ConversionContext.h"
+#include "libblackmagic/DataTypes.h"
+#include "libblackmagic/DeckLink.h"
+
+namespace libblackmagic {
+
+ConversionContext::ConversionContext( DeckLink &deckLink, unsigned int poolSize )
+  : _deckLink( deckLink ),
+    _deckLinkOutput( nullptr ),
+    _poolSize( std::max( 1u, poolSize ) ),
+    _width(0), _height(0),
+    _slots(),
+    _next(0),
+    _sdkObjectsCreated(0),
+    _fallbackConversions(0)
+{;}
+
+ConversionContext::~ConversionContext()
+{
+  reset();
+
+  if( _deckLinkOutput ) _deckLinkOutput->Release();
+}
+
+IDeckLinkOutput *ConversionContext::deckLinkOutput()
+{
+  if( !_deckLinkOutput ) {
+    if( _deckLink.deckLink()->QueryInterface( IID_IDeckLinkOutput, (void **)&_deckLinkOutput ) != S_OK ) {
+      LOG(WARNING) << "Unable to get IDeckLinkOutput for frame conversion";
+      _deckLinkOutput = nullptr;
+    }
+  }
+
+  return _deckLinkOutput;
+}
+
+bool ConversionContext::configure( long width, long height )
+{
+  if( configured() && width == _width && height == _height ) return true;
+
+  reset();
+
+  if( !deckLinkOutput() ) return false;
+
+  LOG(DEBUG) << "Creating " << _poolSize << " conversion frames of "
+             << width << " x " << height;
+
+  for( unsigned int i = 0; i < _poolSize; ++i ) {
+    std::unique_ptr<Slot> slot( new Slot );
+
+    HRESULT result = _deckLinkOutput->CreateVideoFrame( width, height, 4 * width,
+                                                        bmdFormat8BitBGRA, bmdFrameFlagDefault,
+                                                        &slot->frame );
+    if( result != S_OK ) {
+      LOG(WARNING) << "Failed to create conversion frame (result = " << std::hex << result << ")";
+      reset();
+      return false;
+    }
+
+    slot->converter = CreateVideoConversionInstance();
+    if( !slot->converter ) {
+      LOG(WARNING) << "Failed to create video converter";
+      slot->frame->Release();
+      reset();
+      return false;
+    }
+
+    _sdkObjectsCreated += 2;
+    _slots.push_back( std::move(slot) );
+  }
+
+  _width = width;
+  _height = height;
+
+  return true;
+}
+
+void ConversionContext::reset()
+{
+  for( auto &slot : _slots ) {
+    if( slot->frame ) slot->frame->Release();
+    if( slot->converter ) slot->converter->Release();
+  }
+
+  _slots.clear();
+  _width = _height = 0;
+}
+
+bool ConversionContext::convert( IDeckLinkVideoFrame *src, cv::Mat &out )
+{
+  if( configured() && src->GetWidth() == _width && src->GetHeight() == _height ) {
+
+    // Start at the next slot round-robin and take the first one which is free
+    const unsigned int start = _next++;
+    for( unsigned int i = 0; i < _slots.size(); ++i ) {
+      Slot &slot( *_slots[ (start + i) % _slots.size() ] );
+
+      bool expected = false;
+      if( slot.busy.compare_exchange_strong( expected, true ) ) {
+        const bool ok = convertInto( slot.converter, src, slot.frame, out );
+        slot.busy = false;
+        return ok;
+      }
+    }
+
+    LOG(DEBUG) << "All conversion frames busy, using a temporary frame";
+  } else {
+    LOG(DEBUG) << "Frame is " << src->GetWidth() << " x " << src->GetHeight()
+               << ", conversion pool is " << _width << " x " << _height;
+  }
+
+  ++_fallbackConversions;
+  return convertTemporary( src, out );
+}
+
+bool ConversionContext::convertInto( IDeckLinkVideoConversion *converter, IDeckLinkVideoFrame *src,
+                                     IDeckLinkMutableVideoFrame *dst, cv::Mat &out )
+{
+  HRESULT result = converter->ConvertFrame( src, dst );
+  if( result != S_OK ) {
+    LOG(WARNING) << "Failed to convert " << pixelFormatToString( src->GetPixelFormat() )
+                 << " (result = " << std::hex << result << ")";
+    return false;
+  }
+
+  void *buffer = nullptr;
+  if( dst->GetBytes( &buffer ) != S_OK ) {
+    LOG(WARNING) << "Unable to get bytes from conversion frame";
+    return false;
+  }
+
+  cv::Mat mat( cv::Size( dst->GetWidth(), dst->GetHeight() ),
+               CV_8UC4, buffer, dst->GetRowBytes() );
+  mat.copyTo( out );
+
+  return true;
+}
+
+bool ConversionContext::convertTemporary( IDeckLinkVideoFrame *src, cv::Mat &out )
+{
+  if( !deckLinkOutput() ) return false;
+
+  IDeckLinkMutableVideoFrame *dst = nullptr;
+  HRESULT result = _deckLinkOutput->CreateVideoFrame( src->GetWidth(), src->GetHeight(),
+                                                      4 * src->GetWidth(), bmdFormat8BitBGRA,
+                                                      bmdFrameFlagDefault, &dst );
+  if( result != S_OK ) {
+    LOG(WARNING) << "Failed to create destination video frame";
+    return false;
+  }
+
+  IDeckLinkVideoConversion *converter = CreateVideoConversionInstance();
+  _sdkObjectsCreated += 2;
+
+  const bool ok = converter && convertInto( converter, src, dst, out );
+
+  if( converter ) converter->Release();
+  dst->Release();
+
+  return ok;
+}
+
+}
@@ -59,9 +59,23 @@ const std::string pixelFormatToString(BMDPixelFormat pix) {
     return "bmdFormat8BitBGRA";
   else if (pix == bmdFormat10BitYUV)
     return "bmdFormat10BitYUV";
+  else if (pix == bmdFormat10BitRGB)
+    return "bmdFormat10BitRGB";
   return "(unknown)";
 }
 
+unsigned int rowBytesForPixelFormat(BMDPixelFormat pix, unsigned int width) {
+  if (pix == bmdFormat8BitYUV)
+    return width * 2;
+  else if ((pix == bmdFormat8BitARGB) || (pix == bmdFormat8BitBGRA))
+    return width * 4;
+  else if (pix == bmdFormat10BitYUV)
+    return ((width + 47) / 48) * 128;
+  else if (pix == bmdFormat10BitRGB)
+    return ((width + 63) / 64) * 256;
+  return 0;
+}
+
 //=== Mode parameters table ============================
 
 ModeParams ModeParamsTable[] = {{bmdModeHD1080p2997, 1920, 1080, 29.97},
@@ -9,6 +9,7 @@
 #include <g3log/logworker.hpp>
 
 #include "libblackmagic/DeckLink.h"
+#include "libblackmagic/ThreadPolicy.h"
 
 namespace libblackmagic {
 
@@ -20,6 +21,13 @@ DeckLink::DeckLink(int cardNo)
   CHECK(_deckLink != nullptr);
 }
 
+DeckLink::DeckLink(IDeckLink *deckLink)
+    : _deckLink(deckLink)
+{
+  CHECK(_deckLink != nullptr);
+  _deckLink->AddRef();
+}
+
 DeckLink::~DeckLink() {
   _deckLink->Release();
 }
@@ -100,6 +108,25 @@ void DeckLink::listInputModes() {
   input->Release();
 }
 
+int DeckLink::numaNode() {
+  IDeckLinkProfileAttributes *attributes = nullptr;
+  if (_deckLink->QueryInterface(IID_IDeckLinkProfileAttributes,
+                                (void **)&attributes) != S_OK) {
+    LOG(WARNING) << "Unable to query DeckLink attributes";
+    return -1;
+  }
+
+  int node = -1;
+  const char *handle = nullptr;
+  if (attributes->GetString(BMDDeckLinkDeviceHandle, &handle) == S_OK && handle) {
+    node = pciNumaNode(handle);
+    LOG_IF(DEBUG, node < 0) << "No NUMA node for device handle \"" << handle << "\"";
+    free((void *)handle);
+  }
+
+  attributes->Release();
+  return node;
+}
 
 //=================================================================
 // Configuration functions
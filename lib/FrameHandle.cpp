@@ -0,0 +1,93 @@
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/FrameHandle.h"
+
+namespace libblackmagic {
+
+std::atomic<int> FrameHandle::_checkedOut( 0 );
+
+FrameHandle::FrameHandle()
+  : _metadata()
+{
+  _frames[0] = _frames[1] = nullptr;
+}
+
+FrameHandle::FrameHandle( IDeckLinkVideoFrame *left, IDeckLinkVideoFrame *right,
+                          const FrameMetadata &metadata )
+  : _metadata( metadata )
+{
+  _frames[0] = left;
+  _frames[1] = right;
+
+  _checkedOut += size();
+}
+
+FrameHandle::FrameHandle( FrameHandle &&other )
+  : _metadata( other._metadata )
+{
+  _frames[0] = other._frames[0];
+  _frames[1] = other._frames[1];
+  other._frames[0] = other._frames[1] = nullptr;
+}
+
+FrameHandle &FrameHandle::operator=( FrameHandle &&other )
+{
+  if( this != &other ) {
+    reset();
+
+    _metadata = other._metadata;
+    _frames[0] = other._frames[0];
+    _frames[1] = other._frames[1];
+    other._frames[0] = other._frames[1] = nullptr;
+  }
+
+  return *this;
+}
+
+FrameHandle::~FrameHandle()
+{
+  reset();
+}
+
+void FrameHandle::reset()
+{
+  for( auto &frame : _frames ) {
+    if( frame ) {
+      frame->Release();
+      frame = nullptr;
+      --_checkedOut;
+    }
+  }
+}
+
+BMDPixelFormat FrameHandle::pixelFormat( unsigned int eye ) const
+{
+  IDeckLinkVideoFrame *f = frame( eye );
+  return f ? f->GetPixelFormat() : 0;
+}
+
+cv::Mat FrameHandle::mat( unsigned int eye ) const
+{
+  IDeckLinkVideoFrame *f = frame( eye );
+  if( !f ) return cv::Mat();
+
+  void *data = nullptr;
+  if( f->GetBytes( &data ) != S_OK ) {
+    LOG(WARNING) << "Unable to get bytes from frame";
+    return cv::Mat();
+  }
+
+  switch( f->GetPixelFormat() ) {
+    case bmdFormat8BitYUV:
+      // YUV is stored as 2 pixels in 4 bytes
+      return cv::Mat( f->GetHeight(), f->GetWidth(), CV_8UC2, data, f->GetRowBytes() );
+    case bmdFormat8BitBGRA:
+    case bmdFormat8BitARGB:
+      return cv::Mat( f->GetHeight(), f->GetWidth(), CV_8UC4, data, f->GetRowBytes() );
+    default:
+      return cv::Mat( f->GetHeight(), f->GetRowBytes(), CV_8UC1, data, f->GetRowBytes() );
+  }
+}
+
+}
@@ -0,0 +1,51 @@
+
+#include <stdio.h>
+
+#include "libblackmagic/FrameMetadata.h"
+
+namespace libblackmagic {
+
+const BMDTimeScale FrameMetadata::kTimeScale;
+
+std::string FrameTimecode::toString() const
+{
+  if( !valid ) return std::string();
+
+  char buf[16];
+  snprintf( buf, sizeof(buf), "%02u:%02u:%02u%c%02u",
+            hours, minutes, seconds, isDropFrame() ? ';' : ':', frames );
+  return std::string( buf );
+}
+
+static bool readTimecode( IDeckLinkVideoInputFrame *frame, BMDTimecodeFormat format, FrameTimecode &tc )
+{
+  IDeckLinkTimecode *timecode = nullptr;
+  if( frame->GetTimecode( format, &timecode ) != S_OK || !timecode ) return false;
+
+  // GetComponents rather than GetString, which allocates
+  tc.valid = ( timecode->GetComponents( &tc.hours, &tc.minutes, &tc.seconds, &tc.frames ) == S_OK );
+  tc.format = format;
+  tc.flags = timecode->GetFlags();
+
+  timecode->Release();
+  return tc.valid;
+}
+
+void readFrameMetadata( IDeckLinkVideoInputFrame *frame, FrameMetadata &meta )
+{
+  meta.timeScale = FrameMetadata::kTimeScale;
+
+  if( frame->GetStreamTime( &meta.streamTime, &meta.streamDuration, meta.timeScale ) != S_OK )
+    meta.streamTime = meta.streamDuration = 0;
+
+  if( frame->GetHardwareReferenceTimestamp( meta.timeScale, &meta.hardwareTime, &meta.hardwareDuration ) != S_OK )
+    meta.hardwareTime = meta.hardwareDuration = 0;
+
+  meta.timecode = FrameTimecode();
+  if( !readTimecode( frame, bmdTimecodeRP188Any, meta.timecode ) )
+    readTimecode( frame, bmdTimecodeVITC, meta.timecode );
+
+  meta.noInput = frame->GetFlags() & bmdFrameHasNoInputSource;
+}
+
+}
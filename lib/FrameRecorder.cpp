@@ -0,0 +1,715 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_SINGLE_MMAP)
+#define LIBBLACKMAGIC_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/FrameRecorder.h"
+
+namespace libblackmagic {
+
+static const size_t kBlockSize = RecordingFileHeader::kBlockSize;
+
+static size_t roundUp( size_t n )
+{ return (n + kBlockSize - 1) & ~(kBlockSize - 1); }
+
+static bool isAligned( const void *p )
+{ return (reinterpret_cast<uintptr_t>(p) & (kBlockSize - 1)) == 0; }
+
+static uint8_t *alignedAlloc( size_t size )
+{
+  void *p = nullptr;
+  if( posix_memalign( &p, kBlockSize, size ) != 0 ) return nullptr;
+  memset( p, 0, size );
+  return static_cast<uint8_t *>(p);
+}
+
+//== io_uring, through the raw syscalls ==
+
+#ifdef LIBBLACKMAGIC_HAVE_IO_URING
+
+// Just enough of io_uring for the recorder:  one thread queues writes,
+// another waits for them to complete.
+class FrameRecorder::IoUring {
+public:
+
+  // nullptr, with a log message, if the kernel won't give us a ring
+  static IoUring *create( unsigned int entries )
+  {
+    struct io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+
+    const int fd = syscall( __NR_io_uring_setup, entries, &params );
+    if( fd < 0 ) {
+      LOG(INFO) << "io_uring not available (" << strerror(errno) << "), recording with pwritev()";
+      return nullptr;
+    }
+
+    if( !(params.features & IORING_FEAT_SINGLE_MMAP) ) {
+      LOG(INFO) << "Kernel's io_uring is too old, recording with pwritev()";
+      ::close( fd );
+      return nullptr;
+    }
+
+    IoUring *ring = new IoUring( fd, params );
+    if( !ring->_sqes ) {
+      LOG(INFO) << "Unable to map io_uring (" << strerror(errno) << "), recording with pwritev()";
+      delete ring;
+      return nullptr;
+    }
+
+    return ring;
+  }
+
+  ~IoUring()
+  {
+    if( _sqes ) munmap( _sqes, _sqesSize );
+    if( _rings ) munmap( _rings, _ringsSize );
+    ::close( _fd );
+  }
+
+  //== Submitting thread ==
+
+  bool writev( int fd, const struct iovec *iov, int iovcnt, uint64_t offset, uint64_t userData )
+  {
+    struct io_uring_sqe *sqe = next();
+    if( !sqe ) return false;
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>( iov );
+    sqe->len = iovcnt;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    return submit();
+  }
+
+  bool nop( uint64_t userData )
+  {
+    struct io_uring_sqe *sqe = next();
+    if( !sqe ) return false;
+
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = userData;
+    return submit();
+  }
+
+  //== Completing thread ==
+
+  // Waits for the next completion.  False if the ring has failed.
+  bool wait( uint64_t &userData, int32_t &result )
+  {
+    while( true ) {
+      const unsigned int head = *_cqHead;
+      if( head != __atomic_load_n( _cqTail, __ATOMIC_ACQUIRE ) ) {
+        const struct io_uring_cqe &cqe( _cqes[ head & *_cqMask ] );
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n( _cqHead, head + 1, __ATOMIC_RELEASE );
+        return true;
+      }
+
+      if( syscall( __NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0 ) < 0 &&
+          errno != EINTR ) {
+        LOG(WARNING) << "Waiting on io_uring failed: " << strerror(errno);
+        return false;
+      }
+    }
+  }
+
+protected:
+
+  IoUring( int fd, const struct io_uring_params &params )
+    : _fd( fd ), _rings( nullptr ), _ringsSize( 0 ), _sqes( nullptr ), _sqesSize( 0 )
+  {
+    // With IORING_FEAT_SINGLE_MMAP both rings share one mapping
+    _ringsSize = std::max( params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+                           params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) );
+    void *rings = mmap( nullptr, _ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING );
+    if( rings == MAP_FAILED ) return;
+    _rings = static_cast<uint8_t *>( rings );
+
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap( nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQES );
+    if( sqes == MAP_FAILED ) return;
+    _sqes = static_cast<struct io_uring_sqe *>( sqes );
+
+    _sqHead = reinterpret_cast<unsigned int *>( _rings + params.sq_off.head );
+    _sqTail = reinterpret_cast<unsigned int *>( _rings + params.sq_off.tail );
+    _sqMask = reinterpret_cast<unsigned int *>( _rings + params.sq_off.ring_mask );
+    _sqArray = reinterpret_cast<unsigned int *>( _rings + params.sq_off.array );
+    _sqEntries = params.sq_entries;
+
+    _cqHead = reinterpret_cast<unsigned int *>( _rings + params.cq_off.head );
+    _cqTail = reinterpret_cast<unsigned int *>( _rings + params.cq_off.tail );
+    _cqMask = reinterpret_cast<unsigned int *>( _rings + params.cq_off.ring_mask );
+    _cqes = reinterpret_cast<struct io_uring_cqe *>( _rings + params.cq_off.cqes );
+  }
+
+  struct io_uring_sqe *next()
+  {
+    const unsigned int tail = *_sqTail;
+    if( tail - __atomic_load_n( _sqHead, __ATOMIC_ACQUIRE ) >= _sqEntries ) return nullptr;
+
+    const unsigned int index = tail & *_sqMask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset( sqe, 0, sizeof(*sqe) );
+    _sqArray[index] = index;
+    return sqe;
+  }
+
+  bool submit()
+  {
+    __atomic_store_n( _sqTail, *_sqTail + 1, __ATOMIC_RELEASE );
+
+    while( syscall( __NR_io_uring_enter, _fd, 1, 0, 0, nullptr, 0 ) < 0 ) {
+      if( errno == EINTR ) continue;
+      LOG(WARNING) << "Submitting to io_uring failed: " << strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+private:
+
+  int _fd;
+
+  uint8_t *_rings;
+  size_t _ringsSize;
+  struct io_uring_sqe *_sqes;
+  size_t _sqesSize;
+
+  unsigned int *_sqHead, *_sqTail, *_sqMask, *_sqArray;
+  unsigned int _sqEntries;
+
+  unsigned int *_cqHead, *_cqTail, *_cqMask;
+  struct io_uring_cqe *_cqes;
+};
+
+#else
+
+class FrameRecorder::IoUring {
+public:
+  static IoUring *create( unsigned int )
+  {
+    LOG(INFO) << "Built without io_uring, recording with pwritev()";
+    return nullptr;
+  }
+
+  bool writev( int, const struct iovec *, int, uint64_t, uint64_t )  { return false; }
+  bool nop( uint64_t )                                               { return false; }
+  bool wait( uint64_t &, int32_t & )                                 { return false; }
+};
+
+#endif
+
+//== FrameRecorder ==
+
+// user_data of the NOP which tells the writer thread to finish
+static const uint64_t kStopToken = ~uint64_t(0);
+
+// Index entries per chunk;  about 18 minutes at 60 fps
+static const size_t kIndexChunk = 65536;
+
+// Chunk pointers to make room for up front;  about 19 hours at 60 fps
+static const size_t kIndexChunksReserve = 64;
+
+FrameRecorder::FrameRecorder( const Options &opts )
+  : _opts( opts ),
+    _fd( -1 ), _direct( false ), _offset( 0 ), _created( 0 ),
+    _ring(), _writerThread(),
+    _slots(), _spare(), _index(), _indexSize( 0 ),
+    _records(0), _bytes(0), _dropped(0), _errors(0),
+    _inFlight(0), _highWater(0),
+    _failed( false ), _behind( false ), _warnedUnaligned( false ),
+    _backpressureCallback()
+{
+  _opts.framesInFlight = std::max( 1u, _opts.framesInFlight );
+}
+
+FrameRecorder::~FrameRecorder()
+{
+  close();
+}
+
+bool FrameRecorder::open( const std::string &path )
+{
+  close();
+
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+  _direct = false;
+  if( _opts.directIO ) {
+    _fd = ::open( path.c_str(), flags | O_DIRECT, 0644 );
+    if( _fd >= 0 )
+      _direct = true;
+    else if( errno == EINVAL )
+      LOG(WARNING) << "The filesystem holding " << path << " doesn't support O_DIRECT;"
+                   << " recording through the page cache";
+  }
+
+  if( _fd < 0 ) _fd = ::open( path.c_str(), flags, 0644 );
+
+  if( _fd < 0 ) {
+    LOG(WARNING) << "Unable to open " << path << " for recording: " << strerror(errno);
+    return false;
+  }
+
+  _created = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch() ).count();
+
+  if( !writeFileHeader( 0 ) ) {
+    LOG(WARNING) << "Unable to write the header of " << path << ": " << strerror(errno);
+    ::close( _fd );
+    _fd = -1;
+    return false;
+  }
+
+  _offset = kBlockSize;
+
+  // One slot per eye
+  const unsigned int numSlots = 2 * _opts.framesInFlight;
+  _slots.resize( numSlots );
+  _spare.clear();
+  _spare.reserve( numSlots );
+  for( unsigned int i = 0; i < numSlots; ++i ) {
+    _slots[i].block = alignedAlloc( 2 * kBlockSize );
+    if( _slots[i].block ) _spare.push_back( i );
+  }
+
+  _index.clear();
+  _index.reserve( kIndexChunksReserve );
+  _index.emplace_back( new RecordingIndexEntry[ kIndexChunk ] );
+  _indexSize = 0;
+
+  _free.resize( numSlots );
+  _free.open();
+  _pending.resize( numSlots );
+  _pending.open();
+
+  _records = 0;  _bytes = 0;  _dropped = 0;  _errors = 0;
+  _inFlight = 0;  _highWater = 0;
+  _failed = false;
+  _behind = false;
+
+  // One extra entry for the stop NOP
+  if( _opts.useIoUring ) _ring.reset( IoUring::create( numSlots + 1 ) );
+
+  _writerThread = std::thread( &FrameRecorder::writerThread, this );
+
+  LOG(INFO) << "Recording to " << path << (_direct ? " with O_DIRECT" : "")
+            << (_ring ? " through io_uring" : " with pwritev()");
+  return true;
+}
+
+void FrameRecorder::close()
+{
+  if( _fd < 0 ) return;
+
+  // The writer thread finishes what's queued, then exits
+  if( _ring )
+    _ring->nop( kStopToken );
+  else
+    _pending.close();
+
+  if( _writerThread.joinable() ) _writerThread.join();
+  _ring.reset();
+
+  // Without an index, readers walk the records instead
+  if( !_failed && !writeIndex() )
+    LOG(WARNING) << "Unable to write the recording's index: " << strerror(errno);
+
+  if( fsync( _fd ) != 0 )
+    LOG(WARNING) << "Unable to sync recording: " << strerror(errno);
+
+  ::close( _fd );
+  _fd = -1;
+
+  freeSlots();
+
+  const Stats s = stats();
+  LOG(INFO) << "Recorded " << s.records << " frames (" << s.bytes / (1024*1024) << " MB), "
+            << s.dropped << " dropped because the disk fell behind, " << s.errors << " write errors";
+}
+
+void FrameRecorder::freeSlots()
+{
+  for( auto &slot : _slots ) {
+    if( slot.frame ) slot.frame->Release();
+    free( slot.block );
+    free( slot.staging );
+  }
+
+  _slots.clear();
+  _spare.clear();
+}
+
+bool FrameRecorder::record( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye,
+                            const FrameMetadata &meta, BMDDisplayMode mode )
+{
+  if( _fd < 0 || _failed.load( std::memory_order_relaxed ) || !frame ) return false;
+
+  // Collect slots the writer has finished with
+  unsigned int index;
+  while( _free.try_pop( index ) ) _spare.push_back( index );
+
+  const unsigned int eyes = rightEye ? 2 : 1;
+  if( _spare.size() < eyes ) {
+    const uint64_t dropped = ++_dropped;
+
+    if( !_behind ) {
+      _behind = true;
+      LOG(WARNING) << "Disk is falling behind, dropping frames from the recording";
+      if( _backpressureCallback ) _backpressureCallback( dropped );
+    }
+
+    return false;
+  }
+
+  if( _behind ) {
+    _behind = false;
+    LOG(INFO) << "Recording has caught up, " << _dropped.load() << " frames dropped so far";
+  }
+
+  IDeckLinkVideoFrame *frames[2] = { frame, rightEye };
+  unsigned int indices[2];
+  unsigned int prepared = 0;
+
+  for( ; prepared < eyes; ++prepared ) {
+    indices[prepared] = _spare.back();
+    if( !prepare( _slots[ indices[prepared] ], frames[prepared], prepared, meta, mode ) ) {
+      // Nothing has been queued yet, or the left eye is written alone
+      ++_errors;
+      break;
+    }
+    _spare.pop_back();
+  }
+
+  if( prepared == 0 ) return false;
+
+  RecordingIndexEntry entry;
+  entry.offset = _slots[ indices[0] ].offset;
+  entry.sequence = meta.sequence;
+  entry.streamTime = meta.streamTime;
+  entry.timecode = meta.timecode.valid ? RecordingIndexEntry::packTimecode( meta.timecode.hours, meta.timecode.minutes,
+                                                                           meta.timecode.seconds, meta.timecode.frames )
+                                       : RecordingIndexEntry::kNoTimecode;
+  entry.eyes = prepared;
+
+  bool ok = true;
+  for( unsigned int eye = 0; eye < prepared; ++eye )
+    ok = submit( indices[eye] ) && ok;
+
+  if( ok ) {
+    if( _indexSize == _index.size() * kIndexChunk )
+      _index.emplace_back( new RecordingIndexEntry[ kIndexChunk ] );
+
+    _index[ _indexSize / kIndexChunk ][ _indexSize % kIndexChunk ] = entry;
+    ++_indexSize;
+  }
+
+  return ok && prepared == eyes;
+}
+
+bool FrameRecorder::waitForSpace( unsigned int eyes, std::chrono::milliseconds timeout )
+{
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  unsigned int index;
+
+  while( _fd >= 0 && !_failed.load( std::memory_order_relaxed ) ) {
+    while( _free.try_pop( index ) ) _spare.push_back( index );
+    if( _spare.size() >= eyes ) return true;
+
+    const auto now = std::chrono::steady_clock::now();
+    if( now >= deadline || !_free.pop_for( index, deadline - now ) ) return false;
+    _spare.push_back( index );
+  }
+
+  return false;
+}
+
+bool FrameRecorder::prepare( Slot &slot, IDeckLinkVideoFrame *frame, unsigned int eye,
+                             const FrameMetadata &meta, BMDDisplayMode mode )
+{
+  void *bytes = nullptr;
+  if( frame->GetBytes( &bytes ) != S_OK || !bytes ) {
+    LOG(WARNING) << "Unable to get the bytes of a frame to record";
+    return false;
+  }
+
+  const uint8_t *data = static_cast<const uint8_t *>( bytes );
+  const size_t dataSize = size_t(frame->GetRowBytes()) * frame->GetHeight();
+  const size_t padded = roundUp( dataSize );
+
+  RecordedFrameHeader *header = new (slot.block) RecordedFrameHeader();
+  header->headerSize = kBlockSize;
+  header->recordSize = kBlockSize + padded;
+  header->sequence = meta.sequence;
+
+  const auto now = std::chrono::steady_clock::now();
+  header->hostTime = std::chrono::duration_cast<std::chrono::nanoseconds>( meta.hostTime.time_since_epoch() ).count();
+  header->wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        (std::chrono::system_clock::now() - (now - meta.hostTime)).time_since_epoch() ).count();
+
+  header->timeScale = meta.timeScale;
+  header->streamTime = meta.streamTime;
+  header->streamDuration = meta.streamDuration;
+  header->hardwareTime = meta.hardwareTime;
+  header->hardwareDuration = meta.hardwareDuration;
+
+  header->displayMode = mode;
+  header->pixelFormat = frame->GetPixelFormat();
+  header->width = frame->GetWidth();
+  header->height = frame->GetHeight();
+  header->rowBytes = frame->GetRowBytes();
+  header->eye = eye;
+  header->dataSize = dataSize;
+
+  if( meta.is3D ) header->flags |= RecordedFrameHeader::Is3D;
+  if( meta.noInput ) header->flags |= RecordedFrameHeader::NoInput;
+  if( meta.timecode.valid ) {
+    header->flags |= RecordedFrameHeader::TimecodeValid;
+    if( meta.timecode.isDropFrame() ) header->flags |= RecordedFrameHeader::DropFrameTimecode;
+    header->timecodeHours = meta.timecode.hours;
+    header->timecodeMinutes = meta.timecode.minutes;
+    header->timecodeSeconds = meta.timecode.seconds;
+    header->timecodeFrames = meta.timecode.frames;
+  }
+
+  slot.iov[0].iov_base = slot.block;
+  slot.iov[0].iov_len = kBlockSize;
+  slot.iovcnt = 1;
+
+  if( !_direct || isAligned( data ) ) {
+    // Write the whole blocks in place;  only a partial last block is copied
+    const size_t body = dataSize & ~(kBlockSize - 1);
+    const size_t tail = dataSize - body;
+
+    if( body > 0 ) {
+      slot.iov[ slot.iovcnt ].iov_base = const_cast<uint8_t *>( data );
+      slot.iov[ slot.iovcnt ].iov_len = body;
+      ++slot.iovcnt;
+    }
+
+    if( tail > 0 ) {
+      uint8_t *tailBlock = slot.block + kBlockSize;
+      memcpy( tailBlock, data + body, tail );
+      memset( tailBlock + tail, 0, kBlockSize - tail );
+
+      slot.iov[ slot.iovcnt ].iov_base = tailBlock;
+      slot.iov[ slot.iovcnt ].iov_len = kBlockSize;
+      ++slot.iovcnt;
+    }
+  } else {
+    if( !_warnedUnaligned ) {
+      _warnedUnaligned = true;
+      LOG(WARNING) << "Capture buffers aren't " << kBlockSize << "-byte aligned, so frames are"
+                   << " copied before recording;  see InputHandler::useFrameAllocator()";
+    }
+
+    if( slot.stagingSize < padded ) {
+      free( slot.staging );
+      slot.staging = alignedAlloc( padded );
+      slot.stagingSize = slot.staging ? padded : 0;
+      if( !slot.staging ) {
+        LOG(WARNING) << "Unable to allocate " << padded << " bytes to stage a frame for recording";
+        return false;
+      }
+    }
+
+    memcpy( slot.staging, data, dataSize );
+    memset( slot.staging + dataSize, 0, padded - dataSize );
+
+    slot.iov[1].iov_base = slot.staging;
+    slot.iov[1].iov_len = padded;
+    slot.iovcnt = 2;
+  }
+
+  frame->AddRef();
+  slot.frame = frame;
+  slot.offset = _offset;
+  slot.length = header->recordSize;
+  _offset += header->recordSize;
+
+  return true;
+}
+
+bool FrameRecorder::submit( unsigned int index )
+{
+  const unsigned int inFlight = _inFlight.fetch_add( 1, std::memory_order_acq_rel ) + 1;
+  unsigned int highWater = _highWater.load( std::memory_order_relaxed );
+  while( inFlight > highWater && !_highWater.compare_exchange_weak( highWater, inFlight ) ) {;}
+
+  if( !_ring ) return _pending.push( index );
+
+  Slot &slot( _slots[index] );
+  if( _ring->writev( _fd, slot.iov, slot.iovcnt, slot.offset, index ) ) return true;
+
+  // Never reached the kernel, so the slot is still ours
+  LOG(WARNING) << "Unable to queue a recording write;  recording stopped";
+  _failed = true;
+  ++_errors;
+  --_inFlight;
+
+  slot.frame->Release();
+  slot.frame = nullptr;
+  _spare.push_back( index );
+  return false;
+}
+
+void FrameRecorder::completed( unsigned int index, long result )
+{
+  // Pairs with the increment in submit():  the slot reached us through
+  // the kernel, which the memory model (and TSan) can't see
+  _inFlight.fetch_sub( 1, std::memory_order_acq_rel );
+
+  Slot &slot( _slots[index] );
+
+  if( result == (long)slot.length ) {
+    _records.fetch_add( 1, std::memory_order_relaxed );
+    _bytes.fetch_add( slot.length, std::memory_order_relaxed );
+  } else {
+    _errors.fetch_add( 1, std::memory_order_relaxed );
+    if( !_failed.exchange( true ) )
+      LOG(WARNING) << "Recording write failed (" << (result < 0 ? strerror(-result) : "short write")
+                   << ");  recording stopped";
+  }
+
+  slot.frame->Release();
+  slot.frame = nullptr;
+
+  _free.push( index );
+}
+
+void FrameRecorder::writerThread()
+{
+  if( _ring ) {
+    bool stopping = false;
+    uint64_t userData;
+    int32_t result;
+
+    while( (!stopping || _inFlight.load() > 0) && _ring->wait( userData, result ) ) {
+      if( userData == kStopToken )
+        stopping = true;
+      else
+        completed( userData, result );
+    }
+    return;
+  }
+
+  unsigned int index;
+  while( _pending.pop( index ) ) {
+    Slot &slot( _slots[index] );
+
+    // pwritev() may write less than asked;  carry on from where it stopped
+    struct iovec iov[3];
+    std::copy( slot.iov, slot.iov + slot.iovcnt, iov );
+    int iovcnt = slot.iovcnt, first = 0;
+    size_t done = 0;
+
+    while( done < slot.length ) {
+      const ssize_t n = pwritev( _fd, iov + first, iovcnt - first, slot.offset + done );
+      if( n < 0 && errno == EINTR ) continue;
+      if( n <= 0 ) break;
+
+      done += n;
+      for( size_t left = n; left > 0; ) {
+        const size_t step = std::min( left, iov[first].iov_len );
+        iov[first].iov_base = static_cast<uint8_t *>( iov[first].iov_base ) + step;
+        iov[first].iov_len -= step;
+        left -= step;
+        if( iov[first].iov_len == 0 ) ++first;
+      }
+    }
+
+    completed( index, (done == slot.length) ? (long)done : -errno );
+  }
+}
+
+bool FrameRecorder::writeFileHeader( uint64_t indexOffset )
+{
+  // The file header fills the first block, so records start aligned
+  uint8_t *block = alignedAlloc( kBlockSize );
+  if( !block ) return false;
+
+  RecordingFileHeader *header = new (block) RecordingFileHeader();
+  header->created = _created;
+  header->indexOffset = indexOffset;
+
+  const ssize_t written = pwrite( _fd, block, kBlockSize, 0 );
+  free( block );
+
+  if( written >= 0 && written != (ssize_t)kBlockSize ) errno = EIO;
+  return written == (ssize_t)kBlockSize;
+}
+
+bool FrameRecorder::writeIndex()
+{
+  // Everything queued has been written, so _offset is the end of the last record
+  const size_t entries = _indexSize * sizeof(RecordingIndexEntry);
+  const size_t padded = roundUp( sizeof(RecordingIndexHeader) + entries );
+
+  uint8_t *block = alignedAlloc( padded );
+  if( !block ) return false;
+
+  RecordingIndexHeader *header = new (block) RecordingIndexHeader();
+  header->numEntries = _indexSize;
+
+  uint8_t *dst = block + sizeof(RecordingIndexHeader);
+  for( size_t i = 0; i < _indexSize; i += kIndexChunk ) {
+    const size_t n = std::min( kIndexChunk, _indexSize - i ) * sizeof(RecordingIndexEntry);
+    memcpy( dst, _index[ i / kIndexChunk ].get(), n );
+    dst += n;
+  }
+  memset( block + sizeof(RecordingIndexHeader) + entries, 0, padded - sizeof(RecordingIndexHeader) - entries );
+
+  size_t done = 0;
+  while( done < padded ) {
+    const ssize_t n = pwrite( _fd, block + done, padded - done, _offset + done );
+    if( n < 0 && errno == EINTR ) continue;
+    if( n <= 0 ) break;
+    done += n;
+  }
+  free( block );
+
+  if( done != padded ) {
+    if( errno == 0 ) errno = EIO;
+    return false;
+  }
+
+  // Only once the index is on disk does the header point at it
+  return writeFileHeader( _offset );
+}
+
+FrameRecorder::Stats FrameRecorder::stats() const
+{
+  Stats s;
+  s.records = _records.load();
+  s.bytes = _bytes.load();
+  s.dropped = _dropped.load();
+  s.errors = _errors.load();
+  s.inFlight = _inFlight.load();
+  s.highWater = _highWater.load();
+  return s;
+}
+
+}
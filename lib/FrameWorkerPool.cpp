@@ -0,0 +1,152 @@
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/FrameWorkerPool.h"
+
+namespace libblackmagic {
+
+FrameWorkerPool::FrameWorkerPool( unsigned int numWorkers, unsigned int queueDepth )
+    : _numWorkers(0), _slots(),
+      _submitIdx(0), _dispatchIdx(0), _deliverIdx(0),
+      _inUse(0), _pending(0),
+      _running(false), _stopping(false),
+      _process( []( Job &job ){;} ),
+      _deliver( []( Job &job ){ for( auto frame : job.frames ) frame->Release(); } )
+{
+  resize( numWorkers, queueDepth );
+}
+
+FrameWorkerPool::~FrameWorkerPool()
+{
+  stop();
+}
+
+void FrameWorkerPool::resize( unsigned int numWorkers, unsigned int queueDepth )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if( _running ) {
+    LOG(WARNING) << "Can't resize FrameWorkerPool while it is running";
+    return;
+  }
+
+  _numWorkers = std::max( 1u, numWorkers );
+  queueDepth = std::max( _numWorkers, queueDepth );
+
+  // Reserve space for a stereo pair in every slot so submit() never allocates
+  _slots = std::vector<Job>( queueDepth );
+  for( auto &job : _slots ) {
+    job.frames.reserve(2);
+    job.images.reserve(2);
+  }
+
+  _submitIdx = _dispatchIdx = _deliverIdx = 0;
+  _inUse = _pending = 0;
+}
+
+void FrameWorkerPool::start()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if( _running ) return;
+
+  LOG(DEBUG) << "Starting " << _numWorkers << " frame workers";
+
+  _stopping = false;
+  _running = true;
+  for( unsigned int i = 0; i < _numWorkers; ++i ) {
+    _workers.push_back( std::thread( &FrameWorkerPool::workerLoop, this, i ) );
+  }
+}
+
+void FrameWorkerPool::drain()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while( _inUse > 0 ) _jobDelivered.wait(lock);
+}
+
+void FrameWorkerPool::stop()
+{
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if( !_running ) return;
+
+    // Stop accepting new work, then let the workers finish what is queued
+    _running = false;
+    while( _inUse > 0 ) _jobDelivered.wait(lock);
+
+    _stopping = true;
+  }
+  _workAvailable.notify_all();
+
+  for( auto &worker : _workers ) worker.join();
+  _workers.clear();
+
+  LOG(DEBUG) << "Frame workers stopped";
+}
+
+bool FrameWorkerPool::submit( IDeckLinkVideoFrame *left, IDeckLinkVideoFrame *right,
+                              const FrameMetadata &metadata )
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if( !_running || _inUse == _slots.size() ) return false;
+
+    Job &job = _slots[_submitIdx];
+    job.frames.clear();
+    job.frames.push_back(left);
+    if( right ) job.frames.push_back(right);
+    job.metadata = metadata;
+    job.failed = false;
+
+    _submitIdx = (_submitIdx + 1) % _slots.size();
+    ++_inUse;
+    ++_pending;
+  }
+  _workAvailable.notify_one();
+
+  return true;
+}
+
+void FrameWorkerPool::workerLoop( unsigned int index )
+{
+  if( _threadInit ) _threadInit( index );
+
+  while( true ) {
+    unsigned int idx;
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while( _pending == 0 && !_stopping ) _workAvailable.wait(lock);
+      if( _pending == 0 ) return;
+
+      idx = _dispatchIdx;
+      _dispatchIdx = (_dispatchIdx + 1) % _slots.size();
+      --_pending;
+    }
+
+    Job &job = _slots[idx];
+    job.images.resize( job.frames.size() );
+    _process( job );
+
+    // Slots are handed out in order, so waiting for our slot to reach the
+    // head of the ring preserves frame order
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while( _deliverIdx != idx ) _jobDelivered.wait(lock);
+    }
+
+    _deliver( job );
+
+    // Drop our references so the consumer owns the only copy of the images
+    for( auto &image : job.images ) image.release();
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _deliverIdx = (_deliverIdx + 1) % _slots.size();
+      --_inUse;
+    }
+    _jobDelivered.notify_all();
+  }
+}
+
+}
@@ -1,4 +1,6 @@
 
+#include <atomic>
+#include <cmath>
 #include <iostream>
 #include <thread>
 
@@ -10,22 +12,50 @@
 
 namespace libblackmagic {
 
-using std::deque;
-using std::shared_ptr;
-using std::thread;
 using std::vector;
 
 InputHandler::InputHandler( DeckLink &deckLink )
-    : _frameCount(0), _noInputCount(0), _pixelFormat(bmdFormat10BitYUV),
+    : _stats(),
+      _sequence(0), _noInputAtLastFrame(0), _deliverNoInputFrames(false),
+      _pixelFormat(bmdFormat10BitYUV), _decodeFormat(V210_BGRA), _decodeScale(1.0),
       _currentConfig(), _enabled(false),
       _deckLink(deckLink),
       _deckLinkInput(nullptr),
       _dlConfiguration(nullptr),
-      _newImagesCallback( []( const MatVector &images ){;} ),
-      _inputFormatChangedCallback( []( BMDDisplayMode newMode ){;} )
+      _arrivals(),
+      _dispatchThread(),
+      _recorder( nullptr ),
+      _preTrigger( nullptr ),
+      _threading(),
+      _threadCpus(),
+      _callbackThread(),
+      _queue(),
+      _pending(),
+      _deliveryThread(),
+      _queueOpen( false ),
+      _grabMode( GrabOff ),
+      _queueDepth( 4 ),
+      _queuePolicy( Queue::Block ),
+      _newImagesCallback(),
+      _newFramesCallback(),
+      _inputFormatChangedCallback( []( BMDDisplayMode newMode ){;} ),
+      _conversion( deckLink ),
+      _imagePool( new MatBufferPool() ),
+      _useFrameAllocator( false ),
+      _frameAllocatorOptions(),
+      _frameAllocator( nullptr ),
+      _workers()
 {
   _deckLink.AddRef();
 
+  _workers.setProcessFunc( std::bind( &InputHandler::process, this, std::placeholders::_1 ) );
+  _workers.setDeliverFunc( std::bind( &InputHandler::deliver, this, std::placeholders::_1 ) );
+  _workers.setThreadInitFunc( [this]( unsigned int index ) {
+    ThreadPolicy policy( _threading.workers );
+    if( !policy.name.empty() ) policy.name += "-" + std::to_string( index );
+    applyThreadPolicy( policy, _threadCpus );
+  });
+
   auto result = _deckLink.deckLink()->QueryInterface(IID_IDeckLinkInput,
                                   (void **)&_deckLinkInput);
 
@@ -40,6 +70,11 @@ InputHandler::InputHandler( DeckLink &deckLink )
 }
 
 InputHandler::~InputHandler() {
+  // Finish any frames still in flight before tearing down
+  stopDispatch();
+  stopWorkers();
+  stopDelivery();
+
   if (_deckLinkInput) {
     _deckLinkInput->Release();
   }
@@ -48,6 +83,13 @@ InputHandler::~InputHandler() {
     _dlConfiguration->Release();
   }
 
+  if (_frameAllocator) {
+    _frameAllocator->Release();
+  }
+
+  // Lives on until consumers let go of their images
+  _imagePool->Release();
+
   _deckLink.Release();
 }
 
@@ -153,6 +195,53 @@ bool InputHandler::enable(BMDDisplayMode mode, bool doAuto, bool do3D) {
                                                                        : "")
               << " and pixel format " << pixelFormatToString(_pixelFormat);
 
+    // Set up conversion resources for this mode once, rather than per frame
+    if (needsSDKConversion(_pixelFormat)) {
+      if (!_conversion.configure(displayMode->GetWidth(),
+                                 displayMode->GetHeight())) {
+        LOG(WARNING) << "Unable to allocate frame conversion resources";
+      }
+    } else {
+      _conversion.reset();
+    }
+
+    // A quarter second of frames between the driver's thread and ours.
+    // Only resized while nothing is arriving.
+    if (!_dispatchThread.joinable()) {
+      BMDTimeValue frameDuration = 0;
+      BMDTimeScale timeScale = 0;
+      double fps = 60;
+      if (displayMode->GetFrameRate(&frameDuration, &timeScale) == S_OK &&
+          frameDuration > 0)
+        fps = double(timeScale) / frameDuration;
+
+      _arrivals.resize(std::max(4, int(std::ceil(fps / 4))));
+    }
+
+    // Enough images for every worker slot and delivery queue entry, plus
+    // the ones being delivered and held by the consumer
+    const unsigned int images = (_workers.queueDepth() + _queueDepth + 3) *
+                                (do3D ? 2 : 1);
+    _imagePool->configure(imageBytes(displayMode->GetWidth(),
+                                     displayMode->GetHeight()),
+                          images);
+
+    if (_useFrameAllocator) {
+      const size_t bufferSize =
+          size_t(rowBytesForPixelFormat(_pixelFormat, displayMode->GetWidth())) *
+          displayMode->GetHeight();
+
+      if (!_frameAllocator) {
+        _frameAllocator = new PooledFrameAllocator(bufferSize, _frameAllocatorOptions);
+      } else {
+        _frameAllocator->setBufferSize(bufferSize);
+      }
+
+      if (_deckLinkInput->SetVideoInputFrameMemoryAllocator(_frameAllocator) != S_OK) {
+        LOG(WARNING) << "Unable to set input frame allocator, using driver buffers";
+      }
+    }
+
     displayMode->Release();
   }
 
@@ -174,6 +263,9 @@ bool InputHandler::enable(BMDDisplayMode mode, bool doAuto, bool do3D) {
   _currentConfig.setMode(mode);
   _currentConfig.set3D(inputFlags & bmdVideoInputDualStream3D);
 
+  if (_preTrigger && !_preTrigger->configure(_currentConfig, _pixelFormat))
+    LOG(WARNING) << "Unable to size the pre-trigger buffer, frames before triggers won't be kept";
+
   _enabled = true;
   return true;
 }
@@ -185,6 +277,26 @@ bool InputHandler::startStreams() {
 
   LOG(DEBUG) << "Starting DeckLinkInput streams ....";
 
+  // Threads already running keep their placement
+  if (!_dispatchThread.joinable())
+    _threadCpus = numaNodeCpus(_threading, _deckLink);
+
+  if (!_queueOpen) {
+    if (_grabMode == GrabLatest)
+      _queue.configure(1, Queue::DropOldest);
+    else
+      _queue.configure(_queueDepth, _queuePolicy);
+
+    _queue.open();
+    _queueOpen = true;
+
+    if (_grabMode == GrabOff)
+      _deliveryThread = std::thread(&InputHandler::deliveryThread, this);
+  }
+
+  _workers.start();
+  startDispatch();
+
   HRESULT result = _deckLinkInput->StartStreams();
   if (result != S_OK) {
     LOG(WARNING) << "Failed to start input streams " << result;
@@ -201,14 +313,66 @@ bool InputHandler::stopStreams() {
     return false;
   }
 
+  // No more frames will arrive;  deliver whatever is queued and join
+  stopDispatch();
+  stopWorkers();
+  stopDelivery();
+
+  const CaptureStats::Snapshot stats = _stats.snapshot();
+  LOG(INFO) << stats.frames << " frames received, " << stats.delivered
+            << " delivered, " << stats.noInput << " without input;  latency p50 "
+            << stats.deliveryLatency.percentile(0.5) / 1000 << "us, p99 "
+            << stats.deliveryLatency.percentile(0.99) / 1000 << "us;  driver callback p99 "
+            << stats.driverCallbackTime.percentile(0.99) / 1000 << "us, max "
+            << stats.driverCallbackTime.max / 1000 << "us";
+
+  LOG_IF(INFO, stats.dropped > 0) << stats.dropped
+      << " frames dropped because processing couldn't keep up";
+
+  const Queue::Stats qs = _queue.stats();
+  LOG_IF(INFO, qs.dropped > 0) << qs.dropped
+      << " frames dropped from the delivery queue (high water " << qs.highWater
+      << " of " << qs.depth << ")";
+
   return true;
 }
 
+void InputHandler::setProcessingThreads( unsigned int numThreads, unsigned int queueDepth )
+{
+  _workers.resize( numThreads, queueDepth );
+}
+
+void InputHandler::setDeliveryQueue( unsigned int depth, QueuePolicy policy )
+{
+  _queueDepth = depth;
+  _queuePolicy = policy;
+}
+
+void InputHandler::useFrameAllocator( const PooledFrameAllocator::Options &opts )
+{
+  _useFrameAllocator = true;
+  _frameAllocatorOptions = opts;
+}
+
 void InputHandler::setNewImagesCallback( NewImagesCallback callback )
+{
+  if( callback ) {
+    _newImagesCallback = [callback]( const MatVector &images, const FrameMetadata & ) { callback( images ); };
+  } else {
+    _newImagesCallback = NewImagesMetadataCallback();
+  }
+}
+
+void InputHandler::setNewImagesWithMetadataCallback( NewImagesMetadataCallback callback )
 {
   _newImagesCallback = callback;
 }
 
+void InputHandler::setNewFramesCallback( NewFramesCallback callback )
+{
+  _newFramesCallback = callback;
+}
+
 void InputHandler::setInputFormatChangedCallback( InputFormatChangedCallback callback )
 {
   _inputFormatChangedCallback = callback;
@@ -216,93 +380,130 @@ void InputHandler::setInputFormatChangedCallback( InputFormatChangedCallback cal
 
 //====== Input callbacks =====
 
-// Callbacks are called in a private thread....
+// Called on the driver's thread, which also captures the next frame, so
+// this does as little as possible:  the frame is queued for the dispatch
+// thread, which does the rest.  Apart from setting up a new driver
+// thread, nothing here locks, logs or allocates.
 HRESULT
 InputHandler::VideoInputFrameArrived(IDeckLinkVideoInputFrame *videoFrame,
                                      IDeckLinkAudioInputPacket *audioFrame) {
-  // Drop audio first thing
+  // Timestamp before doing anything else
+  const auto hostTime = std::chrono::steady_clock::now();
+  const uint64_t sequence = _sequence++;
+
+  checkCallbackThread();
+  _stats.countFrame();
+
   if (audioFrame)
     audioFrame->Release();
 
-  uint32_t availFrames;
-  if (_deckLinkInput->GetAvailableVideoFrameCount(&availFrames) == S_OK) {
-    LOG(DEBUG) << "videoInputFrameArrives; " << availFrames
-               << " still available";
-  } else {
-    LOG(DEBUG) << "videoInputFrameArrives";
-  }
-
-  // Handle Video Frame
   if (!videoFrame)
     return E_FAIL;
 
-  if (videoFrame->GetFlags() & bmdFrameHasNoInputSource) {
-    LOG(WARNING) << "(thread " << std::this_thread::get_id()
-                 << ") Frame received (" << _frameCount
-                 << ") - No input signal detected";
+  // The AddRef will ensure the frame is valid after the end of the callback.
+  videoFrame->AddRef();
 
-    ++_noInputCount;
-    return S_OK;
+  if (!_arrivals.push(Arrival{videoFrame, hostTime, sequence})) {
+    _stats.countDropped();
+    videoFrame->Release();
   }
 
-  // const char *timecodeString = nullptr;
-  // if (g_config.m_timecodeFormat != 0)
-  // {
-  //   IDeckLinkTimecode *timecode;
-  //   if (videoFrame->GetTimecode(g_config.m_timecodeFormat, &timecode) ==
-  //   S_OK)
-  //   {
-  //     timecode->GetString(&timecodeString);
-  //   }
-  // }
-
-  LOG(DEBUG) << "(thread " << std::hex << std::this_thread::get_id() << std::dec
-             << ") Frame received (" << _frameCount << ") "
-             << videoFrame->GetRowBytes() * videoFrame->GetHeight()
-             << " bytes, " << videoFrame->GetWidth() << " x "
-             << videoFrame->GetHeight();
+  _stats.driverCallbackTime().record(std::chrono::steady_clock::now() - hostTime);
+  return S_OK;
+}
 
-  // The AddRef will ensure the frame is valid after the end of the callback.
-  FrameVector frameVector;
+void InputHandler::checkCallbackThread() {
+  if (std::this_thread::get_id() == _callbackThread)
+    return;
 
-  videoFrame->AddRef();
-  frameVector.push_back(videoFrame);
+  _callbackThread = std::this_thread::get_id();
+  applyThreadPolicy(_threading.driverCallback, _threadCpus);
+}
+
+void InputHandler::startDispatch() {
+  if (_dispatchThread.joinable())
+    return;
+
+  _arrivals.open();
+  _dispatchThread = std::thread(&InputHandler::dispatchThread, this);
+}
+
+void InputHandler::stopDispatch() {
+  if (!_dispatchThread.joinable())
+    return;
+
+  // The thread dispatches whatever is left, then exits
+  _arrivals.close();
+  _dispatchThread.join();
+}
+
+void InputHandler::dispatchThread() {
+  applyThreadPolicy(_threading.dispatch, _threadCpus);
+
+  Arrival arrival;
+  while (_arrivals.pop(arrival))
+    dispatch(arrival);
+}
+
+void InputHandler::dispatch(const Arrival &arrival) {
+  IDeckLinkVideoInputFrame *videoFrame = arrival.frame;
+
+  FrameMetadata metadata;
+  metadata.hostTime = arrival.hostTime;
+  metadata.sequence = arrival.sequence;
+
+  uint32_t availFrames;
+  if (_deckLinkInput->GetAvailableVideoFrameCount(&availFrames) == S_OK)
+    _stats.recordBacklog(availFrames);
+
+  readFrameMetadata(videoFrame, metadata);
+
+  if (metadata.noInput) {
+    // Warn once per outage rather than at frame rate
+    LOG_IF(WARNING, _stats.noInput() == _noInputAtLastFrame)
+        << "Frame received (" << metadata.sequence
+        << ") - No input signal detected";
+
+    _stats.countNoInput();
+    if (!_deliverNoInputFrames) {
+      videoFrame->Release();
+      return;
+    }
+  } else {
+    _noInputAtLastFrame = _stats.noInput();
+  }
 
   // If 3D mode is enabled we retreive the 3D extensions interface which gives.
   // us access to the right eye frame by calling GetFrameForRightEye() .
+  IDeckLinkVideoFrame *rightEyeFrame = nullptr;
   IDeckLinkVideoFrame3DExtensions *threeDExtensions = nullptr;
   if (videoFrame->QueryInterface(IID_IDeckLinkVideoFrame3DExtensions,
                                  (void **)&threeDExtensions) == S_OK) {
 
-    IDeckLinkVideoFrame *rightEyeFrame = nullptr;
-
     if (threeDExtensions->GetFrameForRightEye(&rightEyeFrame) != S_OK) {
       LOG(INFO) << "Error getting right eye frame";
     }
+  }
 
-    LOG(DEBUG) << "(" << std::hex << std::this_thread::get_id() << std::dec
-               << ") Right frame received (" << _frameCount << ") "
-               << rightEyeFrame->GetRowBytes() * rightEyeFrame->GetHeight()
-               << " bytes, " << rightEyeFrame->GetWidth() << " x "
-               << rightEyeFrame->GetHeight();
+  metadata.is3D = (rightEyeFrame != nullptr);
 
-    // rightEyeFrame->AddRef();
-    frameVector.push_back(rightEyeFrame);
-  }
+  if (_recorder)
+    _recorder->record(videoFrame, rightEyeFrame, metadata, _currentConfig.mode());
 
-  // \TODO Need to track these threads and wait for them all to finish before
-  // destruction
-  //
-  // Move processing to a different thread
-  std::thread t = std::thread([=] { process(frameVector); });
-  t.detach();
+  if (_preTrigger)
+    _preTrigger->push(videoFrame, rightEyeFrame, metadata);
 
-  if (threeDExtensions)
-    threeDExtensions->Release();
+  // Move processing to the worker threads
+  if (!_workers.submit(videoFrame, rightEyeFrame, metadata)) {
+    _stats.countDropped();
 
-  _frameCount++;
+    videoFrame->Release();
+    if (rightEyeFrame)
+      rightEyeFrame->Release();
+  }
 
-  return S_OK;
+  if (threeDExtensions)
+    threeDExtensions->Release();
 }
 
 // Callback if bmdVideoInputEnableFormatDetection was set when
@@ -328,18 +529,33 @@ HRESULT InputHandler::VideoInputFormatChanged(
 
   _deckLinkInput->PauseStreams();
 
+  // Let in-flight frames finish with the old conversion resources.  The
+  // arrival ring is resized for the new frame rate while it is stopped.
+  // As in stopWorkers(), frames which don't fit in a queue nobody is
+  // grabbing from are dropped, rather than hold up this SDK thread.
+  const bool dispatching = _dispatchThread.joinable();
+  const bool grabbing = _queueOpen && !_deliveryThread.joinable();
+  stopDispatch();
+  if (grabbing)
+    _queue.stopWaiting();
+  _workers.drain();
+
   LOG(INFO) << "Enabling input at new resolution";
   enable(mode->GetDisplayMode(), true, _currentConfig.do3D());
 
-  // formatFlags & bmdDetectedVideoInputDualStream3D );
+  if (grabbing)
+    _queue.open();
 
-  //_queue.flush();
+  // formatFlags & bmdDetectedVideoInputDualStream3D );
 
   _currentConfig.setMode(mode->GetDisplayMode());
   //_currentConfig.set3D( formatFlags & bmdDetectedVideoInputDualStream3D );
 
   LOG(INFO) << "Enabling output at new mode";
 
+  if (dispatching)
+    startDispatch();
+
   _deckLinkInput->FlushStreams();
   _deckLinkInput->StartStreams();
 
@@ -355,92 +571,310 @@ HRESULT InputHandler::VideoInputFormatChanged(
 }
 
 //
-// Takes a vector of one or two Frames.  Converts to Mats and enqueues them.
+// Takes a job with one or two Frames and converts them to Mats.
+// Called on one of the worker threads;  the pool then calls deliver()
+// in frame order.
 //
-void InputHandler::process(FrameVector frameVector) {
-  MatVector out(frameVector.size());
+void InputHandler::process(FrameWorkerPool::Job &job) {
+  // Zero-copy consumers don't need the conversion
+  if (!_newImagesCallback && _grabMode == GrabOff)
+    return;
+
+  const int eyes = job.frames.size();
+
+  for (auto &image : job.images)
+    image.allocator = _imagePool;
+
+  // Large v210 frames are split into row bands so that a single frame is
+  // spread over every core.  The bands of both eyes go into one
+  // parallel_for_, as OpenCV runs nested loops serially.
+  const int bands = v210Bands(job);
+  if (bands > 1) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::atomic<bool> failed(false);
+    cv::parallel_for_(cv::Range(0, eyes * bands),
+                      [&](const cv::Range &range) {
+                        for (int i = range.start; i < range.end; ++i) {
+                          if (!decodeBand(job.frames[i / bands], job.images[i / bands],
+                                          i % bands, bands))
+                            failed = true;
+                        }
+                      }, eyes * bands);
+    job.failed = failed;
+
+    // The eyes are decoded together, so each took the whole time
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    for (int i = 0; i < eyes; ++i)
+      _stats.conversionTime(i).record(elapsed);
+    return;
+  }
 
-  deque<shared_ptr<thread>> workers;
+  std::atomic<bool> failed(false);
+  auto convert = [&](int i) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!frameToMat(job.frames[i], job.images[i], i))
+      failed = true;
+    _stats.conversionTime(i).record(std::chrono::steady_clock::now() - start);
+  };
+
+  // Mono frames are converted right here, which spares the thread pool's
+  // per-call bookkeeping
+  if (eyes == 1) {
+    convert(0);
+  } else {
+    // Convert the eyes in parallel on OpenCV's (persistent) thread pool
+    cv::parallel_for_(cv::Range(0, eyes), [&](const cv::Range &range) {
+      for (int i = range.start; i < range.end; ++i)
+        convert(i);
+    });
+  }
 
-  for (unsigned int i = 1; i < frameVector.size(); ++i) {
-    workers.push_back(shared_ptr<thread>(new std::thread(
-        &InputHandler::frameToMat, this, frameVector[i], std::ref(out[i]), i)));
+  job.failed = failed;
+}
+
+//
+// Hands a processed job to the delivery queue.  The pool calls this in
+// frame order, one job at a time, so _pending needs no lock.
+//
+void InputHandler::deliver(FrameWorkerPool::Job &job) {
+  // The images would hold whatever their pooled buffers last held
+  if (job.failed) {
+    LOG(WARNING) << "Couldn't read the bytes of frame " << job.metadata.sequence
+                 << ", dropping it";
+    _stats.countFailed();
+
+    for (auto frame : job.frames)
+      frame->Release();
+    job.frames.clear();
+    return;
+  }
+
+  if (_newImagesCallback || _grabMode != GrabOff) {
+    // Copies the Mat headers;  the pool releases its own
+    _pending.images.resize(job.images.size());
+    for (size_t i = 0; i < job.images.size(); ++i)
+      _pending.images[i] = job.images[i];
   }
 
-  // Transform the first image in this thread
-  frameToMat(frameVector[0], out[0], 0);
+  _pending.metadata = job.metadata;
 
-  // Wait for any other threads to finish
-  for (auto worker : workers) worker->join();
+  if (_newFramesCallback && _grabMode == GrabOff) {
+    // The handle takes over our references to the frames
+    _pending.frames = FrameHandle(job.frames[0],
+                       (job.frames.size() > 1) ? job.frames[1] : nullptr,
+                       job.metadata);
+  } else {
+    for (auto frame : job.frames)
+      frame->Release();
+  }
+
+  job.frames.clear();
 
-   _newImagesCallback( out );
+  if (!_queue.push(_pending))
+    LOG(DEBUG) << "Delivery queue full, dropping frame";
+
+  // _pending now holds an empty slot, or whatever was dropped
+  for (auto &image : _pending.images)
+    image.release();
+  _pending.frames.reset();
 }
 
-void InputHandler::frameToMat(IDeckLinkVideoFrame *videoFrame, cv::Mat &out,
-                              int i) {
-  CHECK(videoFrame != nullptr) << "Input VideoFrame in frameToMat is nullptr";
-  // CHECK( out ) << "Output Mat undefined in frameToMat";
+void InputHandler::deliveryThread() {
+  applyThreadPolicy(_threading.delivery, _threadCpus);
 
-  std::string frameName(
-      _currentConfig.do3D() ? ((i == 1) ? "[RIGHT]" : "[LEFT]") : "");
+  QueuedFrame item;
 
-  // LOG(DEBUG) << frameName << " Processing frame with format " <<
-  // pixelFormatToString( videoFrame->GetPixelFormat() );
+  while (_queue.pop(item)) {
+    const auto start = std::chrono::steady_clock::now();
+    _stats.deliveryLatency().record(start - item.metadata.hostTime);
+
+    if (_newImagesCallback && !item.images.empty())
+      _newImagesCallback(item.images, item.metadata);
+
+    if (_newFramesCallback && item.frames.valid())
+      _newFramesCallback(std::move(item.frames));
+
+    _stats.callbackTime().record(std::chrono::steady_clock::now() - start);
+    _stats.countDelivered();
+
+    // Keep the vector's storage for the next frame
+    for (auto &image : item.images)
+      image.release();
+    item.frames.reset();
+  }
+}
+
+void InputHandler::stopWorkers() {
+  // Grabbers may have stopped grabbing, so with Queue::Block a full queue
+  // would hold a worker in deliver() for good.  Whatever doesn't fit is
+  // dropped instead;  the delivery thread, if there is one, keeps taking.
+  if (_queueOpen && !_deliveryThread.joinable())
+    _queue.stopWaiting();
+
+  _workers.stop();
+}
+
+void InputHandler::stopDelivery() {
+  if (!_queueOpen)
+    return;
+
+  // The thread delivers whatever is left, then exits.  Grabbers can
+  // still take what is left.
+  _queue.close();
+  if (_deliveryThread.joinable())
+    _deliveryThread.join();
+
+  _queueOpen = false;
+}
+
+bool InputHandler::grab(QueuedFrame &frame, std::chrono::milliseconds timeout) {
+  // Hand back the buffers first, so they don't linger in the queue
+  for (auto &image : frame.images)
+    image.release();
+  frame.frames.reset();
 
+  if (!_queue.pop_for(frame, timeout))
+    return false;
+
+  grabbed(frame);
+  return true;
+}
+
+bool InputHandler::tryGrab(QueuedFrame &frame) {
+  for (auto &image : frame.images)
+    image.release();
+  frame.frames.reset();
+
+  if (!_queue.try_pop(frame))
+    return false;
+
+  grabbed(frame);
+  return true;
+}
+
+void InputHandler::grabbed(QueuedFrame &frame) {
+  _stats.deliveryLatency().record(std::chrono::steady_clock::now() -
+                                  frame.metadata.hostTime);
+  _stats.countDelivered();
+}
+
+//
+// Returns the number of row bands to decode this job's frames in, and
+// allocates the output images.  Returns 1 if the job isn't worth banding
+// or isn't all v210.
+//
+int InputHandler::v210Bands(FrameWorkerPool::Job &job) {
+  IDeckLinkVideoFrame *first = job.frames[0];
+
+  // Scaled decodes are one pass over the frame
+  if (_decodeScale != 1.0)
+    return 1;
+
+  for (auto frame : job.frames) {
+    if (frame->GetPixelFormat() != bmdFormat10BitYUV ||
+        frame->GetWidth() != first->GetWidth() ||
+        frame->GetHeight() != first->GetHeight())
+      return 1;
+  }
+
+  const int bands = v210DecodeBands(first->GetWidth(), first->GetHeight());
+  if (bands > 1) {
+    for (auto &image : job.images)
+      image.create(first->GetHeight(), first->GetWidth(),
+                   v210OutputType(_decodeFormat));
+  }
+
+  return bands;
+}
+
+bool InputHandler::decodeBand(IDeckLinkVideoFrame *videoFrame, cv::Mat &out,
+                              int band, int bands) {
   void *data = nullptr;
-  if (videoFrame->GetBytes(&data) == S_OK) {
-
-    auto pixFmt = videoFrame->GetPixelFormat();
-
-    if (pixFmt == bmdFormat8BitYUV) {
-      // YUV is stored as 2 pixels in 4 bytes
-      cv::Mat mat(videoFrame->GetHeight(), videoFrame->GetWidth(), CV_8UC2,
-                  data, videoFrame->GetRowBytes());
-      mat.copyTo(out);
-    } else if ((pixFmt == bmdFormat8BitBGRA) || (pixFmt == bmdFormat8BitARGB)) {
-      cv::Mat mat(videoFrame->GetHeight(), videoFrame->GetWidth(), CV_8UC4,
-                  data, videoFrame->GetRowBytes());
-      mat.copyTo(out);
-    } else {
+  if (videoFrame->GetBytes(&data) != S_OK || !data)
+    return false;
+
+  const int height = videoFrame->GetHeight();
+  CHECK(decodeV210Rows(data, videoFrame->GetRowBytes(), videoFrame->GetWidth(),
+                       (height * band) / bands, (height * (band + 1)) / bands,
+                       out, _decodeFormat))
+      << "Failed to decode band " << band << " of v210 frame";
+  return true;
+}
 
-      IDeckLinkOutput *deckLinkOutput = NULL;
-      CHECK(_deckLink.deckLink()->QueryInterface(IID_IDeckLinkOutput,
-                                                (void **)&deckLinkOutput) == S_OK);
+bool InputHandler::needsSDKConversion(BMDPixelFormat pixFmt) {
+  return !((pixFmt == bmdFormat8BitYUV) || (pixFmt == bmdFormat8BitBGRA) ||
+           (pixFmt == bmdFormat8BitARGB) || (pixFmt == bmdFormat10BitYUV));
+}
 
-      IDeckLinkMutableVideoFrame *dstFrame = NULL;
-      HRESULT result = deckLinkOutput->CreateVideoFrame(
-          videoFrame->GetWidth(), videoFrame->GetHeight(),
-          4 * videoFrame->GetWidth(), bmdFormat8BitBGRA, bmdFrameFlagDefault,
-          &dstFrame);
-      CHECK(result == S_OK) << "Failed to create destination video frame";
+size_t InputHandler::imageBytes(int width, int height) const {
+  cv::Size size(width, height);
+  int type = CV_8UC4;
+
+  if (_decodeScale != 1.0 && _decodeFormat != V210_UYVY &&
+      (_pixelFormat == bmdFormat10BitYUV || _pixelFormat == bmdFormat8BitYUV)) {
+    size = scaledSize(width, height, _decodeScale);
+    type = v210OutputType(_decodeFormat);
+  } else if (_pixelFormat == bmdFormat8BitYUV) {
+    type = CV_8UC2;
+  } else if (_pixelFormat == bmdFormat10BitYUV) {
+    type = v210OutputType(_decodeFormat);
+  }
 
-      IDeckLinkVideoConversion *converter = CreateVideoConversionInstance();
+  return size_t(size.area()) * CV_ELEM_SIZE(type);
+}
 
-      LOG(DEBUG) << "Converting " << std::hex
-                 << pixelFormatToString(videoFrame->GetPixelFormat()) << " to "
-                 << pixelFormatToString(dstFrame->GetPixelFormat());
-      result = converter->ConvertFrame(videoFrame, dstFrame);
+bool InputHandler::frameToMat(IDeckLinkVideoFrame *videoFrame, cv::Mat &out,
+                              int i) {
+  CHECK(videoFrame != nullptr) << "Input VideoFrame in frameToMat is nullptr";
+  // CHECK( out ) << "Output Mat undefined in frameToMat";
 
-      CHECK(result == S_OK)
-          << frameName << " Failed to do conversion " << std::hex << result;
+  std::string frameName(
+      _currentConfig.do3D() ? ((i == 1) ? "[RIGHT]" : "[LEFT]") : "");
 
-      void *buffer = nullptr;
-      CHECK(dstFrame->GetBytes(&buffer) == S_OK)
-          << frameName << " Unable to get bytes from dstFrame";
+  // LOG(DEBUG) << frameName << " Processing frame with format " <<
+  // pixelFormatToString( videoFrame->GetPixelFormat() );
 
-      cv::Mat dst(cv::Size(dstFrame->GetWidth(), dstFrame->GetHeight()),
-                  CV_8UC4, buffer, dstFrame->GetRowBytes());
-      dst.copyTo(out);
+  void *data = nullptr;
+  if (videoFrame->GetBytes(&data) != S_OK || !data)
+    return false;
 
-      dstFrame->Release();
-      deckLinkOutput->Release();
-    }
+  auto pixFmt = videoFrame->GetPixelFormat();
+
+  if (_decodeScale != 1.0 && _decodeFormat != V210_UYVY &&
+      (pixFmt == bmdFormat10BitYUV || pixFmt == bmdFormat8BitYUV)) {
+    // Decode and downscale in one pass, rather than touching every
+    // pixel twice
+    CHECK(decodeScaled(data, videoFrame->GetRowBytes(),
+                       (pixFmt == bmdFormat10BitYUV) ? PACKED_V210 : PACKED_UYVY,
+                       videoFrame->GetWidth(), videoFrame->GetHeight(),
+                       _decodeScale, out, _decodeFormat))
+        << frameName << " Failed to do scaled decode";
+  } else if (pixFmt == bmdFormat8BitYUV) {
+    // YUV is stored as 2 pixels in 4 bytes
+    cv::Mat mat(videoFrame->GetHeight(), videoFrame->GetWidth(), CV_8UC2,
+                data, videoFrame->GetRowBytes());
+    mat.copyTo(out);
+  } else if ((pixFmt == bmdFormat8BitBGRA) || (pixFmt == bmdFormat8BitARGB)) {
+    cv::Mat mat(videoFrame->GetHeight(), videoFrame->GetWidth(), CV_8UC4,
+                data, videoFrame->GetRowBytes());
+    mat.copyTo(out);
+  } else if (pixFmt == bmdFormat10BitYUV) {
+    // Decode straight into the output rather than converting through
+    // an intermediate BGRA frame
+    CHECK(decodeV210(data, videoFrame->GetRowBytes(), videoFrame->GetWidth(),
+                     videoFrame->GetHeight(), out, _decodeFormat,
+                     V210_AUTO, 1))
+        << frameName << " Failed to decode v210 frame";
+  } else {
+    // Everything else goes through the SDK converter to BGRA, using
+    // the destination frames cached for this mode
+    CHECK(_conversion.convert(videoFrame, out))
+        << frameName << " Failed to do conversion from "
+        << pixelFormatToString(pixFmt);
   }
 
-  // Regardless of what happens, release the frames
-  auto refs = videoFrame->Release();
-  LOG(DEBUG) << frameName << " Released frame; " << refs
-             << " references remain";
+  return true;
 }
 
 } // namespace libblackmagic
@@ -23,6 +23,14 @@ namespace libblackmagic {
      _input.setInputFormatChangedCallback( std::bind( &OutputHandler::inputFormatChanged, &_output, std::placeholders::_1 ) );
    }
 
+  InputOutputClient::InputOutputClient(IDeckLink *deckLink)
+      : _deckLink(deckLink),
+        _input( _deckLink ),
+        _output( _deckLink )
+   {
+     _input.setInputFormatChangedCallback( std::bind( &OutputHandler::inputFormatChanged, &_output, std::placeholders::_1 ) );
+   }
+
   InputOutputClient::~InputOutputClient()
   {;}
 
@@ -0,0 +1,94 @@
+
+#include <algorithm>
+#include <cmath>
+
+#include "libblackmagic/LatencyHistogram.h"
+
+namespace libblackmagic {
+
+const unsigned int LatencyHistogram::kSubBucketBits;
+const unsigned int LatencyHistogram::kSubBuckets;
+const unsigned int LatencyHistogram::kMaxBit;
+const unsigned int LatencyHistogram::kNumBuckets;
+
+LatencyHistogram::Snapshot::Snapshot()
+  : count(0), sum(0), max(0)
+{
+  counts.fill(0);
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile( double q ) const
+{
+  if( count == 0 ) return 0;
+
+  q = std::min( 1.0, std::max( 0.0, q ) );
+  const uint64_t rank = std::max<uint64_t>( 1, uint64_t( std::ceil( q * count ) ) );
+
+  uint64_t seen = 0;
+  for( unsigned int i = 0; i < kNumBuckets; ++i ) {
+    seen += counts[i];
+    if( seen >= rank ) return std::min( bucketUpperBound(i), max );
+  }
+
+  return max;
+}
+
+void LatencyHistogram::Snapshot::merge( const Snapshot &other )
+{
+  for( unsigned int i = 0; i < kNumBuckets; ++i ) counts[i] += other.counts[i];
+  count += other.count;
+  sum += other.sum;
+  max = std::max( max, other.max );
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+  Snapshot s;
+
+  // Buckets are read one by one while writers carry on, so derive the
+  // count from the buckets themselves to keep percentiles consistent
+  for( unsigned int i = 0; i < kNumBuckets; ++i ) {
+    s.counts[i] = _counts[i].load( std::memory_order_relaxed );
+    s.count += s.counts[i];
+  }
+
+  s.sum = _sum.load( std::memory_order_relaxed );
+  s.max = _max.load( std::memory_order_relaxed );
+  return s;
+}
+
+void LatencyHistogram::reset()
+{
+  for( auto &c : _counts ) c.store( 0, std::memory_order_relaxed );
+  _sum.store( 0, std::memory_order_relaxed );
+  _max.store( 0, std::memory_order_relaxed );
+}
+
+unsigned int LatencyHistogram::bucketFor( uint64_t ns )
+{
+  // Values below 2*kSubBuckets map to themselves
+  if( ns < 2 * kSubBuckets ) return ns;
+
+  const unsigned int msb = 63u - __builtin_clzll(ns);
+  if( msb > kMaxBit ) return kNumBuckets - 1;
+
+  // Keep the top kSubBucketBits+1 bits;  the leading one selects the octave
+  const unsigned int shift = msb - kSubBucketBits;
+  return shift * kSubBuckets + (ns >> shift);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound( unsigned int bucket )
+{
+  if( bucket < 2 * kSubBuckets ) return bucket;
+
+  const unsigned int shift = bucket / kSubBuckets - 1;
+  const uint64_t sub = bucket % kSubBuckets + kSubBuckets;
+  return ((sub + 1) << shift) - 1;
+}
+
+}
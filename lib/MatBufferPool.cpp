@@ -0,0 +1,190 @@
+#include <new>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/MatBufferPool.h"
+
+namespace libblackmagic {
+
+MatBufferPool::MatBufferPool( size_t bufferSize, unsigned int maxBuffers )
+  : _refCount(1),
+    _bufferSize( bufferSize ),
+    _maxBuffers( maxBuffers ),
+    _free(),
+    _allocations(0), _fallbackAllocations(0),
+    _buffers(0), _inUse(0), _highWater(0)
+{
+  _free.reserve( _maxBuffers );
+}
+
+MatBufferPool::~MatBufferPool()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  LOG_IF(WARNING, _inUse > 0) << "Destroying MatBufferPool with " << _inUse << " images outstanding";
+
+  for( auto buffer : _free ) destroyBuffer( buffer );
+  _free.clear();
+}
+
+void MatBufferPool::configure( size_t bufferSize, unsigned int maxBuffers )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  _bufferSize = bufferSize;
+  _maxBuffers = maxBuffers;
+
+  // Keep whatever free buffers are still the right size
+  std::vector<Buffer *> keep;
+  keep.reserve( _maxBuffers );
+  for( auto buffer : _free ) {
+    if( buffer->size == _bufferSize && keep.size() < _maxBuffers )
+      keep.push_back( buffer );
+    else
+      destroyBuffer( buffer );
+  }
+  _free.swap( keep );
+}
+
+size_t MatBufferPool::bufferSize() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _bufferSize;
+}
+
+MatBufferPool::Stats MatBufferPool::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  Stats s;
+  s.allocations = _allocations;
+  s.fallbackAllocations = _fallbackAllocations;
+  s.buffers = _buffers;
+  s.inUse = _inUse;
+  s.highWater = _highWater;
+  s.maxBuffers = _maxBuffers;
+  s.bufferSize = _bufferSize;
+  return s;
+}
+
+void MatBufferPool::AddRef() const
+{
+  ++_refCount;
+}
+
+void MatBufferPool::Release() const
+{
+  if( --_refCount == 0 ) delete this;
+}
+
+//== cv::MatAllocator ==
+
+cv::UMatData *MatBufferPool::allocate( int dims, const int *sizes, int type, void *data0,
+                                       size_t *step, AccessFlag, cv::UMatUsageFlags ) const
+{
+  // Dense steps, as cv::Mat's own allocator makes them
+  size_t total = CV_ELEM_SIZE(type);
+  for( int i = dims-1; i >= 0; --i ) {
+    if( step ) {
+      if( data0 && step[i] != CV_AUTOSTEP )
+        total = step[i];
+      else
+        step[i] = total;
+    }
+    total *= sizes[i];
+  }
+
+  Buffer *buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    ++_allocations;
+    if( ++_inUse > _highWater ) _highWater = _inUse;
+
+    if( !data0 ) buffer = takeBuffer( total );
+    if( !buffer ) ++_fallbackAllocations;
+  }
+
+  AddRef();
+
+  cv::UMatData *u = nullptr;
+  if( buffer ) {
+    u = new (&buffer->header) cv::UMatData( this );
+    u->data = u->origdata = buffer->data;
+    u->userdata = buffer;
+  } else {
+    u = new cv::UMatData( this );
+    if( data0 ) {
+      u->data = u->origdata = (uchar *)data0;
+      u->flags |= cv::UMatData::USER_ALLOCATED;
+    } else {
+      u->data = u->origdata = (uchar *)cv::fastMalloc( total );
+    }
+  }
+  u->size = total;
+
+  return u;
+}
+
+bool MatBufferPool::allocate( cv::UMatData *u, AccessFlag, cv::UMatUsageFlags ) const
+{
+  return u != nullptr;
+}
+
+void MatBufferPool::deallocate( cv::UMatData *u ) const
+{
+  if( !u ) return;
+
+  Buffer *buffer = static_cast<Buffer *>( u->userdata );
+  if( buffer ) {
+    u->~UMatData();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_inUse;
+
+    // Buffers from before the last configure() are let go
+    if( buffer->size == _bufferSize && _free.size() < _maxBuffers )
+      _free.push_back( buffer );
+    else
+      destroyBuffer( buffer );
+  } else {
+    if( !(u->flags & cv::UMatData::USER_ALLOCATED) ) cv::fastFree( u->origdata );
+    delete u;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_inUse;
+  }
+
+  Release();
+}
+
+//== Buffer management ==
+
+MatBufferPool::Buffer *MatBufferPool::takeBuffer( size_t size ) const
+{
+  if( size > _bufferSize ) return nullptr;
+
+  if( !_free.empty() ) {
+    Buffer *buffer = _free.back();
+    _free.pop_back();
+    return buffer;
+  }
+
+  if( _buffers >= _maxBuffers ) return nullptr;
+
+  Buffer *buffer = new Buffer;
+  buffer->data = (uchar *)cv::fastMalloc( _bufferSize );
+  buffer->size = _bufferSize;
+  ++_buffers;
+
+  LOG(DEBUG) << "Image buffer pool grew to " << _buffers << " buffers of " << _bufferSize << " bytes";
+  return buffer;
+}
+
+void MatBufferPool::destroyBuffer( Buffer *buffer ) const
+{
+  cv::fastFree( buffer->data );
+  delete buffer;
+  --_buffers;
+}
+
+}
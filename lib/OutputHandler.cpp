@@ -1,6 +1,8 @@
 
 #include "libblackmagic/DeckLinkAPI.h"
 
+#include <string.h>
+
 #include <g3log/g3log.hpp>
 
 #include "libblackmagic/DataTypes.h"
@@ -16,17 +18,38 @@ namespace libblackmagic {
 				_running(false),
 				_deckLink( deckLink ),
 				_deckLinkOutput( nullptr ),
+				_mode( bmdModeHD1080p2997 ),
 				_totalFramesScheduled(0),
-				_buffer( new SharedBMSDIBuffer() ),
+				_commands( new CameraCommandQueue() ),
+				_sdiBuffer( new SharedBMSDIBuffer( _commands ) ),
 				_blankFrame( nullptr ),
+				_vancLines( 1, kSDIRemoteControlLine ),
+				_commandFrames(),
+				_freeCommandFrames(),
+				_retryFrame( nullptr ),
+				_tallyCameras( 0 ),
+				_threading(),
+				_threadCpus(),
+				_callbackThread(),
+				_playbackStopped( true ),
 				_scheduledPlaybackStoppedCond(),
 				_scheduledPlaybackStoppedMutex()
 		{
+			for( std::atomic<uint8_t> &t : _tally ) t.store( 0 );
 			_deckLink.AddRef();
 		}
 
 	OutputHandler::~OutputHandler(void)
 	{
+		// Playback calls back into this object, so it must be finished first
+		if( _enabled ) {
+			stopStreamsWait();
+			disable();
+			deckLinkOutput()->SetScheduledFrameCompletionCallback( nullptr );
+		}
+
+		releaseCommandFrames();
+		if( _blankFrame ) _blankFrame->Release();
 		if( _deckLinkOutput ) _deckLinkOutput->Release();
 		 _deckLink.Release();
 	}
@@ -60,6 +83,20 @@ namespace libblackmagic {
 	  startStreams();
 	}
 
+	bool OutputHandler::setTally( unsigned int camera, bool program, bool preview )
+	{
+		if( camera < 1 || camera > kMaxTallyCameras ) {
+			LOG(WARNING) << "No tally for camera " << camera;
+			return false;
+		}
+
+		_tally[camera - 1].store( (program ? 0x01 : 0) | (preview ? 0x02 : 0), std::memory_order_relaxed );
+
+		unsigned int cameras = _tallyCameras.load();
+		while( cameras < camera && !_tallyCameras.compare_exchange_weak( cameras, camera ) ) {;}
+		return true;
+	}
+
 	bool OutputHandler::enable( BMDDisplayMode mode, bool do3D )
 	{
 
@@ -104,6 +141,7 @@ namespace libblackmagic {
 	    return false;
 	  }
 
+		_mode = mode;
 	  if( S_OK != displayMode->GetFrameRate( &_frameDuration, &_timeScale ) ) {
 	    LOG(WARNING) << "Unable to get time rate information for output...";
 	    return false;
@@ -122,6 +160,11 @@ namespace libblackmagic {
 		// _config.setMode( displayMode->GetDisplayMode() );
 	  //displayMode->Release();
 
+		if( !makeCommandFrames() ) {
+			LOG(WARNING) << "Unable to make frames for SDI commands";
+			return false;
+		}
+
 		_totalFramesScheduled = 0;
 		scheduleFrame( blankFrame() );
 
@@ -139,6 +182,8 @@ namespace libblackmagic {
 
 		LOG(INFO) << "Starting DeckLinkOutput streams ...";
 
+		_threadCpus = numaNodeCpus( _threading, _deckLink );
+
 		// // Pre-roll a few blank frames
 		// const int prerollFrames = 3;
 		// for( int i = 0; i < prerollFrames ; ++i ) {
@@ -162,15 +207,24 @@ namespace libblackmagic {
 
 		LOG(INFO) << "Stopping DeckLinkOutput streams";
 
+		{
+			std::lock_guard<std::mutex> lock( _scheduledPlaybackStoppedMutex );
+			_playbackStopped = false;
+		}
+
 		// And stop after one frame
 		BMDTimeValue actualStopTime;
 		HRESULT result = deckLinkOutput()->StopScheduledPlayback(0, &actualStopTime, _timeScale);
 		if(result != S_OK)
 		{
 			LOG(WARNING) << "Could not stop video playback - result = " << std::hex << result;
+
+			// ScheduledPlaybackHasStopped() won't be coming
+			std::lock_guard<std::mutex> lock( _scheduledPlaybackStoppedMutex );
+			_playbackStopped = true;
 		}
 
-		_running = true;
+		_running = false;
 		return true;
 	}
 
@@ -179,8 +233,9 @@ namespace libblackmagic {
 		stopStreams();
 
 		{
+			// The callback may well have come before we get here
 			std::unique_lock<std::mutex> lock( _scheduledPlaybackStoppedMutex );
-			_scheduledPlaybackStoppedCond.wait(lock);
+			_scheduledPlaybackStoppedCond.wait(lock, [this]{ return _playbackStopped; });
 		}
 
 		return true;
@@ -192,6 +247,13 @@ namespace libblackmagic {
 		LOG(DEBUG) << "Disabling DecklinkOutput";
 
 		HRESULT result = deckLinkOutput()->DisableVideoOutput();
+
+		// Any still scheduled have been dropped, and won't be completed.  The
+		// next enable() may be for another mode.
+		releaseCommandFrames();
+		if( _blankFrame ) _blankFrame->Release();
+		_blankFrame = nullptr;
+
 		if(result != S_OK)
 		{
 			LOG(WARNING) << "Could not disable output - result = " << std::hex << result;
@@ -210,8 +272,129 @@ namespace libblackmagic {
 		_totalFramesScheduled += numRepeats;
 	}
 
+	bool OutputHandler::makeCommandFrames()
+	{
+		releaseCommandFrames();
+		_commandFrames.reserve( kNumCommandFrames );
+		_freeCommandFrames.reserve( kNumCommandFrames );
+
+		for( unsigned int i = 0; i < kNumCommandFrames; ++i ) {
+			CommandFrame cmd;
+			cmd.frame = makeBlueFrame( deckLinkOutput(), true, _mode );
+			if( !cmd.frame ) break;
+
+			// The frame holds on to its ancillary data, and so the lines
+			IDeckLinkVideoFrameAncillary *ancillary = nullptr;
+			if( deckLinkOutput()->CreateAncillaryData( bmdFormat10BitYUV, &ancillary ) == S_OK ) {
+				if( cmd.frame->SetAncillaryData( ancillary ) == S_OK ) {
+					for( uint32_t lineNumber : _vancLines ) {
+						uint32_t *line = sdiProtocolLine( ancillary, lineNumber );
+						if( line ) cmd.vancLines.push_back( line );
+					}
+				}
+				ancillary->Release();
+			}
+
+			if( cmd.vancLines.size() != _vancLines.size() || _vancLines.empty() ) {
+				cmd.frame->Release();
+				break;
+			}
+
+			const size_t words = vancLineWords( cmd.frame->GetWidth() );
+			for( const uint32_t *line : cmd.vancLines )
+				cmd.blankVanc.push_back( std::vector<uint32_t>( line, line + words ) );
+			cmd.usedWords.assign( cmd.vancLines.size(), 0 );
+
+			_freeCommandFrames.push_back( _commandFrames.size() );
+			_commandFrames.push_back( std::move( cmd ) );
+		}
+
+		LOG_IF(WARNING, _commandFrames.size() < kNumCommandFrames ) << "Only made " << _commandFrames.size() << " of "
+																																<< kNumCommandFrames << " SDI command frames";
+		return !_commandFrames.empty();
+	}
+
+	void OutputHandler::releaseCommandFrames()
+	{
+		if( _retryFrame ) {
+			LOG(WARNING) << "Dropping " << _commands->abandon() << " SDI commands which couldn't be scheduled";
+			_retryFrame = nullptr;
+		}
+
+		for( CommandFrame &cmd : _commandFrames ) cmd.frame->Release();
+		_commandFrames.clear();
+		_freeCommandFrames.clear();
+	}
+
+	IDeckLinkMutableVideoFrame *OutputHandler::commandFrame()
+	{
+		if( _freeCommandFrames.empty() ) return nullptr;
+
+		CommandFrame &cmd( _commandFrames[ _freeCommandFrames.back() ] );
+
+		// Clear what the last use left
+		for( size_t i = 0; i < cmd.vancLines.size(); ++i )
+			memcpy( cmd.vancLines[i], cmd.blankVanc[i].data(), cmd.usedWords[i] * sizeof(uint32_t) );
+
+		VancWriter writer( cmd.vancLines, cmd.frame->GetWidth(), cmd.usedWords );
+
+		const unsigned int tallyCameras = _tallyCameras.load();
+		if( tallyCameras > 0 ) {
+			uint8_t tally[kMaxTallyCameras];
+			for( unsigned int i = 0; i < tallyCameras; ++i ) tally[i] = _tally[i].load( std::memory_order_relaxed );
+			writer.write( kSDIRemoteControlDID, kSDITallySDID, tally, tallyCameras );
+		}
+
+		// Then as many commands as fit;  the rest go with the following frames
+		const unsigned int packets = writeSDIProtocol( writer, *_commands );
+		if( writer.packets() == 0 ) return nullptr;
+
+		LOG_IF(INFO, packets > 0 ) << "Scheduling frame with " << packets << " packets of BM SDI Commands ("
+															<< writer.bytes() << " bytes)";
+
+		_freeCommandFrames.pop_back();
+		return cmd.frame;
+	}
+
+	bool OutputHandler::recycleCommandFrame( IDeckLinkVideoFrame *frame )
+	{
+		for( unsigned int i = 0; i < _commandFrames.size(); ++i ) {
+			if( _commandFrames[i].frame == frame ) {
+				_freeCommandFrames.push_back( i );
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	HRESULT OutputHandler::scheduleCommandFrame( IDeckLinkMutableVideoFrame *frame, BMDTimeValue streamTime )
+	{
+		HRESULT r = deckLinkOutput()->ScheduleVideoFrame( frame, streamTime, _frameDuration, _timeScale );
+		if( r == S_OK ) {
+			_commands->confirm();
+			return r;
+		}
+
+		// Keep playback going, and send the commands with the next frame
+		LOG(WARNING) << "Couldn't schedule an SDI command frame (" << std::hex << r << std::dec
+								 << "), trying again with the next";
+		_retryFrame = frame;
+		return deckLinkOutput()->ScheduleVideoFrame( blankFrame(), streamTime, _frameDuration, _timeScale );
+	}
+
+	void OutputHandler::checkCallbackThread()
+	{
+		if( std::this_thread::get_id() == _callbackThread ) return;
+
+		_callbackThread = std::this_thread::get_id();
+		applyThreadPolicy( _threading.driverCallback, _threadCpus );
+	}
+
 	HRESULT	STDMETHODCALLTYPE OutputHandler::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
 	{
+		checkCallbackThread();
+
 		BMDTimeValue frameCompletionTime = 0;
 		CHECK( deckLinkOutput()->GetFrameCompletionReferenceTimestamp( completedFrame, _timeScale, &frameCompletionTime ) == S_OK);
 
@@ -223,34 +406,42 @@ namespace libblackmagic {
 		LOG(DEBUG) << "Completed a frame at " << frameCompletionTime << " with result " << result << " ; " << res << " " << streamTime << " " << playbackSpeed;
 		if( completedFrame != _blankFrame ) {
 			LOG(DEBUG) << "Completed frame != _blankFrame";
-			completedFrame->Release();
+			recycleCommandFrame( completedFrame );
 		}
 
 		HRESULT r;
 
-		_buffer->getReadLock();
-		if( _buffer->buffer->len > 0 ) {
-			LOG(INFO) << "Scheduling frame with " << int(_buffer->buffer->len) << " bytes of BM SDI Commands";
-			r = deckLinkOutput()->ScheduleVideoFrame( makeFrameWithSDIProtocol( _deckLinkOutput, _buffer->buffer, true ),
-		 																				streamTime, _frameDuration, _timeScale );
-			//scheduleFrame( addSDIProtocolToFrame( _deckLinkOutput, _blankFrame, _buffer->buffer ) );
-			bmResetBuffer( _buffer->buffer );
+		// Anything written to the deprecated shared buffer joins the queue
+		_sdiBuffer->flush();
+
+		// A frame which didn't go out last time goes first
+		IDeckLinkMutableVideoFrame *frame = _retryFrame;
+		_retryFrame = nullptr;
+
+		const bool pending = _commands->pending();
+		if( !frame && (pending || _tallyCameras.load() > 0) ) frame = commandFrame();
+
+		if( frame ) {
+			r = scheduleCommandFrame( frame, streamTime );
 		} else {
-			// Otherwise schedule a blank frame
+			// Otherwise schedule a blank frame;  any commands wait for a
+			// command frame to come back
+			LOG_IF(WARNING, pending ) << "No SDI command frame free, sending commands with the next frame";
 			r = deckLinkOutput()->ScheduleVideoFrame( blankFrame(),
 		 																						streamTime, _frameDuration, _timeScale );
 		}
-		_buffer->releaseReadLock();
 
 		LOG_IF(WARNING, r != S_OK ) << "Scheduling not OK! " << result;
 
-		// Can I release the completeFrame?
-
 		return S_OK;
 	}
 
 	HRESULT	STDMETHODCALLTYPE OutputHandler::ScheduledPlaybackHasStopped(void) {
 		LOG(INFO) << "Scheduled playback has stopped!";
+		{
+			std::lock_guard<std::mutex> lock( _scheduledPlaybackStoppedMutex );
+			_playbackStopped = true;
+		}
 		_scheduledPlaybackStoppedCond.notify_all();
 
 		return S_OK;
@@ -0,0 +1,327 @@
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/PooledFrameAllocator.h"
+
+namespace libblackmagic {
+
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Linux's largest MAX_NUMNODES
+static const int kMaxNumaNodes = 1024;
+
+static size_t roundUp( size_t value, size_t multiple )
+{ return ((value + multiple - 1) / multiple) * multiple; }
+
+PooledFrameAllocator::PooledFrameAllocator( size_t bufferSize, const Options &opts )
+  : _refCount(1),
+    _opts( opts ),
+    _bufferSize( bufferSize ),
+    _bufferStride( 0 ),
+    _arena( nullptr ),
+    _arenaSize( 0 ),
+    _hugePages( false ),
+    _locked( false ),
+    _decommitPending( false ),
+    _retired(),
+    _free(),
+    _allocations(0), _frees(0), _fallbackAllocations(0),
+    _inUse(0), _highWater(0)
+{
+  _free.reserve( _opts.numBuffers );
+}
+
+PooledFrameAllocator::~PooledFrameAllocator()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  LOG_IF(WARNING, _inUse > 0) << "Destroying PooledFrameAllocator with " << _inUse << " buffers outstanding";
+  unmapArena();
+
+  for( const RetiredArena &r : _retired ) {
+    if( r.locked ) munlock( r.base, r.size );
+    munmap( r.base, r.size );
+  }
+}
+
+void PooledFrameAllocator::setBufferSize( size_t bufferSize )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if( bufferSize == _bufferSize ) return;
+
+  _bufferSize = bufferSize;
+
+  // Buffers which are too small would all fall back, so replace them now
+  if( _arena && (allFree() || !bufferFits( _bufferSize )) ) retireArena();
+}
+
+bool PooledFrameAllocator::bufferFits( size_t bufferSize ) const
+{
+  return roundUp( bufferSize, kPageSize ) <= _bufferStride;
+}
+
+PooledFrameAllocator::Stats PooledFrameAllocator::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  Stats s;
+  s.allocations = _allocations;
+  s.frees = _frees;
+  s.fallbackAllocations = _fallbackAllocations;
+  s.inUse = _inUse;
+  s.highWater = _highWater;
+  s.numBuffers = _opts.numBuffers;
+  s.bufferSize = _bufferSize;
+  s.hugePages = _hugePages;
+  s.locked = _locked;
+
+  s.arenaBytes = _arenaSize;
+  for( const RetiredArena &r : _retired ) s.arenaBytes += r.size;
+  s.retiredArenas = _retired.size();
+  return s;
+}
+
+//== IUnknown ==
+
+HRESULT PooledFrameAllocator::QueryInterface( REFIID iid, LPVOID *ppv )
+{
+  if( memcmp( &iid, &IID_IDeckLinkMemoryAllocator, sizeof(REFIID) ) == 0 ) {
+    AddRef();
+    *ppv = static_cast<IDeckLinkMemoryAllocator *>(this);
+    return S_OK;
+  }
+
+  *ppv = nullptr;
+  return E_NOINTERFACE;
+}
+
+ULONG PooledFrameAllocator::AddRef( void )
+{
+  return ++_refCount;
+}
+
+ULONG PooledFrameAllocator::Release( void )
+{
+  const int32_t newRefValue = --_refCount;
+  if( newRefValue == 0 ) {
+    delete this;
+    return 0;
+  }
+  return newRefValue;
+}
+
+//== IDeckLinkMemoryAllocator ==
+
+HRESULT PooledFrameAllocator::AllocateBuffer( uint32_t bufferSize, void **allocatedBuffer )
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if( !_arena ) mapArena();
+
+    ++_allocations;
+    if( ++_inUse > _highWater ) _highWater = _inUse;
+
+    if( bufferSize <= _bufferStride && !_free.empty() ) {
+      *allocatedBuffer = _free.back();
+      _free.pop_back();
+      return S_OK;
+    }
+
+    ++_fallbackAllocations;
+  }
+
+  LOG(DEBUG) << "Frame buffer pool can't satisfy request for " << bufferSize
+             << " bytes, allocating";
+
+  if( posix_memalign( allocatedBuffer, kPageSize, bufferSize ) != 0 ) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_inUse;
+    *allocatedBuffer = nullptr;
+    return E_OUTOFMEMORY;
+  }
+
+  return S_OK;
+}
+
+HRESULT PooledFrameAllocator::ReleaseBuffer( void *buffer )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  ++_frees;
+  --_inUse;
+
+  if( inArena( buffer ) ) {
+    _free.push_back( buffer );
+
+    // The last one back finishes a Decommit()
+    if( _decommitPending && allFree() ) {
+      unmapArena();
+      _decommitPending = false;
+    }
+    return S_OK;
+  }
+
+  for( auto r = _retired.begin(); r != _retired.end(); ++r ) {
+    if( buffer >= r->base && buffer < (void *)((uint8_t *)r->base + r->size) ) {
+      if( --r->outstanding == 0 ) {
+        if( r->locked ) munlock( r->base, r->size );
+        munmap( r->base, r->size );
+        _retired.erase( r );
+      }
+      return S_OK;
+    }
+  }
+
+  free( buffer );
+  return S_OK;
+}
+
+HRESULT PooledFrameAllocator::Commit( void )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  // An arena still waiting on its buffers after a Decommit() can be used
+  // again, if its buffers are big enough
+  _decommitPending = false;
+  if( _arena && !bufferFits( _bufferSize ) ) retireArena();
+
+  if( !_arena && !mapArena() ) return E_OUTOFMEMORY;
+  return S_OK;
+}
+
+HRESULT PooledFrameAllocator::Decommit( void )
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if( !_arena ) return S_OK;
+
+  // Hang on to the arena until every pooled buffer has come back
+  if( allFree() )
+    unmapArena();
+  else
+    _decommitPending = true;
+
+  return S_OK;
+}
+
+//== Arena management ==
+
+bool PooledFrameAllocator::mapArena()
+{
+  _bufferStride = roundUp( _bufferSize, kPageSize );
+  _arenaSize = _bufferStride * _opts.numBuffers;
+  _hugePages = _locked = false;
+
+  if( _arenaSize == 0 ) return false;
+
+  if( _opts.useHugePages ) {
+    const size_t hugeSize = roundUp( _arenaSize, kHugePageSize );
+    _arena = mmap( nullptr, hugeSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+
+    if( _arena != MAP_FAILED ) {
+      _arenaSize = hugeSize;
+      _hugePages = true;
+    } else {
+      LOG(DEBUG) << "No hugepages available for frame buffers (" << strerror(errno)
+                 << "), using transparent hugepages";
+    }
+  }
+
+  if( !_hugePages ) {
+    _arena = mmap( nullptr, _arenaSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if( _arena == MAP_FAILED ) {
+      LOG(WARNING) << "Unable to map " << _arenaSize << " bytes for frame buffers: " << strerror(errno);
+      _arena = nullptr;
+      _arenaSize = 0;
+      return false;
+    }
+
+    if( _opts.useHugePages ) madvise( _arena, _arenaSize, MADV_HUGEPAGE );
+  }
+
+  // Bind before the pages are first touched so they are allocated on the node
+  if( _opts.numaNode >= kMaxNumaNodes ) {
+    LOG(WARNING) << "Not binding frame buffers to NUMA node " << _opts.numaNode
+                 << ", past the largest node Linux supports";
+  } else if( _opts.numaNode >= 0 ) {
+    const size_t bitsPerLong = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> nodeMask( _opts.numaNode / bitsPerLong + 1, 0 );
+    nodeMask.back() = 1UL << (_opts.numaNode % bitsPerLong);
+
+    // The kernel reads one bit fewer than maxnode
+    if( syscall( SYS_mbind, _arena, _arenaSize, MPOL_BIND, nodeMask.data(),
+                 nodeMask.size() * bitsPerLong + 1, MPOL_MF_MOVE ) != 0 ) {
+      LOG(WARNING) << "Unable to bind frame buffers to NUMA node " << _opts.numaNode
+                   << ": " << strerror(errno);
+    }
+  }
+
+  // Fault everything in now rather than on the first frame
+  if( _opts.lockMemory ) {
+    if( mlock( _arena, _arenaSize ) == 0 ) {
+      _locked = true;
+    } else {
+      LOG(WARNING) << "Unable to mlock " << _arenaSize << " bytes of frame buffers: " << strerror(errno)
+                   << " (check RLIMIT_MEMLOCK)";
+    }
+  }
+  if( !_locked ) memset( _arena, 0, _arenaSize );
+
+  _free.clear();
+  for( unsigned int i = _opts.numBuffers; i > 0; --i )
+    _free.push_back( (uint8_t *)_arena + (i-1) * _bufferStride );
+
+  LOG(INFO) << "Allocated " << _opts.numBuffers << " frame buffers of " << _bufferSize << " bytes"
+            << (_hugePages ? ", hugepages" : "") << (_locked ? ", locked" : "");
+
+  return true;
+}
+
+void PooledFrameAllocator::retireArena()
+{
+  if( !_arena ) return;
+
+  if( !allFree() ) {
+    RetiredArena r;
+    r.base = _arena;
+    r.size = _arenaSize;
+    r.locked = _locked;
+    r.outstanding = _opts.numBuffers - _free.size();
+    _retired.push_back( r );
+
+    LOG(DEBUG) << "Retiring frame buffer arena with " << r.outstanding << " buffers outstanding";
+
+    // Forget it without unmapping
+    _arena = nullptr;
+    _locked = false;
+  }
+
+  unmapArena();
+  _decommitPending = false;
+}
+
+void PooledFrameAllocator::unmapArena()
+{
+  if( _arena ) {
+    if( _locked ) munlock( _arena, _arenaSize );
+    munmap( _arena, _arenaSize );
+  }
+
+  _arena = nullptr;
+  _arenaSize = 0;
+  _bufferStride = 0;
+  _free.clear();
+}
+
+}
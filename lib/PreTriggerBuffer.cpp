@@ -0,0 +1,396 @@
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/DataTypes.h"
+#include "libblackmagic/PreTriggerBuffer.h"
+
+namespace libblackmagic {
+
+// How long a dump to a FrameRecorder waits for the disk before giving up
+static const std::chrono::seconds kRecorderTimeout( 5 );
+
+// How long past its end a dump waits for a frame which arrived before
+// then, but is still on its way through the dispatch thread
+static const std::chrono::milliseconds kArrivalGrace( 500 );
+
+//== RetainedFrame ==
+
+// One eye of a kept frame, over its buffer in the ring.  References pin
+// the slot rather than owning the frame, which is never deleted.
+class PreTriggerBuffer::RetainedFrame : public IDeckLinkVideoFrame {
+public:
+  RetainedFrame()
+    : _pins( nullptr ), _width(0), _height(0), _rowBytes(0),
+      _pixelFormat(0), _flags( bmdFrameFlagDefault ), _bytes( nullptr ) {;}
+
+  void set( std::atomic<int> *pins, uint8_t *bytes )
+    { _pins = pins;  _bytes = bytes; }
+
+  // Copies frame's format and bytes in
+  void copy( IDeckLinkVideoFrame *frame, const void *bytes ) {
+    _width = frame->GetWidth();
+    _height = frame->GetHeight();
+    _rowBytes = frame->GetRowBytes();
+    _pixelFormat = frame->GetPixelFormat();
+    _flags = frame->GetFlags();
+    memcpy( _bytes, bytes, size_t(_rowBytes) * _height );
+  }
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) {
+    if( memcmp( &iid, &IID_IUnknown, sizeof(REFIID) ) == 0 ||
+        memcmp( &iid, &IID_IDeckLinkVideoFrame, sizeof(REFIID) ) == 0 ) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoFrame *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _pins->fetch_add( 1, std::memory_order_relaxed ) + 1; }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _pins->fetch_sub( 1, std::memory_order_release ) - 1; }
+
+  //== IDeckLinkVideoFrame ==
+  virtual long STDMETHODCALLTYPE GetWidth( void )                 { return _width; }
+  virtual long STDMETHODCALLTYPE GetHeight( void )                { return _height; }
+  virtual long STDMETHODCALLTYPE GetRowBytes( void )              { return _rowBytes; }
+  virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat( void ) { return _pixelFormat; }
+  virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags( void )        { return _flags; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetBytes( void **buffer ) {
+    *buffer = _bytes;
+    return S_OK;
+  }
+
+  // Timecode is only kept in the frame's FrameMetadata
+  virtual HRESULT STDMETHODCALLTYPE GetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode **timecode )
+    { *timecode = nullptr;  return S_FALSE; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetAncillaryData( IDeckLinkVideoFrameAncillary **ancillary )
+    { *ancillary = nullptr;  return S_FALSE; }
+
+private:
+  std::atomic<int> *_pins;
+
+  long _width, _height, _rowBytes;
+  BMDPixelFormat _pixelFormat;
+  BMDFrameFlags _flags;
+  uint8_t *_bytes;
+};
+
+//== Slot ==
+
+struct PreTriggerBuffer::Slot {
+  Slot() : pins(0), eyes(0), meta() {;}
+
+  // References to frames, held by dumps and their sinks.  A pinned slot
+  // is never overwritten.
+  std::atomic<int> pins;
+
+  RetainedFrame frames[2];
+  unsigned int eyes;
+  FrameMetadata meta;
+};
+
+//== PreTriggerBuffer ==
+
+PreTriggerBuffer::PreTriggerBuffer( const Options &opts )
+  : _opts( opts ), _config(),
+    _arena( nullptr ), _bufferSize( 0 ),
+    _slots(), _order(), _free(), _dump(),
+    _retained(0), _skipped(0), _dumped(0), _missed(0)
+{;}
+
+PreTriggerBuffer::~PreTriggerBuffer()
+{
+  freeSlots();
+}
+
+bool PreTriggerBuffer::configure( const ModeConfig &config, BMDPixelFormat pixFmt )
+{
+  std::lock_guard<std::mutex> pushLock( _pushMutex );
+
+  std::unique_lock<std::mutex> dumpLock( _dumpMutex, std::try_to_lock );
+  const bool pinned = std::any_of( _slots.begin(), _slots.end(),
+                                   []( const std::unique_ptr<Slot> &slot ) { return slot->pins.load() > 0; } );
+  if( !dumpLock.owns_lock() || pinned ) {
+    LOG(WARNING) << "Can't resize the pre-trigger buffer while its frames are being dumped";
+    return false;
+  }
+
+  freeSlots();
+
+  const ModeParams params( config.params() );
+  _bufferSize = size_t( rowBytesForPixelFormat( pixFmt, params.width ) ) * params.height;
+
+  const unsigned int numFrames = std::max( 1, int( std::ceil( _opts.seconds * params.frameRate ) ) );
+  const unsigned int eyes = config.do3D() ? 2 : 1;
+  if( _bufferSize == 0 || params.frameRate <= 0 ) {
+    LOG(WARNING) << "Can't size a pre-trigger buffer for mode " << displayModeToString( config.mode() );
+    return false;
+  }
+
+  PooledFrameAllocator::Options allocOpts;
+  allocOpts.numBuffers = numFrames * eyes;
+  allocOpts.useHugePages = _opts.useHugePages;
+  allocOpts.lockMemory = _opts.lockMemory;
+  allocOpts.numaNode = _opts.numaNode;
+
+  _arena = new PooledFrameAllocator( _bufferSize, allocOpts );
+  bool ok = ( _arena->Commit() == S_OK );
+
+  std::vector< std::unique_ptr<Slot> > slots;
+  slots.reserve( numFrames );
+  for( unsigned int i = 0; ok && i < numFrames; ++i ) {
+    slots.emplace_back( new Slot() );
+    Slot &slot( *slots.back() );
+
+    for( unsigned int eye = 0; ok && eye < eyes; ++eye ) {
+      void *buffer = nullptr;
+      ok = ( _arena->AllocateBuffer( _bufferSize, &buffer ) == S_OK );
+      slot.frames[eye].set( &slot.pins, static_cast<uint8_t *>( buffer ) );
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _slots.swap( slots );
+
+    _order.reserve( numFrames );
+    _free.reserve( numFrames );
+    for( unsigned int i = numFrames; i > 0; --i ) _free.push_back( i - 1 );
+
+    _config = config;
+  }
+
+  if( !ok ) {
+    LOG(WARNING) << "Unable to allocate " << numFrames << " frames for the pre-trigger buffer";
+    freeSlots();
+    return false;
+  }
+
+  const PooledFrameAllocator::Stats arenaStats( _arena->stats() );
+  LOG(INFO) << "Keeping " << _opts.seconds << " s (" << numFrames << " frames) before triggers, "
+            << (_bufferSize * allocOpts.numBuffers) / (1024*1024) << " MB"
+            << (arenaStats.locked ? ", locked" : "");
+  return true;
+}
+
+void PreTriggerBuffer::freeSlots()
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  LOG_IF(WARNING, std::any_of( _slots.begin(), _slots.end(),
+                               []( const std::unique_ptr<Slot> &slot ) { return slot->pins.load() > 0; } ))
+      << "Freeing the pre-trigger buffer while its frames are still held";
+
+  if( _arena ) {
+    for( auto &slot : _slots ) {
+      for( unsigned int eye = 0; eye < 2; ++eye ) {
+        void *bytes = nullptr;
+        slot->frames[eye].GetBytes( &bytes );
+        if( bytes ) _arena->ReleaseBuffer( bytes );
+      }
+    }
+
+    _arena->Decommit();
+    _arena->Release();
+    _arena = nullptr;
+  }
+
+  _slots.clear();
+  _order.clear();
+  _free.clear();
+}
+
+bool PreTriggerBuffer::push( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye, const FrameMetadata &meta )
+{
+  std::lock_guard<std::mutex> pushLock( _pushMutex );
+  if( _slots.empty() || !frame ) return false;
+
+  IDeckLinkVideoFrame *frames[2] = { frame, rightEye };
+  const void *bytes[2] = { nullptr, nullptr };
+  const unsigned int eyes = rightEye ? 2 : 1;
+
+  // Frames from before a format change the ring hasn't been resized for
+  bool fits = eyes <= (_config.do3D() ? 2u : 1u);
+  for( unsigned int eye = 0; fits && eye < eyes; ++eye ) {
+    void *b = nullptr;
+    fits = size_t( frames[eye]->GetRowBytes() ) * frames[eye]->GetHeight() <= _bufferSize &&
+           frames[eye]->GetBytes( &b ) == S_OK && b;
+    bytes[eye] = b;
+  }
+
+  if( !fits ) {
+    ++_skipped;
+    return false;
+  }
+
+  unsigned int index;
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+
+    if( !_free.empty() ) {
+      index = _free.back();
+      _free.pop_back();
+    } else {
+      // The oldest frame no one is holding
+      auto oldest = std::find_if( _order.begin(), _order.end(), [this]( unsigned int i ) {
+        return _slots[i]->pins.load( std::memory_order_acquire ) == 0;
+      });
+
+      if( oldest == _order.end() ) {
+        ++_skipped;
+        return false;
+      }
+
+      index = *oldest;
+      if( _dump.pending( _slots[index]->meta ) ) ++_missed;
+      _order.erase( oldest );
+    }
+  }
+
+  Slot &slot( *_slots[index] );
+  for( unsigned int eye = 0; eye < eyes; ++eye )
+    slot.frames[eye].copy( frames[eye], bytes[eye] );
+  slot.eyes = eyes;
+  slot.meta = meta;
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _order.push_back( index );
+  }
+  _arrived.notify_all();
+
+  ++_retained;
+  return true;
+}
+
+PreTriggerBuffer::Slot *PreTriggerBuffer::next()
+{
+  for( unsigned int index : _order ) {
+    Slot &slot( *_slots[index] );
+    if( slot.meta.hostTime > _dump.to ) {
+      _dump.passed = true;
+      return nullptr;
+    }
+
+    if( _dump.pending( slot.meta ) ) {
+      slot.pins.fetch_add( 1, std::memory_order_relaxed );
+      _dump.started = true;
+      _dump.sequence = slot.meta.sequence;
+      return &slot;
+    }
+  }
+
+  return nullptr;
+}
+
+size_t PreTriggerBuffer::dump( TimePoint from, TimePoint to, Sink sink )
+{
+  std::lock_guard<std::mutex> dumpLock( _dumpMutex );
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _dump = DumpState();
+    _dump.active = true;
+    _dump.from = from;
+    _dump.to = to;
+  }
+
+  const TimePoint until = ( to < TimePoint::max() - kArrivalGrace ) ? to + kArrivalGrace : TimePoint::max();
+
+  size_t dumped = 0;
+  while( true ) {
+    Slot *slot = nullptr;
+    {
+      std::unique_lock<std::mutex> lock( _mutex );
+
+      // Caught up with capture before to, so wait for what's still to come
+      while( !_dump.cancelled && !(slot = next()) && !_dump.passed &&
+             std::chrono::steady_clock::now() < until )
+        _arrived.wait_until( lock, until );
+    }
+    if( !slot ) break;
+
+    const bool taken = sink( &slot->frames[0], slot->eyes == 2 ? &slot->frames[1] : nullptr, slot->meta );
+    slot->frames[0].Release();
+
+    if( !taken ) break;
+    ++dumped;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _dump.active = false;
+  }
+
+  _dumped += dumped;
+  return dumped;
+}
+
+size_t PreTriggerBuffer::dump( TimePoint from, TimePoint to, FrameRecorder &recorder )
+{
+  return dump( from, to, [&]( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye, const FrameMetadata &meta ) {
+    if( !recorder.waitForSpace( rightEye ? 2 : 1, kRecorderTimeout ) ) {
+      LOG(WARNING) << "Recorder isn't taking frames, stopping the pre-trigger dump";
+      return false;
+    }
+    return recorder.record( frame, rightEye, meta, _config.mode() );
+  });
+}
+
+void PreTriggerBuffer::cancel()
+{
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( _dump.active ) _dump.cancelled = true;
+  }
+  _arrived.notify_all();
+}
+
+bool PreTriggerBuffer::window( TimePoint &oldest, TimePoint &newest ) const
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  if( _order.empty() ) return false;
+
+  oldest = _slots[ _order.front() ]->meta.hostTime;
+  newest = _slots[ _order.back() ]->meta.hostTime;
+  return true;
+}
+
+void PreTriggerBuffer::clear()
+{
+  std::lock_guard<std::mutex> pushLock( _pushMutex );
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  // Pinned frames stay until their dump has finished with them
+  auto pinned = std::stable_partition( _order.begin(), _order.end(), [this]( unsigned int i ) {
+    return _slots[i]->pins.load( std::memory_order_acquire ) > 0;
+  });
+  _free.insert( _free.end(), pinned, _order.end() );
+  _order.erase( pinned, _order.end() );
+}
+
+PreTriggerBuffer::Stats PreTriggerBuffer::stats() const
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  Stats s;
+  s.retained = _retained.load();
+  s.skipped = _skipped.load();
+  s.dumped = _dumped.load();
+  s.missed = _missed.load();
+  s.frames = _order.size();
+  s.capacity = _slots.size();
+  s.bytes = _arena ? _bufferSize * _arena->stats().numBuffers : 0;
+  s.locked = _arena && _arena->stats().locked;
+  return s;
+}
+
+}
@@ -0,0 +1,230 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/RecordingReader.h"
+
+namespace libblackmagic {
+
+static uint32_t packTimecode( const RecordedFrameHeader &header )
+{
+  if( !(header.flags & RecordedFrameHeader::TimecodeValid) ) return RecordingIndexEntry::kNoTimecode;
+  return RecordingIndexEntry::packTimecode( header.timecodeHours, header.timecodeMinutes,
+                                            header.timecodeSeconds, header.timecodeFrames );
+}
+
+//== RecordingReader::Frame ==
+
+FrameMetadata RecordingReader::Frame::metadata() const
+{
+  FrameMetadata meta;
+  if( !valid() ) return meta;
+
+  const RecordedFrameHeader &h( header() );
+  meta.sequence = h.sequence;
+  meta.timeScale = h.timeScale;
+  meta.streamTime = h.streamTime;
+  meta.streamDuration = h.streamDuration;
+  meta.hardwareTime = h.hardwareTime;
+  meta.hardwareDuration = h.hardwareDuration;
+
+  if( h.flags & RecordedFrameHeader::TimecodeValid ) {
+    meta.timecode.valid = true;
+    meta.timecode.format = bmdTimecodeRP188Any;
+    meta.timecode.flags = (h.flags & RecordedFrameHeader::DropFrameTimecode) ? bmdTimecodeIsDropFrame : bmdTimecodeFlagDefault;
+    meta.timecode.hours = h.timecodeHours;
+    meta.timecode.minutes = h.timecodeMinutes;
+    meta.timecode.seconds = h.timecodeSeconds;
+    meta.timecode.frames = h.timecodeFrames;
+  }
+
+  meta.noInput = h.flags & RecordedFrameHeader::NoInput;
+  meta.is3D = numEyes == 2;
+  return meta;
+}
+
+//== RecordingReader ==
+
+RecordingReader::RecordingReader()
+  : _map( nullptr ), _size( 0 ),
+    _hasIndex( false ), _entries(), _byTimecode()
+{;}
+
+RecordingReader::~RecordingReader()
+{
+  close();
+}
+
+bool RecordingReader::open( const std::string &path )
+{
+  close();
+
+  const int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+  if( fd < 0 ) {
+    LOG(WARNING) << "Unable to open recording " << path << ": " << strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof(RecordingFileHeader) ) {
+    LOG(WARNING) << path << " is too short to be a recording";
+    ::close( fd );
+    return false;
+  }
+
+  // Private and writable, as DeckLink frames hand out non-const buffers;
+  // anything written is copied on write and never reaches the file
+  void *map = mmap( nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+
+  if( map == MAP_FAILED ) {
+    LOG(WARNING) << "Unable to map recording " << path << ": " << strerror(errno);
+    return false;
+  }
+
+  _map = static_cast<uint8_t *>( map );
+  _size = st.st_size;
+  madvise( _map, _size, MADV_SEQUENTIAL );
+
+  const RecordingFileHeader *header = reinterpret_cast<const RecordingFileHeader *>( _map );
+  if( !header->valid() || header->version != RecordingFileHeader::kVersion ||
+      header->blockSize != RecordingFileHeader::kBlockSize ) {
+    LOG(WARNING) << path << " isn't a recording this version can read";
+    close();
+    return false;
+  }
+
+  if( header->indexOffset == 0 || !readIndex( header->indexOffset ) ) {
+    if( header->indexOffset != 0 ) LOG(WARNING) << "The index of " << path << " is damaged";
+    walkRecords();
+  }
+
+  for( size_t i = 0; i < _entries.size(); ++i ) {
+    if( _entries[i].timecode != RecordingIndexEntry::kNoTimecode )
+      _byTimecode.emplace( _entries[i].timecode, i );
+  }
+
+  LOG(INFO) << "Opened " << path << ": " << _entries.size() << " frames"
+            << (_hasIndex ? "" : ", found without an index");
+  return true;
+}
+
+void RecordingReader::close()
+{
+  if( _map ) munmap( _map, _size );
+  _map = nullptr;
+  _size = 0;
+
+  _hasIndex = false;
+  _entries.clear();
+  _byTimecode.clear();
+}
+
+bool RecordingReader::readIndex( uint64_t offset )
+{
+  if( offset > _size || _size - offset < sizeof(RecordingIndexHeader) ) return false;
+
+  const RecordingIndexHeader *header = reinterpret_cast<const RecordingIndexHeader *>( _map + offset );
+  if( !header->valid() ) return false;
+
+  const uint64_t space = _size - offset - sizeof(RecordingIndexHeader);
+  if( header->numEntries > space / sizeof(RecordingIndexEntry) ) return false;
+
+  const RecordingIndexEntry *entries = reinterpret_cast<const RecordingIndexEntry *>( _map + offset + sizeof(RecordingIndexHeader) );
+  _entries.assign( entries, entries + header->numEntries );
+  _hasIndex = true;
+  return true;
+}
+
+void RecordingReader::walkRecords()
+{
+  // Stops at the first record which isn't whole, e.g. the last one
+  // written before a crash
+  uint64_t offset = RecordingFileHeader::kBlockSize;
+  while( const RecordedFrameHeader *header = record( offset ) ) {
+    const bool rightEye = header->eye == 1 && !_entries.empty() && _entries.back().eyes == 1 &&
+                          _entries.back().sequence == header->sequence;
+
+    if( rightEye ) {
+      _entries.back().eyes = 2;
+    } else {
+      RecordingIndexEntry entry;
+      entry.offset = offset;
+      entry.sequence = header->sequence;
+      entry.streamTime = header->streamTime;
+      entry.timecode = packTimecode( *header );
+      entry.eyes = 1;
+      _entries.push_back( entry );
+    }
+
+    offset += header->recordSize;
+  }
+}
+
+const RecordedFrameHeader *RecordingReader::record( uint64_t offset ) const
+{
+  if( offset > _size || _size - offset < sizeof(RecordedFrameHeader) ) return nullptr;
+
+  const RecordedFrameHeader *header = reinterpret_cast<const RecordedFrameHeader *>( _map + offset );
+  if( !header->valid() || header->headerSize < sizeof(RecordedFrameHeader) ||
+      header->recordSize < uint64_t(header->headerSize) + header->dataSize ||
+      header->recordSize > _size - offset ) return nullptr;
+
+  return header;
+}
+
+RecordingReader::Frame RecordingReader::frame( size_t index ) const
+{
+  Frame frame;
+  if( index >= _entries.size() ) return frame;
+
+  const RecordingIndexEntry &entry( _entries[index] );
+  uint64_t offset = entry.offset;
+
+  for( unsigned int eye = 0; eye < std::min( entry.eyes, 2u ); ++eye ) {
+    const RecordedFrameHeader *header = record( offset );
+    if( !header || header->eye != eye ) return Frame();
+
+    frame.eyes[eye] = header;
+    frame.data[eye] = _map + offset + header->headerSize;
+    offset += header->recordSize;
+  }
+
+  frame.numEyes = std::min( entry.eyes, 2u );
+  return frame;
+}
+
+long RecordingReader::findTimecode( const FrameTimecode &timecode ) const
+{
+  if( !timecode.valid ) return -1;
+
+  auto found = _byTimecode.find( RecordingIndexEntry::packTimecode( timecode.hours, timecode.minutes,
+                                                                    timecode.seconds, timecode.frames ) );
+  return found == _byTimecode.end() ? -1 : long(found->second);
+}
+
+BMDDisplayMode RecordingReader::displayMode() const
+{
+  const Frame first( frame( 0 ) );
+  return first.valid() ? BMDDisplayMode( first.header().displayMode ) : BMDDisplayMode( 0 );
+}
+
+BMDPixelFormat RecordingReader::pixelFormat() const
+{
+  const Frame first( frame( 0 ) );
+  return first.valid() ? BMDPixelFormat( first.header().pixelFormat ) : BMDPixelFormat( 0 );
+}
+
+bool RecordingReader::is3D() const
+{
+  return !_entries.empty() && _entries.front().eyes == 2;
+}
+
+}
@@ -31,12 +31,16 @@
 //#include "platform.h"
 
 #include <stdint.h>
+
+#include <algorithm>
+
 #include <DeckLinkAPI.h>
 
 #include "g3log/g3log.hpp"
 
 #include "libblackmagic/Identical3DFrames.h"
 #include "libblackmagic/SDICameraControl.h"
+#include "libblackmagic/TemplateFrameCache.h"
 
 namespace libblackmagic {
 
@@ -44,29 +48,15 @@ namespace libblackmagic {
 // Frame parameters
 // const uint32_t kFrameDuration = 1000;
 // const uint32_t kTimeScale = 25000;
-const uint32_t kFrameWidth = 1920;
-const uint32_t kFrameHeight = 1080;
-const uint32_t kRowBytes = 5120;
-
 const BMDPixelFormat      kPixelFormat = bmdFormat10BitYUV;
 
-
-// 10-bit YUV blue pixels
-const uint32_t kBlueData[4] = { 0x40aa298, 0x2a8a62a8, 0x298aa040, 0x2a8102a8 };
-
 // Studio Camera control packet:
 // Set dynamic range to film.
 // See Studio Camera manual for more information on protocol.
 //const uint8_t kSDIRemoteControlData[9] = { 0x00, 0x07, 0x00, 0x00, 0x01, 0x07, 0x01, 0x00, 0x00 };
 
-// Data Identifier
-const uint8_t kSDIRemoteControlDID = 0x51;
-
-// Secondary Data Identifier
-const uint8_t kSDIRemoteControlSDID = 0x53;
-
-// Define VANC line for camera control
-const uint32_t kSDIRemoteControlLine = 16;
+// Data Identifier, Secondary Data Identifier and VANC line for camera
+// control are in SDICameraControl.h
 
 // Keep track of the number of scheduled frames
 //uint32_t gTotalFramesScheduled = 0;
@@ -114,11 +104,11 @@ static void WriteAncDataToLuma(uint32_t*& sdiStreamPosition, uint32_t value, uin
 	}
 }
 
-static void WriteAncillaryDataPacket(uint32_t* line, const uint8_t did, const uint8_t sdid, const uint8_t* data, uint32_t length)
+size_t encodeAncillaryPacketScalar(uint32_t* line, const uint8_t did, const uint8_t sdid, const uint8_t* data, size_t length)
 {
 	// Sanity check
 	if (length == 0 || length > 255)
-		return;
+		return 0;
 
 	const uint32_t encodedDID  = EncodeByte(did);
 	const uint32_t encodedSDID = EncodeByte(sdid);
@@ -148,43 +138,160 @@ static void WriteAncillaryDataPacket(uint32_t* line, const uint8_t did, const ui
 	sum &= 0x1ff;
 	sum |= ((~(sum << 1)) & 0x200);
 	WriteAncDataToLuma(line, sum, length);
+
+	return ancillaryPacketWords(length);
 }
 
-static void SetVancData(IDeckLinkVideoFrameAncillary* ancillary, BMSDIBuffer *cmd )
+//=== Table-driven encoder ===
+
+// EncodeByte() of every byte
+static const uint16_t kAncillaryEncode[256] = {
+	0x200, 0x101, 0x102, 0x203, 0x104, 0x205, 0x206, 0x107,
+	0x108, 0x209, 0x20a, 0x10b, 0x20c, 0x10d, 0x10e, 0x20f,
+	0x110, 0x211, 0x212, 0x113, 0x214, 0x115, 0x116, 0x217,
+	0x218, 0x119, 0x11a, 0x21b, 0x11c, 0x21d, 0x21e, 0x11f,
+	0x120, 0x221, 0x222, 0x123, 0x224, 0x125, 0x126, 0x227,
+	0x228, 0x129, 0x12a, 0x22b, 0x12c, 0x22d, 0x22e, 0x12f,
+	0x230, 0x131, 0x132, 0x233, 0x134, 0x235, 0x236, 0x137,
+	0x138, 0x239, 0x23a, 0x13b, 0x23c, 0x13d, 0x13e, 0x23f,
+	0x140, 0x241, 0x242, 0x143, 0x244, 0x145, 0x146, 0x247,
+	0x248, 0x149, 0x14a, 0x24b, 0x14c, 0x24d, 0x24e, 0x14f,
+	0x250, 0x151, 0x152, 0x253, 0x154, 0x255, 0x256, 0x157,
+	0x158, 0x259, 0x25a, 0x15b, 0x25c, 0x15d, 0x15e, 0x25f,
+	0x260, 0x161, 0x162, 0x263, 0x164, 0x265, 0x266, 0x167,
+	0x168, 0x269, 0x26a, 0x16b, 0x26c, 0x16d, 0x16e, 0x26f,
+	0x170, 0x271, 0x272, 0x173, 0x274, 0x175, 0x176, 0x277,
+	0x278, 0x179, 0x17a, 0x27b, 0x17c, 0x27d, 0x27e, 0x17f,
+	0x180, 0x281, 0x282, 0x183, 0x284, 0x185, 0x186, 0x287,
+	0x288, 0x189, 0x18a, 0x28b, 0x18c, 0x28d, 0x28e, 0x18f,
+	0x290, 0x191, 0x192, 0x293, 0x194, 0x295, 0x296, 0x197,
+	0x198, 0x299, 0x29a, 0x19b, 0x29c, 0x19d, 0x19e, 0x29f,
+	0x2a0, 0x1a1, 0x1a2, 0x2a3, 0x1a4, 0x2a5, 0x2a6, 0x1a7,
+	0x1a8, 0x2a9, 0x2aa, 0x1ab, 0x2ac, 0x1ad, 0x1ae, 0x2af,
+	0x1b0, 0x2b1, 0x2b2, 0x1b3, 0x2b4, 0x1b5, 0x1b6, 0x2b7,
+	0x2b8, 0x1b9, 0x1ba, 0x2bb, 0x1bc, 0x2bd, 0x2be, 0x1bf,
+	0x2c0, 0x1c1, 0x1c2, 0x2c3, 0x1c4, 0x2c5, 0x2c6, 0x1c7,
+	0x1c8, 0x2c9, 0x2ca, 0x1cb, 0x2cc, 0x1cd, 0x1ce, 0x2cf,
+	0x1d0, 0x2d1, 0x2d2, 0x1d3, 0x2d4, 0x1d5, 0x1d6, 0x2d7,
+	0x2d8, 0x1d9, 0x1da, 0x2db, 0x1dc, 0x2dd, 0x2de, 0x1df,
+	0x1e0, 0x2e1, 0x2e2, 0x1e3, 0x2e4, 0x1e5, 0x1e6, 0x2e7,
+	0x2e8, 0x1e9, 0x1ea, 0x2eb, 0x1ec, 0x2ed, 0x2ee, 0x1ef,
+	0x2f0, 0x1f1, 0x1f2, 0x2f3, 0x1f4, 0x2f5, 0x2f6, 0x1f7,
+	0x1f8, 0x2f9, 0x2fa, 0x1fb, 0x2fc, 0x1fd, 0x1fe, 0x2ff,
+};
+
+// Bit 9 of a checksum is the inverse of bit 8
+static inline uint32_t AncillaryChecksum( uint32_t sum )
 {
-	HRESULT   result;
-	uint32_t* buffer;
+	sum &= 0x1ff;
+	return sum | ((~(sum << 1)) & 0x200);
+}
 
-	result = ancillary->GetBufferForVerticalBlankingLine(kSDIRemoteControlLine, (void **)&buffer);
-	if (result != S_OK)
-	{
-		LOGF(WARNING, "Could not get buffer for Vertical blanking line - result = %08x\n", result);
-		return;
+size_t encodeAncillaryPacket( uint32_t *line, uint8_t did, uint8_t sdid, const uint8_t *data, size_t len )
+{
+	if( len == 0 || len > 255 ) return 0;
+
+	const uint32_t encodedDID = kAncillaryEncode[did],
+								 encodedSDID = kAncillaryEncode[sdid],
+								 encodedDC = kAncillaryEncode[len];
+
+	// Start sequence (0, 0x3ff, 0x3ff), then DID, SDID and DC
+	line[0] = 0;
+	line[1] = 0x3ff003ff;
+	line[2] = encodedDID << 10;
+	line[3] = encodedSDID | (encodedDC << 20);
+
+	// Only the low nine bits of the sum count, so bit 9 of each sample can
+	// go in too
+	uint32_t sum = encodedDID + encodedSDID + encodedDC;
+	uint32_t *out = line + 4;
+
+	// Three samples to each pair of words
+	const uint8_t *end = data + len - (len % 3);
+	for( ; data != end; data += 3, out += 2 ) {
+		const uint32_t a = kAncillaryEncode[data[0]],
+									 b = kAncillaryEncode[data[1]],
+									 c = kAncillaryEncode[data[2]];
+		out[0] = a << 10;
+		out[1] = b | (c << 20);
+		sum += a + b + c;
 	}
 
-	// Write camera control data to buffer
-	WriteAncillaryDataPacket(buffer, kSDIRemoteControlDID, kSDIRemoteControlSDID,
-													(const uint8_t *)cmd->data, cmd->len);
+	// The last one or two bytes, and the checksum, share the final pair
+	uint32_t tail[3] = { 0, 0, 0 };
+	const size_t remaining = len % 3;
+	for( size_t i = 0; i < remaining; ++i ) {
+		tail[i] = kAncillaryEncode[data[i]];
+		sum += tail[i];
+	}
+	tail[remaining] = AncillaryChecksum( sum );
+
+	out[0] = tail[0] << 10;
+	out[1] = tail[1] | (tail[2] << 20);
+
+	return ancillaryPacketWords( len );
+}
+
+// Luma sample n after the header
+static inline uint32_t AncillaryLuma( const uint32_t *samples, size_t n )
+{
+	const uint32_t *pair = samples + 2 * (n / 3);
+	switch( n % 3 ) {
+		case 0:		return (pair[0] >> 10) & 0x3ff;
+		case 1:		return pair[1] & 0x3ff;
+		default:	return (pair[1] >> 20) & 0x3ff;
+	}
 }
 
-static void FillBlue(IDeckLinkMutableVideoFrame* theFrame)
+size_t decodeAncillaryPacket( const uint32_t *line, size_t words, AncillaryPacket &packet )
 {
-	uint32_t* nextWord;
-	uint32_t  wordsRemaining;
+	if( words < ancillaryPacketWords( 1 ) ) return 0;
+	if( (line[0] & 0xffc00) != 0 || (line[1] & 0x3ff003ff) != 0x3ff003ff ) return 0;
 
-	theFrame->GetBytes((void**)&nextWord);
-	wordsRemaining = (kRowBytes * kFrameHeight) / 4;
+	const uint32_t encodedDID = (line[2] >> 10) & 0x3ff,
+								 encodedSDID = line[3] & 0x3ff,
+								 encodedDC = (line[3] >> 20) & 0x3ff;
+	if( kAncillaryEncode[encodedDID & 0xff] != encodedDID ||
+			kAncillaryEncode[encodedSDID & 0xff] != encodedSDID ||
+			kAncillaryEncode[encodedDC & 0xff] != encodedDC ) return 0;
 
-	while (wordsRemaining > 0)
-	{
-		*(nextWord++) = kBlueData[0];
-		*(nextWord++) = kBlueData[1];
-		*(nextWord++) = kBlueData[2];
-		*(nextWord++) = kBlueData[3];
-		wordsRemaining = wordsRemaining - 4;
+	const size_t len = encodedDC & 0xff;
+	if( len == 0 || ancillaryPacketWords( len ) > words ) return 0;
+
+	uint32_t sum = encodedDID + encodedSDID + encodedDC;
+	const uint32_t *samples = line + 4;
+
+	// As the encoder, three at a time then the rest
+	size_t i = 0;
+	for( ; i + 3 <= len; i += 3, samples += 2 ) {
+		const uint32_t a = (samples[0] >> 10) & 0x3ff,
+									 b = samples[1] & 0x3ff,
+									 c = (samples[1] >> 20) & 0x3ff;
+		packet.data[i] = uint8_t(a);  packet.data[i+1] = uint8_t(b);  packet.data[i+2] = uint8_t(c);
+		sum += a + b + c;
+		if( kAncillaryEncode[a & 0xff] != a || kAncillaryEncode[b & 0xff] != b || kAncillaryEncode[c & 0xff] != c ) return 0;
 	}
+
+	for( size_t j = 0; i < len; ++i, ++j ) {
+		const uint32_t a = AncillaryLuma( samples, j );
+		packet.data[i] = uint8_t(a);
+		sum += a;
+		if( kAncillaryEncode[a & 0xff] != a ) return 0;
+	}
+
+	if( AncillaryLuma( samples, len % 3 ) != AncillaryChecksum( sum ) ) return 0;
+
+	packet.did = encodedDID;
+	packet.sdid = encodedSDID;
+	packet.len = len;
+	return ancillaryPacketWords( len );
 }
 
+static void SetVancData(IDeckLinkVideoFrameAncillary* ancillary, BMSDIBuffer *cmd )
+{
+	uint32_t* buffer = sdiProtocolLine( ancillary );
+	if( buffer ) writeSDIProtocol( buffer, cmd );
+}
 
 //=== Public functions ====
 
@@ -224,23 +331,135 @@ bail:
 }
 
 
+IDeckLinkMutableVideoFrame* addSDIProtocolToFrame( IDeckLinkOutput *deckLinkOutput, IDeckLinkMutableVideoFrame* frame,
+																										CameraCommandQueue &queue, const std::vector<uint32_t> &lines )
+{
+	IDeckLinkVideoFrameAncillary*	ancillaryData = nullptr;
+
+	HRESULT result = deckLinkOutput->CreateAncillaryData(kPixelFormat, &ancillaryData);
+	if(result != S_OK)
+	{
+		LOGF(WARNING, "Could not create Ancillary data - result = %08x\n", result);
+		return frame;
+	}
+
+	std::vector<uint32_t *> buffers;
+	for( uint32_t line : lines ) {
+		uint32_t *buffer = sdiProtocolLine( ancillaryData, line );
+		if( buffer ) buffers.push_back( buffer );
+	}
+
+	std::vector<size_t> used;
+	VancWriter writer( buffers, frame->GetWidth(), used );
+	writeSDIProtocol( writer, queue );
+
+	result = frame->SetAncillaryData(ancillaryData);
+	if (result != S_OK)
+		LOGF(WARNING, "Fail to set ancillary data to the frame - result = %08x\n", result);
+
+	ancillaryData->Release();
+	return frame;
+}
+
+
 
-IDeckLinkMutableVideoFrame* makeBlueFrame( IDeckLinkOutput *deckLinkOutput, bool do3D )
+uint32_t *sdiProtocolLine( IDeckLinkVideoFrameAncillary *ancillary, uint32_t lineNumber )
 {
-	HRESULT                         result;
-	IDeckLinkMutableVideoFrame*     frame = nullptr;
+	HRESULT   result;
+	uint32_t* buffer = nullptr;
 
-	result = deckLinkOutput->CreateVideoFrame(kFrameWidth, kFrameHeight, kRowBytes, kPixelFormat, bmdFrameFlagDefault, &frame);
+	result = ancillary->GetBufferForVerticalBlankingLine(lineNumber, (void **)&buffer);
 	if (result != S_OK)
 	{
-		LOGF(WARNING, "Could not create a video frame - result = %08x\n", result);
-		goto bail;
+		LOGF(WARNING, "Could not get buffer for Vertical blanking line - result = %08x\n", result);
+		return nullptr;
 	}
 
-	FillBlue(frame);
+	return buffer;
+}
+
 
-bail:
-  return frame;
+void writeSDIProtocol( uint32_t *line, BMSDIBuffer *buffer )
+{
+	// Write camera control data to buffer
+	encodeAncillaryPacket(line, kSDIRemoteControlDID, kSDIRemoteControlSDID,
+												(const uint8_t *)buffer->data, buffer->len);
+}
+
+
+unsigned int writeSDIProtocol( VancWriter &writer, CameraCommandQueue &queue )
+{
+	unsigned int packets = 0;
+	BMSDIBuffer packet;
+
+	while( queue.pending() ) {
+		const size_t room = writer.room();
+		if( room == 0 ) break;
+
+		bmResetBuffer( &packet );
+		if( queue.fill( &packet, room ) == 0 ) break;
+
+		writer.write( kSDIRemoteControlDID, kSDIRemoteControlSDID, (const uint8_t *)packet.data, packet.len );
+		++packets;
+	}
+
+	return packets;
+}
+
+//=== VancWriter ===
+
+// Data a packet can carry in the given number of words
+static size_t AncillaryDataForWords( size_t words )
+{
+	if( words < ancillaryPacketWords( 1 ) ) return 0;
+	const size_t data = (words - 4) / 2 * 3 - 1;
+	return data < 255 ? data : 255;
+}
+
+VancWriter::VancWriter( const std::vector<uint32_t *> &lines, long width, std::vector<size_t> &used )
+	: _lines( lines ),
+		_lineWords( vancLineWords( width ) ),
+		_used( used ),
+		_line( 0 ),
+		_packets( 0 ),
+		_bytes( 0 )
+{
+	_used.assign( _lines.size(), 0 );
+}
+
+size_t VancWriter::room() const
+{
+	size_t most = 0;
+	for( size_t i = _line; i < _lines.size(); ++i )
+		most = std::max( most, AncillaryDataForWords( _lineWords - _used[i] ) );
+	return most;
+}
+
+bool VancWriter::write( uint8_t did, uint8_t sdid, const uint8_t *data, size_t len )
+{
+	if( len == 0 || len > 255 ) return false;
+
+	const size_t words = ancillaryPacketWords( len );
+	size_t line = _line;
+	while( line < _lines.size() && _used[line] + words > _lineWords ) ++line;
+	if( line == _lines.size() ) return false;
+
+	// Packets follow one another with no gap:  the encoder zeroes any
+	// samples after the checksum in its last pair of words
+	encodeAncillaryPacket( _lines[line] + _used[line], did, sdid, data, len );
+
+	_line = line;
+	_used[line] += words;
+	++_packets;
+	_bytes += len;
+	return true;
+}
+
+
+IDeckLinkMutableVideoFrame* makeBlueFrame( IDeckLinkOutput *deckLinkOutput, bool do3D, BMDDisplayMode mode )
+{
+	// A copy of the mode's blue template, rendered the first time
+	return TemplateFrameCache::shared().makeFrame( deckLinkOutput, mode, kPixelFormat, TemplateFrameCache::Blue );
 }
 
 
@@ -0,0 +1,1743 @@
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/DataTypes.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+namespace libblackmagic {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+bool sameIID( REFIID a, REFIID b )
+{ return memcmp( &a, &b, sizeof(REFIID) ) == 0; }
+
+// value * to / from without overflowing for nanosecond values
+BMDTimeValue rescale( int64_t value, int64_t from, int64_t to )
+{ return (value / from) * to + ((value % from) * to) / from; }
+
+int64_t nanosSince( Clock::time_point epoch )
+{ return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - epoch ).count(); }
+
+//== Display modes ==
+
+struct SimMode {
+  BMDDisplayMode mode;
+  const char *name;
+  long width, height;
+  BMDTimeValue duration;
+  BMDTimeScale scale;
+
+  bool supports3D() const { return height <= 1080; }
+
+  Clock::duration period() const
+    { return std::chrono::duration_cast<Clock::duration>( std::chrono::nanoseconds( rescale( duration, scale, 1000000000 ) ) ); }
+};
+
+const SimMode kModes[] = {
+  { bmdModeHD1080p2398, "1080p23.98", 1920, 1080, 1001, 24000 },
+  { bmdModeHD1080p24,   "1080p24",    1920, 1080, 1000, 24000 },
+  { bmdModeHD1080p25,   "1080p25",    1920, 1080, 1000, 25000 },
+  { bmdModeHD1080p2997, "1080p29.97", 1920, 1080, 1001, 30000 },
+  { bmdModeHD1080p30,   "1080p30",    1920, 1080, 1000, 30000 },
+  { bmdModeHD1080p50,   "1080p50",    1920, 1080, 1000, 50000 },
+  { bmdModeHD1080p5994, "1080p59.94", 1920, 1080, 1001, 60000 },
+  { bmdModeHD1080p6000, "1080p60",    1920, 1080, 1000, 60000 },
+  { bmdMode4K2160p25,   "2160p25",    3840, 2160, 1000, 25000 },
+  { bmdMode4K2160p2997, "2160p29.97", 3840, 2160, 1001, 30000 },
+  { bmdMode4K2160p30,   "2160p30",    3840, 2160, 1000, 30000 },
+  { bmdMode4K2160p50,   "2160p50",    3840, 2160, 1000, 50000 },
+  { bmdMode4K2160p5994, "2160p59.94", 3840, 2160, 1001, 60000 },
+  { bmdMode4K2160p60,   "2160p60",    3840, 2160, 1000, 60000 },
+  { bmdModeHD720p5994,  "720p59.94",  1280,  720, 1001, 60000 },
+  { bmdModeHD720p60,    "720p60",     1280,  720, 1000, 60000 },
+};
+
+const unsigned int kNumModes = sizeof(kModes) / sizeof(SimMode);
+
+const SimMode *findMode( BMDDisplayMode mode )
+{
+  for( unsigned int i = 0; i < kNumModes; ++i )
+    if( kModes[i].mode == mode ) return &kModes[i];
+  return nullptr;
+}
+
+bool supportedPixelFormat( BMDPixelFormat pixFmt )
+{
+  return pixFmt == bmdFormat8BitYUV || pixFmt == bmdFormat10BitYUV ||
+         pixFmt == bmdFormat8BitBGRA || pixFmt == bmdFormat10BitRGB;
+}
+
+//== Test pattern ==
+
+// 75% colour bars, in BT.709 video range YCbCr and in RGB
+struct Bar { uint8_t y, cb, cr, b, g, r; };
+
+const Bar kBars[] = {
+  { 180, 128, 128, 191, 191, 191 },   // white
+  { 168,  44, 136,   0, 191, 191 },   // yellow
+  { 145, 147,  44, 191, 191,   0 },   // cyan
+  { 133,  63,  52,   0, 191,   0 },   // green
+  {  63, 193, 204, 191,   0, 191 },   // magenta
+  {  51, 109, 212,   0,   0, 191 },   // red
+  {  28, 212, 120, 191,   0,   0 },   // blue
+};
+
+const Bar kBlack = { 16, 128, 128, 0, 0, 0 };
+
+const long kNumBars = sizeof(kBars) / sizeof(Bar);
+
+const Bar &barAt( long x, long width, bool mirror, bool black )
+{
+  if( black ) return kBlack;
+  x = std::min( x, width - 1 );
+  if( mirror ) x = width - 1 - x;
+  return kBars[ x * kNumBars / width ];
+}
+
+uint32_t packV210( uint8_t a, uint8_t b, uint8_t c )
+{ return (uint32_t(a) << 2) | (uint32_t(b) << 12) | (uint32_t(c) << 22); }
+
+// Full range 8-bit to video range 10-bit, as r210 carries
+uint32_t videoRange10( uint8_t v )
+{ return (16 + (v * 219 + 127) / 255) << 2; }
+
+// Fills one row (rowBytes long) of the pattern
+void renderRow( uint8_t *row, size_t rowBytes, BMDPixelFormat pixFmt,
+                long width, bool mirror, bool black )
+{
+  memset( row, 0, rowBytes );
+
+  if( pixFmt == bmdFormat8BitBGRA ) {
+    for( long x = 0; x < width; ++x ) {
+      const Bar &p( barAt( x, width, mirror, black ) );
+      row[4*x] = p.b;  row[4*x+1] = p.g;  row[4*x+2] = p.r;  row[4*x+3] = 255;
+    }
+  } else if( pixFmt == bmdFormat8BitYUV ) {
+    for( long x = 0; x < width; x += 2 ) {
+      const Bar &p0( barAt( x, width, mirror, black ) ), &p1( barAt( x+1, width, mirror, black ) );
+      row[2*x] = p0.cb;  row[2*x+1] = p0.y;  row[2*x+2] = p0.cr;  row[2*x+3] = p1.y;
+    }
+  } else if( pixFmt == bmdFormat10BitRGB ) {
+    // Big-endian words of 2 padding bits then 10-bit R, G, B
+    for( long x = 0; x < width; ++x ) {
+      const Bar &p( barAt( x, width, mirror, black ) );
+      const uint32_t w = (videoRange10( p.r ) << 20) | (videoRange10( p.g ) << 10) | videoRange10( p.b );
+      row[4*x] = w >> 24;  row[4*x+1] = w >> 16;  row[4*x+2] = w >> 8;  row[4*x+3] = w;
+    }
+  } else if( pixFmt == bmdFormat10BitYUV ) {
+    uint32_t *w = reinterpret_cast<uint32_t *>( row );
+    for( long x = 0; x < width; x += 6, w += 4 ) {
+      const Bar *p[6];
+      for( int i = 0; i < 6; ++i ) p[i] = &barAt( x+i, width, mirror, black );
+
+      w[0] = packV210( p[0]->cb, p[0]->y,  p[0]->cr );
+      w[1] = packV210( p[1]->y,  p[2]->cb, p[2]->y );
+      w[2] = packV210( p[2]->cr, p[3]->y,  p[4]->cb );
+      w[3] = packV210( p[4]->y,  p[4]->cr, p[5]->y );
+    }
+  }
+}
+
+//== Reference counting for heap-allocated SDK objects ==
+
+template< class Base >
+class RefCounted : public Base {
+public:
+  template< typename... Args >
+  RefCounted( Args&&... args ) : Base( std::forward<Args>(args)... ), _refCount(1) {;}
+
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return ++_refCount; }
+
+  virtual ULONG STDMETHODCALLTYPE Release( void ) {
+    const ULONG count = --_refCount;
+    if( count == 0 ) delete this;
+    return count;
+  }
+
+protected:
+  virtual ~RefCounted() {;}
+
+  std::atomic<ULONG> _refCount;
+};
+
+class SimDisplayMode : public RefCounted<IDeckLinkDisplayMode> {
+public:
+  SimDisplayMode( const SimMode &mode ) : _mode( mode ) {;}
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { *ppv = nullptr; return E_NOINTERFACE; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetName( const char **name )  { *name = strdup( _mode.name ); return S_OK; }
+  virtual BMDDisplayMode STDMETHODCALLTYPE GetDisplayMode( void ) { return _mode.mode; }
+  virtual long STDMETHODCALLTYPE GetWidth( void )                 { return _mode.width; }
+  virtual long STDMETHODCALLTYPE GetHeight( void )                { return _mode.height; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetFrameRate( BMDTimeValue *duration, BMDTimeScale *scale )
+    { *duration = _mode.duration;  *scale = _mode.scale;  return S_OK; }
+
+  virtual BMDFieldDominance STDMETHODCALLTYPE GetFieldDominance( void ) { return bmdProgressiveFrame; }
+  virtual BMDDisplayModeFlags STDMETHODCALLTYPE GetFlags( void )
+    { return _mode.supports3D() ? bmdDisplayModeSupports3D : 0; }
+
+private:
+  const SimMode &_mode;
+};
+
+class SimDisplayModeIterator : public RefCounted<IDeckLinkDisplayModeIterator> {
+public:
+  SimDisplayModeIterator() : _next(0) {;}
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { *ppv = nullptr; return E_NOINTERFACE; }
+
+  virtual HRESULT STDMETHODCALLTYPE Next( IDeckLinkDisplayMode **mode ) {
+    if( _next >= kNumModes ) { *mode = nullptr;  return S_FALSE; }
+    *mode = new SimDisplayMode( kModes[_next++] );
+    return S_OK;
+  }
+
+private:
+  unsigned int _next;
+};
+
+HRESULT getDisplayMode( BMDDisplayMode mode, IDeckLinkDisplayMode **displayMode )
+{
+  const SimMode *m = findMode( mode );
+  if( !m ) { *displayMode = nullptr;  return E_INVALIDARG; }
+  *displayMode = new SimDisplayMode( *m );
+  return S_OK;
+}
+
+HRESULT doesSupportVideoMode( BMDDisplayMode mode, BMDPixelFormat pixFmt, bool dualStream3D,
+                              BMDDisplayMode *actualMode, bool *supported )
+{
+  const SimMode *m = findMode( mode );
+  *supported = m && supportedPixelFormat( pixFmt ) && ( !dualStream3D || m->supports3D() );
+  if( actualMode ) *actualMode = *supported ? mode : BMDDisplayMode(bmdModeUnknown);
+  return S_OK;
+}
+
+// Timecode embedded in a frame;  references count against the frame
+class SimTimecode : public IDeckLinkTimecode {
+public:
+  SimTimecode( IUnknown *owner )
+    : _owner( owner ), _flags( bmdTimecodeFlagDefault ), _hours(0), _minutes(0), _seconds(0), _frames(0) {;}
+
+  void set( uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags ) {
+    _hours = hours;  _minutes = minutes;  _seconds = seconds;  _frames = frames;  _flags = flags;
+  }
+
+  // Non-drop timecode for frame index of the mode
+  void set( uint64_t index, const SimMode &mode ) {
+    const uint64_t fps = (mode.scale + mode.duration / 2) / mode.duration;
+    const uint64_t seconds = index / fps;
+    set( (seconds / 3600) % 24, (seconds / 60) % 60, seconds % 60, index % fps, bmdTimecodeFlagDefault );
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { *ppv = nullptr; return E_NOINTERFACE; }
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _owner->AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _owner->Release(); }
+
+  virtual BMDTimecodeBCD STDMETHODCALLTYPE GetBCD( void ) {
+    return (bcd(_hours) << 24) | (bcd(_minutes) << 16) | (bcd(_seconds) << 8) | bcd(_frames);
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetComponents( uint8_t *hours, uint8_t *minutes, uint8_t *seconds, uint8_t *frames ) {
+    *hours = _hours;  *minutes = _minutes;  *seconds = _seconds;  *frames = _frames;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetString( const char **timecode ) {
+    char buf[16];
+    snprintf( buf, sizeof(buf), "%02u:%02u:%02u:%02u", _hours, _minutes, _seconds, _frames );
+    *timecode = strdup( buf );
+    return S_OK;
+  }
+
+  virtual BMDTimecodeFlags STDMETHODCALLTYPE GetFlags( void ) { return _flags; }
+  virtual HRESULT STDMETHODCALLTYPE GetTimecodeUserBits( BMDTimecodeUserBits *userBits ) { *userBits = 0;  return S_OK; }
+
+private:
+  static uint32_t bcd( uint8_t v ) { return ((v / 10) << 4) | (v % 10); }
+
+  IUnknown *_owner;
+  BMDTimecodeFlags _flags;
+  uint8_t _hours, _minutes, _seconds, _frames;
+};
+
+bool isRP188( BMDTimecodeFormat format )
+{
+  return format == bmdTimecodeRP188Any || format == bmdTimecodeRP188VITC1 ||
+         format == bmdTimecodeRP188VITC2 || format == bmdTimecodeRP188LTC;
+}
+
+// VANC lines of one frame, in the frame's pixel format
+class SimAncillary : public RefCounted<IDeckLinkVideoFrameAncillary> {
+public:
+  SimAncillary( const SimMode &mode, BMDPixelFormat pixFmt )
+    : _mode( mode ), _pixelFormat( pixFmt ),
+      _rowBytes( rowBytesForPixelFormat( pixFmt, mode.width ) ) {;}
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { *ppv = nullptr; return E_NOINTERFACE; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetBufferForVerticalBlankingLine( uint32_t lineNumber, void **buffer ) {
+    if( lineNumber == 0 || _rowBytes == 0 ) return E_INVALIDARG;
+
+    std::vector<uint8_t> &line( _lines[lineNumber] );
+    if( line.empty() ) {
+      line.resize( _rowBytes );
+      renderRow( line.data(), _rowBytes, _pixelFormat, _mode.width, false, true );
+    }
+
+    *buffer = line.data();
+    return S_OK;
+  }
+
+  virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat( void ) { return _pixelFormat; }
+  virtual BMDDisplayMode STDMETHODCALLTYPE GetDisplayMode( void ) { return _mode.mode; }
+
+private:
+  const SimMode &_mode;
+  BMDPixelFormat _pixelFormat;
+  size_t _rowBytes;
+  std::map< uint32_t, std::vector<uint8_t> > _lines;
+};
+
+//== Video frames ==
+
+// The IDeckLinkVideoFrame half of every simulated frame
+template< class Base >
+class SimFrame : public Base {
+public:
+  SimFrame( IUnknown *owner )
+    : _width(0), _height(0), _rowBytes(0), _pixelFormat(0),
+      _flags( bmdFrameFlagDefault ), _bytes( nullptr ),
+      _timecode( owner ), _timecodeFormat(0), _ancillary( nullptr ) {;}
+
+  virtual ~SimFrame() {
+    if( _ancillary ) _ancillary->Release();
+  }
+
+  virtual long STDMETHODCALLTYPE GetWidth( void )                 { return _width; }
+  virtual long STDMETHODCALLTYPE GetHeight( void )                { return _height; }
+  virtual long STDMETHODCALLTYPE GetRowBytes( void )              { return _rowBytes; }
+  virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat( void ) { return _pixelFormat; }
+  virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags( void )        { return _flags; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetBytes( void **buffer ) {
+    *buffer = _bytes;
+    return _bytes ? S_OK : E_FAIL;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode **timecode ) {
+    const bool match = _timecodeFormat != 0 &&
+        ( format == _timecodeFormat || ( format == bmdTimecodeRP188Any && isRP188( _timecodeFormat ) ) );
+    if( !match ) { *timecode = nullptr;  return S_FALSE; }
+
+    _timecode.AddRef();
+    *timecode = &_timecode;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetAncillaryData( IDeckLinkVideoFrameAncillary **ancillary ) {
+    *ancillary = _ancillary;
+    if( !_ancillary ) return S_FALSE;
+    _ancillary->AddRef();
+    return S_OK;
+  }
+
+protected:
+  long _width, _height, _rowBytes;
+  BMDPixelFormat _pixelFormat;
+  BMDFrameFlags _flags;
+  uint8_t *_bytes;
+
+  SimTimecode _timecode;
+  BMDTimecodeFormat _timecodeFormat;
+
+  IDeckLinkVideoFrameAncillary *_ancillary;
+};
+
+class InputPool;
+class SimInputFrame;
+
+// Right eye of a 3D input frame.  It lives and dies with the left eye.
+class SimRightEye : public SimFrame<IDeckLinkVideoFrame> {
+public:
+  SimRightEye( IUnknown *left ) : SimFrame<IDeckLinkVideoFrame>( left ), _left( left ) {;}
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) {
+    if( sameIID( iid, IID_IUnknown ) || sameIID( iid, IID_IDeckLinkVideoFrame ) ) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoFrame *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _left->AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _left->Release(); }
+
+private:
+  friend class SimInputFrame;
+
+  IUnknown *_left;
+};
+
+// Frames are recycled rather than deleted.  A frame holds a reference to
+// its pool while the application has it, so a pool replaced by
+// EnableVideoInput() lives until the last of its frames comes back.
+class InputPool : public std::enable_shared_from_this<InputPool> {
+public:
+  InputPool( const SimMode &mode, BMDPixelFormat pixFmt, bool is3D,
+             unsigned int numBuffers, IDeckLinkMemoryAllocator *allocator );
+  ~InputPool();
+
+  const SimMode &mode() const         { return _mode; }
+  BMDPixelFormat pixelFormat() const  { return _pixelFormat; }
+  bool is3D() const                   { return _is3D; }
+  size_t rowBytes() const             { return _rowBytes; }
+  size_t frameBytes() const           { return _rowBytes * _mode.height; }
+
+  IDeckLinkMemoryAllocator *allocator() { return _allocator; }
+
+  // Pattern row for an eye;  black if noInput
+  const uint8_t *pattern( int eye, bool noInput ) const
+    { return _patterns[ noInput ? 2 : eye ].data(); }
+
+  // nullptr if every frame is out
+  SimInputFrame *checkout();
+  void recycle( SimInputFrame *frame );
+
+  // True if a frame came back within the timeout
+  bool waitForFree( Clock::duration timeout );
+
+private:
+  const SimMode &_mode;
+  BMDPixelFormat _pixelFormat;
+  bool _is3D;
+  size_t _rowBytes;
+
+  IDeckLinkMemoryAllocator *_allocator;
+
+  std::vector< std::unique_ptr<SimInputFrame> > _frames;
+  std::vector< SimInputFrame * > _free;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+
+  std::vector<uint8_t> _patterns[3];
+};
+
+class SimInputFrame : public SimFrame<IDeckLinkVideoInputFrame>, public IDeckLinkVideoFrame3DExtensions {
+public:
+  SimInputFrame( InputPool &pool )
+    : SimFrame<IDeckLinkVideoInputFrame>( static_cast<IDeckLinkVideoInputFrame *>(this) ),
+      _pool( pool ), _checkedOut(), _refCount(0), _right( static_cast<IDeckLinkVideoInputFrame *>(this) ),
+      _is3D( false ), _hardwareTime(0),
+      _streamTime(0), _streamDuration(0), _streamScale(1), _recording()
+  {
+    _width = pool.mode().width;
+    _height = pool.mode().height;
+    _rowBytes = pool.rowBytes();
+    _pixelFormat = pool.pixelFormat();
+    _timecodeFormat = bmdTimecodeRP188Any;
+
+    _right._width = pool.mode().width;
+    _right._height = pool.mode().height;
+    _right._rowBytes = pool.rowBytes();
+    _right._pixelFormat = pool.pixelFormat();
+    _right._timecodeFormat = bmdTimecodeRP188Any;
+  }
+
+  // Called by the pool as the frame goes out.  Picks up buffers and
+  // draws the pattern into them.
+  bool prepare( std::shared_ptr<InputPool> pool, uint64_t index, bool noInput, bool is3D, int64_t hardwareTime ) {
+    const int eyes = _pool.is3D() ? 2 : 1;
+    IDeckLinkMemoryAllocator *allocator = _pool.allocator();
+
+    for( int eye = 0; eye < eyes; ++eye ) {
+      uint8_t *&bytes( eye == 0 ? _bytes : _right._bytes );
+
+      if( allocator ) {
+        if( allocator->AllocateBuffer( _pool.frameBytes(), (void **)&bytes ) != S_OK ) {
+          bytes = nullptr;
+          releaseBuffers();
+          return false;
+        }
+      } else {
+        // Sized once, on the frame's first trip
+        _storage[eye].resize( _pool.frameBytes() );
+        bytes = _storage[eye].data();
+      }
+
+      const uint8_t *pattern = _pool.pattern( eye, noInput );
+      for( long row = 0; row < _height; ++row )
+        memcpy( bytes + row * _rowBytes, pattern, _rowBytes );
+    }
+
+    _checkedOut = pool;
+    _refCount = 1;
+    _is3D = is3D && eyes == 2;
+    _hardwareTime = hardwareTime;
+    _streamTime = index * _pool.mode().duration;
+    _streamDuration = _pool.mode().duration;
+    _streamScale = _pool.mode().scale;
+    _flags = _right._flags = noInput ? BMDFrameFlags(bmdFrameHasNoInputSource) : BMDFrameFlags(bmdFrameFlagDefault);
+    _timecode.set( index, _pool.mode() );
+    _right._timecode.set( index, _pool.mode() );
+    _timecodeFormat = _right._timecodeFormat = bmdTimecodeRP188Any;
+    return true;
+  }
+
+  // As prepare(), but the frame's buffers are those of a recorded frame,
+  // which are held (through the reader) until the frame comes back.
+  bool play( std::shared_ptr<InputPool> pool, std::shared_ptr<const RecordingReader> recording,
+             const RecordingReader::Frame &recorded, int64_t hardwareTime ) {
+    const RecordedFrameHeader &header( recorded.header() );
+    if( header.width != (uint32_t)_width || header.height != (uint32_t)_height ||
+        header.rowBytes != (uint32_t)_rowBytes || header.pixelFormat != _pixelFormat ) return false;
+
+    const int eyes = std::min<int>( _pool.is3D() ? 2 : 1, recorded.numEyes );
+    _bytes = recorded.data[0];
+    _right._bytes = eyes == 2 ? recorded.data[1] : nullptr;
+    _recording = recording;
+
+    _checkedOut = pool;
+    _refCount = 1;
+    _is3D = eyes == 2;
+    _hardwareTime = hardwareTime;
+    _streamTime = header.streamTime;
+    _streamDuration = header.streamDuration;
+    _streamScale = header.timeScale > 0 ? header.timeScale : 1;
+
+    const bool noInput = header.flags & RecordedFrameHeader::NoInput;
+    _flags = _right._flags = noInput ? BMDFrameFlags(bmdFrameHasNoInputSource) : BMDFrameFlags(bmdFrameFlagDefault);
+
+    if( header.flags & RecordedFrameHeader::TimecodeValid ) {
+      const BMDTimecodeFlags flags = (header.flags & RecordedFrameHeader::DropFrameTimecode) ? bmdTimecodeIsDropFrame : bmdTimecodeFlagDefault;
+      _timecode.set( header.timecodeHours, header.timecodeMinutes, header.timecodeSeconds, header.timecodeFrames, flags );
+      _right._timecode.set( header.timecodeHours, header.timecodeMinutes, header.timecodeSeconds, header.timecodeFrames, flags );
+      _timecodeFormat = _right._timecodeFormat = bmdTimecodeRP188Any;
+    } else {
+      _timecodeFormat = _right._timecodeFormat = 0;
+    }
+
+    return true;
+  }
+
+  void releaseBuffers() {
+    if( _recording ) {
+      _bytes = _right._bytes = nullptr;
+      _recording.reset();
+      return;
+    }
+
+    IDeckLinkMemoryAllocator *allocator = _pool.allocator();
+    if( !allocator ) return;
+
+    if( _bytes ) allocator->ReleaseBuffer( _bytes );
+    if( _right._bytes ) allocator->ReleaseBuffer( _right._bytes );
+    _bytes = _right._bytes = nullptr;
+  }
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) {
+    if( sameIID( iid, IID_IUnknown ) || sameIID( iid, IID_IDeckLinkVideoFrame ) ||
+        sameIID( iid, IID_IDeckLinkVideoInputFrame ) ) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoInputFrame *>(this);
+      return S_OK;
+    } else if( _is3D && sameIID( iid, IID_IDeckLinkVideoFrame3DExtensions ) ) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoFrame3DExtensions *>(this);
+      return S_OK;
+    }
+
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  virtual ULONG STDMETHODCALLTYPE AddRef( void ) { return ++_refCount; }
+
+  virtual ULONG STDMETHODCALLTYPE Release( void ) {
+    const ULONG count = --_refCount;
+    if( count == 0 ) {
+      // If this was the pool's last reference, the pool and this frame
+      // go when it leaves scope
+      std::shared_ptr<InputPool> pool;
+      pool.swap( _checkedOut );
+      pool->recycle( this );
+    }
+    return count;
+  }
+
+  //== IDeckLinkVideoInputFrame ==
+  virtual HRESULT STDMETHODCALLTYPE GetStreamTime( BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale ) {
+    *frameTime = rescale( _streamTime, _streamScale, timeScale );
+    *frameDuration = rescale( _streamDuration, _streamScale, timeScale );
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetHardwareReferenceTimestamp( BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration ) {
+    const SimMode &mode( _pool.mode() );
+    *frameTime = rescale( _hardwareTime, 1000000000, timeScale );
+    *frameDuration = rescale( mode.duration, mode.scale, timeScale );
+    return S_OK;
+  }
+
+  //== IDeckLinkVideoFrame3DExtensions ==
+  virtual BMDVideo3DPackingFormat STDMETHODCALLTYPE Get3DPackingFormat( void ) { return bmdVideo3DPackingLeftOnly; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetFrameForRightEye( IDeckLinkVideoFrame **rightEyeFrame ) {
+    if( !_is3D ) { *rightEyeFrame = nullptr;  return S_FALSE; }
+    AddRef();
+    *rightEyeFrame = &_right;
+    return S_OK;
+  }
+
+private:
+  InputPool &_pool;
+  std::shared_ptr<InputPool> _checkedOut;
+  std::atomic<ULONG> _refCount;
+
+  SimRightEye _right;
+  std::vector<uint8_t> _storage[2];
+
+  bool _is3D;
+  int64_t _hardwareTime;
+
+  // In units of 1/_streamScale seconds
+  int64_t _streamTime, _streamDuration, _streamScale;
+
+  // Set while the frame's buffers are in a recording
+  std::shared_ptr<const RecordingReader> _recording;
+};
+
+InputPool::InputPool( const SimMode &mode, BMDPixelFormat pixFmt, bool is3D,
+                      unsigned int numBuffers, IDeckLinkMemoryAllocator *allocator )
+  : _mode( mode ), _pixelFormat( pixFmt ), _is3D( is3D ),
+    _rowBytes( rowBytesForPixelFormat( pixFmt, mode.width ) ),
+    _allocator( allocator ),
+    _frames(), _free(), _mutex(), _cond()
+{
+  if( _allocator ) {
+    _allocator->AddRef();
+    LOG_IF(WARNING, _allocator->Commit() != S_OK) << "Frame allocator failed to commit";
+  }
+
+  // Each 3D frame takes a buffer per eye
+  const unsigned int numFrames = std::max( 1u, is3D ? numBuffers / 2 : numBuffers );
+  for( unsigned int i = 0; i < numFrames; ++i ) {
+    _frames.emplace_back( new SimInputFrame( *this ) );
+    _free.push_back( _frames.back().get() );
+  }
+
+  for( int i = 0; i < 3; ++i ) {
+    _patterns[i].resize( _rowBytes );
+    renderRow( _patterns[i].data(), _rowBytes, pixFmt, mode.width, i == 1, i == 2 );
+  }
+}
+
+InputPool::~InputPool()
+{
+  _frames.clear();
+
+  if( _allocator ) {
+    _allocator->Decommit();
+    _allocator->Release();
+  }
+}
+
+SimInputFrame *InputPool::checkout()
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  if( _free.empty() ) return nullptr;
+
+  SimInputFrame *frame = _free.back();
+  _free.pop_back();
+  return frame;
+}
+
+void InputPool::recycle( SimInputFrame *frame )
+{
+  frame->releaseBuffers();
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _free.push_back( frame );
+  }
+  _cond.notify_all();
+}
+
+bool InputPool::waitForFree( Clock::duration timeout )
+{
+  std::unique_lock<std::mutex> lock( _mutex );
+  return _cond.wait_for( lock, timeout, [this]{ return !_free.empty(); } );
+}
+
+// Frames made by IDeckLinkOutput::CreateVideoFrame()
+class SimMutableFrame : public RefCounted< SimFrame<IDeckLinkMutableVideoFrame> > {
+public:
+  SimMutableFrame( long width, long height, long rowBytes, BMDPixelFormat pixFmt,
+                   BMDFrameFlags flags, IDeckLinkMemoryAllocator *allocator )
+    : RefCounted< SimFrame<IDeckLinkMutableVideoFrame> >( static_cast<IDeckLinkMutableVideoFrame *>(this) ),
+      _allocator( allocator ), _storage()
+  {
+    _width = width;  _height = height;  _rowBytes = rowBytes;
+    _pixelFormat = pixFmt;  _flags = flags;
+
+    if( _allocator ) {
+      _allocator->AddRef();
+      if( _allocator->AllocateBuffer( rowBytes * height, (void **)&_bytes ) != S_OK ) _bytes = nullptr;
+    } else {
+      _storage.resize( rowBytes * height );
+      _bytes = _storage.data();
+    }
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) {
+    if( sameIID( iid, IID_IUnknown ) || sameIID( iid, IID_IDeckLinkVideoFrame ) ||
+        sameIID( iid, IID_IDeckLinkMutableVideoFrame ) ) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkMutableVideoFrame *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetFlags( BMDFrameFlags flags ) { _flags = flags;  return S_OK; }
+
+  virtual HRESULT STDMETHODCALLTYPE SetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode *timecode ) {
+    uint8_t h, m, s, f;
+    if( !timecode || timecode->GetComponents( &h, &m, &s, &f ) != S_OK ) return E_INVALIDARG;
+    return SetTimecodeFromComponents( format, h, m, s, f, timecode->GetFlags() );
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetTimecodeFromComponents( BMDTimecodeFormat format, uint8_t hours, uint8_t minutes,
+                                                               uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags ) {
+    _timecode.set( hours, minutes, seconds, frames, flags );
+    _timecodeFormat = format;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetAncillaryData( IDeckLinkVideoFrameAncillary *ancillary ) {
+    if( ancillary ) ancillary->AddRef();
+    if( _ancillary ) _ancillary->Release();
+    _ancillary = ancillary;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetTimecodeUserBits( BMDTimecodeFormat format, BMDTimecodeUserBits userBits ) { return S_OK; }
+
+protected:
+  virtual ~SimMutableFrame() {
+    if( _allocator ) {
+      if( _bytes ) _allocator->ReleaseBuffer( _bytes );
+      _allocator->Release();
+    }
+  }
+
+private:
+  IDeckLinkMemoryAllocator *_allocator;
+  std::vector<uint8_t> _storage;
+};
+
+} // namespace
+
+//== Input ==
+
+class SimulatedDeckLink::Input : public IDeckLinkInput {
+public:
+  Input( SimulatedDeckLink &device, const Options &opts, Clock::time_point epoch )
+    : _device( device ), _epoch( epoch ), _numBuffers( std::max( 1u, opts.numBuffers ) ),
+      _callback( nullptr ), _allocator( nullptr ),
+      _sourceMode( opts.recording ? opts.recording->displayMode() : opts.mode ),
+      _source3D( opts.recording ? opts.recording->is3D() : opts.is3D ),
+      _mode( nullptr ), _pixelFormat(0), _flags(0), _pool(),
+      _enabled( false ), _paused( false ), _stop( false ), _formatPending( false ),
+      _noInputPending(0), _realTime( opts.realTime ),
+      _index(0), _next(), _behind(0),
+      _recording( opts.recording ), _position(0), _singleStep( false ), _steps(0),
+      _delivered(0), _dropped(0), _noInput(0), _formatChanges(0)
+  {
+    CHECK( !_recording || _recording->size() > 0 ) << "Recording to play is empty";
+    CHECK( findMode( _sourceMode ) != nullptr ) << "Simulated source mode is not supported";
+  }
+
+  ~Input() {
+    StopStreams();
+    if( _thread.joinable() ) _thread.detach();
+
+    if( _callback ) _callback->Release();
+    if( _allocator ) _allocator->Release();
+  }
+
+  void injectFormatChange( BMDDisplayMode mode, bool is3D ) {
+    CHECK( findMode( mode ) != nullptr ) << "Simulated source mode is not supported";
+
+    std::lock_guard<std::mutex> lock( _mutex );
+    _sourceMode = mode;
+    _source3D = is3D;
+    _formatPending = true;
+    _cond.notify_all();
+  }
+
+  void injectNoInput( unsigned int frames ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _noInputPending += frames;
+  }
+
+  void setRealTime( bool realTime ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _realTime = realTime;
+    _next = Clock::now();
+    _cond.notify_all();
+  }
+
+  void seek( size_t frame ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _position = frame;
+    _next = Clock::now();
+    _cond.notify_all();
+  }
+
+  size_t playbackPosition() {
+    std::lock_guard<std::mutex> lock( _mutex );
+    return _position;
+  }
+
+  void setSingleStep( bool singleStep ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _singleStep = singleStep;
+    _steps = 0;
+    _next = Clock::now();
+    _cond.notify_all();
+  }
+
+  void step( unsigned int frames ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _steps += frames;
+    _cond.notify_all();
+  }
+
+  void stats( Stats &s ) const {
+    s.framesDelivered = _delivered;
+    s.framesDropped = _dropped;
+    s.noInputFrames = _noInput;
+    s.formatChanges = _formatChanges;
+  }
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { return _device.QueryInterface( iid, ppv ); }
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _device.AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _device.Release(); }
+
+  //== IDeckLinkInput ==
+  virtual HRESULT STDMETHODCALLTYPE DoesSupportVideoMode( BMDVideoConnection connection, BMDDisplayMode requestedMode,
+                                                          BMDPixelFormat requestedPixelFormat, BMDVideoInputConversionMode conversionMode,
+                                                          BMDSupportedVideoModeFlags flags, BMDDisplayMode *actualMode, bool *supported ) {
+    return doesSupportVideoMode( requestedMode, requestedPixelFormat, flags & bmdSupportedVideoModeDualStream3D,
+                                 actualMode, supported );
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetDisplayMode( BMDDisplayMode mode, IDeckLinkDisplayMode **displayMode )
+    { return getDisplayMode( mode, displayMode ); }
+
+  virtual HRESULT STDMETHODCALLTYPE GetDisplayModeIterator( IDeckLinkDisplayModeIterator **iterator )
+    { *iterator = new SimDisplayModeIterator();  return S_OK; }
+
+  virtual HRESULT STDMETHODCALLTYPE SetScreenPreviewCallback( IDeckLinkScreenPreviewCallback *callback ) { return E_NOTIMPL; }
+
+  virtual HRESULT STDMETHODCALLTYPE EnableVideoInput( BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags ) {
+    const bool is3D = flags & bmdVideoInputDualStream3D;
+    const SimMode *mode = findMode( displayMode );
+    if( !mode || !supportedPixelFormat( pixelFormat ) || ( is3D && !mode->supports3D() ) ) return E_INVALIDARG;
+
+    // Recorded frames are played as they are
+    if( _recording && pixelFormat != _recording->pixelFormat() ) {
+      LOG(WARNING) << "The recording being played is in pixel format " << std::hex << _recording->pixelFormat()
+                   << ", not " << pixelFormat << std::dec;
+      return E_INVALIDARG;
+    }
+
+    std::lock_guard<std::mutex> lock( _mutex );
+    _mode = mode;
+    _pixelFormat = pixelFormat;
+    _flags = flags;
+    _pool = std::make_shared<InputPool>( *mode, pixelFormat, is3D, _numBuffers, _allocator );
+    _formatPending = ( displayMode != _sourceMode );
+    _enabled = true;
+    _cond.notify_all();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE DisableVideoInput( void ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _enabled = false;
+    _pool.reset();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetAvailableVideoFrameCount( uint32_t *availableFrameCount ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *availableFrameCount = _behind;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetVideoInputFrameMemoryAllocator( IDeckLinkMemoryAllocator *allocator ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( allocator ) allocator->AddRef();
+    if( _allocator ) _allocator->Release();
+    _allocator = allocator;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE EnableAudioInput( BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE DisableAudioInput( void ) { return S_OK; }
+  virtual HRESULT STDMETHODCALLTYPE GetAvailableAudioSampleFrameCount( uint32_t *count ) { *count = 0;  return S_OK; }
+
+  virtual HRESULT STDMETHODCALLTYPE StartStreams( void ) {
+    std::unique_lock<std::mutex> lock( _mutex );
+    if( !_enabled ) return E_ACCESSDENIED;
+
+    if( _thread.joinable() && std::this_thread::get_id() == _thread.get_id() ) {
+      // Restarted from within a callback (e.g. after a format change)
+      _stop = _paused = false;
+      _next = Clock::now();
+      return S_OK;
+    }
+
+    if( _stop && _thread.joinable() ) {
+      lock.unlock();
+      _thread.join();
+      lock.lock();
+    }
+
+    _paused = false;
+    _next = Clock::now();
+
+    if( !_thread.joinable() ) {
+      _stop = false;
+      _index = 0;
+      _thread = std::thread( &Input::run, this );
+    }
+
+    _cond.notify_all();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE StopStreams( void ) {
+    std::unique_lock<std::mutex> lock( _mutex );
+    _stop = true;
+    _cond.notify_all();
+
+    // From a callback the thread finishes once the callback returns
+    if( !_thread.joinable() || std::this_thread::get_id() == _thread.get_id() ) return S_OK;
+
+    lock.unlock();
+    _thread.join();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE PauseStreams( void ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _paused = true;
+    return S_OK;
+  }
+
+  // No frames are ever queued
+  virtual HRESULT STDMETHODCALLTYPE FlushStreams( void ) { return S_OK; }
+
+  virtual HRESULT STDMETHODCALLTYPE SetCallback( IDeckLinkInputCallback *callback ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( callback ) callback->AddRef();
+    if( _callback ) _callback->Release();
+    _callback = callback;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetHardwareReferenceClock( BMDTimeScale timeScale, BMDTimeValue *hardwareTime,
+                                                               BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    const SimMode &mode( _mode ? *_mode : *findMode( _sourceMode ) );
+
+    *hardwareTime = rescale( nanosSince( _epoch ), 1000000000, timeScale );
+    *ticksPerFrame = rescale( mode.duration, mode.scale, timeScale );
+    *timeInFrame = *ticksPerFrame > 0 ? *hardwareTime % *ticksPerFrame : 0;
+    return S_OK;
+  }
+
+private:
+
+  void run();
+
+  // Until the frame after recorded is due
+  Clock::duration recordedPeriod( const RecordingReader::Frame &recorded ) const;
+
+  SimulatedDeckLink &_device;
+  const Clock::time_point _epoch;
+  const unsigned int _numBuffers;
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::thread _thread;
+
+  IDeckLinkInputCallback *_callback;
+  IDeckLinkMemoryAllocator *_allocator;
+
+  // What the source is sending
+  BMDDisplayMode _sourceMode;
+  bool _source3D;
+
+  // What the application enabled
+  const SimMode *_mode;
+  BMDPixelFormat _pixelFormat;
+  BMDVideoInputFlags _flags;
+  std::shared_ptr<InputPool> _pool;
+
+  bool _enabled, _paused, _stop, _formatPending;
+  unsigned int _noInputPending;
+  bool _realTime;
+
+  uint64_t _index;
+  Clock::time_point _next;
+  uint32_t _behind;
+
+  // Playing a recording
+  const std::shared_ptr<const RecordingReader> _recording;
+  size_t _position;
+  bool _singleStep;
+  unsigned int _steps;
+
+  std::atomic<unsigned long> _delivered, _dropped, _noInput, _formatChanges;
+};
+
+Clock::duration SimulatedDeckLink::Input::recordedPeriod( const RecordingReader::Frame &recorded ) const
+{
+  const RecordedFrameHeader &header( recorded.header() );
+  const RecordingReader::Frame next( _recording->frame( _position + 1 ) );
+
+  // Gaps where frames weren't recorded are kept;  the last frame, or a
+  // jump backwards, takes the frame's own duration
+  int64_t ticks = header.streamDuration;
+  if( next.valid() && next.header().timeScale == header.timeScale &&
+      next.header().streamTime > header.streamTime )
+    ticks = next.header().streamTime - header.streamTime;
+
+  if( ticks <= 0 || header.timeScale <= 0 ) return _mode->period();
+  return std::chrono::duration_cast<Clock::duration>( std::chrono::nanoseconds( rescale( ticks, header.timeScale, 1000000000 ) ) );
+}
+
+// Callbacks are made without _mutex held, as the application calls
+// straight back into the input from them
+void SimulatedDeckLink::Input::run()
+{
+  std::unique_lock<std::mutex> lock( _mutex );
+
+  while( !_stop ) {
+    if( _paused || !_enabled ) {
+      _cond.wait( lock );
+      continue;
+    }
+
+    if( _formatPending && (_flags & bmdVideoInputEnableFormatDetection) ) {
+      _formatPending = false;
+      ++_formatChanges;
+
+      IDeckLinkDisplayMode *mode = new SimDisplayMode( *findMode( _sourceMode ) );
+      const BMDDetectedVideoInputFormatFlags formatFlags = bmdDetectedVideoInputYCbCr422 |
+          ( _source3D ? bmdDetectedVideoInputDualStream3D : 0 );
+
+      IDeckLinkInputCallback *callback = _callback;
+      if( callback ) callback->AddRef();
+      lock.unlock();
+
+      if( callback ) {
+        callback->VideoInputFormatChanged( bmdVideoInputDisplayModeChanged, mode, formatFlags );
+        callback->Release();
+      }
+      mode->Release();
+
+      lock.lock();
+      continue;
+    }
+
+    RecordingReader::Frame recorded;
+    if( _recording ) {
+      // At the end, or waiting to be stepped
+      if( _position >= _recording->size() || ( _singleStep && _steps == 0 ) ) {
+        _behind = 0;
+        _cond.wait( lock );
+        continue;
+      }
+
+      recorded = _recording->frame( _position );
+      if( !recorded.valid() ) {
+        LOG(WARNING) << "Skipping damaged frame " << _position << " of the recording";
+        ++_position;
+        continue;
+      }
+    }
+
+    // Stepped frames are never lost to pacing
+    const bool realTime = _realTime && !( _recording && _singleStep );
+    const Clock::duration period = _recording ? recordedPeriod( recorded ) : _mode->period();
+
+    if( realTime ) {
+      const Clock::time_point now = Clock::now();
+      if( now < _next ) {
+        _behind = 0;
+        _cond.wait_until( lock, _next );
+        continue;
+      }
+
+      // The card only has so many buffers;  past that, frames are lost
+      _behind = (now - _next) / period;
+      if( _behind >= _numBuffers ) {
+        _index += _behind;
+        _dropped += _behind;
+        _next += _behind * period;
+
+        if( _recording ) {
+          _position += std::min<size_t>( _behind, _recording->size() - _position );
+          _behind = 0;
+          continue;
+        }
+        _behind = 0;
+      }
+    } else {
+      _next = Clock::now();
+    }
+
+    std::shared_ptr<InputPool> pool( _pool );
+    SimInputFrame *frame = pool->checkout();
+
+    const bool noInput = ( _sourceMode != _mode->mode ) || _noInputPending > 0;
+    const bool prepared = frame && ( ( _recording && !noInput )
+                                     ? frame->play( pool, _recording, recorded, nanosSince( _epoch ) )
+                                     : frame->prepare( pool, _index, noInput, _source3D, nanosSince( _epoch ) ) );
+    if( !prepared ) {
+      if( frame ) pool->recycle( frame );
+
+      if( realTime ) {
+        ++_dropped;
+        ++_index;
+        if( _recording ) ++_position;
+        _next += period;
+      } else {
+        // As fast as possible means as fast as the application hands frames back
+        lock.unlock();
+        pool->waitForFree( std::chrono::milliseconds(10) );
+        lock.lock();
+      }
+      continue;
+    }
+
+    if( _noInputPending > 0 ) --_noInputPending;
+    if( noInput || (frame->GetFlags() & bmdFrameHasNoInputSource) ) ++_noInput;
+    ++_index;
+    _next += period;
+
+    if( _recording ) {
+      ++_position;
+      if( _steps > 0 ) --_steps;
+    }
+
+    IDeckLinkInputCallback *callback = _callback;
+    if( callback ) callback->AddRef();
+    lock.unlock();
+
+    if( callback ) {
+      callback->VideoInputFrameArrived( frame, nullptr );
+      callback->Release();
+    }
+    ++_delivered;
+    frame->Release();
+
+    lock.lock();
+  }
+}
+
+//== Output ==
+
+class SimulatedDeckLink::Output : public IDeckLinkOutput {
+public:
+  Output( SimulatedDeckLink &device, Clock::time_point epoch )
+    : _device( device ), _epoch( epoch ),
+      _callback( nullptr ), _allocator( nullptr ), _frameCallback(),
+      _mode( nullptr ), _scheduled(),
+      _playing( false ), _stopRequested( false ),
+      _playbackStart(), _startTime(0), _playbackScale(1), _speed(0),
+      _completedFrame( nullptr ), _completedTime(0),
+      _framesScheduled(0), _framesCompleted(0)
+  {;}
+
+  ~Output() {
+    DisableVideoOutput();
+    if( _callback ) _callback->Release();
+    if( _allocator ) _allocator->Release();
+  }
+
+  void setFrameCallback( OutputFrameCallback callback ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _frameCallback = callback;
+  }
+
+  void stats( Stats &s ) const {
+    s.outputFramesScheduled = _framesScheduled;
+    s.outputFramesCompleted = _framesCompleted;
+  }
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { return _device.QueryInterface( iid, ppv ); }
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _device.AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _device.Release(); }
+
+  //== IDeckLinkOutput ==
+  virtual HRESULT STDMETHODCALLTYPE DoesSupportVideoMode( BMDVideoConnection connection, BMDDisplayMode requestedMode,
+                                                          BMDPixelFormat requestedPixelFormat, BMDVideoOutputConversionMode conversionMode,
+                                                          BMDSupportedVideoModeFlags flags, BMDDisplayMode *actualMode, bool *supported ) {
+    return doesSupportVideoMode( requestedMode, requestedPixelFormat, flags & bmdSupportedVideoModeDualStream3D,
+                                 actualMode, supported );
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetDisplayMode( BMDDisplayMode mode, IDeckLinkDisplayMode **displayMode )
+    { return getDisplayMode( mode, displayMode ); }
+
+  virtual HRESULT STDMETHODCALLTYPE GetDisplayModeIterator( IDeckLinkDisplayModeIterator **iterator )
+    { *iterator = new SimDisplayModeIterator();  return S_OK; }
+
+  virtual HRESULT STDMETHODCALLTYPE SetScreenPreviewCallback( IDeckLinkScreenPreviewCallback *callback ) { return E_NOTIMPL; }
+
+  virtual HRESULT STDMETHODCALLTYPE EnableVideoOutput( BMDDisplayMode displayMode, BMDVideoOutputFlags flags ) {
+    const SimMode *mode = findMode( displayMode );
+    if( !mode ) return E_INVALIDARG;
+
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( _playing ) return E_ACCESSDENIED;
+    _mode = mode;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE DisableVideoOutput( void ) {
+    std::unique_lock<std::mutex> lock( _mutex );
+    _stopRequested = true;
+    _cond.notify_all();
+
+    if( _thread.joinable() ) {
+      lock.unlock();
+      if( std::this_thread::get_id() == _thread.get_id() ) _thread.detach();
+      else _thread.join();
+      lock.lock();
+    }
+
+    // Frames still scheduled are dropped without completion
+    std::deque<Scheduled> scheduled;
+    scheduled.swap( _scheduled );
+    _mode = nullptr;
+    lock.unlock();
+
+    for( Scheduled &s : scheduled ) s.frame->Release();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetVideoOutputFrameMemoryAllocator( IDeckLinkMemoryAllocator *allocator ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( allocator ) allocator->AddRef();
+    if( _allocator ) _allocator->Release();
+    _allocator = allocator;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE CreateVideoFrame( int32_t width, int32_t height, int32_t rowBytes, BMDPixelFormat pixelFormat,
+                                                      BMDFrameFlags flags, IDeckLinkMutableVideoFrame **outFrame ) {
+    *outFrame = nullptr;
+    if( width <= 0 || height <= 0 || rowBytes < int32_t(rowBytesForPixelFormat( pixelFormat, width )) ) return E_INVALIDARG;
+
+    IDeckLinkMemoryAllocator *allocator;
+    {
+      std::lock_guard<std::mutex> lock( _mutex );
+      allocator = _allocator;
+    }
+
+    IDeckLinkMutableVideoFrame *frame = new SimMutableFrame( width, height, rowBytes, pixelFormat, flags, allocator );
+
+    void *bytes = nullptr;
+    if( frame->GetBytes( &bytes ) != S_OK ) {
+      frame->Release();
+      return E_OUTOFMEMORY;
+    }
+
+    *outFrame = frame;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE CreateAncillaryData( BMDPixelFormat pixelFormat, IDeckLinkVideoFrameAncillary **buffer ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *buffer = nullptr;
+    if( !_mode ) return E_ACCESSDENIED;
+
+    *buffer = new SimAncillary( *_mode, pixelFormat );
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE DisplayVideoFrameSync( IDeckLinkVideoFrame *frame ) {
+    OutputFrameCallback callback;
+    {
+      std::lock_guard<std::mutex> lock( _mutex );
+      if( !_mode ) return E_ACCESSDENIED;
+      callback = _frameCallback;
+    }
+
+    if( callback ) callback( frame );
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE ScheduleVideoFrame( IDeckLinkVideoFrame *frame, BMDTimeValue displayTime,
+                                                        BMDTimeValue displayDuration, BMDTimeScale timeScale ) {
+    if( !frame ) return E_INVALIDARG;
+
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( !_mode ) return E_ACCESSDENIED;
+
+    frame->AddRef();
+    _scheduled.push_back( Scheduled{ frame, displayTime, displayDuration, timeScale } );
+    ++_framesScheduled;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE SetScheduledFrameCompletionCallback( IDeckLinkVideoOutputCallback *callback ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( callback ) callback->AddRef();
+    if( _callback ) _callback->Release();
+    _callback = callback;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetBufferedVideoFrameCount( uint32_t *bufferedFrameCount ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *bufferedFrameCount = _scheduled.size();
+    return S_OK;
+  }
+
+  //== Audio output is not simulated ==
+  virtual HRESULT STDMETHODCALLTYPE EnableAudioOutput( BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType,
+                                                       uint32_t channelCount, uint32_t streamType ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE DisableAudioOutput( void ) { return S_OK; }
+  virtual HRESULT STDMETHODCALLTYPE WriteAudioSamplesSync( void *buffer, uint32_t sampleFrameCount, uint32_t *sampleFramesWritten ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE BeginAudioPreroll( void ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE EndAudioPreroll( void ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE ScheduleAudioSamples( void *buffer, uint32_t sampleFrameCount, BMDTimeValue streamTime,
+                                                          BMDTimeScale timeScale, uint32_t *sampleFramesWritten ) { return E_NOTIMPL; }
+  virtual HRESULT STDMETHODCALLTYPE GetBufferedAudioSampleFrameCount( uint32_t *bufferedSampleFrameCount ) { *bufferedSampleFrameCount = 0;  return S_OK; }
+  virtual HRESULT STDMETHODCALLTYPE FlushBufferedAudioSamples( void ) { return S_OK; }
+  virtual HRESULT STDMETHODCALLTYPE SetAudioCallback( IDeckLinkAudioOutputCallback *callback ) { return E_NOTIMPL; }
+
+  //== Scheduled playback ==
+  virtual HRESULT STDMETHODCALLTYPE StartScheduledPlayback( BMDTimeValue playbackStartTime, BMDTimeScale timeScale, double playbackSpeed ) {
+    std::unique_lock<std::mutex> lock( _mutex );
+    if( !_mode || timeScale <= 0 ) return E_ACCESSDENIED;
+    if( _playing ) return S_OK;
+
+    // Collect a playback thread which has already stopped
+    if( _thread.joinable() ) {
+      lock.unlock();
+      if( std::this_thread::get_id() == _thread.get_id() ) _thread.detach();
+      else _thread.join();
+      lock.lock();
+    }
+
+    _playing = true;
+    _stopRequested = false;
+    _playbackStart = Clock::now();
+    _startTime = playbackStartTime;
+    _playbackScale = timeScale;
+    _speed = playbackSpeed;
+    _thread = std::thread( &Output::run, this );
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE StopScheduledPlayback( BMDTimeValue stopPlaybackAtTime, BMDTimeValue *actualStopTime, BMDTimeScale timeScale ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( actualStopTime ) *actualStopTime = streamTime( timeScale );
+    if( !_playing ) return S_OK;
+
+    _stopRequested = true;
+    _cond.notify_all();
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE IsScheduledPlaybackRunning( bool *active ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *active = _playing;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetScheduledStreamTime( BMDTimeScale desiredTimeScale, BMDTimeValue *time, double *playbackSpeed ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *time = streamTime( desiredTimeScale );
+    *playbackSpeed = _playing ? _speed : 0.0;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetReferenceStatus( BMDReferenceStatus *referenceStatus ) {
+    *referenceStatus = bmdReferenceNotSupportedByHardware;
+    return S_OK;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetHardwareReferenceClock( BMDTimeScale timeScale, BMDTimeValue *hardwareTime,
+                                                               BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    *hardwareTime = rescale( nanosSince( _epoch ), 1000000000, timeScale );
+    *ticksPerFrame = _mode ? rescale( _mode->duration, _mode->scale, timeScale ) : 0;
+    *timeInFrame = *ticksPerFrame > 0 ? *hardwareTime % *ticksPerFrame : 0;
+    return S_OK;
+  }
+
+  // Valid for the frame being completed, during its callback
+  virtual HRESULT STDMETHODCALLTYPE GetFrameCompletionReferenceTimestamp( IDeckLinkVideoFrame *frame, BMDTimeScale timeScale,
+                                                                          BMDTimeValue *frameCompletionTimestamp ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( !frame || frame != _completedFrame ) return E_FAIL;
+    *frameCompletionTimestamp = rescale( _completedTime, 1000000000, timeScale );
+    return S_OK;
+  }
+
+private:
+
+  struct Scheduled {
+    IDeckLinkVideoFrame *frame;
+    BMDTimeValue time, duration;
+    BMDTimeScale scale;
+  };
+
+  void run();
+  void complete( IDeckLinkVideoOutputCallback *callback, IDeckLinkVideoFrame *frame,
+                 BMDOutputFrameCompletionResult result );
+
+  // Called with _mutex held
+  BMDTimeValue streamTime( BMDTimeScale timeScale ) const {
+    if( !_playing || timeScale <= 0 ) return 0;
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - _playbackStart ).count();
+    return rescale( _startTime, _playbackScale, timeScale ) + rescale( int64_t(elapsed * _speed), 1000000000, timeScale );
+  }
+
+  SimulatedDeckLink &_device;
+  const Clock::time_point _epoch;
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::thread _thread;
+
+  IDeckLinkVideoOutputCallback *_callback;
+  IDeckLinkMemoryAllocator *_allocator;
+  OutputFrameCallback _frameCallback;
+
+  const SimMode *_mode;
+  std::deque<Scheduled> _scheduled;
+
+  bool _playing, _stopRequested;
+  Clock::time_point _playbackStart;
+  BMDTimeValue _startTime;
+  BMDTimeScale _playbackScale;
+  double _speed;
+
+  IDeckLinkVideoFrame *_completedFrame;
+  int64_t _completedTime;
+
+  std::atomic<unsigned long> _framesScheduled, _framesCompleted;
+};
+
+void SimulatedDeckLink::Output::complete( IDeckLinkVideoOutputCallback *callback, IDeckLinkVideoFrame *frame,
+                                          BMDOutputFrameCompletionResult result )
+{
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _completedFrame = frame;
+    _completedTime = nanosSince( _epoch );
+  }
+
+  if( callback ) callback->ScheduledFrameCompleted( frame, result );
+  frame->Release();
+
+  std::lock_guard<std::mutex> lock( _mutex );
+  _completedFrame = nullptr;
+}
+
+// Shows one frame per frame period, in the order they were scheduled.
+// Scheduled times are not honoured;  if nothing is scheduled the last
+// frame simply stays up.
+void SimulatedDeckLink::Output::run()
+{
+  std::unique_lock<std::mutex> lock( _mutex );
+
+  IDeckLinkVideoOutputCallback *callback = _callback;
+  if( callback ) callback->AddRef();
+  OutputFrameCallback frameCallback( _frameCallback );
+
+  const Clock::duration period = _mode->period();
+  Clock::time_point next = _playbackStart + period;
+
+  while( !_stopRequested ) {
+    if( _cond.wait_until( lock, next, [this]{ return _stopRequested; } ) ) break;
+    next += period;
+
+    if( _scheduled.empty() ) continue;
+
+    Scheduled s = _scheduled.front();
+    _scheduled.pop_front();
+    lock.unlock();
+
+    if( frameCallback ) frameCallback( s.frame );
+    complete( callback, s.frame, bmdOutputFrameCompleted );
+    ++_framesCompleted;
+
+    lock.lock();
+  }
+
+  // Frames scheduled during the flush wait for the next playback
+  std::deque<Scheduled> flushed;
+  flushed.swap( _scheduled );
+  lock.unlock();
+
+  for( Scheduled &s : flushed ) complete( callback, s.frame, bmdOutputFrameFlushed );
+
+  lock.lock();
+  _playing = false;
+  lock.unlock();
+
+  if( callback ) {
+    callback->ScheduledPlaybackHasStopped();
+    callback->Release();
+  }
+}
+
+//== Attributes ==
+
+class SimulatedDeckLink::Attributes : public IDeckLinkProfileAttributes {
+public:
+  Attributes( SimulatedDeckLink &device, const Options &opts )
+    : _device( device ), _formatDetection( opts.formatDetection ) {;}
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { return _device.QueryInterface( iid, ppv ); }
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _device.AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _device.Release(); }
+
+  virtual HRESULT STDMETHODCALLTYPE GetFlag( BMDDeckLinkAttributeID cfgID, bool *value ) {
+    switch( cfgID ) {
+      case BMDDeckLinkSupportsInputFormatDetection:  *value = _formatDetection;  return S_OK;
+      case BMDDeckLinkSupportsDualLinkSDI:           *value = false;  return S_OK;
+    }
+    return E_INVALIDARG;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetInt( BMDDeckLinkAttributeID cfgID, int64_t *value ) {
+    switch( cfgID ) {
+      case BMDDeckLinkProfileID:            *value = bmdProfileOneSubDeviceFullDuplex;  return S_OK;
+      case BMDDeckLinkNumberOfSubDevices:   *value = 1;  return S_OK;
+      case BMDDeckLinkSubDeviceIndex:       *value = 0;  return S_OK;
+      case BMDDeckLinkPersistentID:
+      case BMDDeckLinkTopologicalID:        *value = 0;  return S_OK;
+    }
+    return E_INVALIDARG;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetFloat( BMDDeckLinkAttributeID cfgID, double *value ) { return E_INVALIDARG; }
+
+  virtual HRESULT STDMETHODCALLTYPE GetString( BMDDeckLinkAttributeID cfgID, const char **value ) {
+    switch( cfgID ) {
+      case BMDDeckLinkModelName:     *value = strdup( kModelName );  return S_OK;
+      case BMDDeckLinkDisplayName:   *value = strdup( kModelName );  return S_OK;
+      case BMDDeckLinkDeviceHandle:  *value = strdup( "sim:0" );  return S_OK;
+    }
+    return E_INVALIDARG;
+  }
+
+  static const char *kModelName;
+
+private:
+  SimulatedDeckLink &_device;
+  bool _formatDetection;
+};
+
+const char *SimulatedDeckLink::Attributes::kModelName = "Simulated DeckLink";
+
+//== Configuration ==
+
+// Stores whatever it is given;  none of it changes the simulation
+class SimulatedDeckLink::Configuration : public IDeckLinkConfiguration {
+public:
+  Configuration( SimulatedDeckLink &device ) : _device( device ) {;}
+
+  //== IUnknown ==
+  virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) { return _device.QueryInterface( iid, ppv ); }
+  virtual ULONG STDMETHODCALLTYPE AddRef( void )  { return _device.AddRef(); }
+  virtual ULONG STDMETHODCALLTYPE Release( void ) { return _device.Release(); }
+
+  virtual HRESULT STDMETHODCALLTYPE SetFlag( BMDDeckLinkConfigurationID cfgID, bool value )        { return set( _flags, cfgID, value ); }
+  virtual HRESULT STDMETHODCALLTYPE GetFlag( BMDDeckLinkConfigurationID cfgID, bool *value )       { return get( _flags, cfgID, value ); }
+  virtual HRESULT STDMETHODCALLTYPE SetInt( BMDDeckLinkConfigurationID cfgID, int64_t value )      { return set( _ints, cfgID, value ); }
+  virtual HRESULT STDMETHODCALLTYPE GetInt( BMDDeckLinkConfigurationID cfgID, int64_t *value )     { return get( _ints, cfgID, value ); }
+  virtual HRESULT STDMETHODCALLTYPE SetFloat( BMDDeckLinkConfigurationID cfgID, double value )     { return set( _floats, cfgID, value ); }
+  virtual HRESULT STDMETHODCALLTYPE GetFloat( BMDDeckLinkConfigurationID cfgID, double *value )    { return get( _floats, cfgID, value ); }
+
+  virtual HRESULT STDMETHODCALLTYPE SetString( BMDDeckLinkConfigurationID cfgID, const char *value ) {
+    return value ? set( _strings, cfgID, std::string( value ) ) : E_INVALIDARG;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE GetString( BMDDeckLinkConfigurationID cfgID, const char **value ) {
+    std::string str;
+    const HRESULT result = get( _strings, cfgID, &str );
+    if( result == S_OK ) *value = strdup( str.c_str() );
+    return result;
+  }
+
+  virtual HRESULT STDMETHODCALLTYPE WriteConfigurationToPreferences( void ) { return S_OK; }
+
+private:
+
+  template< typename T >
+  HRESULT set( std::map< BMDDeckLinkConfigurationID, T > &values, BMDDeckLinkConfigurationID cfgID, const T &value ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    values[cfgID] = value;
+    return S_OK;
+  }
+
+  template< typename T >
+  HRESULT get( const std::map< BMDDeckLinkConfigurationID, T > &values, BMDDeckLinkConfigurationID cfgID, T *value ) {
+    std::lock_guard<std::mutex> lock( _mutex );
+    auto itr = values.find( cfgID );
+    if( itr == values.end() ) return E_INVALIDARG;
+    *value = itr->second;
+    return S_OK;
+  }
+
+  SimulatedDeckLink &_device;
+
+  std::mutex _mutex;
+  std::map< BMDDeckLinkConfigurationID, bool > _flags;
+  std::map< BMDDeckLinkConfigurationID, int64_t > _ints;
+  std::map< BMDDeckLinkConfigurationID, double > _floats;
+  std::map< BMDDeckLinkConfigurationID, std::string > _strings;
+};
+
+//== SimulatedDeckLink ==
+
+SimulatedDeckLink::SimulatedDeckLink( const Options &opts )
+  : _refCount(1)
+{
+  const Clock::time_point epoch = Clock::now();
+
+  _input.reset( new Input( *this, opts, epoch ) );
+  _output.reset( new Output( *this, epoch ) );
+  _attributes.reset( new Attributes( *this, opts ) );
+  _configuration.reset( new Configuration( *this ) );
+}
+
+SimulatedDeckLink::~SimulatedDeckLink()
+{
+  // Stop the threads before anything they use goes away
+  _input.reset();
+  _output.reset();
+}
+
+void SimulatedDeckLink::injectFormatChange( BMDDisplayMode mode, bool is3D )
+{ _input->injectFormatChange( mode, is3D ); }
+
+void SimulatedDeckLink::injectNoInput( unsigned int frames )
+{ _input->injectNoInput( frames ); }
+
+void SimulatedDeckLink::setRealTime( bool realTime )
+{ _input->setRealTime( realTime ); }
+
+void SimulatedDeckLink::seek( size_t frame )
+{ _input->seek( frame ); }
+
+size_t SimulatedDeckLink::playbackPosition() const
+{ return _input->playbackPosition(); }
+
+void SimulatedDeckLink::setSingleStep( bool singleStep )
+{ _input->setSingleStep( singleStep ); }
+
+void SimulatedDeckLink::step( unsigned int frames )
+{ _input->step( frames ); }
+
+void SimulatedDeckLink::setOutputFrameCallback( OutputFrameCallback callback )
+{ _output->setFrameCallback( callback ); }
+
+SimulatedDeckLink::Stats SimulatedDeckLink::stats() const
+{
+  Stats s;
+  _input->stats( s );
+  _output->stats( s );
+  return s;
+}
+
+//== IUnknown ==
+
+HRESULT SimulatedDeckLink::QueryInterface( REFIID iid, LPVOID *ppv )
+{
+  IUnknown *iface = nullptr;
+
+  if( sameIID( iid, IID_IUnknown ) || sameIID( iid, IID_IDeckLink ) ) {
+    iface = static_cast<IDeckLink *>(this);
+  } else if( sameIID( iid, IID_IDeckLinkInput ) ) {
+    iface = _input.get();
+  } else if( sameIID( iid, IID_IDeckLinkOutput ) ) {
+    iface = _output.get();
+  } else if( sameIID( iid, IID_IDeckLinkProfileAttributes ) ) {
+    iface = _attributes.get();
+  } else if( sameIID( iid, IID_IDeckLinkConfiguration ) ) {
+    iface = _configuration.get();
+  }
+
+  *ppv = iface;
+  if( !iface ) return E_NOINTERFACE;
+
+  AddRef();
+  return S_OK;
+}
+
+ULONG SimulatedDeckLink::AddRef( void )
+{
+  return ++_refCount;
+}
+
+ULONG SimulatedDeckLink::Release( void )
+{
+  const int32_t count = --_refCount;
+  if( count == 0 ) delete this;
+  return count;
+}
+
+//== IDeckLink ==
+
+HRESULT SimulatedDeckLink::GetModelName( const char **modelName )
+{
+  *modelName = strdup( Attributes::kModelName );
+  return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetDisplayName( const char **displayName )
+{
+  *displayName = strdup( Attributes::kModelName );
+  return S_OK;
+}
+
+}
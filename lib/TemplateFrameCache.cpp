@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/DataTypes.h"
+#include "libblackmagic/TemplateFrameCache.h"
+
+namespace libblackmagic {
+
+namespace {
+
+  // 10-bit video range Y'CbCr
+  struct Colour {
+    uint32_t y, cb, cr;
+  };
+
+  // As kBlueData in the SDK's VancOutput example
+  const Colour kBlue = { 680, 664, 64 };
+  const Colour kBlack = { 64, 512, 512 };
+
+  // 75% bars, Rec. 709
+  const Colour kBars[8] = {
+    { 721, 512, 512 },    // white
+    { 674, 176, 543 },    // yellow
+    { 581, 589, 176 },    // cyan
+    { 534, 253, 207 },    // green
+    { 251, 771, 817 },    // magenta
+    { 204, 435, 848 },    // red
+    { 111, 848, 481 },    // blue
+    {  64, 512, 512 }     // black
+  };
+
+  const Colour &colourAt( long x, long width, TemplateFrameCache::Pattern pattern )
+  {
+    if( pattern == TemplateFrameCache::Blue ) return kBlue;
+    if( pattern == TemplateFrameCache::Black ) return kBlack;
+    return kBars[ std::min( x, width - 1 ) * 8 / width ];
+  }
+
+  inline uint32_t packV210( uint32_t a, uint32_t b, uint32_t c )
+    { return a | (b << 10) | (c << 20); }
+
+  // Fills dst[unit, total) with copies of dst[0, unit), doubling each
+  // time, so it's a handful of large memcpy()s
+  void replicate( uint8_t *dst, size_t unit, size_t total )
+  {
+    for( size_t filled = unit; filled < total; filled *= 2 )
+      memcpy( dst + filled, dst, std::min( filled, total - filled ) );
+  }
+
+}
+
+TemplateFrameCache::TemplateFrameCache()
+  : _mutex(), _templates()
+{;}
+
+TemplateFrameCache &TemplateFrameCache::shared()
+{
+  static TemplateFrameCache cache;
+  return cache;
+}
+
+bool TemplateFrameCache::renderRow( uint8_t *row, long width, long rowBytes,
+                                    BMDPixelFormat pixFmt, Pattern pattern )
+{
+  // Bars change colour every width/8 pixels;  anything else is one group
+  // of pixels repeated
+  const bool solid = pattern != Bars;
+
+  if( pixFmt == bmdFormat10BitYUV ) {
+    // Six pixels in four words;  padding at the end of the row gets the
+    // last colour
+    const long groups = solid ? 1 : rowBytes / 16;
+    uint32_t *w = reinterpret_cast<uint32_t *>( row );
+    for( long g = 0; g < groups; ++g, w += 4 ) {
+      const Colour *p[6];
+      for( int i = 0; i < 6; ++i ) p[i] = &colourAt( g * 6 + i, width, pattern );
+
+      w[0] = packV210( p[0]->cb, p[0]->y,  p[0]->cr );
+      w[1] = packV210( p[1]->y,  p[2]->cb, p[2]->y );
+      w[2] = packV210( p[2]->cr, p[3]->y,  p[4]->cb );
+      w[3] = packV210( p[4]->y,  p[4]->cr, p[5]->y );
+    }
+
+    if( solid ) replicate( row, 16, rowBytes );
+    return true;
+  }
+
+  if( pixFmt == bmdFormat8BitYUV ) {
+    const long pairs = solid ? 1 : rowBytes / 4;
+    for( long x = 0; x < pairs * 2; x += 2 ) {
+      const Colour &p0( colourAt( x, width, pattern ) ), &p1( colourAt( x + 1, width, pattern ) );
+      row[2*x]   = p0.cb >> 2;
+      row[2*x+1] = p0.y >> 2;
+      row[2*x+2] = p0.cr >> 2;
+      row[2*x+3] = p1.y >> 2;
+    }
+
+    if( solid ) replicate( row, 4, rowBytes );
+    return true;
+  }
+
+  return false;
+}
+
+TemplateFrameCache::TemplatePtr TemplateFrameCache::get( IDeckLinkOutput *output, BMDDisplayMode mode,
+                                                         BMDPixelFormat pixFmt, Pattern pattern )
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  const Key key( mode, pixFmt, pattern );
+  auto found = _templates.find( key );
+  if( found != _templates.end() ) return found->second;
+
+  IDeckLinkDisplayMode *displayMode = nullptr;
+  if( !output || output->GetDisplayMode( mode, &displayMode ) != S_OK || !displayMode ) {
+    LOG(WARNING) << "Output doesn't support mode " << displayModeToString( mode ) << ", can't make a template frame";
+    return TemplatePtr();
+  }
+
+  std::shared_ptr<Template> t( std::make_shared<Template>() );
+  t->mode = mode;
+  t->pixelFormat = pixFmt;
+  t->pattern = pattern;
+  t->width = displayMode->GetWidth();
+  t->height = displayMode->GetHeight();
+  t->rowBytes = rowBytesForPixelFormat( pixFmt, t->width );
+  displayMode->Release();
+
+  if( t->rowBytes == 0 || t->height <= 0 ) {
+    LOG(WARNING) << "Can't make template frames in " << pixelFormatToString( pixFmt );
+    return TemplatePtr();
+  }
+
+  // The first row, then the rest as copies of it
+  t->bytes.resize( size_t( t->rowBytes ) * t->height );
+  if( !renderRow( t->bytes.data(), t->width, t->rowBytes, pixFmt, pattern ) ) {
+    LOG(WARNING) << "Can't make template frames in " << pixelFormatToString( pixFmt );
+    return TemplatePtr();
+  }
+  replicate( t->bytes.data(), t->rowBytes, t->bytes.size() );
+
+  LOG(DEBUG) << "Made a " << t->width << "x" << t->height << " template frame in " << pixelFormatToString( pixFmt );
+
+  _templates[key] = t;
+  return t;
+}
+
+IDeckLinkMutableVideoFrame *TemplateFrameCache::makeFrame( IDeckLinkOutput *output, BMDDisplayMode mode,
+                                                           BMDPixelFormat pixFmt, Pattern pattern )
+{
+  const TemplatePtr t( get( output, mode, pixFmt, pattern ) );
+  if( !t ) return nullptr;
+
+  IDeckLinkMutableVideoFrame *frame = nullptr;
+  HRESULT result = output->CreateVideoFrame( t->width, t->height, t->rowBytes, pixFmt, bmdFrameFlagDefault, &frame );
+  if( result != S_OK || !frame ) {
+    LOGF(WARNING, "Could not create a video frame - result = %08x\n", result);
+    return nullptr;
+  }
+
+  void *bytes = nullptr;
+  if( frame->GetBytes( &bytes ) != S_OK || !bytes ) {
+    frame->Release();
+    return nullptr;
+  }
+
+  memcpy( bytes, t->bytes.data(), t->bytes.size() );
+  return frame;
+}
+
+void TemplateFrameCache::clear()
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  _templates.clear();
+}
+
+size_t TemplateFrameCache::size() const
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  return _templates.size();
+}
+
+}
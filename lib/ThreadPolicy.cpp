@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <g3log/g3log.hpp>
+
+#include "libblackmagic/DeckLink.h"
+#include "libblackmagic/ThreadPolicy.h"
+
+namespace libblackmagic {
+
+static const char *kNodePath = "/sys/devices/system/node/node";
+
+static std::string describe( const ThreadPolicy &policy )
+{
+  return policy.name.empty() ? std::string("thread") : policy.name;
+}
+
+bool applyThreadPolicy( const ThreadPolicy &policy, const std::vector<int> &defaultCpus )
+{
+  bool ok = true;
+
+  if( !policy.name.empty() ) {
+    const std::string name( policy.name.substr( 0, 15 ) );
+    const int err = pthread_setname_np( pthread_self(), name.c_str() );
+    if( err != 0 ) {
+      LOG(WARNING) << "Unable to name thread \"" << name << "\": " << strerror(err);
+      ok = false;
+    }
+  }
+
+  const std::vector<int> &cpus( policy.cpus.empty() ? defaultCpus : policy.cpus );
+  if( !cpus.empty() ) {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+
+    int valid = 0;
+    for( auto cpu : cpus ) {
+      if( cpu < 0 || cpu >= CPU_SETSIZE ) {
+        LOG(WARNING) << "Ignoring CPU " << cpu << " in the policy for " << describe(policy);
+        ok = false;
+        continue;
+      }
+      CPU_SET( cpu, &set );
+      ++valid;
+    }
+
+    if( valid > 0 ) {
+      const int err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+      if( err != 0 ) {
+        LOG(WARNING) << "Unable to set the CPU affinity of " << describe(policy) << ": " << strerror(err);
+        ok = false;
+      }
+    }
+  }
+
+  if( policy.realtimePriority > 0 ) {
+    const int lo = sched_get_priority_min( SCHED_FIFO ), hi = sched_get_priority_max( SCHED_FIFO );
+
+    struct sched_param param;
+    param.sched_priority = policy.realtimePriority;
+    if( param.sched_priority < lo || param.sched_priority > hi ) {
+      param.sched_priority = std::min( hi, std::max( lo, param.sched_priority ) );
+      LOG(WARNING) << "SCHED_FIFO priority " << policy.realtimePriority << " for " << describe(policy)
+                   << " is outside " << lo << "-" << hi << ", using " << param.sched_priority;
+      ok = false;
+    }
+
+    const int err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+    if( err != 0 ) {
+      LOG(WARNING) << "Unable to run " << describe(policy) << " SCHED_FIFO at priority "
+                   << param.sched_priority << ": " << strerror(err)
+                   << ((err == EPERM) ? " (needs CAP_SYS_NICE or an RLIMIT_RTPRIO)" : "");
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+std::vector<int> numaNodeCpus( const ThreadingOptions &opts, DeckLink &deckLink )
+{
+  if( opts.numaNode == ThreadingOptions::AnyNode || numNumaNodes() < 2 ) return std::vector<int>();
+
+  int node = opts.numaNode;
+  if( node == ThreadingOptions::LocalToCard ) {
+    node = deckLink.numaNode();
+    if( node < 0 ) {
+      LOG(WARNING) << "Can't tell which NUMA node the card is on, so threads aren't kept local to it;"
+                   << " set ThreadingOptions::numaNode";
+      return std::vector<int>();
+    }
+  }
+
+  std::vector<int> cpus( cpusOnNumaNode( node ) );
+  LOG_IF(WARNING, cpus.empty()) << "NUMA node " << node << " doesn't exist or has no CPUs";
+  return cpus;
+}
+
+int numNumaNodes()
+{
+  int nodes = 0;
+  while( access( (kNodePath + std::to_string(nodes)).c_str(), F_OK ) == 0 ) ++nodes;
+  return std::max( nodes, 1 );
+}
+
+std::vector<int> cpusOnNumaNode( int node )
+{
+  std::vector<int> cpus;
+  if( node < 0 ) return cpus;
+
+  // e.g. "0-7,16-23"
+  std::ifstream in( kNodePath + std::to_string(node) + "/cpulist" );
+  std::string list;
+  if( !std::getline( in, list ) ) return cpus;
+
+  std::stringstream ranges( list );
+  std::string range;
+  while( std::getline( ranges, range, ',' ) ) {
+    int first = 0, last = 0;
+    const int n = sscanf( range.c_str(), "%d-%d", &first, &last );
+    if( n < 1 ) continue;
+    if( n == 1 ) last = first;
+
+    for( int cpu = first; cpu <= last; ++cpu ) cpus.push_back( cpu );
+  }
+
+  return cpus;
+}
+
+int pciNumaNode( const std::string &str )
+{
+  // Look for bus:device.function, optionally with a domain in front
+  for( size_t i = 0; i + 7 <= str.size(); ++i ) {
+    const char *s = str.c_str() + i;
+    if( !(isxdigit(s[0]) && isxdigit(s[1]) && s[2] == ':' && isxdigit(s[3]) && isxdigit(s[4]) &&
+          s[5] == '.' && isxdigit(s[6])) ) continue;
+
+    std::string address( str, i, 7 );
+    if( i >= 5 && str[i-1] == ':' )
+      address = str.substr( i-5, 12 );
+    else
+      address = "0000:" + address;
+
+    std::ifstream in( "/sys/bus/pci/devices/" + address + "/numa_node" );
+    int node = -1;
+    if( in >> node ) return node;
+  }
+
+  return -1;
+}
+
+}
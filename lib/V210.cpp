@@ -0,0 +1,761 @@
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <g3log/g3log.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V210_X86
+#include <immintrin.h>
+#endif
+
+#include "libblackmagic/V210.h"
+
+namespace libblackmagic {
+
+//
+// Decoding is done one row at a time in two stages:
+//
+//  1. unpack the 10-bit samples into a row of 16-bit luma and a row of
+//     interleaved 16-bit Cb/Cr pairs
+//  2. convert those rows to the output format.
+//
+// The SIMD kernels use exactly the same fixed-point arithmetic as the scalar
+// versions, so every instruction set produces bit-identical output.
+//
+
+// BT.709 video range YCbCr to RGB coefficients, scaled by 4096.  Applied with
+// a 16x16 high multiply to (sample << 4), which leaves results at 10-bit scale.
+static const int16_t kY  = 4769;   // 1.164383
+static const int16_t kRV = 7343;   // 1.792741
+static const int16_t kGU = 873;    // 0.213249
+static const int16_t kGV = 2183;   // 0.532909
+static const int16_t kBU = 8652;   // 2.112402
+
+// Scratch rows are padded so SIMD stores may run past the end of the row
+static const unsigned int kRowPad = 64;
+
+namespace {
+
+  inline int16_t mulhi( int16_t a, int16_t b )
+  { return (int16_t)(( int32_t(a) * int32_t(b) ) >> 16); }
+
+  inline uint8_t saturate( int v )
+  { return (uint8_t)( v < 0 ? 0 : ( v > 255 ? 255 : v ) ); }
+
+  //=== Scalar reference ===
+
+  inline void unpackGroupScalar( const uint8_t *src, int16_t *y, int16_t *c )
+  {
+    uint32_t w[4];
+    memcpy( w, src, sizeof(w) );
+
+    c[0] = w[0] & 0x3ff;  y[0] = (w[0] >> 10) & 0x3ff;  c[1] = (w[0] >> 20) & 0x3ff;
+    y[1] = w[1] & 0x3ff;  c[2] = (w[1] >> 10) & 0x3ff;  y[2] = (w[1] >> 20) & 0x3ff;
+    c[3] = w[2] & 0x3ff;  y[3] = (w[2] >> 10) & 0x3ff;  c[4] = (w[2] >> 20) & 0x3ff;
+    y[4] = w[3] & 0x3ff;  c[5] = (w[3] >> 10) & 0x3ff;  y[5] = (w[3] >> 20) & 0x3ff;
+  }
+
+  void unpackRowScalar( const uint8_t *src, int16_t *y, int16_t *c, int groupBegin, int groupEnd )
+  {
+    for( int g = groupBegin; g < groupEnd; ++g )
+      unpackGroupScalar( src + 16*g, y + 6*g, c + 6*g );
+  }
+
+  inline void pixelToBGR( int16_t Y, int16_t Cb, int16_t Cr, uint8_t *bgr )
+  {
+    const int16_t yt = mulhi( (Y - 64) * 16, kY );
+    const int16_t u = (Cb - 512) * 16, v = (Cr - 512) * 16;
+
+    bgr[0] = saturate( (int16_t)(yt + mulhi(u, kBU) + 2) >> 2 );
+    bgr[1] = saturate( (int16_t)(yt - mulhi(u, kGU) - mulhi(v, kGV) + 2) >> 2 );
+    bgr[2] = saturate( (int16_t)(yt + mulhi(v, kRV) + 2) >> 2 );
+  }
+
+  void convertRowScalar( const int16_t *y, const int16_t *c, uint8_t *dst,
+                         int xBegin, int xEnd, V210Output fmt )
+  {
+    for( int x = xBegin; x < xEnd; ++x ) {
+      const int16_t Cb = c[ x & ~1 ], Cr = c[ (x & ~1) + 1 ];
+
+      switch( fmt ) {
+        case V210_BGR:
+          pixelToBGR( y[x], Cb, Cr, dst + 3*x );
+          break;
+        case V210_BGRA:
+          pixelToBGR( y[x], Cb, Cr, dst + 4*x );
+          dst[4*x+3] = 255;
+          break;
+        case V210_UYVY:
+          dst[2*x]   = (x & 1) ? (Cr >> 2) : (Cb >> 2);
+          dst[2*x+1] = y[x] >> 2;
+          break;
+        case V210_Y:
+          dst[x] = y[x] >> 2;
+          break;
+      }
+    }
+  }
+
+#ifdef V210_X86
+
+  //=== SSE4.1 ===
+
+  // Within each 16-bit lane, pshufb gathers the two bytes holding one
+  // component, the multiply shifts it up to bits 6-15 and srli drops
+  // the neighbouring bits.
+  #define V210_Y_SHUFFLE   1, 2, 4, 5, 6, 7, 9, 10, 12, 13, 14, 15, -1, -1, -1, -1
+  #define V210_Y_MULT      16, 64, 4, 16, 64, 4, 0, 0
+  #define V210_C_SHUFFLE   0, 1, 2, 3, 5, 6, 8, 9, 10, 11, 13, 14, -1, -1, -1, -1
+  #define V210_C_MULT      64, 4, 16, 64, 4, 16, 0, 0
+
+  // Duplicate each Cb (Cr) across the two pixels which share it
+  #define V210_CB_DUP      0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13
+  #define V210_CR_DUP      2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15
+
+  __attribute__((target("sse4.1")))
+  inline void unpackGroupSSE( __m128i group, int16_t *y, int16_t *c )
+  {
+    const __m128i yShuf = _mm_setr_epi8( V210_Y_SHUFFLE ), yMult = _mm_setr_epi16( V210_Y_MULT );
+    const __m128i cShuf = _mm_setr_epi8( V210_C_SHUFFLE ), cMult = _mm_setr_epi16( V210_C_MULT );
+
+    __m128i yy = _mm_srli_epi16( _mm_mullo_epi16( _mm_shuffle_epi8( group, yShuf ), yMult ), 6 );
+    __m128i cc = _mm_srli_epi16( _mm_mullo_epi16( _mm_shuffle_epi8( group, cShuf ), cMult ), 6 );
+
+    // Only the first six lanes are valid;  the next group overwrites the rest
+    _mm_storeu_si128( (__m128i *)y, yy );
+    _mm_storeu_si128( (__m128i *)c, cc );
+  }
+
+  __attribute__((target("sse4.1")))
+  void unpackRowSSE( const uint8_t *src, int16_t *y, int16_t *c, int groupBegin, int groupEnd )
+  {
+    for( int g = groupBegin; g < groupEnd; ++g )
+      unpackGroupSSE( _mm_loadu_si128( (const __m128i *)(src + 16*g) ), y + 6*g, c + 6*g );
+  }
+
+  // Converts eight pixels of luma and four Cb/Cr pairs to 16-bit B, G, R
+  __attribute__((target("sse4.1")))
+  inline void toBGR16SSE( __m128i Y, __m128i C, __m128i &B, __m128i &G, __m128i &R )
+  {
+    const __m128i cbDup = _mm_setr_epi8( V210_CB_DUP ), crDup = _mm_setr_epi8( V210_CR_DUP );
+    const __m128i two = _mm_set1_epi16( 2 );
+
+    const __m128i yt = _mm_mulhi_epi16( _mm_slli_epi16( _mm_sub_epi16( Y, _mm_set1_epi16(64) ), 4 ), _mm_set1_epi16( kY ) );
+
+    const __m128i c4 = _mm_slli_epi16( _mm_sub_epi16( C, _mm_set1_epi16(512) ), 4 );
+    const __m128i u = _mm_shuffle_epi8( c4, cbDup ), v = _mm_shuffle_epi8( c4, crDup );
+
+    B = _mm_srai_epi16( _mm_add_epi16( _mm_add_epi16( yt, _mm_mulhi_epi16( u, _mm_set1_epi16( kBU ) ) ), two ), 2 );
+    G = _mm_srai_epi16( _mm_add_epi16( _mm_sub_epi16( _mm_sub_epi16( yt, _mm_mulhi_epi16( u, _mm_set1_epi16( kGU ) ) ),
+                                                      _mm_mulhi_epi16( v, _mm_set1_epi16( kGV ) ) ), two ), 2 );
+    R = _mm_srai_epi16( _mm_add_epi16( _mm_add_epi16( yt, _mm_mulhi_epi16( v, _mm_set1_epi16( kRV ) ) ), two ), 2 );
+  }
+
+  // Writes eight pixels from 16-bit B, G, R (or Y, C) lanes
+  __attribute__((target("sse4.1")))
+  inline void storeBGRSSE( __m128i B, __m128i G, __m128i R, uint8_t *dst, bool alpha )
+  {
+    const __m128i bg = _mm_unpacklo_epi8( _mm_packus_epi16( B, B ), _mm_packus_epi16( G, G ) );
+    const __m128i ra = _mm_unpacklo_epi8( _mm_packus_epi16( R, R ), _mm_set1_epi8( (char)0xff ) );
+
+    const __m128i lo = _mm_unpacklo_epi16( bg, ra ), hi = _mm_unpackhi_epi16( bg, ra );
+
+    if( alpha ) {
+      _mm_storeu_si128( (__m128i *)dst, lo );
+      _mm_storeu_si128( (__m128i *)(dst + 16), hi );
+    } else {
+      // Squeeze out the alpha bytes;  use exact-size stores so we never
+      // write past the end of the output row
+      const __m128i squeeze = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+      const __m128i l = _mm_shuffle_epi8( lo, squeeze ), h = _mm_shuffle_epi8( hi, squeeze );
+
+      _mm_storel_epi64( (__m128i *)dst, l );
+      const uint32_t lTail = _mm_cvtsi128_si32( _mm_srli_si128( l, 8 ) );
+      memcpy( dst + 8, &lTail, 4 );
+
+      _mm_storel_epi64( (__m128i *)(dst + 12), h );
+      const uint32_t hTail = _mm_cvtsi128_si32( _mm_srli_si128( h, 8 ) );
+      memcpy( dst + 20, &hTail, 4 );
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  inline void storeYCSSE( __m128i Y, __m128i C, uint8_t *dst, V210Output fmt )
+  {
+    if( fmt == V210_Y ) {
+      _mm_storel_epi64( (__m128i *)dst, _mm_packus_epi16( _mm_srli_epi16( Y, 2 ), _mm_setzero_si128() ) );
+    } else {
+      const __m128i lo = _mm_srli_epi16( _mm_unpacklo_epi16( C, Y ), 2 );
+      const __m128i hi = _mm_srli_epi16( _mm_unpackhi_epi16( C, Y ), 2 );
+      _mm_storeu_si128( (__m128i *)dst, _mm_packus_epi16( lo, hi ) );
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  inline void convert8SSE( __m128i Y, __m128i C, uint8_t *dst, int x, V210Output fmt )
+  {
+    if( fmt == V210_BGR || fmt == V210_BGRA ) {
+      __m128i B, G, R;
+      toBGR16SSE( Y, C, B, G, R );
+      storeBGRSSE( B, G, R, dst + x * (fmt == V210_BGRA ? 4 : 3), fmt == V210_BGRA );
+    } else {
+      storeYCSSE( Y, C, dst + x * (fmt == V210_UYVY ? 2 : 1), fmt );
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  int convertRowSSE( const int16_t *y, const int16_t *c, uint8_t *dst,
+                     int xBegin, int xEnd, V210Output fmt )
+  {
+    int x = xBegin;
+    for( ; x + 8 <= xEnd; x += 8 ) {
+      convert8SSE( _mm_loadu_si128( (const __m128i *)(y + x) ),
+                   _mm_loadu_si128( (const __m128i *)(c + x) ), dst, x, fmt );
+    }
+    return x;
+  }
+
+  //=== AVX2 ===
+
+  __attribute__((target("avx2")))
+  void unpackRowAVX2( const uint8_t *src, int16_t *y, int16_t *c, int groupBegin, int groupEnd )
+  {
+    const __m256i yShuf = _mm256_setr_epi8( V210_Y_SHUFFLE, V210_Y_SHUFFLE ), yMult = _mm256_setr_epi16( V210_Y_MULT, V210_Y_MULT );
+    const __m256i cShuf = _mm256_setr_epi8( V210_C_SHUFFLE, V210_C_SHUFFLE ), cMult = _mm256_setr_epi16( V210_C_MULT, V210_C_MULT );
+
+    // Two groups per iteration, one in each 128-bit lane
+    int g = groupBegin;
+    for( ; g + 2 <= groupEnd; g += 2 ) {
+      const __m256i groups = _mm256_loadu_si256( (const __m256i *)(src + 16*g) );
+
+      const __m256i yy = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_shuffle_epi8( groups, yShuf ), yMult ), 6 );
+      const __m256i cc = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_shuffle_epi8( groups, cShuf ), cMult ), 6 );
+
+      // Store the low lane first so the high lane overwrites its unused tail
+      _mm_storeu_si128( (__m128i *)(y + 6*g), _mm256_castsi256_si128( yy ) );
+      _mm_storeu_si128( (__m128i *)(y + 6*g + 6), _mm256_extracti128_si256( yy, 1 ) );
+      _mm_storeu_si128( (__m128i *)(c + 6*g), _mm256_castsi256_si128( cc ) );
+      _mm_storeu_si128( (__m128i *)(c + 6*g + 6), _mm256_extracti128_si256( cc, 1 ) );
+    }
+
+    unpackRowSSE( src, y, c, g, groupEnd );
+  }
+
+  __attribute__((target("avx2")))
+  int convertRowAVX2( const int16_t *y, const int16_t *c, uint8_t *dst,
+                      int xBegin, int xEnd, V210Output fmt )
+  {
+    const __m256i cbDup = _mm256_setr_epi8( V210_CB_DUP, V210_CB_DUP ), crDup = _mm256_setr_epi8( V210_CR_DUP, V210_CR_DUP );
+    const __m256i two = _mm256_set1_epi16( 2 );
+
+    int x = xBegin;
+
+    if( fmt == V210_BGR || fmt == V210_BGRA ) {
+      const bool alpha = (fmt == V210_BGRA);
+      const int bpp = alpha ? 4 : 3;
+
+      // Do the arithmetic sixteen pixels at a time, then interleave each
+      // half with the SSE store
+      for( ; x + 16 <= xEnd; x += 16 ) {
+        const __m256i Y = _mm256_loadu_si256( (const __m256i *)(y + x) );
+        const __m256i C = _mm256_loadu_si256( (const __m256i *)(c + x) );
+
+        const __m256i yt = _mm256_mulhi_epi16( _mm256_slli_epi16( _mm256_sub_epi16( Y, _mm256_set1_epi16(64) ), 4 ), _mm256_set1_epi16( kY ) );
+        const __m256i c4 = _mm256_slli_epi16( _mm256_sub_epi16( C, _mm256_set1_epi16(512) ), 4 );
+        const __m256i u = _mm256_shuffle_epi8( c4, cbDup ), v = _mm256_shuffle_epi8( c4, crDup );
+
+        const __m256i B = _mm256_srai_epi16( _mm256_add_epi16( _mm256_add_epi16( yt, _mm256_mulhi_epi16( u, _mm256_set1_epi16( kBU ) ) ), two ), 2 );
+        const __m256i G = _mm256_srai_epi16( _mm256_add_epi16( _mm256_sub_epi16( _mm256_sub_epi16( yt, _mm256_mulhi_epi16( u, _mm256_set1_epi16( kGU ) ) ),
+                                                                                 _mm256_mulhi_epi16( v, _mm256_set1_epi16( kGV ) ) ), two ), 2 );
+        const __m256i R = _mm256_srai_epi16( _mm256_add_epi16( _mm256_add_epi16( yt, _mm256_mulhi_epi16( v, _mm256_set1_epi16( kRV ) ) ), two ), 2 );
+
+        storeBGRSSE( _mm256_castsi256_si128(B), _mm256_castsi256_si128(G), _mm256_castsi256_si128(R), dst + x*bpp, alpha );
+        storeBGRSSE( _mm256_extracti128_si256(B, 1), _mm256_extracti128_si256(G, 1), _mm256_extracti128_si256(R, 1), dst + (x+8)*bpp, alpha );
+      }
+    } else if( fmt == V210_Y ) {
+      for( ; x + 32 <= xEnd; x += 32 ) {
+        const __m256i lo = _mm256_srli_epi16( _mm256_loadu_si256( (const __m256i *)(y + x) ), 2 );
+        const __m256i hi = _mm256_srli_epi16( _mm256_loadu_si256( (const __m256i *)(y + x + 16) ), 2 );
+        // packus works within 128-bit lanes;  restore pixel order afterwards
+        _mm256_storeu_si256( (__m256i *)(dst + x), _mm256_permute4x64_epi64( _mm256_packus_epi16( lo, hi ), 0xd8 ) );
+      }
+    } else {
+      for( ; x + 16 <= xEnd; x += 16 ) {
+        const __m256i Y = _mm256_loadu_si256( (const __m256i *)(y + x) );
+        const __m256i C = _mm256_loadu_si256( (const __m256i *)(c + x) );
+        const __m256i lo = _mm256_srli_epi16( _mm256_unpacklo_epi16( C, Y ), 2 );
+        const __m256i hi = _mm256_srli_epi16( _mm256_unpackhi_epi16( C, Y ), 2 );
+        // unpack and pack both work within 128-bit lanes, so the result
+        // is already in pixel order
+        _mm256_storeu_si256( (__m256i *)(dst + 2*x), _mm256_packus_epi16( lo, hi ) );
+      }
+    }
+
+    return convertRowSSE( y, c, dst, x, xEnd, fmt );
+  }
+
+  //=== AVX-512 (BW) ===
+
+  __attribute__((target("avx512f,avx512bw")))
+  void unpackRowAVX512( const uint8_t *src, int16_t *y, int16_t *c, int groupBegin, int groupEnd )
+  {
+    const __m512i yShuf = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_Y_SHUFFLE ) );
+    const __m512i yMult = _mm512_broadcast_i32x4( _mm_setr_epi16( V210_Y_MULT ) );
+    const __m512i cShuf = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_C_SHUFFLE ) );
+    const __m512i cMult = _mm512_broadcast_i32x4( _mm_setr_epi16( V210_C_MULT ) );
+
+    // Four groups per iteration, one in each 128-bit lane
+    int g = groupBegin;
+    for( ; g + 4 <= groupEnd; g += 4 ) {
+      const __m512i groups = _mm512_loadu_si512( (const void *)(src + 16*g) );
+
+      const __m512i yy = _mm512_srli_epi16( _mm512_mullo_epi16( _mm512_shuffle_epi8( groups, yShuf ), yMult ), 6 );
+      const __m512i cc = _mm512_srli_epi16( _mm512_mullo_epi16( _mm512_shuffle_epi8( groups, cShuf ), cMult ), 6 );
+
+      _mm_storeu_si128( (__m128i *)(y + 6*g),      _mm512_castsi512_si128( yy ) );
+      _mm_storeu_si128( (__m128i *)(y + 6*g + 6),  _mm512_extracti32x4_epi32( yy, 1 ) );
+      _mm_storeu_si128( (__m128i *)(y + 6*g + 12), _mm512_extracti32x4_epi32( yy, 2 ) );
+      _mm_storeu_si128( (__m128i *)(y + 6*g + 18), _mm512_extracti32x4_epi32( yy, 3 ) );
+
+      _mm_storeu_si128( (__m128i *)(c + 6*g),      _mm512_castsi512_si128( cc ) );
+      _mm_storeu_si128( (__m128i *)(c + 6*g + 6),  _mm512_extracti32x4_epi32( cc, 1 ) );
+      _mm_storeu_si128( (__m128i *)(c + 6*g + 12), _mm512_extracti32x4_epi32( cc, 2 ) );
+      _mm_storeu_si128( (__m128i *)(c + 6*g + 18), _mm512_extracti32x4_epi32( cc, 3 ) );
+    }
+
+    unpackRowAVX2( src, y, c, g, groupEnd );
+  }
+
+  __attribute__((target("avx512f,avx512bw")))
+  int convertRowAVX512( const int16_t *y, const int16_t *c, uint8_t *dst,
+                        int xBegin, int xEnd, V210Output fmt )
+  {
+    int x = xBegin;
+
+    if( fmt == V210_BGR || fmt == V210_BGRA ) {
+      const __m512i cbDup = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_CB_DUP ) );
+      const __m512i crDup = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_CR_DUP ) );
+      const __m512i two = _mm512_set1_epi16( 2 );
+      const bool alpha = (fmt == V210_BGRA);
+      const int bpp = alpha ? 4 : 3;
+
+      for( ; x + 32 <= xEnd; x += 32 ) {
+        const __m512i Y = _mm512_loadu_si512( (const void *)(y + x) );
+        const __m512i C = _mm512_loadu_si512( (const void *)(c + x) );
+
+        const __m512i yt = _mm512_mulhi_epi16( _mm512_slli_epi16( _mm512_sub_epi16( Y, _mm512_set1_epi16(64) ), 4 ), _mm512_set1_epi16( kY ) );
+        const __m512i c4 = _mm512_slli_epi16( _mm512_sub_epi16( C, _mm512_set1_epi16(512) ), 4 );
+        const __m512i u = _mm512_shuffle_epi8( c4, cbDup ), v = _mm512_shuffle_epi8( c4, crDup );
+
+        const __m512i B = _mm512_srai_epi16( _mm512_add_epi16( _mm512_add_epi16( yt, _mm512_mulhi_epi16( u, _mm512_set1_epi16( kBU ) ) ), two ), 2 );
+        const __m512i G = _mm512_srai_epi16( _mm512_add_epi16( _mm512_sub_epi16( _mm512_sub_epi16( yt, _mm512_mulhi_epi16( u, _mm512_set1_epi16( kGU ) ) ),
+                                                                                 _mm512_mulhi_epi16( v, _mm512_set1_epi16( kGV ) ) ), two ), 2 );
+        const __m512i R = _mm512_srai_epi16( _mm512_add_epi16( _mm512_add_epi16( yt, _mm512_mulhi_epi16( v, _mm512_set1_epi16( kRV ) ) ), two ), 2 );
+
+        storeBGRSSE( _mm512_castsi512_si128(B), _mm512_castsi512_si128(G), _mm512_castsi512_si128(R), dst + x*bpp, alpha );
+        storeBGRSSE( _mm512_extracti32x4_epi32(B, 1), _mm512_extracti32x4_epi32(G, 1), _mm512_extracti32x4_epi32(R, 1), dst + (x+8)*bpp, alpha );
+        storeBGRSSE( _mm512_extracti32x4_epi32(B, 2), _mm512_extracti32x4_epi32(G, 2), _mm512_extracti32x4_epi32(R, 2), dst + (x+16)*bpp, alpha );
+        storeBGRSSE( _mm512_extracti32x4_epi32(B, 3), _mm512_extracti32x4_epi32(G, 3), _mm512_extracti32x4_epi32(R, 3), dst + (x+24)*bpp, alpha );
+      }
+    }
+
+    // The luma and UYVY outputs are bandwidth bound;  AVX2 is plenty
+    return convertRowAVX2( y, c, dst, x, xEnd, fmt );
+  }
+
+#endif
+
+  //=== Dispatch ===
+
+  typedef void (*UnpackRowFunc)( const uint8_t *, int16_t *, int16_t *, int, int );
+  typedef int (*ConvertRowFunc)( const int16_t *, const int16_t *, uint8_t *, int, int, V210Output );
+
+  int convertRowNone( const int16_t *, const int16_t *, uint8_t *, int xBegin, int, V210Output )
+  { return xBegin; }
+
+  void selectKernels( V210Isa isa, UnpackRowFunc &unpack, ConvertRowFunc &convert )
+  {
+    unpack = unpackRowScalar;
+    convert = convertRowNone;
+
+#ifdef V210_X86
+    switch( isa ) {
+      case V210_AVX512:
+        unpack = unpackRowAVX512;  convert = convertRowAVX512;
+        break;
+      case V210_AVX2:
+        unpack = unpackRowAVX2;    convert = convertRowAVX2;
+        break;
+      case V210_SSE41:
+        unpack = unpackRowSSE;     convert = convertRowSSE;
+        break;
+      default:
+        break;
+    }
+#endif
+  }
+
+}
+
+V210Isa v210BestIsa()
+{
+  static const V210Isa best = []() -> V210Isa {
+#ifdef V210_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx512bw") ) return V210_AVX512;
+    if( __builtin_cpu_supports("avx2") ) return V210_AVX2;
+    if( __builtin_cpu_supports("sse4.1") ) return V210_SSE41;
+#endif
+    return V210_SCALAR;
+  }();
+
+  return best;
+}
+
+bool v210IsaSupported( V210Isa isa )
+{
+  return isa == V210_AUTO || isa <= v210BestIsa();
+}
+
+const std::string v210IsaToString( V210Isa isa )
+{
+  switch( isa ) {
+    case V210_SCALAR:  return "scalar";
+    case V210_SSE41:   return "SSE4.1";
+    case V210_AVX2:    return "AVX2";
+    case V210_AVX512:  return "AVX-512";
+    case V210_AUTO:    return "auto";
+  }
+  return "(unknown)";
+}
+
+int v210OutputType( V210Output fmt )
+{
+  switch( fmt ) {
+    case V210_BGR:    return CV_8UC3;
+    case V210_BGRA:   return CV_8UC4;
+    case V210_UYVY:   return CV_8UC2;
+    case V210_Y:      return CV_8UC1;
+  }
+  return CV_8UC4;
+}
+
+size_t v210RowBytes( unsigned int width )
+{
+  return ((width + 47) / 48) * 128;
+}
+
+int v210DecodeBands( int width, int height )
+{
+  static const int kPixelsPerBand = 256 * 1024;
+
+  const int bands = std::max( 1, (width * height) / kPixelsPerBand );
+  return std::min( std::min( bands, cv::getNumThreads() ), std::max( 1, height ) );
+}
+
+static bool checkDecodeArgs( size_t srcRowBytes, int width, V210Isa &isa )
+{
+  if( srcRowBytes < size_t((width + 5) / 6) * 16 ) {
+    LOG(WARNING) << "v210 row stride " << srcRowBytes << " is too small for width " << width;
+    return false;
+  }
+
+  if( isa == V210_AUTO ) isa = v210BestIsa();
+  if( !v210IsaSupported( isa ) ) {
+    LOG(WARNING) << "CPU does not support " << v210IsaToString( isa ) << ", v210 decode not done";
+    return false;
+  }
+
+  return true;
+}
+
+bool decodeV210( const void *src, size_t srcRowBytes,
+                 int width, int height,
+                 cv::Mat &out, V210Output fmt, V210Isa isa, int bands )
+{
+  if( !checkDecodeArgs( srcRowBytes, width, isa ) ) return false;
+
+  out.create( height, width, v210OutputType( fmt ) );
+
+  if( bands <= 0 ) bands = v210DecodeBands( width, height );
+  bands = std::min( bands, std::max( 1, height ) );
+
+  if( bands == 1 ) return decodeV210Rows( src, srcRowBytes, width, 0, height, out, fmt, isa );
+
+  cv::parallel_for_( cv::Range( 0, bands ), [&]( const cv::Range &range ) {
+    for( int b = range.start; b < range.end; ++b ) {
+      decodeV210Rows( src, srcRowBytes, width,
+                      (height * b) / bands, (height * (b+1)) / bands,
+                      out, fmt, isa );
+    }
+  }, bands );
+
+  return true;
+}
+
+bool decodeV210Rows( const void *src, size_t srcRowBytes,
+                     int width, int rowBegin, int rowEnd,
+                     cv::Mat &out, V210Output fmt, V210Isa isa )
+{
+  if( !checkDecodeArgs( srcRowBytes, width, isa ) ) return false;
+
+  if( out.cols != width || out.rows < rowEnd || out.type() != v210OutputType( fmt ) ) {
+    LOG(WARNING) << "Output image is " << out.cols << " x " << out.rows
+                 << ", can't decode rows " << rowBegin << "-" << rowEnd << " of width " << width;
+    return false;
+  }
+
+  UnpackRowFunc unpack;
+  ConvertRowFunc convert;
+  selectKernels( isa, unpack, convert );
+
+  // Per-thread scratch rows;  only reallocated when the width grows
+  static thread_local std::vector<int16_t> yRow, cRow;
+  const size_t scratch = 6 * ((width + 5) / 6) + kRowPad;
+  if( yRow.size() < scratch ) {
+    yRow.resize( scratch );
+    cRow.resize( scratch );
+  }
+
+  const int groups = (width + 5) / 6;
+  const uint8_t *srcRow = static_cast<const uint8_t *>( src ) + size_t(rowBegin) * srcRowBytes;
+
+  for( int r = rowBegin; r < rowEnd; ++r, srcRow += srcRowBytes ) {
+    uint8_t *dst = out.ptr<uint8_t>( r );
+
+    // The source row is padded, so a partial last group is still
+    // sixteen readable bytes
+    unpack( srcRow, yRow.data(), cRow.data(), 0, groups );
+
+    const int done = convert( yRow.data(), cRow.data(), dst, 0, width, fmt );
+    convertRowScalar( yRow.data(), cRow.data(), dst, done, width, fmt );
+  }
+
+  return true;
+}
+
+//=== Fused decode and downscale ===
+
+namespace {
+
+  // 2vuy rows to the same 10-bit layout unpackRow* produces
+  void unpackUYVYRow( const uint8_t *src, int16_t *y, int16_t *c, int width )
+  {
+    for( int x = 0; x < width; x += 2 ) {
+      c[x]   = src[2*x]   << 2;
+      y[x]   = src[2*x+1] << 2;
+      c[x+1] = src[2*x+2] << 2;
+      y[x+1] = src[2*x+3] << 2;
+    }
+  }
+
+  inline void storeScaled( int Y, int Cb, int Cr, uint8_t *dst, int x, V210Output fmt )
+  {
+    switch( fmt ) {
+      case V210_BGR:
+        pixelToBGR( Y, Cb, Cr, dst + 3*x );
+        break;
+      case V210_BGRA:
+        pixelToBGR( Y, Cb, Cr, dst + 4*x );
+        dst[4*x+3] = 255;
+        break;
+      default:
+        dst[x] = Y >> 2;
+        break;
+    }
+  }
+
+  // One tap for every overlapping (source, destination) pair, weighted by
+  // the overlap, as cv::resize's INTER_AREA.  Ordered by destination, and
+  // within that by source.
+  struct AreaTap {
+    int src, dst;
+    float weight;
+  };
+
+  void areaTaps( int srcSize, int dstSize, std::vector<AreaTap> &taps )
+  {
+    taps.clear();
+
+    const double scale = double(srcSize) / dstSize;
+    for( int d = 0; d < dstSize; ++d ) {
+      const double begin = d * scale, end = std::min( (d+1) * scale, double(srcSize) );
+
+      for( int s = int(begin); s < end; ++s ) {
+        const double w = std::min( double(s+1), end ) - std::max( double(s), begin );
+        if( w > 1e-6 ) taps.push_back( AreaTap{ s, d, float( w / scale ) } );
+      }
+    }
+  }
+
+  struct ScaledSource {
+    const uint8_t *data;
+    size_t rowBytes;
+    PackedYUV layout;
+    int width;
+    UnpackRowFunc unpack;
+
+    void unpackRow( int r, int16_t *y, int16_t *c ) const
+    {
+      const uint8_t *row = data + size_t(r) * rowBytes;
+      if( layout == PACKED_V210 ) {
+        unpack( row, y, c, 0, (width + 5) / 6 );
+      } else {
+        unpackUYVYRow( row, y, c, width );
+      }
+    }
+  };
+
+  // Averages k x k blocks with integer sums
+  void decodeBlocks( const ScaledSource &src, int k, cv::Mat &out, V210Output fmt,
+                     int16_t *y, int16_t *c )
+  {
+    static thread_local std::vector<int32_t> acc;
+    acc.resize( 3 * out.cols );
+    int32_t *accY = acc.data(), *accCb = accY + out.cols, *accCr = accCb + out.cols;
+
+    const int shift = 2 * __builtin_ctz(k);
+    const int32_t round = (1 << shift) >> 1;
+
+    for( int dy = 0; dy < out.rows; ++dy ) {
+      std::fill( acc.begin(), acc.end(), 0 );
+
+      for( int j = 0; j < k; ++j ) {
+        src.unpackRow( dy * k + j, y, c );
+
+        for( int x = 0; x < out.cols; ++x ) {
+          for( int s = x * k; s < (x+1) * k; ++s ) {
+            accY[x]  += y[s];
+            accCb[x] += c[ s & ~1 ];
+            accCr[x] += c[ (s & ~1) + 1 ];
+          }
+        }
+      }
+
+      uint8_t *dst = out.ptr<uint8_t>( dy );
+      for( int x = 0; x < out.cols; ++x )
+        storeScaled( (accY[x] + round) >> shift, (accCb[x] + round) >> shift,
+                     (accCr[x] + round) >> shift, dst, x, fmt );
+    }
+  }
+
+  // Area filter for any downscale
+  void decodeArea( const ScaledSource &src, int height, cv::Mat &out, V210Output fmt,
+                   int16_t *y, int16_t *c )
+  {
+    static thread_local std::vector<AreaTap> xTaps, yTaps;
+    static thread_local std::vector<float> rows;
+
+    areaTaps( src.width, out.cols, xTaps );
+    areaTaps( height, out.rows, yTaps );
+
+    // One source row resampled to the output width, and the output row
+    // being accumulated
+    rows.resize( 6 * out.cols );
+    float *hY = rows.data(), *hCb = hY + out.cols, *hCr = hCb + out.cols;
+    float *vY = hCr + out.cols, *vCb = vY + out.cols, *vCr = vCb + out.cols;
+
+    std::fill( vY, vY + 3 * out.cols, 0.0f );
+
+    int current = -1;
+    for( size_t t = 0; t < yTaps.size(); ++t ) {
+      const AreaTap &tap( yTaps[t] );
+
+      // Neighbouring output rows may share a source row;  resample it once
+      if( tap.src != current ) {
+        current = tap.src;
+        src.unpackRow( current, y, c );
+
+        std::fill( hY, hY + 3 * out.cols, 0.0f );
+        for( const auto &x : xTaps ) {
+          hY[x.dst]  += x.weight * y[x.src];
+          hCb[x.dst] += x.weight * c[ x.src & ~1 ];
+          hCr[x.dst] += x.weight * c[ (x.src & ~1) + 1 ];
+        }
+      }
+
+      for( int x = 0; x < out.cols; ++x ) {
+        vY[x]  += tap.weight * hY[x];
+        vCb[x] += tap.weight * hCb[x];
+        vCr[x] += tap.weight * hCr[x];
+      }
+
+      // Taps are ordered by output row, so this one is finished
+      if( t + 1 == yTaps.size() || yTaps[t+1].dst != tap.dst ) {
+        uint8_t *dst = out.ptr<uint8_t>( tap.dst );
+        for( int x = 0; x < out.cols; ++x )
+          storeScaled( cvRound(vY[x]), cvRound(vCb[x]), cvRound(vCr[x]), dst, x, fmt );
+
+        std::fill( vY, vY + 3 * out.cols, 0.0f );
+      }
+    }
+  }
+
+}
+
+cv::Size scaledSize( int width, int height, double scale )
+{
+  return cv::Size( std::max( 1, cvRound( width * scale ) ),
+                   std::max( 1, cvRound( height * scale ) ) );
+}
+
+bool decodeScaled( const void *src, size_t srcRowBytes, PackedYUV layout,
+                   int width, int height, double scale,
+                   cv::Mat &out, V210Output fmt, V210Isa isa )
+{
+  if( scale <= 0.0 || scale > 1.0 ) {
+    LOG(WARNING) << "Can only decode at a scale in (0,1], not " << scale;
+    return false;
+  }
+
+  if( fmt == V210_UYVY ) {
+    LOG(WARNING) << "Scaled decode can't produce UYVY";
+    return false;
+  }
+
+  const size_t minRowBytes = (layout == PACKED_V210) ? size_t((width + 5) / 6) * 16
+                                                     : size_t((width + 1) / 2) * 4;
+  if( srcRowBytes < minRowBytes ) {
+    LOG(WARNING) << "Row stride " << srcRowBytes << " is too small for width " << width;
+    return false;
+  }
+
+  if( isa == V210_AUTO ) isa = v210BestIsa();
+  if( !v210IsaSupported( isa ) ) {
+    LOG(WARNING) << "CPU does not support " << v210IsaToString( isa ) << ", decode not done";
+    return false;
+  }
+
+  UnpackRowFunc unpack;
+  ConvertRowFunc convert;
+  selectKernels( isa, unpack, convert );
+
+  const cv::Size size( scaledSize( width, height, scale ) );
+  out.create( size, v210OutputType( fmt ) );
+
+  static thread_local std::vector<int16_t> yRow, cRow;
+  const size_t scratch = 6 * ((width + 5) / 6) + kRowPad;
+  if( yRow.size() < scratch ) {
+    yRow.resize( scratch );
+    cRow.resize( scratch );
+  }
+
+  const ScaledSource source{ static_cast<const uint8_t *>( src ), srcRowBytes, layout, width, unpack };
+
+  // Power-of-two scales which divide the image evenly are plain block averages
+  const int k = cvRound( 1.0 / scale );
+  if( k > 1 && (k & (k-1)) == 0 &&
+      width % k == 0 && height % k == 0 && size.width * k == width && size.height * k == height ) {
+    decodeBlocks( source, k, out, fmt, yRow.data(), cRow.data() );
+  } else {
+    decodeArea( source, height, out, fmt, yRow.data(), cRow.data() );
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+//
+// Counts every heap allocation in the process, including OpenCV's, by
+// interposing on glibc's allocator.  Defines malloc() and friends, so
+// include it in exactly one translation unit of a test program.
+//
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstdint>
+
+extern "C" {
+  void *__libc_malloc( size_t size );
+  void *__libc_calloc( size_t num, size_t size );
+  void *__libc_realloc( void *ptr, size_t size );
+  void *__libc_memalign( size_t alignment, size_t size );
+}
+
+static std::atomic<uint64_t> allocations( 0 );
+
+extern "C" {
+
+  void *malloc( size_t size ) {
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_malloc( size );
+  }
+
+  void *calloc( size_t num, size_t size ) {
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_calloc( num, size );
+  }
+
+  void *realloc( void *ptr, size_t size ) {
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_realloc( ptr, size );
+  }
+
+  void *memalign( size_t alignment, size_t size ) {
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_memalign( alignment, size );
+  }
+
+  void *aligned_alloc( size_t alignment, size_t size ) {
+    return memalign( alignment, size );
+  }
+
+  int posix_memalign( void **ptr, size_t alignment, size_t size ) {
+    *ptr = memalign( alignment, size );
+    return *ptr ? 0 : ENOMEM;
+  }
+
+}
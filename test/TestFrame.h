@@ -0,0 +1,108 @@
+#pragma once
+
+//
+// A stand-in for a captured DeckLink frame, and somewhere to record it,
+// shared by the recorder, reader and pre-trigger tests.
+//
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "DeckLinkAPI.h"
+
+namespace bmtest {
+
+  // Holds one thread at wait() until another calls release()
+  struct Gate {
+    Gate() : entered(false), open(false) {;}
+
+    void wait() {
+      std::unique_lock<std::mutex> lock( mutex );
+      entered = true;
+      cond.notify_all();
+      cond.wait( lock, [&]{ return open; } );
+    }
+
+    void waitForEntry() {
+      std::unique_lock<std::mutex> lock( mutex );
+      cond.wait( lock, [&]{ return entered; } );
+    }
+
+    void release() {
+      std::lock_guard<std::mutex> lock( mutex );
+      open = true;
+      cond.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool entered, open;
+  };
+
+  // v210 frame over a buffer patterned from seed, so its first byte is
+  // the seed, optionally not block aligned.  Deletes itself on the last
+  // Release(), so one on the stack must keep its own reference.  If gate
+  // is set, the release which takes the count back to one waits on it.
+  class TestFrame : public IDeckLinkVideoFrame {
+  public:
+    TestFrame( uint8_t seed, long width = 1920, long height = 1080, long rowBytes = 5120,
+               bool aligned = true, Gate *gate = nullptr )
+      : _refCount(1), _width(width), _height(height), _rowBytes(rowBytes),
+        _buffer( nullptr ), _data( nullptr ), _gate( gate )
+    {
+      if( posix_memalign( &_buffer, 4096, rowBytes * height + 64 ) != 0 ) abort();
+      _data = static_cast<uint8_t *>( _buffer ) + (aligned ? 0 : 64);
+      for( long i = 0; i < rowBytes * height; ++i ) _data[i] = uint8_t( seed + i * 7 );
+    }
+
+    TestFrame( const TestFrame & ) = delete;
+    TestFrame &operator=( const TestFrame & ) = delete;
+
+    virtual ~TestFrame()   { free( _buffer ); }
+
+    const uint8_t *data() const   { return _data; }
+    size_t size() const           { return _rowBytes * _height; }
+    int refCount() const          { return _refCount; }
+
+    virtual long GetWidth()                    { return _width; }
+    virtual long GetHeight()                   { return _height; }
+    virtual long GetRowBytes()                 { return _rowBytes; }
+    virtual BMDPixelFormat GetPixelFormat()    { return bmdFormat10BitYUV; }
+    virtual BMDFrameFlags GetFlags()           { return bmdFrameFlagDefault; }
+    virtual HRESULT GetBytes( void **buffer )  { *buffer = _data;  return S_OK; }
+    virtual HRESULT GetTimecode( BMDTimecodeFormat, IDeckLinkTimecode **tc )   { *tc = nullptr;  return S_FALSE; }
+    virtual HRESULT GetAncillaryData( IDeckLinkVideoFrameAncillary **anc )      { *anc = nullptr;  return S_FALSE; }
+
+    virtual HRESULT QueryInterface( REFIID, LPVOID *ppv )   { *ppv = nullptr;  return E_NOINTERFACE; }
+    virtual ULONG AddRef()    { return ++_refCount; }
+    virtual ULONG Release()
+    {
+      if( _refCount == 2 && _gate ) _gate->wait();
+      const int count = --_refCount;
+      if( count == 0 ) delete this;
+      return count;
+    }
+
+  private:
+    std::atomic<int> _refCount;
+    long _width, _height, _rowBytes;
+    void *_buffer;
+    uint8_t *_data;
+    Gate *_gate;
+  };
+
+  // A new, empty file under /tmp, for the test to remove
+  inline std::string tempPath() {
+    char path[] = "/tmp/bm_recording_XXXXXX";
+    const int fd = mkstemp( path );
+    if( fd >= 0 ) close( fd );
+    return path;
+  }
+
+}
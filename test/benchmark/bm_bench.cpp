@@ -0,0 +1,296 @@
+//
+// Benchmarks for the capture path, run against a SimulatedDeckLink so no
+// hardware is needed.
+//
+//  BM_Convert    frame to cv::Mat conversion, as done on the worker
+//                threads, for each input pixel format at 1080p and 2160p,
+//                mono and stereo
+//  BM_Delivery   end-to-end, from the simulated card to the new images
+//                callback, as fast as possible and at the real frame rate,
+//                with the time spent in the driver's callback
+//  BM_AncillaryEncode, BM_AncillaryDecode
+//                one camera control packet to and from VANC samples, as
+//                the output callback writes on each command frame
+//
+// Every capture benchmark reports heap allocations per frame.  Results are written
+// as JSON unless another --benchmark_format is given, e.g.
+//
+//   bm_bench --benchmark_out=results.json
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "libblackmagic/DataTypes.h"
+#include "libblackmagic/DeckLink.h"
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/SDICameraControl.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+#include "../AllocationCounter.h"
+
+using namespace libblackmagic;
+
+//== Helpers ==
+
+static const BMDPixelFormat PixelFormats[] = {
+  bmdFormat8BitYUV, bmdFormat8BitBGRA, bmdFormat10BitYUV, bmdFormat10BitRGB
+};
+
+static BMDDisplayMode modeForHeight( int64_t height )
+{
+  return (height == 2160) ? bmdMode4K2160p2997 : bmdModeHD1080p2997;
+}
+
+// Gives the benchmarks the worker threads' view of an InputHandler
+class BenchInputHandler : public InputHandler {
+public:
+  BenchInputHandler( DeckLink &deckLink ) : InputHandler( deckLink ) {;}
+
+  using InputHandler::process;
+};
+
+static SimulatedDeckLink *makeSimulator( BMDDisplayMode mode, bool realTime )
+{
+  SimulatedDeckLink::Options opts;
+  opts.mode = mode;
+  opts.realTime = realTime;
+  return new SimulatedDeckLink( opts );
+}
+
+static void addLatencyCounters( benchmark::State &state, const LatencyHistogram::Snapshot &latency )
+{
+  state.counters["latency_mean_us"] = latency.mean() / 1000;
+  state.counters["latency_p50_us"] = latency.percentile(0.5) / 1000.0;
+  state.counters["latency_p99_us"] = latency.percentile(0.99) / 1000.0;
+  state.counters["latency_max_us"] = latency.max / 1000.0;
+}
+
+//== Conversion ==
+//
+// Args:  pixel format index, frame height, number of eyes
+//
+static void BM_Convert( benchmark::State &state )
+{
+  const BMDPixelFormat pixFmt = PixelFormats[ state.range(0) ];
+  const BMDDisplayMode mode = modeForHeight( state.range(1) );
+  const int eyes = state.range(2);
+
+  SimulatedDeckLink *sim = makeSimulator( mode, false );
+  DeckLink deckLink( sim );
+  sim->Release();
+
+  BenchInputHandler input( deckLink );
+  input.setPixelFormat( pixFmt );
+  input.setNewImagesCallback( []( const InputHandler::MatVector & ){;} );
+
+  // Stereo is simply two frames per job, so 2160p "3D" can be measured too
+  if( !input.enable( mode, false, false ) ) {
+    state.SkipWithError( "Unable to enable input" );
+    return;
+  }
+
+  IDeckLinkOutput *output = nullptr;
+  sim->QueryInterface( IID_IDeckLinkOutput, (void **)&output );
+
+  IDeckLinkDisplayMode *displayMode = nullptr;
+  output->GetDisplayMode( mode, &displayMode );
+  const long width = displayMode->GetWidth(), height = displayMode->GetHeight();
+  displayMode->Release();
+
+  const long rowBytes = rowBytesForPixelFormat( pixFmt, width );
+
+  FrameWorkerPool::Job job;
+  for( int i = 0; i < eyes; ++i ) {
+    IDeckLinkMutableVideoFrame *frame = nullptr;
+    output->CreateVideoFrame( width, height, rowBytes, pixFmt, bmdFrameFlagDefault, &frame );
+    job.frames.push_back( frame );
+  }
+  job.images.resize( eyes );
+
+  // One frame to give the image pool its buffers
+  input.process( job );
+  for( auto &image : job.images ) image.release();
+
+  const uint64_t allocsBefore = allocations.load();
+
+  for( auto _ : state ) {
+    input.process( job );
+    benchmark::DoNotOptimize( job.images[0].data );
+
+    // As deliver() does once the images are queued
+    for( auto &image : job.images ) image.release();
+  }
+
+  state.counters["allocs_per_frame"] = benchmark::Counter( allocations.load() - allocsBefore,
+                                                           benchmark::Counter::kAvgIterations );
+  state.counters["frames_per_second"] = benchmark::Counter( state.iterations(), benchmark::Counter::kIsRate );
+  state.counters["sdk_objects_created"] = input.conversion().sdkObjectsCreated();
+  state.counters["fallback_conversions"] = input.conversion().fallbackConversions();
+  state.SetBytesProcessed( state.iterations() * eyes * rowBytes * height );
+  state.SetLabel( pixelFormatToString( pixFmt ) );
+
+  for( auto frame : job.frames ) frame->Release();
+  output->Release();
+}
+
+BENCHMARK( BM_Convert )
+  ->ArgNames( {"format", "height", "eyes"} )
+  ->ArgsProduct( {{0, 1, 2, 3}, {1080, 2160}, {1, 2}} )
+  ->Unit( benchmark::kMillisecond )
+  ->UseRealTime();
+
+//== End-to-end delivery ==
+//
+// Each iteration is one frame arriving at the new images callback.
+// Args:  pixel format index, frame height, real time (0/1)
+//
+static void BM_Delivery( benchmark::State &state )
+{
+  const BMDPixelFormat pixFmt = PixelFormats[ state.range(0) ];
+  const BMDDisplayMode mode = modeForHeight( state.range(1) );
+  const bool realTime = state.range(2);
+
+  SimulatedDeckLink *sim = makeSimulator( mode, realTime );
+  DeckLink deckLink( sim );
+  sim->Release();
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  uint64_t delivered = 0;
+
+  InputHandler input( deckLink );
+  input.setPixelFormat( pixFmt );
+  input.setNewImagesCallback( [&]( const InputHandler::MatVector &images ) {
+    benchmark::DoNotOptimize( images[0].data );
+    std::lock_guard<std::mutex> lock( mutex );
+    ++delivered;
+    cond.notify_all();
+  });
+
+  if( !input.enable( mode, false, false ) || !input.startStreams() ) {
+    state.SkipWithError( "Unable to start input" );
+    return;
+  }
+
+  auto waitFor = [&]( uint64_t count ) {
+    std::unique_lock<std::mutex> lock( mutex );
+    cond.wait( lock, [&]{ return delivered >= count; } );
+  };
+
+  // Let the pipeline, and the pools behind it, fill before measuring
+  uint64_t target = realTime ? 5 : 100;
+  waitFor( target );
+  input.stats().reset();
+
+  const uint64_t allocsBefore = allocations.load();
+
+  for( auto _ : state ) {
+    waitFor( ++target );
+  }
+
+  const uint64_t allocs = allocations.load() - allocsBefore;
+  const CaptureStats::Snapshot stats( input.stats().snapshot() );
+  input.stopStreams();
+
+  state.counters["allocs_per_frame"] = benchmark::Counter( allocs, benchmark::Counter::kAvgIterations );
+  state.counters["frames_per_second"] = benchmark::Counter( state.iterations(), benchmark::Counter::kIsRate );
+  state.counters["frames_dropped"] = stats.dropped + sim->stats().framesDropped;
+  addLatencyCounters( state, stats.deliveryLatency );
+  state.counters["driver_callback_p99_us"] = stats.driverCallbackTime.percentile(0.99) / 1000.0;
+  state.counters["driver_callback_max_us"] = stats.driverCallbackTime.max / 1000.0;
+  state.SetLabel( pixelFormatToString( pixFmt ) + (realTime ? " real time" : "") );
+}
+
+BENCHMARK( BM_Delivery )
+  ->ArgNames( {"format", "height", "realtime"} )
+  ->ArgsProduct( {{0, 1, 2, 3}, {1080, 2160}, {0}} )
+  ->Unit( benchmark::kMillisecond )
+  ->UseRealTime();
+
+BENCHMARK( BM_Delivery )
+  ->ArgNames( {"format", "height", "realtime"} )
+  ->ArgsProduct( {{0, 2}, {1080}, {1}} )
+  ->Unit( benchmark::kMillisecond )
+  ->Iterations( 300 )
+  ->UseRealTime();
+
+//== Ancillary packets ==
+//
+// Args:  encoder (0 table-driven, 1 scalar reference), payload bytes
+//
+static void BM_AncillaryEncode( benchmark::State &state )
+{
+  const bool scalar = state.range(0);
+  const size_t len = state.range(1);
+
+  std::vector<uint8_t> data( len );
+  for( size_t i = 0; i < len; ++i ) data[i] = i * 7;
+  std::vector<uint32_t> line( vancLineWords( 1920 ) );
+
+  for( auto _ : state ) {
+    if( scalar )
+      encodeAncillaryPacketScalar( line.data(), kSDIRemoteControlDID, kSDIRemoteControlSDID, data.data(), len );
+    else
+      encodeAncillaryPacket( line.data(), kSDIRemoteControlDID, kSDIRemoteControlSDID, data.data(), len );
+    benchmark::DoNotOptimize( line.data() );
+    benchmark::ClobberMemory();
+  }
+
+  state.SetBytesProcessed( state.iterations() * len );
+  state.SetLabel( scalar ? "scalar" : "table" );
+}
+
+BENCHMARK( BM_AncillaryEncode )
+  ->ArgNames( {"scalar", "bytes"} )
+  ->ArgsProduct( {{0, 1}, {12, 96, 255}} );
+
+// Args:  payload bytes
+static void BM_AncillaryDecode( benchmark::State &state )
+{
+  const size_t len = state.range(0);
+
+  std::vector<uint8_t> data( len );
+  for( size_t i = 0; i < len; ++i ) data[i] = i * 7;
+  std::vector<uint32_t> line( vancLineWords( 1920 ) );
+  encodeAncillaryPacket( line.data(), kSDIRemoteControlDID, kSDIRemoteControlSDID, data.data(), len );
+
+  AncillaryPacket packet;
+  for( auto _ : state ) {
+    benchmark::DoNotOptimize( decodeAncillaryPacket( line.data(), line.size(), packet ) );
+    benchmark::ClobberMemory();
+  }
+
+  state.SetBytesProcessed( state.iterations() * len );
+}
+
+BENCHMARK( BM_AncillaryDecode )
+  ->ArgNames( {"bytes"} )
+  ->Arg( 12 )->Arg( 96 )->Arg( 255 );
+
+//== main ==
+
+int main( int argc, char **argv )
+{
+  // JSON unless asked otherwise
+  std::vector<char *> args( argv, argv + argc );
+  bool haveFormat = false;
+  for( int i = 1; i < argc; ++i )
+    if( std::string( argv[i] ).find( "--benchmark_format" ) == 0 ) haveFormat = true;
+
+  char jsonFormat[] = "--benchmark_format=json";
+  if( !haveFormat ) args.push_back( jsonFormat );
+
+  int numArgs = args.size();
+  benchmark::Initialize( &numArgs, args.data() );
+  if( benchmark::ReportUnrecognizedArguments( numArgs, args.data() ) ) return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "libblackmagic/BoundedQueue.h"
+
+using namespace libblackmagic;
+
+TEST(TestBoundedQueue, DropOldestKeepsNewest) {
+  BoundedQueue<int> q( 3, BoundedQueue<int>::DropOldest );
+
+  for( int i = 1; i <= 5; ++i ) {
+    int item = i;
+    ASSERT_TRUE( q.push(item) );
+  }
+
+  auto stats = q.stats();
+  ASSERT_EQ( stats.enqueued, 5u );
+  ASSERT_EQ( stats.dropped, 2u );
+  ASSERT_EQ( stats.highWater, 3u );
+
+  int out = 0;
+  for( int expected = 3; expected <= 5; ++expected ) {
+    ASSERT_TRUE( q.try_pop(out) );
+    ASSERT_EQ( out, expected );
+  }
+  ASSERT_FALSE( q.try_pop(out) );
+}
+
+TEST(TestBoundedQueue, DropNewestRefusesItem) {
+  BoundedQueue<int> q( 2, BoundedQueue<int>::DropNewest );
+
+  int a = 1, b = 2, c = 3;
+  ASSERT_TRUE( q.push(a) );
+  ASSERT_TRUE( q.push(b) );
+  ASSERT_FALSE( q.push(c) );
+
+  // Refused item is handed back
+  ASSERT_EQ( c, 3 );
+  ASSERT_EQ( q.stats().dropped, 1u );
+
+  int out = 0;
+  ASSERT_TRUE( q.try_pop(out) );
+  ASSERT_EQ( out, 1 );
+}
+
+TEST(TestBoundedQueue, BlockWaitsForConsumer) {
+  BoundedQueue<int> q( 1, BoundedQueue<int>::Block );
+
+  std::thread producer( [&q]() {
+    for( int i = 0; i < 100; ++i ) {
+      int item = i;
+      q.push(item);
+    }
+    q.close();
+  });
+
+  int out = 0, expected = 0;
+  while( q.pop(out) ) ASSERT_EQ( out, expected++ );
+  producer.join();
+
+  ASSERT_EQ( expected, 100 );
+  ASSERT_EQ( q.stats().dropped, 0u );
+  ASSERT_EQ( q.stats().highWater, 1u );
+}
+
+TEST(TestBoundedQueue, StopWaitingReleasesBlockedPush) {
+  BoundedQueue<int> q( 1, BoundedQueue<int>::Block );
+
+  int first = 1;
+  ASSERT_TRUE( q.push(first) );
+
+  // Nobody pops, so this waits until told not to
+  bool pushed = true;
+  std::thread producer( [&q, &pushed]() {
+    int item = 2;
+    pushed = q.push(item);
+  });
+
+  std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+  q.stopWaiting();
+  producer.join();
+
+  ASSERT_FALSE( pushed );
+  ASSERT_EQ( q.stats().dropped, 1u );
+
+  // What was queued is still there
+  int out = 0;
+  ASSERT_TRUE( q.try_pop(out) );
+  ASSERT_EQ( out, 1 );
+
+  // And open() makes pushes wait again
+  q.open();
+  int item = 3;
+  ASSERT_TRUE( q.push(item) );
+}
+
+TEST(TestBoundedQueue, ClosedQueueRefusesPush) {
+  BoundedQueue<int> q( 2 );
+  q.close();
+
+  int item = 1;
+  ASSERT_FALSE( q.push(item) );
+
+  int out;
+  ASSERT_FALSE( q.pop(out) );
+  ASSERT_FALSE( q.pop_for(out, std::chrono::milliseconds(1)) );
+}
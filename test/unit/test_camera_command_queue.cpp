@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/CameraCommandQueue.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  const uint8_t kAssign = 0, kOffset = 1;
+
+  // An int16 command, 12 bytes with its header and padding
+  void addCommand( BMSDIBuffer *buffer, uint8_t camera, uint8_t category, uint8_t parameter,
+                   uint8_t operation, int16_t value ) {
+    const uint8_t msg[12] = { camera, 6, 0, 0,
+                              category, parameter, 2, operation,
+                              uint8_t(value & 0xff), uint8_t((value >> 8) & 0xff), 0, 0 };
+    memcpy( buffer->data + buffer->len, msg, sizeof(msg) );
+    buffer->len += sizeof(msg);
+  }
+
+  struct Command {
+    uint8_t camera, category, parameter, operation;
+    int16_t value;
+
+    bool operator==( const Command &other ) const {
+      return camera == other.camera && category == other.category && parameter == other.parameter &&
+             operation == other.operation && value == other.value;
+    }
+  };
+
+  std::ostream &operator<<( std::ostream &out, const Command &c ) {
+    return out << int(c.camera) << "/" << int(c.category) << "." << int(c.parameter)
+               << (c.operation == kAssign ? " = " : " += ") << c.value;
+  }
+
+  std::vector<Command> parse( const BMSDIBuffer &packet ) {
+    std::vector<Command> commands;
+    for( size_t offset = 0; offset + 12 <= packet.len; offset += 12 ) {
+      const uint8_t *m = packet.data + offset;
+      commands.push_back( Command{ m[0], m[4], m[5], m[7], int16_t( m[8] | (m[9] << 8) ) } );
+    }
+    return commands;
+  }
+
+  std::vector<Command> fill( CameraCommandQueue &queue ) {
+    BMSDIBuffer packet;
+    bmResetBuffer( &packet );
+    queue.fill( &packet );
+    queue.confirm();
+    return parse( packet );
+  }
+
+}
+
+TEST(TestCameraCommandQueue, LatestValueWins) {
+  CameraCommandQueue queue;
+
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 1, 13, kAssign, 1 ); } );     // gain
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 0, 0, kOffset, 10 ); } );     // focus
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 1, 13, kAssign, 2 ); } );
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 2, 1, 13, kAssign, 5 ); } );     // another camera
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 1, 13, kAssign, 3 ); } );
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 0, 0, kOffset, 10 ); } );     // offsets add up
+
+  ASSERT_TRUE( queue.pending() );
+
+  // The last gain, where the first was
+  const std::vector<Command> expected = {
+    { 1, 1, 13, kAssign, 3 },
+    { 1, 0, 0, kOffset, 10 },
+    { 2, 1, 13, kAssign, 5 },
+    { 1, 0, 0, kOffset, 10 }
+  };
+  ASSERT_EQ( fill( queue ), expected );
+
+  CameraCommandQueue::Stats stats( queue.stats() );
+  ASSERT_EQ( stats.queued, 6u );
+  ASSERT_EQ( stats.coalesced, 2u );
+  ASSERT_EQ( stats.sent, 4u );
+  ASSERT_EQ( stats.packets, 1u );
+
+  ASSERT_FALSE( queue.pending() );
+  ASSERT_TRUE( fill( queue ).empty() );
+  ASSERT_EQ( queue.stats().packets, 1u );
+}
+
+TEST(TestCameraCommandQueue, AssignmentSupersedesOffsets) {
+  CameraCommandQueue queue;
+
+  queue( []( BMSDIBuffer *b ) {
+    addCommand( b, 1, 0, 0, kOffset, 10 );
+    addCommand( b, 1, 0, 0, kOffset, 10 );
+    addCommand( b, 1, 0, 0, kAssign, 100 );
+    addCommand( b, 1, 0, 0, kOffset, -5 );
+  });
+
+  const std::vector<Command> expected = {
+    { 1, 0, 0, kAssign, 100 },
+    { 1, 0, 0, kOffset, -5 }
+  };
+  ASSERT_EQ( fill( queue ), expected );
+  ASSERT_EQ( queue.stats().coalesced, 2u );
+}
+
+TEST(TestCameraCommandQueue, SpillsToLaterPackets) {
+  CameraCommandQueue queue;
+
+  // 360 bytes of commands, more than one packet holds
+  for( int i = 0; i < 30; ++i )
+    ASSERT_TRUE( queue( [i]( BMSDIBuffer *b ){ addCommand( b, 1, 4, i, kAssign, i ); } ) );
+
+  const std::vector<Command> first( fill( queue ) );
+  ASSERT_EQ( first.size(), 21u );
+  ASSERT_TRUE( queue.pending() );
+  ASSERT_EQ( queue.stats().pending, 9u );
+
+  // A newer value for one still waiting keeps its place
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 4, 25, kAssign, 1000 ); } );
+
+  const std::vector<Command> second( fill( queue ) );
+  ASSERT_EQ( second.size(), 9u );
+  for( int i = 0; i < 21; ++i ) ASSERT_EQ( first[i].parameter, i );
+  for( int i = 0; i < 9; ++i ) ASSERT_EQ( second[i].parameter, 21 + i );
+  ASSERT_EQ( second[4].value, 1000 );
+
+  ASSERT_FALSE( queue.pending() );
+}
+
+TEST(TestCameraCommandQueue, FullQueueRefusesRatherThanBlocks) {
+  CameraCommandQueue queue( 4 );
+
+  unsigned int accepted = 0;
+  for( int i = 0; i < 10; ++i )
+    if( queue( [i]( BMSDIBuffer *b ){ addCommand( b, 1, 4, i, kAssign, i ); } ) ) ++accepted;
+
+  ASSERT_EQ( accepted, 4u );
+  ASSERT_EQ( queue.stats().dropped, 6u );
+
+  ASSERT_EQ( fill( queue ).size(), 4u );
+  ASSERT_TRUE( queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 4, 0, kAssign, 0 ); } ) );
+
+  // Too long to be a single command
+  BMSDIBuffer oversized;
+  bmResetBuffer( &oversized );
+  oversized.data[1] = 100;
+  oversized.len = 104;
+  ASSERT_FALSE( queue.push( oversized ) );
+}
+
+TEST(TestCameraCommandQueue, CountsSentOnceConfirmed) {
+  CameraCommandQueue queue;
+  for( int i = 0; i < 3; ++i )
+    queue( [i]( BMSDIBuffer *b ){ addCommand( b, 1, 4, i, kAssign, i ); } );
+
+  BMSDIBuffer packet;
+  bmResetBuffer( &packet );
+  ASSERT_EQ( queue.fill( &packet ), 3u );
+  ASSERT_EQ( queue.stats().sent, 0u );
+  ASSERT_EQ( queue.stats().packets, 0u );
+
+  // Their frame never went out
+  ASSERT_EQ( queue.abandon(), 3u );
+  ASSERT_EQ( queue.stats().dropped, 3u );
+
+  queue( []( BMSDIBuffer *b ){ addCommand( b, 1, 4, 0, kAssign, 0 ); } );
+  bmResetBuffer( &packet );
+  ASSERT_EQ( queue.fill( &packet ), 1u );
+  queue.confirm();
+
+  const CameraCommandQueue::Stats stats( queue.stats() );
+  ASSERT_EQ( stats.sent, 1u );
+  ASSERT_EQ( stats.packets, 1u );
+  ASSERT_EQ( stats.dropped, 3u );
+  ASSERT_EQ( queue.abandon(), 0u );
+}
+
+TEST(TestCameraCommandQueue, ManyProducers) {
+  CameraCommandQueue queue( 1024 );
+
+  const int kProducers = 4, kValues = 5000;
+  std::atomic<int> running( kProducers );
+
+  // Each producer counts its own parameter up, on its own camera
+  std::vector<std::thread> producers;
+  for( int p = 0; p < kProducers; ++p ) {
+    producers.push_back( std::thread( [&queue, &running, p]() {
+      for( int v = 1; v <= kValues; ++v ) {
+        while( !queue( [p, v]( BMSDIBuffer *b ){ addCommand( b, p, 1, 13, kAssign, v ); } ) )
+          std::this_thread::yield();
+      }
+      --running;
+    }));
+  }
+
+  // Values only ever go up, and the last one always arrives
+  std::map<uint8_t, int16_t> latest;
+  bool inOrder = true;
+  while( running > 0 || queue.pending() ) {
+    for( const Command &c : fill( queue ) ) {
+      if( c.value <= latest[c.camera] ) inOrder = false;
+      latest[c.camera] = c.value;
+    }
+    std::this_thread::yield();
+  }
+
+  for( std::thread &t : producers ) t.join();
+  for( const Command &c : fill( queue ) ) latest[c.camera] = c.value;
+
+  ASSERT_TRUE( inOrder );
+  for( int p = 0; p < kProducers; ++p ) ASSERT_EQ( latest[p], kValues );
+
+  const CameraCommandQueue::Stats stats( queue.stats() );
+  ASSERT_EQ( stats.queued, uint64_t(kProducers * kValues) );
+  ASSERT_EQ( stats.sent + stats.coalesced, stats.queued );
+}
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/FrameRecorder.h"
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+#include "../TestFrame.h"
+
+using namespace libblackmagic;
+using namespace bmtest;
+
+namespace {
+
+  struct Record {
+    RecordedFrameHeader header;
+    std::vector<uint8_t> data;
+  };
+
+  // Walks a recording the way a reader would
+  bool readRecording( const std::string &path, std::vector<Record> &records ) {
+    std::ifstream in( path, std::ios::binary );
+
+    RecordingFileHeader fileHeader;
+    in.read( reinterpret_cast<char *>( &fileHeader ), sizeof(fileHeader) );
+    if( !in || !fileHeader.valid() || fileHeader.blockSize != 4096 ) return false;
+
+    // The index, if there is one, follows the last record
+    uint64_t offset = fileHeader.blockSize;
+    while( fileHeader.indexOffset == 0 || offset < fileHeader.indexOffset ) {
+      Record record;
+      in.seekg( offset );
+      in.read( reinterpret_cast<char *>( &record.header ), sizeof(record.header) );
+      if( !in ) return true;
+      if( !record.header.valid() ) return false;
+
+      record.data.resize( record.header.dataSize );
+      in.seekg( offset + record.header.headerSize );
+      in.read( reinterpret_cast<char *>( record.data.data() ), record.data.size() );
+      if( !in ) return false;
+
+      offset += record.header.recordSize;
+      records.push_back( record );
+    }
+
+    return true;
+  }
+
+}
+
+class TestFrameRecorder : public ::testing::TestWithParam<bool> {};
+
+TEST_P(TestFrameRecorder, WritesReadableRecords) {
+  FrameRecorder::Options opts;
+  opts.useIoUring = GetParam();
+  const std::string path( tempPath() );
+
+  // Block-sized frames are written in place, the others need their tail
+  // (or, unaligned, the whole frame) copied
+  TestFrame *mono = new TestFrame( 1, 256, 32, 512, true );
+  TestFrame *left = new TestFrame( 2, 100, 10, 5000, true );
+  TestFrame *right = new TestFrame( 3, 100, 10, 5000, false );
+
+  {
+    FrameRecorder recorder( opts );
+    ASSERT_TRUE( recorder.open( path ) );
+
+    FrameMetadata meta;
+    meta.sequence = 7;
+    meta.streamTime = 1234;
+    meta.timecode.valid = true;
+    meta.timecode.hours = 1;  meta.timecode.frames = 29;
+    ASSERT_TRUE( recorder.record( mono, nullptr, meta, bmdModeHD1080p2997 ) );
+
+    meta.sequence = 8;
+    meta.is3D = true;
+    meta.timecode.valid = false;
+    ASSERT_TRUE( recorder.record( left, right, meta, bmdModeHD1080p2997 ) );
+
+    recorder.close();
+
+    const FrameRecorder::Stats stats( recorder.stats() );
+    ASSERT_EQ( stats.records, 3u );
+    ASSERT_EQ( stats.dropped, 0u );
+    ASSERT_EQ( stats.errors, 0u );
+  }
+
+  // The recorder has let go of every frame
+  ASSERT_EQ( mono->refCount(), 1 );
+  ASSERT_EQ( left->refCount(), 1 );
+  ASSERT_EQ( right->refCount(), 1 );
+
+  std::vector<Record> records;
+  ASSERT_TRUE( readRecording( path, records ) );
+  ASSERT_EQ( records.size(), 3u );
+
+  const TestFrame *frames[3] = { mono, left, right };
+  for( unsigned int i = 0; i < 3; ++i ) {
+    const RecordedFrameHeader &h( records[i].header );
+    ASSERT_EQ( h.headerSize % 4096, 0u );
+    ASSERT_EQ( h.recordSize % 4096, 0u );
+    ASSERT_EQ( h.dataSize, frames[i]->size() );
+    ASSERT_EQ( h.displayMode, (uint32_t)bmdModeHD1080p2997 );
+    ASSERT_EQ( h.pixelFormat, (uint32_t)bmdFormat10BitYUV );
+    ASSERT_TRUE( std::equal( records[i].data.begin(), records[i].data.end(), frames[i]->data() ) );
+  }
+
+  ASSERT_EQ( records[0].header.sequence, 7u );
+  ASSERT_EQ( records[0].header.streamTime, 1234 );
+  ASSERT_EQ( records[0].header.width, 256u );
+  ASSERT_TRUE( records[0].header.flags & RecordedFrameHeader::TimecodeValid );
+  ASSERT_EQ( records[0].header.timecodeHours, 1 );
+  ASSERT_EQ( records[0].header.timecodeFrames, 29 );
+
+  for( unsigned int i = 1; i < 3; ++i ) {
+    ASSERT_EQ( records[i].header.sequence, 8u );
+    ASSERT_EQ( records[i].header.eye, i - 1 );
+    ASSERT_TRUE( records[i].header.flags & RecordedFrameHeader::Is3D );
+  }
+
+  mono->Release();
+  left->Release();
+  right->Release();
+  unlink( path.c_str() );
+}
+
+TEST_P(TestFrameRecorder, DropsFramesWhenDiskFallsBehind) {
+  FrameRecorder::Options opts;
+  opts.useIoUring = GetParam();
+  opts.framesInFlight = 1;
+  const std::string path( tempPath() );
+
+  // Stalls the writer thread as it finishes the first frame
+  Gate gate;
+  TestFrame *slow = new TestFrame( 1, 256, 16, 512, true, &gate );
+  TestFrame *frame = new TestFrame( 2, 256, 16, 512, true );
+
+  uint64_t reported = 0;
+  FrameRecorder recorder( opts );
+  recorder.setBackpressureCallback( [&]( uint64_t dropped ) { reported = dropped; } );
+  ASSERT_TRUE( recorder.open( path ) );
+
+  FrameMetadata meta;
+  ASSERT_TRUE( recorder.record( slow, nullptr, meta, bmdModeHD1080p2997 ) );
+  gate.waitForEntry();
+
+  // One slot left, then nothing until the writer catches up
+  ASSERT_TRUE( recorder.record( frame, nullptr, meta, bmdModeHD1080p2997 ) );
+  ASSERT_FALSE( recorder.record( frame, nullptr, meta, bmdModeHD1080p2997 ) );
+  ASSERT_FALSE( recorder.record( frame, nullptr, meta, bmdModeHD1080p2997 ) );
+  ASSERT_EQ( reported, 1u );
+
+  gate.release();
+  recorder.close();
+
+  const FrameRecorder::Stats stats( recorder.stats() );
+  ASSERT_EQ( stats.records, 2u );
+  ASSERT_EQ( stats.dropped, 2u );
+  ASSERT_EQ( stats.inFlight, 0u );
+
+  slow->Release();
+  frame->Release();
+  unlink( path.c_str() );
+}
+
+INSTANTIATE_TEST_CASE_P(WritePaths, TestFrameRecorder, ::testing::Values( true, false ));
+
+TEST(TestFrameRecorderCapture, RecordsBothEyes) {
+  SimulatedDeckLink::Options opts;
+  opts.realTime = false;
+  opts.is3D = true;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+
+  const std::string path( tempPath() );
+  FrameRecorder recorder;
+  ASSERT_TRUE( recorder.open( path ) );
+
+  {
+    InputHandler input( deckLink );
+    input.setRecorder( &recorder );
+    input.setNewFramesCallback( []( FrameHandle ){;} );
+
+    // Page-aligned capture buffers are written in place
+    PooledFrameAllocator::Options allocOpts;
+    allocOpts.useHugePages = false;
+    allocOpts.lockMemory = false;
+    input.useFrameAllocator( allocOpts );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, true ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    for( int i = 0; i < 500 && recorder.stats().records < 40; ++i )
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+
+    input.stopStreams();
+  }
+
+  recorder.close();
+  ASSERT_GE( recorder.stats().records, 40u );
+  ASSERT_EQ( recorder.stats().errors, 0u );
+
+  std::vector<Record> records;
+  ASSERT_TRUE( readRecording( path, records ) );
+  ASSERT_EQ( records.size(), recorder.stats().records );
+
+  for( size_t i = 0; i < records.size(); ++i ) {
+    const RecordedFrameHeader &h( records[i].header );
+    ASSERT_EQ( h.eye, i % 2 );
+    ASSERT_EQ( h.sequence, records[i - (i % 2)].header.sequence );
+    ASSERT_EQ( h.width, 1920u );
+    ASSERT_EQ( h.height, 1080u );
+    ASSERT_EQ( h.pixelFormat, (uint32_t)bmdFormat10BitYUV );
+    ASSERT_EQ( h.displayMode, (uint32_t)bmdModeHD1080p2997 );
+  }
+
+  sim->Release();
+  unlink( path.c_str() );
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/FrameWorkerPool.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  // Only counts its references;  the pool never looks inside a frame
+  class TestFrame : public IDeckLinkVideoFrame {
+  public:
+    TestFrame() : _refCount(1) {;}
+
+    int refCount() const   { return _refCount; }
+
+    virtual long GetWidth()                    { return 0; }
+    virtual long GetHeight()                   { return 0; }
+    virtual long GetRowBytes()                 { return 0; }
+    virtual BMDPixelFormat GetPixelFormat()    { return bmdFormat10BitYUV; }
+    virtual BMDFrameFlags GetFlags()           { return bmdFrameFlagDefault; }
+    virtual HRESULT GetBytes( void **buffer )  { *buffer = nullptr;  return E_FAIL; }
+    virtual HRESULT GetTimecode( BMDTimecodeFormat, IDeckLinkTimecode **tc )   { *tc = nullptr;  return S_FALSE; }
+    virtual HRESULT GetAncillaryData( IDeckLinkVideoFrameAncillary **anc )      { *anc = nullptr;  return S_FALSE; }
+
+    virtual HRESULT QueryInterface( REFIID, LPVOID *ppv )   { *ppv = nullptr;  return E_NOINTERFACE; }
+    virtual ULONG AddRef()    { return ++_refCount; }
+    virtual ULONG Release()   { return --_refCount; }
+
+  private:
+    std::atomic<int> _refCount;
+  };
+
+  // Up to 2 ms of work per job, different for each, so jobs finish out
+  // of order
+  std::vector<std::chrono::microseconds> randomDelays( size_t count ) {
+    std::mt19937 gen( 101 );
+    std::uniform_int_distribution<int> dist( 0, 2000 );
+
+    std::vector<std::chrono::microseconds> delays;
+    for( size_t i = 0; i < count; ++i ) delays.push_back( std::chrono::microseconds( dist( gen ) ) );
+    return delays;
+  }
+
+  // Job i is submitted with frames[i]
+  struct Jobs {
+    Jobs( size_t count )
+      : frames( count ), delays( randomDelays( count ) ), delivered()
+      {;}
+
+    int indexOf( const FrameWorkerPool::Job &job ) const
+      { return static_cast<TestFrame *>( job.frames[0] ) - frames.data(); }
+
+    std::vector<TestFrame> frames;
+    std::vector<std::chrono::microseconds> delays;
+    std::vector<int> delivered;
+  };
+
+  // Sets up pool to sleep for each job's delay, and record the order
+  // jobs are delivered in
+  void recordDelivery( FrameWorkerPool &pool, Jobs &jobs ) {
+    pool.setProcessFunc( [&jobs]( FrameWorkerPool::Job &job ) {
+      std::this_thread::sleep_for( jobs.delays[ jobs.indexOf( job ) ] );
+    });
+
+    pool.setDeliverFunc( [&jobs]( FrameWorkerPool::Job &job ) {
+      jobs.delivered.push_back( jobs.indexOf( job ) );
+      for( auto frame : job.frames ) frame->Release();
+    });
+  }
+
+}
+
+TEST(TestFrameWorkerPool, DeliversInSubmissionOrder) {
+  const int numJobs = 200;
+  Jobs jobs( numJobs );
+
+  FrameWorkerPool pool( 4, 8 );
+  recordDelivery( pool, jobs );
+  pool.start();
+
+  for( int i = 0; i < numJobs; ++i ) {
+    // Every slot busy, so wait for one
+    while( !pool.submit( &jobs.frames[i] ) )
+      std::this_thread::sleep_for( std::chrono::microseconds(100) );
+  }
+
+  pool.drain();
+
+  ASSERT_EQ( jobs.delivered.size(), size_t(numJobs) );
+  for( int i = 0; i < numJobs; ++i ) ASSERT_EQ( jobs.delivered[i], i );
+
+  // Each frame released once, by the deliver function
+  for( const TestFrame &frame : jobs.frames ) ASSERT_EQ( frame.refCount(), 0 );
+
+  pool.stop();
+}
+
+TEST(TestFrameWorkerPool, StopDrainsJobsInFlight) {
+  const int numJobs = 8;
+  Jobs jobs( numJobs );
+
+  FrameWorkerPool pool( 3, numJobs );
+  recordDelivery( pool, jobs );
+  pool.start();
+
+  for( int i = 0; i < numJobs; ++i )
+    ASSERT_TRUE( pool.submit( &jobs.frames[i] ) );
+
+  // With most, if not all, still queued or being processed
+  pool.stop();
+
+  ASSERT_EQ( jobs.delivered.size(), size_t(numJobs) );
+  for( int i = 0; i < numJobs; ++i ) ASSERT_EQ( jobs.delivered[i], i );
+  for( const TestFrame &frame : jobs.frames ) ASSERT_EQ( frame.refCount(), 0 );
+
+  // Nothing more once stopped, and the frames are left to the caller
+  jobs.frames[0].AddRef();
+  ASSERT_FALSE( pool.submit( &jobs.frames[0] ) );
+  ASSERT_EQ( jobs.frames[0].refCount(), 1 );
+
+  // And it starts again
+  jobs.delivered.clear();
+  pool.start();
+  ASSERT_TRUE( pool.submit( &jobs.frames[0] ) );
+  pool.stop();
+  ASSERT_EQ( jobs.delivered, std::vector<int>( 1, 0 ) );
+  ASSERT_EQ( jobs.frames[0].refCount(), 0 );
+}
@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+
+#include "libblackmagic/LatencyHistogram.h"
+
+using namespace libblackmagic;
+
+TEST(TestLatencyHistogram, BucketsAreContiguous) {
+  // Every value lands in a bucket whose upper bound is at least the value,
+  // and the previous bucket's upper bound is below it
+  for( uint64_t v = 0; v < (1u << 20); v += 7 ) {
+    const unsigned int b = LatencyHistogram::bucketFor(v);
+    ASSERT_LT( b, LatencyHistogram::kNumBuckets );
+    ASSERT_GE( LatencyHistogram::bucketUpperBound(b), v );
+    if( b > 0 ) {
+      ASSERT_LT( LatencyHistogram::bucketUpperBound(b-1), v );
+    }
+  }
+
+  ASSERT_EQ( LatencyHistogram::bucketFor( ~0ULL ), LatencyHistogram::kNumBuckets - 1 );
+}
+
+TEST(TestLatencyHistogram, RelativeErrorIsBounded) {
+  for( uint64_t v = 32; v < (1ULL << 34); v = v * 3 / 2 ) {
+    const uint64_t upper = LatencyHistogram::bucketUpperBound( LatencyHistogram::bucketFor(v) );
+    ASSERT_LE( double(upper - v) / v, 1.0 / LatencyHistogram::kSubBuckets );
+  }
+}
+
+TEST(TestLatencyHistogram, Percentiles) {
+  LatencyHistogram hist;
+
+  for( uint64_t v = 1; v <= 1000; ++v ) hist.record( v * 1000 );
+
+  auto snap = hist.snapshot();
+  ASSERT_EQ( snap.count, 1000u );
+  ASSERT_EQ( snap.max, 1000000u );
+  ASSERT_NEAR( snap.mean(), 500500.0, 1.0 );
+
+  ASSERT_NEAR( double(snap.percentile(0.5)), 500000.0, 500000.0 / 16 );
+  ASSERT_NEAR( double(snap.percentile(0.99)), 990000.0, 990000.0 / 16 );
+  ASSERT_EQ( snap.percentile(1.0), 1000000u );
+
+  hist.reset();
+  ASSERT_EQ( hist.snapshot().count, 0u );
+  ASSERT_EQ( hist.snapshot().percentile(0.5), 0u );
+}
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/MatBufferPool.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+#include "../AllocationCounter.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  cv::Mat pooledImage( MatBufferPool *pool, int rows, int cols, int type ) {
+    cv::Mat image;
+    image.allocator = pool;
+    image.create( rows, cols, type );
+    return image;
+  }
+
+}
+
+TEST(TestMatBufferPool, RecyclesBuffers) {
+  MatBufferPool *pool = new MatBufferPool( 1080 * 1920 * 4, 4 );
+
+  cv::Mat image( pooledImage( pool, 1080, 1920, CV_8UC4 ) );
+  const uchar *data = image.data;
+  ASSERT_NE( data, nullptr );
+
+  // A copy of the header keeps the buffer
+  cv::Mat copy( image );
+  image.release();
+  ASSERT_EQ( pool->stats().inUse, 1u );
+
+  copy.release();
+  ASSERT_EQ( pool->stats().inUse, 0u );
+
+  // Smaller images fit in the same buffer
+  image = pooledImage( pool, 540, 960, CV_8UC4 );
+  ASSERT_EQ( image.data, data );
+
+  const MatBufferPool::Stats stats( pool->stats() );
+  ASSERT_EQ( stats.allocations, 2u );
+  ASSERT_EQ( stats.buffers, 1u );
+  ASSERT_EQ( stats.fallbackAllocations, 0u );
+
+  image.release();
+  pool->Release();
+}
+
+TEST(TestMatBufferPool, FallsBackWhenFull) {
+  MatBufferPool *pool = new MatBufferPool( 100 * 100, 2 );
+
+  cv::Mat a( pooledImage( pool, 100, 100, CV_8UC1 ) ),
+          b( pooledImage( pool, 100, 100, CV_8UC1 ) ),
+          c( pooledImage( pool, 100, 100, CV_8UC1 ) ),
+          big( pooledImage( pool, 200, 200, CV_8UC1 ) );
+
+  ASSERT_FALSE( c.empty() );
+  ASSERT_FALSE( big.empty() );
+
+  const MatBufferPool::Stats stats( pool->stats() );
+  ASSERT_EQ( stats.buffers, 2u );
+  ASSERT_EQ( stats.inUse, 4u );
+  ASSERT_EQ( stats.fallbackAllocations, 2u );
+
+  pool->Release();
+}
+
+TEST(TestMatBufferPool, ConfigureReplacesBuffers) {
+  MatBufferPool *pool = new MatBufferPool( 100 * 100, 4 );
+
+  cv::Mat held( pooledImage( pool, 100, 100, CV_8UC1 ) );
+  pooledImage( pool, 100, 100, CV_8UC1 );
+  ASSERT_EQ( pool->stats().buffers, 2u );
+
+  // The free buffer goes now, the held one when it is released
+  pool->configure( 200 * 200, 4 );
+  ASSERT_EQ( pool->stats().buffers, 1u );
+
+  held.release();
+  ASSERT_EQ( pool->stats().buffers, 0u );
+
+  cv::Mat image( pooledImage( pool, 200, 200, CV_8UC1 ) );
+  ASSERT_EQ( pool->stats().buffers, 1u );
+  ASSERT_EQ( pool->stats().fallbackAllocations, 0u );
+
+  pool->Release();
+}
+
+TEST(TestMatBufferPool, ImagesOutliveThePool) {
+  MatBufferPool *pool = new MatBufferPool( 100 * 100, 4 );
+
+  cv::Mat image( pooledImage( pool, 100, 100, CV_8UC1 ) );
+  pool->Release();
+
+  // The image's reference keeps the pool alive
+  memset( image.data, 0xff, 100 * 100 );
+  image.release();
+}
+
+TEST(TestMatBufferPool, SteadyStateCaptureDoesNotAllocate) {
+  SimulatedDeckLink::Options opts;
+  opts.realTime = false;
+  opts.numBuffers = 4;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  unsigned int count = 0;
+  const uchar *lastData = nullptr;
+
+  auto waitFor = [&]( unsigned int n ) {
+    std::unique_lock<std::mutex> lock( mutex );
+    return cond.wait_for( lock, std::chrono::seconds(10), [&]{ return count >= n; } );
+  };
+
+  {
+    InputHandler input( deckLink );
+    input.setPixelFormat( bmdFormat8BitYUV );
+    input.setNewImagesCallback( [&]( const InputHandler::MatVector &images ) {
+      // Stalling once fills every worker slot and the delivery queue, so
+      // the image pool reaches its largest size during warm-up
+      if( count == 50 ) std::this_thread::sleep_for( std::chrono::milliseconds(250) );
+
+      std::lock_guard<std::mutex> lock( mutex );
+      lastData = images[0].data;
+      ++count;
+      cond.notify_all();
+    });
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+    ASSERT_TRUE( waitFor( 100 ) );
+
+    const uint64_t before = allocations.load();
+    ASSERT_TRUE( waitFor( 300 ) );
+    const uint64_t after = allocations.load();
+
+    input.stopStreams();
+
+    ASSERT_EQ( after - before, 0u );
+    ASSERT_NE( lastData, nullptr );
+
+    const MatBufferPool::Stats stats( input.imageBufferStats() );
+    ASSERT_EQ( stats.fallbackAllocations, 0u );
+    ASSERT_EQ( stats.bufferSize, 1920u * 1080 * 2 );
+  }
+
+  sim->Release();
+}
@@ -0,0 +1,332 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/DeckLink.h"
+#include "libblackmagic/OutputHandler.h"
+#include "libblackmagic/SDICameraControl.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  const size_t kVancWords = vancLineWords( 1920 );
+
+  // What went out on each frame:  the VANC lines asked for
+  struct Sent {
+    IDeckLinkVideoFrame *frame;
+    std::vector< std::vector<uint32_t> > vanc;
+  };
+
+  struct Packet {
+    uint8_t sdid;
+    std::vector<uint8_t> data;
+  };
+
+  // Luma sample n of a v210 line:  three to every two words
+  uint32_t luma( const std::vector<uint32_t> &line, size_t n ) {
+    const uint32_t *pair = &line[2 * (n / 3)];
+    switch( n % 3 ) {
+      case 0:   return (pair[0] >> 10) & 0x3ff;
+      case 1:   return pair[1] & 0x3ff;
+      default:  return (pair[1] >> 20) & 0x3ff;
+    }
+  }
+
+  // The packets (of DID 0x51) one after another from the start of a VANC
+  // line, and the number of words they fill.  Empty if a checksum is wrong.
+  std::vector<Packet> decodeLine( const std::vector<uint32_t> &line, size_t &words ) {
+    std::vector<Packet> packets;
+    const size_t samples = line.size() / 2 * 3;
+
+    size_t n = 0;
+    while( n + 7 <= samples && luma( line, n ) == 0 && luma( line, n+1 ) == 0x3ff && luma( line, n+2 ) == 0x3ff ) {
+      if( (luma( line, n+3 ) & 0xff) != 0x51 ) break;
+
+      Packet p;
+      p.sdid = luma( line, n+4 ) & 0xff;
+      const unsigned int len = luma( line, n+5 ) & 0xff;
+
+      uint32_t sum = 0;
+      for( unsigned int i = 3; i < 6 + len; ++i ) sum += luma( line, n+i ) & 0x1ff;
+      for( unsigned int i = 0; i < len; ++i ) p.data.push_back( luma( line, n+6+i ) & 0xff );
+
+      sum &= 0x1ff;
+      sum |= (~(sum << 1)) & 0x200;
+      if( luma( line, n+6+len ) != sum ) return std::vector<Packet>();
+
+      packets.push_back( p );
+      n += 3 * ((6 + len + 1 + 2) / 3);
+    }
+
+    words = 2 * (n / 3);
+    return packets;
+  }
+
+  // Records each frame's VANC lines
+  void recordLines( SimulatedDeckLink *sim, const std::vector<uint32_t> &lines,
+                    std::mutex &mutex, std::vector<Sent> &sent ) {
+    sim->setOutputFrameCallback( [lines, &mutex, &sent]( IDeckLinkVideoFrame *frame ) {
+      Sent s;
+      s.frame = frame;
+
+      IDeckLinkVideoFrameAncillary *ancillary = nullptr;
+      if( frame->GetAncillaryData( &ancillary ) == S_OK && ancillary ) {
+        for( uint32_t n : lines ) {
+          const uint32_t *line = sdiProtocolLine( ancillary, n );
+          if( line ) s.vanc.push_back( std::vector<uint32_t>( line, line + kVancWords ) );
+        }
+        ancillary->Release();
+      }
+
+      std::lock_guard<std::mutex> lock( mutex );
+      sent.push_back( s );
+    });
+  }
+
+  std::vector<uint32_t> blankLine( OutputHandler &output ) {
+    IDeckLinkVideoFrameAncillary *ancillary = nullptr;
+    output.deckLinkOutput()->CreateAncillaryData( bmdFormat10BitYUV, &ancillary );
+    const uint32_t *line = sdiProtocolLine( ancillary );
+    const std::vector<uint32_t> blank( line, line + kVancWords );
+    ancillary->Release();
+    return blank;
+  }
+
+  // Sets a different int16 parameter of camera 1 with each of count
+  // messages, 12 bytes apiece
+  BMSDIBuffer command( unsigned int count, uint8_t value ) {
+    BMSDIBuffer buffer;
+    bmResetBuffer( &buffer );
+    for( unsigned int i = 0; i < count; ++i ) {
+      const uint8_t msg[12] = { 1, 6, 0, 0,  4, uint8_t(i), 2, 0,  value, 0,  0, 0 };
+      memcpy( buffer.data + buffer.len, msg, sizeof(msg) );
+      buffer.len += sizeof(msg);
+    }
+    return buffer;
+  }
+
+}
+
+TEST(TestOutputHandler, ReusesCommandFrames) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  DeckLink deckLink( sim );
+
+  std::mutex mutex;
+  std::vector<Sent> sent;
+  recordLines( sim, { kSDIRemoteControlLine }, mutex, sent );
+
+  // Long and short packets in turn, so each reuse of a frame has to
+  // clear what the last one left
+  std::vector<BMSDIBuffer> commands;
+  for( unsigned int i = 0; i < 12; ++i )
+    commands.push_back( command( (i % 2) ? 1 : 16, i ) );
+
+  std::vector<uint32_t> blankVanc;
+  {
+    OutputHandler output( deckLink );
+    ASSERT_TRUE( output.enable( bmdModeHD1080p2997 ) );
+    blankVanc = blankLine( output );
+
+    ASSERT_TRUE( output.startStreams() );
+
+    // One batch at a time, each once the last has gone out
+    CameraCommandQueue &queue( *output.commandQueue() );
+    for( const BMSDIBuffer &cmd : commands ) {
+      ASSERT_TRUE( queue.push( cmd ) );
+      for( int i = 0; i < 200 && queue.stats().sent < queue.stats().queued; ++i )
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+      ASSERT_EQ( queue.stats().sent, queue.stats().queued );
+    }
+    ASSERT_EQ( queue.stats().packets, commands.size() );
+
+    // Until the last is out
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    output.stopStreamsWait();
+  }
+
+  std::lock_guard<std::mutex> lock( mutex );
+
+  std::set<IDeckLinkVideoFrame *> frames;
+  std::vector< std::vector<uint8_t> > received, expected;
+  for( const Sent &s : sent ) {
+    frames.insert( s.frame );
+    if( s.vanc.empty() ) continue;
+
+    size_t end = 0;
+    const std::vector<Packet> packets( decodeLine( s.vanc[0], end ) );
+    ASSERT_EQ( packets.size(), 1u );
+    received.push_back( packets[0].data );
+
+    // Past the end of this packet (and its checksum), the line is as it
+    // was made
+    ASSERT_EQ( end, ancillaryPacketWords( packets[0].data.size() ) );
+    for( size_t i = end; i < kVancWords; ++i ) ASSERT_EQ( s.vanc[0][i], blankVanc[i] );
+  }
+
+  // Every command, in order, on the blank frame or a pooled one
+  for( const BMSDIBuffer &cmd : commands ) expected.push_back( std::vector<uint8_t>( cmd.data, cmd.data + cmd.len ) );
+  ASSERT_EQ( received, expected );
+  ASSERT_LE( frames.size(), OutputHandler::kNumCommandFrames + 1 );
+
+  sim->Release();
+}
+
+TEST(TestOutputHandler, SpreadsCommandsOverLines) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  DeckLink deckLink( sim );
+
+  const std::vector<uint32_t> lines = { 16, 17 };
+  std::mutex mutex;
+  std::vector<Sent> sent;
+  recordLines( sim, lines, mutex, sent );
+
+  // 200 commands, 2400 bytes:  ten 255-byte packets' worth, all waiting
+  // for the first frame
+  std::vector<uint8_t> expected;
+  {
+    OutputHandler output( deckLink );
+    output.setVancLines( lines );
+    ASSERT_TRUE( output.enable( bmdModeHD1080p2997 ) );
+
+    CameraCommandQueue &queue( *output.commandQueue() );
+    for( unsigned int i = 0; i < 200; ++i ) {
+      const uint8_t msg[12] = { uint8_t(1 + i / 100), 6, 0, 0,  4, uint8_t(i % 100), 2, 0,  uint8_t(i), 0,  0, 0 };
+      queue( [&msg]( BMSDIBuffer *b ){ memcpy( b->data, msg, sizeof(msg) ); b->len = sizeof(msg); } );
+      expected.insert( expected.end(), msg, msg + sizeof(msg) );
+    }
+
+    ASSERT_TRUE( output.startStreams() );
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    output.stopStreamsWait();
+
+    ASSERT_EQ( queue.stats().sent, 200u );
+    ASSERT_GE( queue.stats().packets, 10u );
+  }
+
+  std::lock_guard<std::mutex> lock( mutex );
+
+  // All in one frame, both lines full of packets
+  unsigned int commandFrames = 0;
+  std::vector<uint8_t> received;
+  for( const Sent &s : sent ) {
+    if( s.vanc.size() != lines.size() ) continue;
+
+    unsigned int packets = 0;
+    for( const std::vector<uint32_t> &line : s.vanc ) {
+      size_t words = 0;
+      for( const Packet &p : decodeLine( line, words ) ) {
+        ASSERT_EQ( p.sdid, kSDIRemoteControlSDID );
+        received.insert( received.end(), p.data.begin(), p.data.end() );
+        ++packets;
+      }
+      ASSERT_GT( words, 0u );
+    }
+
+    if( packets > 0 ) ++commandFrames;
+  }
+
+  ASSERT_EQ( commandFrames, 1u );
+  ASSERT_EQ( received, expected );
+
+  sim->Release();
+}
+
+TEST(TestOutputHandler, SendsTallyWithEveryFrame) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  DeckLink deckLink( sim );
+
+  std::mutex mutex;
+  std::vector<Sent> sent;
+  recordLines( sim, { kSDIRemoteControlLine }, mutex, sent );
+
+  const BMSDIBuffer cmd( command( 2, 7 ) );
+  {
+    OutputHandler output( deckLink );
+    ASSERT_TRUE( output.enable( bmdModeHD1080p2997 ) );
+
+    ASSERT_TRUE( output.setTally( 2, true, false ) );
+    ASSERT_TRUE( output.setTally( 3, false, true ) );
+    ASSERT_FALSE( output.setTally( 0, true, true ) );
+
+    ASSERT_TRUE( output.commandQueue()->push( cmd ) );
+
+    ASSERT_TRUE( output.startStreams() );
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    output.stopStreamsWait();
+  }
+
+  std::lock_guard<std::mutex> lock( mutex );
+
+  // Tally first, then the commands once
+  const std::vector<uint8_t> tally = { 0x00, 0x01, 0x02 };
+  unsigned int tallies = 0, commands = 0;
+  for( const Sent &s : sent ) {
+    if( s.vanc.empty() ) continue;
+
+    size_t words = 0;
+    const std::vector<Packet> packets( decodeLine( s.vanc[0], words ) );
+    ASSERT_FALSE( packets.empty() );
+    ASSERT_EQ( packets[0].sdid, kSDITallySDID );
+    ASSERT_EQ( packets[0].data, tally );
+    ++tallies;
+
+    if( packets.size() > 1 ) {
+      ASSERT_EQ( packets[1].data, std::vector<uint8_t>( cmd.data, cmd.data + cmd.len ) );
+      ++commands;
+    }
+  }
+
+  ASSERT_GE( tallies, 3u );
+  ASSERT_EQ( commands, 1u );
+
+  sim->Release();
+}
+
+// Callers written against the old shared buffer still get their commands out
+TEST(TestOutputHandler, DeprecatedSharedBufferStillSends) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  DeckLink deckLink( sim );
+
+  const BMSDIBuffer direct( command( 2, 1 ) ), guarded( command( 3, 2 ) );
+  {
+    OutputHandler output( deckLink );
+    ASSERT_TRUE( output.enable( bmdModeHD1080p2997 ) );
+
+    // Written straight to the buffer, and picked up by the output
+    std::shared_ptr<SharedBMSDIBuffer> sdiBuffer( output.sdiProtocolBuffer() );
+    {
+      SharedBMSDIBuffer::lock_guard lock( sdiBuffer->writeMutex() );
+      memcpy( sdiBuffer->buffer->data, direct.data, direct.len );
+      sdiBuffer->buffer->len = direct.len;
+    }
+
+    ASSERT_TRUE( output.startStreams() );
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    ASSERT_EQ( output.commandQueue()->stats().sent, 2u );
+
+    // Or through a guard, which queues them at once
+    SDIBufferGuard guard( sdiBuffer );
+    ASSERT_TRUE( guard( [&guarded]( BMSDIBuffer *b ) {
+      memcpy( b->data + b->len, guarded.data, guarded.len );
+      b->len += guarded.len;
+    }));
+    ASSERT_EQ( output.commandQueue()->stats().queued, 5u );
+
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    output.stopStreamsWait();
+
+    const CameraCommandQueue::Stats stats( output.commandQueue()->stats() );
+    ASSERT_EQ( stats.sent, 5u );
+    ASSERT_EQ( sdiBuffer->buffer->len, 0u );
+  }
+
+  sim->Release();
+}
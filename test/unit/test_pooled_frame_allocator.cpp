@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <set>
+#include <vector>
+
+#include "libblackmagic/PooledFrameAllocator.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  const size_t kBufferSize = 3 * 4096 + 100;
+
+  // Small, and without hugepages or mlock, so it runs anywhere
+  PooledFrameAllocator *makeAllocator( size_t bufferSize = kBufferSize, unsigned int numBuffers = 4 ) {
+    PooledFrameAllocator::Options opts;
+    opts.numBuffers = numBuffers;
+    opts.useHugePages = false;
+    opts.lockMemory = false;
+    return new PooledFrameAllocator( bufferSize, opts );
+  }
+
+  std::vector<void *> allocate( PooledFrameAllocator *alloc, unsigned int count, uint32_t size = kBufferSize ) {
+    std::vector<void *> buffers;
+    for( unsigned int i = 0; i < count; ++i ) {
+      void *buffer = nullptr;
+      EXPECT_EQ( alloc->AllocateBuffer( size, &buffer ), S_OK );
+      EXPECT_NE( buffer, nullptr );
+      memset( buffer, i, size );
+      buffers.push_back( buffer );
+    }
+    return buffers;
+  }
+
+  void release( PooledFrameAllocator *alloc, const std::vector<void *> &buffers ) {
+    for( void *buffer : buffers ) ASSERT_EQ( alloc->ReleaseBuffer( buffer ), S_OK );
+  }
+
+}
+
+TEST(TestPooledFrameAllocator, ReusesBuffers) {
+  PooledFrameAllocator *alloc = makeAllocator();
+  ASSERT_EQ( alloc->Commit(), S_OK );
+
+  const std::vector<void *> first( allocate( alloc, 4 ) );
+  const std::set<void *> pooled( first.begin(), first.end() );
+  ASSERT_EQ( pooled.size(), 4u );
+  for( void *buffer : first ) ASSERT_EQ( reinterpret_cast<uintptr_t>( buffer ) % 4096, 0u );
+  release( alloc, first );
+
+  // The same four, over and over
+  for( int i = 0; i < 10; ++i ) {
+    const std::vector<void *> again( allocate( alloc, 4 ) );
+    for( void *buffer : again ) ASSERT_EQ( pooled.count( buffer ), 1u );
+    release( alloc, again );
+  }
+
+  const PooledFrameAllocator::Stats stats( alloc->stats() );
+  ASSERT_EQ( stats.allocations, 44u );
+  ASSERT_EQ( stats.frees, 44u );
+  ASSERT_EQ( stats.fallbackAllocations, 0u );
+  ASSERT_EQ( stats.inUse, 0u );
+  ASSERT_EQ( stats.highWater, 4u );
+
+  alloc->Decommit();
+  alloc->Release();
+}
+
+TEST(TestPooledFrameAllocator, FallsBackWhenEmptyOrTooSmall) {
+  PooledFrameAllocator *alloc = makeAllocator();
+  ASSERT_EQ( alloc->Commit(), S_OK );
+
+  // One more than the pool holds, and one bigger than its buffers
+  std::vector<void *> buffers( allocate( alloc, 5 ) );
+  const std::vector<void *> large( allocate( alloc, 1, 8 * 4096 ) );
+  buffers.insert( buffers.end(), large.begin(), large.end() );
+
+  PooledFrameAllocator::Stats stats( alloc->stats() );
+  ASSERT_EQ( stats.allocations, 6u );
+  ASSERT_EQ( stats.fallbackAllocations, 2u );
+  ASSERT_EQ( stats.inUse, 6u );
+
+  // Fallbacks are freed, the pool's go back to the pool
+  release( alloc, buffers );
+  stats = alloc->stats();
+  ASSERT_EQ( stats.inUse, 0u );
+
+  release( alloc, allocate( alloc, 4 ) );
+  ASSERT_EQ( alloc->stats().fallbackAllocations, 2u );
+
+  alloc->Decommit();
+  alloc->Release();
+}
+
+TEST(TestPooledFrameAllocator, GrowsWhileBuffersAreOut) {
+  PooledFrameAllocator *alloc = makeAllocator();
+  ASSERT_EQ( alloc->Commit(), S_OK );
+
+  // A consumer holds on to a frame across a change to a larger mode
+  const std::vector<void *> held( allocate( alloc, 1 ) );
+
+  const size_t larger = 10 * 4096;
+  alloc->setBufferSize( larger );
+  ASSERT_EQ( alloc->Commit(), S_OK );
+  ASSERT_EQ( alloc->stats().retiredArenas, 1u );
+
+  // New buffers are pooled, not fallbacks
+  const std::vector<void *> fresh( allocate( alloc, 4, larger ) );
+  ASSERT_EQ( alloc->stats().fallbackAllocations, 0u );
+  release( alloc, fresh );
+
+  // The held buffer is still good, and its arena goes when it comes back
+  ASSERT_EQ( static_cast<uint8_t *>( held[0] )[kBufferSize - 1], 0 );
+  release( alloc, held );
+
+  const PooledFrameAllocator::Stats stats( alloc->stats() );
+  ASSERT_EQ( stats.retiredArenas, 0u );
+  ASSERT_EQ( stats.arenaBytes, 4 * larger );
+  ASSERT_EQ( stats.inUse, 0u );
+
+  // Shrinking with nothing out remaps straight away
+  alloc->setBufferSize( kBufferSize );
+  ASSERT_EQ( alloc->stats().arenaBytes, 0u );
+  release( alloc, allocate( alloc, 4 ) );
+  ASSERT_EQ( alloc->stats().arenaBytes, 4 * 4 * 4096u );
+  ASSERT_EQ( alloc->stats().fallbackAllocations, 0u );
+
+  alloc->Decommit();
+  alloc->Release();
+}
+
+TEST(TestPooledFrameAllocator, DecommitWaitsForOutstandingBuffers) {
+  PooledFrameAllocator *alloc = makeAllocator();
+  ASSERT_EQ( alloc->Commit(), S_OK );
+
+  std::vector<void *> held( allocate( alloc, 2 ) );
+  ASSERT_EQ( alloc->Decommit(), S_OK );
+
+  // Still mapped, until the last buffer is back
+  ASSERT_GT( alloc->stats().arenaBytes, 0u );
+  release( alloc, std::vector<void *>( 1, held[0] ) );
+  ASSERT_GT( alloc->stats().arenaBytes, 0u );
+  release( alloc, std::vector<void *>( 1, held[1] ) );
+  ASSERT_EQ( alloc->stats().arenaBytes, 0u );
+
+  // Committed again before they come back, the same arena carries on
+  ASSERT_EQ( alloc->Commit(), S_OK );
+  held = allocate( alloc, 1 );
+  ASSERT_EQ( alloc->Decommit(), S_OK );
+  ASSERT_EQ( alloc->Commit(), S_OK );
+  const std::vector<void *> more( allocate( alloc, 3 ) );
+  release( alloc, held );
+  release( alloc, more );
+
+  const PooledFrameAllocator::Stats stats( alloc->stats() );
+  ASSERT_GT( stats.arenaBytes, 0u );
+  ASSERT_EQ( stats.retiredArenas, 0u );
+  ASSERT_EQ( stats.fallbackAllocations, 0u );
+
+  alloc->Decommit();
+  ASSERT_EQ( alloc->stats().arenaBytes, 0u );
+  alloc->Release();
+}
+
+TEST(TestPooledFrameAllocator, PoolsOnAnyNumaNode) {
+  // Node 0 always exists;  the others can't be bound, but the pool
+  // still works, just without the binding
+  for( int node : { 0, 63, 64, 200, 1 << 20 } ) {
+    PooledFrameAllocator::Options opts;
+    opts.numBuffers = 2;
+    opts.useHugePages = false;
+    opts.lockMemory = false;
+    opts.numaNode = node;
+
+    PooledFrameAllocator *alloc = new PooledFrameAllocator( kBufferSize, opts );
+    ASSERT_EQ( alloc->Commit(), S_OK );
+
+    const std::vector<void *> buffers( allocate( alloc, 2 ) );
+    ASSERT_EQ( alloc->stats().fallbackAllocations, 0u );
+    release( alloc, buffers );
+
+    alloc->Decommit();
+    alloc->Release();
+  }
+}
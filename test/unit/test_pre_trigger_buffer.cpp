@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/FrameRecorder.h"
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/PreTriggerBuffer.h"
+#include "libblackmagic/RecordingReader.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+#include "../TestFrame.h"
+
+using namespace libblackmagic;
+using namespace bmtest;
+
+namespace {
+
+  PreTriggerBuffer::Options testOptions( float seconds ) {
+    PreTriggerBuffer::Options opts;
+    opts.seconds = seconds;
+    opts.useHugePages = false;
+    opts.lockMemory = false;
+    return opts;
+  }
+
+  // Well in the past, so dumps of these frames don't wait for more
+  const PreTriggerBuffer::TimePoint kStart( std::chrono::steady_clock::now() - std::chrono::hours(1) );
+
+  void pushFrames( PreTriggerBuffer &buffer, uint64_t first, uint64_t last ) {
+    for( uint64_t i = first; i < last; ++i ) {
+      TestFrame frame( static_cast<uint8_t>( i ) );
+      FrameMetadata meta;
+      meta.sequence = i;
+      meta.hostTime = kStart + i * std::chrono::milliseconds(33);
+      ASSERT_TRUE( buffer.push( &frame, nullptr, meta ) );
+    }
+  }
+
+  // First byte of the frame, which is its seed
+  uint8_t seedOf( IDeckLinkVideoFrame *frame ) {
+    void *bytes = nullptr;
+    frame->GetBytes( &bytes );
+    return *static_cast<uint8_t *>( bytes );
+  }
+
+}
+
+TEST(TestPreTriggerBuffer, KeepsTheLastSeconds) {
+  PreTriggerBuffer buffer( testOptions( 0.5 ) );
+  ASSERT_TRUE( buffer.configure( ModeConfig( bmdModeHD1080p2997 ), bmdFormat10BitYUV ) );
+
+  // Half a second at 29.97
+  ASSERT_EQ( buffer.stats().capacity, 15u );
+
+  pushFrames( buffer, 0, 40 );
+
+  PreTriggerBuffer::Stats stats( buffer.stats() );
+  ASSERT_EQ( stats.frames, 15u );
+  ASSERT_EQ( stats.retained, 40u );
+  ASSERT_EQ( stats.skipped, 0u );
+
+  PreTriggerBuffer::TimePoint oldest, newest;
+  ASSERT_TRUE( buffer.window( oldest, newest ) );
+  ASSERT_TRUE( oldest == kStart + 25 * std::chrono::milliseconds(33) );
+  ASSERT_TRUE( newest == kStart + 39 * std::chrono::milliseconds(33) );
+
+  // Part of what's kept, oldest first
+  std::vector<uint64_t> sequences;
+  const size_t dumped = buffer.dump( kStart + 30 * std::chrono::milliseconds(33), kStart + 34 * std::chrono::milliseconds(33),
+      [&]( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *rightEye, const FrameMetadata &meta ) {
+        EXPECT_EQ( rightEye, nullptr );
+        EXPECT_EQ( seedOf( frame ), uint8_t(meta.sequence) );
+        EXPECT_EQ( frame->GetRowBytes(), 5120 );
+        sequences.push_back( meta.sequence );
+        return true;
+      });
+
+  ASSERT_EQ( dumped, 5u );
+  ASSERT_EQ( sequences, std::vector<uint64_t>({ 30, 31, 32, 33, 34 }) );
+  ASSERT_EQ( buffer.stats().dumped, 5u );
+
+  buffer.clear();
+  ASSERT_EQ( buffer.stats().frames, 0u );
+  ASSERT_FALSE( buffer.window( oldest, newest ) );
+}
+
+TEST(TestPreTriggerBuffer, HeldFramesAreNotOverwritten) {
+  PreTriggerBuffer buffer( testOptions( 0.5 ) );
+  ASSERT_TRUE( buffer.configure( ModeConfig( bmdModeHD1080p2997 ), bmdFormat10BitYUV ) );
+  pushFrames( buffer, 0, 40 );
+
+  // Capture carries on while the first frame is being dumped, and
+  // overwrites the ten after it
+  IDeckLinkVideoFrame *held = nullptr;
+  std::vector<uint64_t> sequences;
+  buffer.dump( kStart, kStart + 49 * std::chrono::milliseconds(33),
+      [&]( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *, const FrameMetadata &meta ) {
+        if( !held ) {
+          held = frame;
+          held->AddRef();
+          pushFrames( buffer, 40, 50 );
+        }
+        sequences.push_back( meta.sequence );
+        return true;
+      });
+
+  ASSERT_EQ( sequences.size(), 15u );
+  ASSERT_EQ( sequences.front(), 25u );
+  for( size_t i = 1; i < sequences.size(); ++i ) ASSERT_EQ( sequences[i], 35 + i );
+  ASSERT_EQ( buffer.stats().missed, 10u );
+
+  // Still the frame it was
+  ASSERT_EQ( seedOf( held ), 25 );
+
+  // Until it's let go, every other slot is overwritten instead
+  pushFrames( buffer, 50, 70 );
+  ASSERT_EQ( seedOf( held ), 25 );
+  ASSERT_FALSE( buffer.configure( ModeConfig( bmdModeHD1080p2997 ), bmdFormat10BitYUV ) );
+
+  held->Release();
+  pushFrames( buffer, 70, 71 );
+  ASSERT_EQ( seedOf( held ), 70 );
+}
+
+TEST(TestPreTriggerBuffer, DumpsFramesArrivingAfterTheTrigger) {
+  PreTriggerBuffer buffer( testOptions( 0.5 ) );
+  ASSERT_TRUE( buffer.configure( ModeConfig( bmdModeHD1080p2997 ), bmdFormat10BitYUV ) );
+
+  // Capture, at 100 fps for a second
+  std::atomic<uint64_t> pushed( 0 );
+  std::vector<PreTriggerBuffer::TimePoint> arrivals;
+  std::thread capture( [&]() {
+    for( uint64_t i = 0; i < 100; ++i ) {
+      TestFrame frame( static_cast<uint8_t>( i ) );
+      FrameMetadata meta;
+      meta.sequence = i;
+      meta.hostTime = std::chrono::steady_clock::now();
+      arrivals.push_back( meta.hostTime );
+      buffer.push( &frame, nullptr, meta );
+      ++pushed;
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+  });
+
+  while( pushed < 20 ) std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+
+  // From before the trigger to a quarter of a second after it
+  const PreTriggerBuffer::TimePoint trigger( std::chrono::steady_clock::now() );
+  const PreTriggerBuffer::TimePoint to( trigger + std::chrono::milliseconds(250) );
+  std::vector<uint64_t> sequences;
+  std::vector<PreTriggerBuffer::TimePoint> dumpedArrivals;
+  const size_t dumped = buffer.dump( trigger - std::chrono::seconds(1), to,
+      [&]( IDeckLinkVideoFrame *frame, IDeckLinkVideoFrame *, const FrameMetadata &meta ) {
+        EXPECT_EQ( seedOf( frame ), uint8_t(meta.sequence) );
+        sequences.push_back( meta.sequence );
+        dumpedArrivals.push_back( meta.hostTime );
+        return true;
+      });
+
+  // Back once capture went past the end, well before it stopped
+  ASSERT_LT( pushed.load(), 100u );
+  capture.join();
+
+  ASSERT_EQ( dumped, sequences.size() );
+  ASSERT_EQ( dumped + buffer.stats().missed, sequences.back() - sequences.front() + 1 );
+  for( size_t i = 1; i < sequences.size(); ++i ) ASSERT_GT( sequences[i], sequences[i-1] );
+
+  // Up to and including the last frame before to
+  ASSERT_TRUE( dumpedArrivals.back() > trigger );
+  ASSERT_TRUE( dumpedArrivals.back() <= to );
+  ASSERT_TRUE( arrivals[ sequences.back() + 1 ] > to );
+
+  // A dump with nothing more coming can be cancelled
+  std::thread canceller( [&]() {
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    buffer.cancel();
+  });
+  const PreTriggerBuffer::TimePoint now( std::chrono::steady_clock::now() );
+  buffer.dump( now, now + std::chrono::hours(1), []( IDeckLinkVideoFrame *, IDeckLinkVideoFrame *, const FrameMetadata & ) {
+    return true;
+  });
+  canceller.join();
+  ASSERT_LT( std::chrono::steady_clock::now() - now, std::chrono::seconds(10) );
+}
+
+TEST(TestPreTriggerBuffer, DumpsCaptureToRecorder) {
+  SimulatedDeckLink::Options opts;
+  opts.realTime = false;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+
+  PreTriggerBuffer buffer( testOptions( 1.0 ) );
+  const std::string path( tempPath() );
+  FrameRecorder recorder;
+  ASSERT_TRUE( recorder.open( path ) );
+
+  size_t dumped = 0;
+  {
+    InputHandler input( deckLink );
+    input.setPreTrigger( &buffer );
+    input.setNewFramesCallback( []( FrameHandle ){;} );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_EQ( buffer.stats().capacity, 30u );
+    ASSERT_TRUE( input.startStreams() );
+
+    for( int i = 0; i < 500 && buffer.stats().retained < 60; ++i )
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+
+    // While capture continues, at the frame rate (once the frames already
+    // queued for dispatch are through) so the window doesn't move before
+    // the dump starts
+    sim->setRealTime( true );
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    PreTriggerBuffer::TimePoint oldest, newest;
+    ASSERT_TRUE( buffer.window( oldest, newest ) );
+    dumped = buffer.dump( oldest, newest, recorder );
+
+    input.stopStreams();
+  }
+
+  // Every frame in the window was either dumped or, if capture overtook
+  // the dump, overwritten first
+  recorder.close();
+  ASSERT_GT( dumped, 0u );
+  ASSERT_EQ( dumped + buffer.stats().missed, 30u );
+  ASSERT_EQ( recorder.stats().records, dumped );
+  ASSERT_EQ( recorder.stats().dropped, 0u );
+
+  RecordingReader reader;
+  ASSERT_TRUE( reader.open( path ) );
+  ASSERT_EQ( reader.size(), dumped );
+  ASSERT_EQ( reader.displayMode(), bmdModeHD1080p2997 );
+  for( size_t i = 1; i < reader.size(); ++i )
+    ASSERT_GT( reader.frame( i ).header().sequence, reader.frame( i - 1 ).header().sequence );
+
+  reader.close();
+  sim->Release();
+  unlink( path.c_str() );
+}
@@ -0,0 +1,285 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libblackmagic/FrameRecorder.h"
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/RecordingReader.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+#include "../TestFrame.h"
+
+using namespace libblackmagic;
+using namespace bmtest;
+
+namespace {
+
+  // Records at least numFrames frames of the simulator's colour bars
+  bool makeRecording( const std::string &path, bool is3D, unsigned int numFrames ) {
+    SimulatedDeckLink::Options opts;
+    opts.realTime = false;
+    opts.is3D = is3D;
+    SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+    DeckLink deckLink( sim );
+
+    FrameRecorder recorder;
+    if( !recorder.open( path ) ) return false;
+
+    {
+      InputHandler input( deckLink );
+      input.setRecorder( &recorder );
+      input.setNewFramesCallback( []( FrameHandle ){;} );
+
+      if( !input.enable( bmdModeHD1080p2997, false, is3D ) || !input.startStreams() ) return false;
+
+      const unsigned int eyes = is3D ? 2 : 1;
+      for( int i = 0; i < 500 && recorder.stats().records < numFrames * eyes; ++i )
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+
+      input.stopStreams();
+    }
+
+    recorder.close();
+    sim->Release();
+    return recorder.stats().errors == 0;
+  }
+
+  // Data of the nth record, found by walking the file
+  std::vector<uint8_t> readRecord( const std::string &path, unsigned int n ) {
+    std::ifstream in( path, std::ios::binary );
+    uint64_t offset = RecordingFileHeader::kBlockSize;
+
+    RecordedFrameHeader header;
+    for( unsigned int i = 0; i <= n; ++i ) {
+      in.seekg( offset );
+      in.read( reinterpret_cast<char *>( &header ), sizeof(header) );
+      if( !in || !header.valid() ) return std::vector<uint8_t>();
+      if( i < n ) offset += header.recordSize;
+    }
+
+    std::vector<uint8_t> data( header.dataSize );
+    in.seekg( offset + header.headerSize );
+    in.read( reinterpret_cast<char *>( data.data() ), data.size() );
+    return data;
+  }
+
+  struct Played {
+    FrameMetadata metadata;
+    const void *bytes[2];
+  };
+
+}
+
+TEST(TestRecordingReader, ReadsIndexedRecording) {
+  const std::string path( tempPath() );
+  ASSERT_TRUE( makeRecording( path, true, 20 ) );
+
+  RecordingReader reader;
+  ASSERT_TRUE( reader.open( path ) );
+  ASSERT_TRUE( reader.hasIndex() );
+  ASSERT_GE( reader.size(), 20u );
+  ASSERT_EQ( reader.displayMode(), bmdModeHD1080p2997 );
+  ASSERT_EQ( reader.pixelFormat(), bmdFormat10BitYUV );
+  ASSERT_TRUE( reader.is3D() );
+
+  for( size_t i = 0; i < reader.size(); ++i ) {
+    const RecordingReader::Frame frame( reader.frame( i ) );
+    ASSERT_TRUE( frame.valid() );
+    ASSERT_EQ( frame.numEyes, 2u );
+    ASSERT_EQ( frame.eyes[1]->sequence, frame.eyes[0]->sequence );
+    if( i > 0 ) { ASSERT_GT( frame.header().sequence, reader.frame( i - 1 ).header().sequence ); }
+
+    // Every frame can be found by its timecode
+    const FrameMetadata meta( frame.metadata() );
+    ASSERT_TRUE( meta.timecode.valid );
+    ASSERT_TRUE( meta.is3D );
+    ASSERT_EQ( reader.findTimecode( meta.timecode ), long(i) );
+  }
+
+  ASSERT_FALSE( reader.frame( reader.size() ).valid() );
+
+  FrameTimecode missing;
+  missing.valid = true;
+  missing.hours = 23;
+  ASSERT_EQ( reader.findTimecode( missing ), -1 );
+
+  // Frame data is as it is in the file
+  const RecordingReader::Frame frame( reader.frame( 3 ) );
+  const std::vector<uint8_t> right( readRecord( path, 7 ) );
+  ASSERT_EQ( right.size(), frame.eyes[1]->dataSize );
+  ASSERT_TRUE( std::equal( right.begin(), right.end(), frame.data[1] ) );
+
+  reader.close();
+  unlink( path.c_str() );
+}
+
+TEST(TestRecordingReader, WalksRecordingWithoutIndex) {
+  const std::string path( tempPath() );
+  ASSERT_TRUE( makeRecording( path, false, 10 ) );
+
+  std::vector<uint64_t> sequences;
+  uint64_t lastRecord = 0;
+  {
+    RecordingReader reader;
+    ASSERT_TRUE( reader.open( path ) );
+    ASSERT_TRUE( reader.hasIndex() );
+    for( size_t i = 0; i < reader.size(); ++i ) sequences.push_back( reader.frame( i ).header().sequence );
+    lastRecord = reinterpret_cast<const uint8_t *>( reader.frame( reader.size() - 1 ).eyes[0] ) -
+                 reinterpret_cast<const uint8_t *>( reader.frame( 0 ).eyes[0] ) + RecordingFileHeader::kBlockSize;
+  }
+
+  // As if the recorder had never got to close():  no index, and the last
+  // record cut short
+  const int fd = open( path.c_str(), O_RDWR );
+  ASSERT_GE( fd, 0 );
+  const uint64_t noIndex = 0;
+  ASSERT_EQ( pwrite( fd, &noIndex, sizeof(noIndex), offsetof(RecordingFileHeader, indexOffset) ), (ssize_t)sizeof(noIndex) );
+  ASSERT_EQ( ftruncate( fd, lastRecord + RecordingFileHeader::kBlockSize + 100 ), 0 );
+  close( fd );
+
+  RecordingReader reader;
+  ASSERT_TRUE( reader.open( path ) );
+  ASSERT_FALSE( reader.hasIndex() );
+  ASSERT_EQ( reader.size(), sequences.size() - 1 );
+
+  for( size_t i = 0; i < reader.size(); ++i ) {
+    ASSERT_EQ( reader.frame( i ).header().sequence, sequences[i] );
+    ASSERT_EQ( reader.findTimecode( reader.frame( i ).metadata().timecode ), long(i) );
+  }
+
+  reader.close();
+  unlink( path.c_str() );
+}
+
+TEST(TestRecordingReader, PlaysThroughInputHandler) {
+  const std::string path( tempPath() );
+  ASSERT_TRUE( makeRecording( path, true, 20 ) );
+
+  std::shared_ptr<RecordingReader> reader( std::make_shared<RecordingReader>() );
+  ASSERT_TRUE( reader->open( path ) );
+
+  SimulatedDeckLink::Options opts;
+  opts.realTime = false;
+  opts.recording = reader;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+
+  std::mutex mutex;
+  std::vector<Played> played;
+
+  {
+    InputHandler input( deckLink );
+    input.setPixelFormat( reader->pixelFormat() );
+    input.setNewFramesCallback( [&]( FrameHandle frames ) {
+      Played p;
+      p.metadata = frames.metadata();
+      for( unsigned int eye = 0; eye < 2; ++eye ) {
+        void *bytes = nullptr;
+        if( frames.frame( eye ) ) frames.frame( eye )->GetBytes( &bytes );
+        p.bytes[eye] = bytes;
+      }
+
+      std::lock_guard<std::mutex> lock( mutex );
+      played.push_back( p );
+    });
+
+    ASSERT_TRUE( input.enable( reader->displayMode(), false, reader->is3D() ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    for( int i = 0; i < 500 && sim->playbackPosition() < reader->size(); ++i )
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+
+    input.stopStreams();
+  }
+
+  // Every frame, in order, straight out of the mapping
+  std::lock_guard<std::mutex> lock( mutex );
+  ASSERT_EQ( played.size(), reader->size() );
+  for( size_t i = 0; i < played.size(); ++i ) {
+    const RecordingReader::Frame frame( reader->frame( i ) );
+    const FrameMetadata recorded( frame.metadata() );
+
+    ASSERT_EQ( played[i].bytes[0], frame.data[0] );
+    ASSERT_EQ( played[i].bytes[1], frame.data[1] );
+    ASSERT_TRUE( played[i].metadata.is3D );
+    ASSERT_EQ( played[i].metadata.timecode.toString(), recorded.timecode.toString() );
+    ASSERT_EQ( played[i].metadata.streamTime, recorded.streamTime );
+  }
+
+  sim->Release();
+  unlink( path.c_str() );
+}
+
+TEST(TestRecordingReader, StepsAndSeeks) {
+  const std::string path( tempPath() );
+  ASSERT_TRUE( makeRecording( path, false, 20 ) );
+
+  std::shared_ptr<RecordingReader> reader( std::make_shared<RecordingReader>() );
+  ASSERT_TRUE( reader->open( path ) );
+
+  SimulatedDeckLink::Options opts;
+  opts.recording = reader;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+  sim->setSingleStep( true );
+
+  std::mutex mutex;
+  std::vector<FrameMetadata> played;
+
+  auto waitFor = [&]( size_t count ) {
+    for( int i = 0; i < 200; ++i ) {
+      {
+        std::lock_guard<std::mutex> lock( mutex );
+        if( played.size() >= count ) return;
+      }
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+  };
+
+  {
+    InputHandler input( deckLink );
+    input.setNewFramesCallback( [&]( FrameHandle frames ) {
+      std::lock_guard<std::mutex> lock( mutex );
+      played.push_back( frames.metadata() );
+    });
+
+    ASSERT_TRUE( input.enable( reader->displayMode(), false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    // Nothing until stepped
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    ASSERT_EQ( sim->playbackPosition(), 0u );
+
+    sim->step( 3 );
+    waitFor( 3 );
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    ASSERT_EQ( sim->playbackPosition(), 3u );
+
+    // Back to a frame found by its timecode
+    const long target = reader->findTimecode( reader->frame( 10 ).metadata().timecode );
+    ASSERT_EQ( target, 10 );
+    sim->seek( target );
+    sim->step( 2 );
+    waitFor( 5 );
+
+    input.stopStreams();
+  }
+
+  std::lock_guard<std::mutex> lock( mutex );
+  ASSERT_EQ( played.size(), 5u );
+
+  const size_t expected[5] = { 0, 1, 2, 10, 11 };
+  for( size_t i = 0; i < 5; ++i )
+    ASSERT_EQ( played[i].timecode.toString(), reader->frame( expected[i] ).metadata().timecode.toString() );
+
+  sim->Release();
+  unlink( path.c_str() );
+}
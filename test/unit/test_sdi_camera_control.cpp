@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "libblackmagic/SDICameraControl.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  const size_t kWords = ancillaryPacketWords( 255 );
+
+  std::vector<uint8_t> randomBytes( size_t len, std::mt19937 &gen ) {
+    std::vector<uint8_t> bytes( len );
+    for( uint8_t &b : bytes ) b = gen() & 0xff;
+    return bytes;
+  }
+
+}
+
+// The table-driven encoder must match Blackmagic's, for every byte value
+// and every length
+TEST(TestSDICameraControl, EncoderMatchesScalar) {
+  std::mt19937 gen( 291 );
+
+  std::vector<uint8_t> every( 256 );
+  for( int i = 0; i < 256; ++i ) every[i] = i;
+
+  std::vector< std::vector<uint8_t> > payloads;
+  payloads.push_back( std::vector<uint8_t>( every.begin(), every.begin() + 255 ) );
+  payloads.push_back( std::vector<uint8_t>( every.begin() + 1, every.end() ) );
+  for( size_t len = 1; len <= 255; ++len ) payloads.push_back( randomBytes( len, gen ) );
+
+  for( const std::vector<uint8_t> &data : payloads ) {
+    std::vector<uint32_t> table( kWords, 0 ), scalar( kWords, 0 );
+    const uint8_t did = gen() & 0xff, sdid = gen() & 0xff;
+
+    const size_t words = encodeAncillaryPacket( table.data(), did, sdid, data.data(), data.size() );
+    ASSERT_EQ( words, ancillaryPacketWords( data.size() ) );
+    ASSERT_EQ( encodeAncillaryPacketScalar( scalar.data(), did, sdid, data.data(), data.size() ), words );
+    ASSERT_EQ( table, scalar ) << data.size() << " bytes";
+  }
+
+  uint32_t line[4] = { 1, 2, 3, 4 };
+  ASSERT_EQ( encodeAncillaryPacket( line, 0x51, 0x53, every.data(), 0 ), 0u );
+  ASSERT_EQ( encodeAncillaryPacket( line, 0x51, 0x53, every.data(), 256 ), 0u );
+  ASSERT_EQ( line[0], 1u );
+}
+
+TEST(TestSDICameraControl, DecoderRoundTrips) {
+  std::mt19937 gen( 292 );
+
+  for( size_t len = 1; len <= 255; ++len ) {
+    const std::vector<uint8_t> data( randomBytes( len, gen ) );
+
+    // From either encoder
+    for( int scalar = 0; scalar < 2; ++scalar ) {
+      std::vector<uint32_t> line( kWords, 0 );
+      const size_t words = scalar ? encodeAncillaryPacketScalar( line.data(), 0x51, 0x52, data.data(), len )
+                                  : encodeAncillaryPacket( line.data(), 0x51, 0x52, data.data(), len );
+
+      AncillaryPacket packet;
+      ASSERT_EQ( decodeAncillaryPacket( line.data(), line.size(), packet ), words );
+      ASSERT_EQ( packet.did, 0x51 );
+      ASSERT_EQ( packet.sdid, 0x52 );
+      ASSERT_EQ( packet.len, len );
+      ASSERT_EQ( std::vector<uint8_t>( packet.data, packet.data + packet.len ), data );
+
+      // But not from less than the whole packet
+      ASSERT_EQ( decodeAncillaryPacket( line.data(), words - 1, packet ), 0u );
+    }
+  }
+}
+
+TEST(TestSDICameraControl, DecoderRejectsDamage) {
+  std::mt19937 gen( 293 );
+  const std::vector<uint8_t> data( randomBytes( 100, gen ) );
+
+  std::vector<uint32_t> good( kWords, 0 );
+  const size_t words = encodeAncillaryPacket( good.data(), 0x51, 0x53, data.data(), data.size() );
+
+  AncillaryPacket packet;
+  ASSERT_EQ( decodeAncillaryPacket( good.data(), good.size(), packet ), words );
+
+  // Any single bit of any luma sample, from the DID to the checksum
+  for( size_t word = 2; word < words; ++word ) {
+    for( int bit = 0; bit < 30; ++bit ) {
+      const bool luma = (word % 2 == 0) ? (bit >= 10 && bit < 20) : (bit < 10 || bit >= 20);
+      if( !luma ) continue;
+
+      // 101 samples with the checksum, so the last is unused
+      if( word == words - 1 && bit >= 20 ) continue;
+
+      std::vector<uint32_t> bad( good );
+      bad[word] ^= 1u << bit;
+      ASSERT_EQ( decodeAncillaryPacket( bad.data(), bad.size(), packet ), 0u ) << word << " " << bit;
+    }
+  }
+
+  // A blank line isn't a packet
+  const std::vector<uint32_t> black( kWords, 0x04010040 );
+  ASSERT_EQ( decodeAncillaryPacket( black.data(), black.size(), packet ), 0u );
+}
@@ -0,0 +1,302 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/InputOutputClient.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  // Collects what the InputHandler delivers
+  struct Receiver {
+    Receiver() : count(0), lastSequence(0), inOrder(true) {;}
+
+    void operator()( const InputHandler::MatVector &images, const FrameMetadata &meta ) {
+      std::lock_guard<std::mutex> lock( mutex );
+      if( count > 0 && meta.sequence <= lastSequence ) inOrder = false;
+      lastSequence = meta.sequence;
+      ++count;
+      last = images;
+      lastMetadata = meta;
+      cond.notify_all();
+    }
+
+    bool waitFor( unsigned int n, std::chrono::seconds timeout = std::chrono::seconds(10) ) {
+      std::unique_lock<std::mutex> lock( mutex );
+      return cond.wait_for( lock, timeout, [&]{ return count >= n; } );
+    }
+
+    template< typename Pred >
+    bool waitUntil( Pred pred, std::chrono::seconds timeout = std::chrono::seconds(10) ) {
+      std::unique_lock<std::mutex> lock( mutex );
+      return cond.wait_for( lock, timeout, [&]{ return pred( *this ); } );
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned int count;
+    uint64_t lastSequence;
+    bool inOrder;
+    InputHandler::MatVector last;
+    FrameMetadata lastMetadata;
+  };
+
+  SimulatedDeckLink *makeSimulator( bool is3D = false ) {
+    SimulatedDeckLink::Options opts;
+    opts.realTime = false;
+    opts.numBuffers = 4;
+    opts.is3D = is3D;
+    return new SimulatedDeckLink( opts );
+  }
+
+}
+
+TEST(TestSimulatedDeckLink, DeliversFrames) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  Receiver rx;
+  {
+    InputHandler input( deckLink );
+    input.setNewImagesWithMetadataCallback( std::ref(rx) );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+    ASSERT_TRUE( rx.waitFor( 20 ) );
+    input.stopStreams();
+
+    ASSERT_GE( input.stats().snapshot().driverCallbackTime.count, 20u );
+  }
+
+  std::lock_guard<std::mutex> lock( rx.mutex );
+  ASSERT_TRUE( rx.inOrder );
+  ASSERT_EQ( rx.last.size(), 1u );
+  ASSERT_EQ( rx.last[0].cols, 1920 );
+  ASSERT_EQ( rx.last[0].rows, 1080 );
+  ASSERT_TRUE( rx.lastMetadata.timecode.valid );
+  ASSERT_GT( rx.lastMetadata.streamTime, 0 );
+
+  ASSERT_GE( sim->stats().framesDelivered, 20u );
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, StereoEyesAreMirrored) {
+  SimulatedDeckLink *sim = makeSimulator( true );
+  DeckLink deckLink( sim );
+
+  Receiver rx;
+  {
+    InputHandler input( deckLink );
+    input.setNewImagesWithMetadataCallback( std::ref(rx) );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, true ) );
+    ASSERT_TRUE( input.startStreams() );
+    ASSERT_TRUE( rx.waitFor( 5 ) );
+    input.stopStreams();
+  }
+
+  std::lock_guard<std::mutex> lock( rx.mutex );
+  ASSERT_TRUE( rx.lastMetadata.is3D );
+  ASSERT_EQ( rx.last.size(), 2u );
+
+  // BGRA;  the left edge of one eye is the right edge of the other
+  const cv::Mat &left( rx.last[0] ), &right( rx.last[1] );
+  const int x = 100, mirrored = left.cols - 1 - x;
+  const uint8_t *l = left.ptr<uint8_t>(540), *r = right.ptr<uint8_t>(540);
+  ASSERT_EQ( 0, memcmp( l + 4*x, r + 4*mirrored, 4 ) );
+  ASSERT_NE( 0, memcmp( l + 4*x, l + 4*mirrored, 4 ) );
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, NoInputFramesAreCounted) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  Receiver rx;
+  {
+    InputHandler input( deckLink );
+    input.setNewImagesWithMetadataCallback( std::ref(rx) );
+
+    sim->injectNoInput( 5 );
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+    ASSERT_TRUE( rx.waitFor( 5 ) );
+    input.stopStreams();
+
+    ASSERT_EQ( input.stats().noInput(), 5u );
+  }
+
+  ASSERT_EQ( sim->stats().noInputFrames, 5u );
+
+  // The first five were discarded by the handler
+  std::lock_guard<std::mutex> lock( rx.mutex );
+  ASSERT_FALSE( rx.lastMetadata.noInput );
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, GrabTakesFramesInOrder) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  {
+    InputHandler input( deckLink );
+    input.setGrabMode( InputHandler::GrabInOrder );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    InputHandler::QueuedFrame frame;
+    uint64_t last = 0;
+    for( int i = 0; i < 10; ++i ) {
+      ASSERT_TRUE( input.grab( frame, std::chrono::milliseconds(1000) ) );
+      ASSERT_EQ( frame.images.size(), 1u );
+      ASSERT_EQ( frame.images[0].cols, 1920 );
+      if( i > 0 ) { ASSERT_GT( frame.metadata.sequence, last ); }
+      last = frame.metadata.sequence;
+    }
+
+    input.stopStreams();
+
+    // Whatever was queued can still be taken, then grabbing fails
+    while( input.tryGrab( frame ) ) ASSERT_GT( frame.metadata.sequence, last );
+    ASSERT_FALSE( input.grab( frame, std::chrono::milliseconds(10) ) );
+    ASSERT_TRUE( frame.images.empty() || frame.images[0].empty() );
+  }
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, StopsWhenNobodyGrabs) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  {
+    InputHandler input( deckLink );
+    input.setGrabMode( InputHandler::GrabInOrder );
+    input.setDeliveryQueue( 1, InputHandler::Queue::Block );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    // Never grab, so the queue fills and the workers back up behind it
+    std::this_thread::sleep_for( std::chrono::milliseconds(300) );
+
+    std::future<bool> stopped = std::async( std::launch::async, [&input]{ return input.stopStreams(); } );
+    ASSERT_EQ( stopped.wait_for( std::chrono::seconds(10) ), std::future_status::ready );
+
+    // The frame which made it is still there
+    InputHandler::QueuedFrame frame;
+    ASSERT_TRUE( input.tryGrab( frame ) );
+    ASSERT_FALSE( input.tryGrab( frame ) );
+  }
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, FormatChangeWhileGrabbing) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  {
+    InputHandler input( deckLink );
+    input.setGrabMode( InputHandler::GrabInOrder );
+    input.setDeliveryQueue( 1, InputHandler::Queue::Block );
+
+    std::promise<BMDDisplayMode> changed;
+    input.setInputFormatChangedCallback( [&changed]( BMDDisplayMode mode ) { changed.set_value( mode ); } );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, true, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    InputHandler::QueuedFrame frame;
+    ASSERT_TRUE( input.grab( frame, std::chrono::seconds(5) ) );
+
+    // Then stop grabbing, and wait for the format change before grabbing
+    // again, so the queue is full and the workers back up behind it
+    std::this_thread::sleep_for( std::chrono::milliseconds(300) );
+    sim->injectFormatChange( bmdModeHD720p60, false );
+
+    std::future<BMDDisplayMode> mode( changed.get_future() );
+    ASSERT_EQ( mode.wait_for( std::chrono::seconds(2) ), std::future_status::ready );
+    ASSERT_EQ( mode.get(), bmdModeHD720p60 );
+
+    // And grabs carry on in the new mode
+    bool newMode = false;
+    for( int i = 0; i < 20 && !newMode; ++i ) {
+      ASSERT_TRUE( input.grab( frame, std::chrono::seconds(5) ) );
+      newMode = !frame.images.empty() && frame.images[0].cols == 1280;
+    }
+    ASSERT_TRUE( newMode );
+
+    input.stopStreams();
+  }
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, GrabLatestSkipsStaleFrames) {
+  SimulatedDeckLink *sim = makeSimulator();
+  DeckLink deckLink( sim );
+
+  {
+    InputHandler input( deckLink );
+    input.setGrabMode( InputHandler::GrabLatest );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    InputHandler::QueuedFrame first, second;
+    ASSERT_TRUE( input.grab( first, std::chrono::milliseconds(1000) ) );
+
+    // The simulator runs flat out, so frames not taken are replaced
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( input.deliveryQueueStats().dropped == 0 && std::chrono::steady_clock::now() < deadline )
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+
+    const bool grabbed = input.grab( second, std::chrono::milliseconds(1000) );
+    input.stopStreams();
+
+    ASSERT_TRUE( grabbed );
+    ASSERT_GT( second.metadata.sequence, first.metadata.sequence + 1 );
+    ASSERT_EQ( input.deliveryQueueStats().depth, 1u );
+  }
+
+  sim->Release();
+}
+
+TEST(TestSimulatedDeckLink, FormatChangeReconfiguresInputAndOutput) {
+  SimulatedDeckLink *sim = makeSimulator();
+
+  Receiver rx;
+  {
+    InputOutputClient client( sim );
+    client.input().setNewImagesWithMetadataCallback( std::ref(rx) );
+
+    ASSERT_TRUE( client.input().enable( bmdModeHD1080p2997, true, false ) );
+    ASSERT_TRUE( client.startStreams() );
+    ASSERT_TRUE( rx.waitFor( 5 ) );
+
+    sim->injectFormatChange( bmdModeHD720p60, false );
+    ASSERT_TRUE( rx.waitUntil( []( Receiver &r ){ return !r.last.empty() && r.last[0].cols == 1280; } ) );
+    ASSERT_EQ( client.input().currentConfig().mode(), bmdModeHD720p60 );
+
+    // Output keeps running in the new mode
+    const unsigned long completed = sim->stats().outputFramesCompleted;
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    ASSERT_GT( sim->stats().outputFramesCompleted, completed );
+
+    client.stopStreams();
+  }
+
+  ASSERT_EQ( sim->stats().formatChanges, 1u );
+  sim->Release();
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "libblackmagic/SpscRing.h"
+
+using namespace libblackmagic;
+
+TEST(TestSpscRing, CapacityIsPowerOfTwo) {
+  SpscRing<int> ring( 5 );
+  ASSERT_EQ( ring.capacity(), 8u );
+
+  ring.resize( 16 );
+  ASSERT_EQ( ring.capacity(), 16u );
+}
+
+TEST(TestSpscRing, FifoAndFull) {
+  SpscRing<int> ring( 4 );
+
+  for( int i = 0; i < 4; ++i ) ASSERT_TRUE( ring.push( i ) );
+  ASSERT_FALSE( ring.push( 4 ) );
+  ASSERT_EQ( ring.size(), 4u );
+
+  int item = -1;
+  for( int i = 0; i < 4; ++i ) {
+    ASSERT_TRUE( ring.try_pop( item ) );
+    ASSERT_EQ( item, i );
+  }
+  ASSERT_FALSE( ring.try_pop( item ) );
+}
+
+TEST(TestSpscRing, PopForTimesOut) {
+  SpscRing<int> ring( 4 );
+
+  int item;
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE( ring.pop_for( item, std::chrono::milliseconds(20) ) );
+  ASSERT_GE( std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20) );
+}
+
+TEST(TestSpscRing, CloseDrainsThenWakesConsumer) {
+  SpscRing<int> ring( 4 );
+  ring.push( 1 );
+  ring.push( 2 );
+
+  int sum = 0;
+  std::thread consumer( [&]() {
+    int item;
+    while( ring.pop( item ) ) sum += item;
+  });
+
+  std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+  ring.close();
+  consumer.join();
+
+  ASSERT_EQ( sum, 3 );
+  ASSERT_FALSE( ring.push( 3 ) );
+}
+
+TEST(TestSpscRing, ProducerAndConsumerThreads) {
+  SpscRing<uint64_t> ring( 8 );
+  const uint64_t count = 200000;
+
+  bool inOrder = true;
+  uint64_t received = 0;
+  std::thread consumer( [&]() {
+    uint64_t item;
+    while( ring.pop( item ) ) {
+      if( item != received ) inOrder = false;
+      ++received;
+    }
+  });
+
+  for( uint64_t i = 0; i < count; ++i ) {
+    while( !ring.push( i ) ) std::this_thread::yield();
+
+    // Now and then let the consumer go to sleep
+    if( (i % 10000) == 0 ) std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+  }
+
+  ring.close();
+  consumer.join();
+
+  ASSERT_TRUE( inOrder );
+  ASSERT_EQ( received, count );
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "libblackmagic/DeckLink.h"
+#include "libblackmagic/OutputHandler.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+#include "libblackmagic/TemplateFrameCache.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  IDeckLinkOutput *simulatedOutput( SimulatedDeckLink *sim ) {
+    IDeckLinkOutput *output = nullptr;
+    sim->QueryInterface( IID_IDeckLinkOutput, (void **)&output );
+    return output;
+  }
+
+  // Y, Cb and Cr of pixel x in a v210 row
+  void v210Pixel( const uint8_t *row, long x, uint32_t &y, uint32_t &cb, uint32_t &cr ) {
+    const uint32_t *w = reinterpret_cast<const uint32_t *>( row ) + (x / 6) * 4;
+    uint32_t samples[12];
+    for( int i = 0; i < 4; ++i )
+      for( int j = 0; j < 3; ++j ) samples[3*i + j] = (w[i] >> (10 * j)) & 0x3ff;
+
+    // Cb Y Cr Y Cb Y Cr Y ...
+    const long pair = (x % 6) / 2;
+    cb = samples[4 * pair];
+    y = samples[4 * pair + 1 + 2 * (x % 2)];
+    cr = samples[4 * pair + 2];
+  }
+
+}
+
+TEST(TestTemplateFrameCache, BlueMatchesTheSDKExample) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  IDeckLinkOutput *output = simulatedOutput( sim );
+  TemplateFrameCache cache;
+
+  TemplateFrameCache::TemplatePtr blue( cache.get( output, bmdModeHD1080p2997, bmdFormat10BitYUV, TemplateFrameCache::Blue ) );
+  ASSERT_TRUE( blue );
+  ASSERT_EQ( blue->width, 1920 );
+  ASSERT_EQ( blue->height, 1080 );
+  ASSERT_EQ( blue->rowBytes, 5120 );
+  ASSERT_EQ( blue->bytes.size(), 5120u * 1080 );
+
+  const uint32_t kBlueData[4] = { 0x40aa298, 0x2a8a62a8, 0x298aa040, 0x2a8102a8 };
+  const uint32_t *words = reinterpret_cast<const uint32_t *>( blue->bytes.data() );
+  for( size_t i = 0; i < blue->bytes.size() / 4; ++i ) ASSERT_EQ( words[i], kBlueData[i % 4] ) << i;
+
+  // Made once
+  ASSERT_EQ( cache.get( output, bmdModeHD1080p2997, bmdFormat10BitYUV, TemplateFrameCache::Blue ), blue );
+  ASSERT_EQ( cache.size(), 1u );
+
+  // And copied into frames
+  IDeckLinkMutableVideoFrame *frame = cache.makeFrame( output, bmdModeHD1080p2997, bmdFormat10BitYUV, TemplateFrameCache::Blue );
+  ASSERT_NE( frame, nullptr );
+  void *bytes = nullptr;
+  ASSERT_EQ( frame->GetBytes( &bytes ), S_OK );
+  ASSERT_EQ( memcmp( bytes, blue->bytes.data(), blue->bytes.size() ), 0 );
+  frame->Release();
+
+  output->Release();
+  sim->Release();
+}
+
+TEST(TestTemplateFrameCache, RendersAnyMode) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  IDeckLinkOutput *output = simulatedOutput( sim );
+  TemplateFrameCache cache;
+
+  TemplateFrameCache::TemplatePtr bars( cache.get( output, bmdMode4K2160p2997, bmdFormat10BitYUV, TemplateFrameCache::Bars ) );
+  ASSERT_TRUE( bars );
+  ASSERT_EQ( bars->width, 3840 );
+  ASSERT_EQ( bars->height, 2160 );
+  ASSERT_EQ( bars->rowBytes, 10240 );
+
+  // White, then yellow, ... then black, on every row
+  const long barWidth = 3840 / 8;
+  for( long row : { 0L, 1079L, 2159L } ) {
+    const uint8_t *r = bars->bytes.data() + row * bars->rowBytes;
+    uint32_t y, cb, cr;
+
+    v210Pixel( r, barWidth / 2, y, cb, cr );
+    ASSERT_EQ( y, 721u );
+    ASSERT_EQ( cb, 512u );
+
+    v210Pixel( r, barWidth + barWidth / 2, y, cb, cr );
+    ASSERT_EQ( y, 674u );
+    ASSERT_EQ( cb, 176u );
+    ASSERT_EQ( cr, 543u );
+
+    v210Pixel( r, 3839, y, cb, cr );
+    ASSERT_EQ( y, 64u );
+  }
+
+  // 8-bit black at 720p
+  TemplateFrameCache::TemplatePtr black( cache.get( output, bmdModeHD720p60, bmdFormat8BitYUV, TemplateFrameCache::Black ) );
+  ASSERT_TRUE( black );
+  ASSERT_EQ( black->rowBytes, 2560 );
+  for( size_t i = 0; i < black->bytes.size(); i += 2 ) {
+    ASSERT_EQ( black->bytes[i], 128 );
+    ASSERT_EQ( black->bytes[i+1], 16 );
+  }
+
+  // Not a format SDI output uses
+  ASSERT_FALSE( cache.get( output, bmdModeHD1080p2997, bmdFormat8BitBGRA, TemplateFrameCache::Blue ) );
+  ASSERT_EQ( cache.size(), 2u );
+
+  output->Release();
+  sim->Release();
+}
+
+TEST(TestTemplateFrameCache, OutputFollowsTheMode) {
+  SimulatedDeckLink *sim = new SimulatedDeckLink();
+  DeckLink deckLink( sim );
+
+  std::atomic<long> width( 0 );
+  sim->setOutputFrameCallback( [&]( IDeckLinkVideoFrame *frame ) { width = frame->GetWidth(); } );
+
+  {
+    OutputHandler output( deckLink );
+    ASSERT_TRUE( output.enable( bmdModeHD720p60 ) );
+    ASSERT_TRUE( output.startStreams() );
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    output.stopStreamsWait();
+    ASSERT_EQ( width, 1280 );
+
+    output.disable();
+    ASSERT_TRUE( output.enable( bmdMode4K2160p2997 ) );
+    ASSERT_TRUE( output.startStreams() );
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    output.stopStreamsWait();
+    ASSERT_EQ( width, 3840 );
+  }
+
+  sim->Release();
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "libblackmagic/InputHandler.h"
+#include "libblackmagic/SimulatedDeckLink.h"
+#include "libblackmagic/ThreadPolicy.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  // Names of every thread in the process
+  std::set<std::string> threadNames() {
+    std::set<std::string> names;
+
+    DIR *dir = opendir( "/proc/self/task" );
+    if( !dir ) return names;
+
+    while( struct dirent *entry = readdir( dir ) ) {
+      if( entry->d_name[0] == '.' ) continue;
+
+      std::ifstream comm( std::string("/proc/self/task/") + entry->d_name + "/comm" );
+      std::string name;
+      if( std::getline( comm, name ) ) names.insert( name );
+    }
+
+    closedir( dir );
+    return names;
+  }
+
+}
+
+TEST(TestThreadPolicy, NamesAndPinsThread) {
+  ThreadPolicy policy( "bm-test-thread-long-name" );
+  policy.cpus.push_back( 0 );
+
+  bool applied = false;
+  char name[16] = "";
+  cpu_set_t set;
+  CPU_ZERO( &set );
+
+  std::thread t( [&]() {
+    applied = applyThreadPolicy( policy );
+    pthread_getname_np( pthread_self(), name, sizeof(name) );
+    sched_getaffinity( 0, sizeof(set), &set );
+  });
+  t.join();
+
+  ASSERT_TRUE( applied );
+  ASSERT_STREQ( name, "bm-test-thread-" );
+  ASSERT_EQ( CPU_COUNT( &set ), 1 );
+  ASSERT_TRUE( CPU_ISSET( 0, &set ) );
+}
+
+TEST(TestThreadPolicy, BadSettingsAreReported) {
+  ThreadPolicy policy;
+  policy.cpus.push_back( -1 );
+  policy.realtimePriority = 1000;
+
+  bool applied = true;
+  std::thread t( [&]() { applied = applyThreadPolicy( policy ); } );
+  t.join();
+
+  ASSERT_FALSE( applied );
+}
+
+TEST(TestThreadPolicy, NumaLookups) {
+  ASSERT_GE( numNumaNodes(), 1 );
+  ASSERT_TRUE( cpusOnNumaNode( -1 ).empty() );
+  ASSERT_TRUE( cpusOnNumaNode( 4096 ).empty() );
+
+  // Not PCI addresses, or no such device
+  ASSERT_EQ( pciNumaNode( "sim:0" ), -1 );
+  ASSERT_EQ( pciNumaNode( "ffff:ff:1f.7" ), -1 );
+}
+
+TEST(TestThreadPolicy, InputThreadsAreNamed) {
+  SimulatedDeckLink::Options opts;
+  opts.realTime = false;
+  SimulatedDeckLink *sim = new SimulatedDeckLink( opts );
+  DeckLink deckLink( sim );
+
+  {
+    InputHandler input( deckLink );
+    input.setNewImagesCallback( []( const InputHandler::MatVector & ){;} );
+    input.setProcessingThreads( 2 );
+
+    ASSERT_TRUE( input.enable( bmdModeHD1080p2997, false, false ) );
+    ASSERT_TRUE( input.startStreams() );
+
+    // Wait for the callback thread to have been seen
+    for( int i = 0; i < 100 && input.stats().frames() == 0; ++i )
+      std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+
+    const std::set<std::string> names( threadNames() );
+    input.stopStreams();
+
+    for( auto name : { "bm-callback", "bm-dispatch", "bm-worker-0", "bm-worker-1", "bm-deliver" } )
+      ASSERT_EQ( names.count( name ), 1u ) << name;
+  }
+
+  sim->Release();
+}
@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+
+#include "libblackmagic/V210.h"
+
+using namespace libblackmagic;
+
+namespace {
+
+  // Packs one 4:2:2 pixel pair repeated across a row-padded v210 image
+  cv::Mat makeFlatV210( int width, int height, uint32_t Y, uint32_t Cb, uint32_t Cr )
+  {
+    cv::Mat img( height, v210RowBytes(width), CV_8UC1 );
+
+    const uint32_t words[4] = { Cb | (Y << 10) | (Cr << 20),
+                                Y | (Cb << 10) | (Y << 20),
+                                Cr | (Y << 10) | (Cb << 20),
+                                Y | (Cr << 10) | (Y << 20) };
+
+    for( int r = 0; r < height; ++r ) {
+      uint32_t *row = img.ptr<uint32_t>(r);
+      for( int i = 0; i < img.cols / 4; ++i ) row[i] = words[i % 4];
+    }
+
+    return img;
+  }
+
+  cv::Mat makeRandomV210( int width, int height, unsigned int seed )
+  {
+    cv::Mat img( height, v210RowBytes(width), CV_8UC1 );
+
+    std::mt19937 gen( seed );
+    for( int r = 0; r < height; ++r ) {
+      uint32_t *row = img.ptr<uint32_t>(r);
+      for( int i = 0; i < img.cols / 4; ++i ) row[i] = gen() & 0x3fffffff;
+    }
+
+    return img;
+  }
+
+  bool identical( const cv::Mat &a, const cv::Mat &b )
+  {
+    if( a.size() != b.size() || a.type() != b.type() ) return false;
+    for( int r = 0; r < a.rows; ++r )
+      if( memcmp( a.ptr(r), b.ptr(r), a.cols * a.elemSize() ) != 0 ) return false;
+    return true;
+  }
+
+}
+
+// Every available instruction set must match the scalar reference exactly
+TEST(TestV210, simdMatchesScalar) {
+
+  const int widths[] = { 1920, 1280, 3840, 720, 1926, 13 };
+  const V210Output fmts[] = { V210_BGR, V210_BGRA, V210_UYVY, V210_Y };
+
+  for( auto width : widths ) {
+    const int height = 4;
+    cv::Mat src( makeRandomV210( width, height, width ) );
+
+    for( auto fmt : fmts ) {
+      cv::Mat ref;
+      ASSERT_TRUE( decodeV210( src.data, src.step, width, height, ref, fmt, V210_SCALAR ) );
+      ASSERT_EQ( ref.type(), v210OutputType(fmt) );
+
+      for( int isa = V210_SSE41; isa <= V210_AVX512; ++isa ) {
+        if( !v210IsaSupported( V210Isa(isa) ) ) continue;
+
+        cv::Mat out;
+        ASSERT_TRUE( decodeV210( src.data, src.step, width, height, out, fmt, V210Isa(isa) ) );
+        EXPECT_TRUE( identical( ref, out ) ) << v210IsaToString( V210Isa(isa) )
+                                              << " differs from scalar at width " << width
+                                              << ", output " << fmt;
+      }
+    }
+  }
+
+}
+
+// The scalar fixed point conversion should be within a couple of counts of BT.709
+TEST(TestV210, scalarMatchesBT709) {
+
+  const uint32_t samples[][3] = { { 64, 512, 512 }, { 940, 512, 512 }, { 502, 512, 512 },
+                                  { 250, 409, 960 }, { 691, 167, 543 }, { 313, 960, 463 },
+                                  { 0, 0, 0 }, { 1023, 1023, 1023 } };
+
+  for( auto s : samples ) {
+    cv::Mat src( makeFlatV210( 12, 1, s[0], s[1], s[2] ) );
+
+    cv::Mat out;
+    ASSERT_TRUE( decodeV210( src.data, src.step, 12, 1, out, V210_BGR, V210_SCALAR ) );
+
+    const double y = (s[0] - 64.0) / 4.0, u = (s[1] - 512.0) / 4.0, v = (s[2] - 512.0) / 4.0;
+    const double bgr[3] = { 1.164383 * y + 2.112402 * u,
+                            1.164383 * y - 0.213249 * u - 0.532909 * v,
+                            1.164383 * y + 1.792741 * v };
+
+    for( int x = 0; x < 12; ++x ) {
+      for( int ch = 0; ch < 3; ++ch ) {
+        const double expected = std::min( 255.0, std::max( 0.0, bgr[ch] ) );
+        EXPECT_NEAR( out.ptr<uint8_t>(0)[3*x + ch], expected, 1.5 );
+      }
+    }
+  }
+
+}
+
+TEST(TestV210, yuvOutputs) {
+
+  cv::Mat src( makeFlatV210( 1920, 2, 0x3a8, 0x104, 0x2fc ) );
+
+  cv::Mat uyvy;
+  ASSERT_TRUE( decodeV210( src.data, src.step, 1920, 2, uyvy, V210_UYVY ) );
+  ASSERT_EQ( uyvy.type(), CV_8UC2 );
+  for( int x = 0; x < 1920; x += 2 ) {
+    const uint8_t *px = uyvy.ptr<uint8_t>(1) + 2*x;
+    ASSERT_EQ( px[0], 0x104 >> 2 );
+    ASSERT_EQ( px[1], 0x3a8 >> 2 );
+    ASSERT_EQ( px[2], 0x2fc >> 2 );
+    ASSERT_EQ( px[3], 0x3a8 >> 2 );
+  }
+
+  cv::Mat luma;
+  ASSERT_TRUE( decodeV210( src.data, src.step, 1920, 2, luma, V210_Y ) );
+  ASSERT_EQ( luma.type(), CV_8UC1 );
+  for( int x = 0; x < 1920; ++x ) ASSERT_EQ( luma.ptr<uint8_t>(0)[x], 0x3a8 >> 2 );
+
+}
+
+TEST(TestV210, rejectsShortStride) {
+
+  cv::Mat src( makeFlatV210( 1920, 1, 64, 512, 512 ) );
+  cv::Mat out;
+  ASSERT_FALSE( decodeV210( src.data, 100, 1920, 1, out, V210_BGRA ) );
+
+}
+
+// Decoding in row bands must give the same image as one pass
+TEST(TestV210, bandsMatchSinglePass) {
+
+  const int width = 1926, height = 37;
+  cv::Mat src( makeRandomV210( width, height, 42 ) );
+
+  cv::Mat ref;
+  ASSERT_TRUE( decodeV210( src.data, src.step, width, height, ref, V210_BGRA, V210_AUTO, 1 ) );
+
+  for( int bands : { 2, 5, 16, 100 } ) {
+    cv::Mat out;
+    ASSERT_TRUE( decodeV210( src.data, src.step, width, height, out, V210_BGRA, V210_AUTO, bands ) );
+    EXPECT_TRUE( identical( ref, out ) ) << bands << " bands differ from single pass";
+  }
+
+  // decodeV210Rows needs the output allocated
+  cv::Mat unallocated;
+  ASSERT_FALSE( decodeV210Rows( src.data, src.step, width, 0, height, unallocated, V210_BGRA ) );
+
+}
+
+// A flat image must decode to the same colour at any scale
+TEST(TestV210, scaledFlatImage) {
+
+  const int width = 1920, height = 1080;
+  cv::Mat v210( makeFlatV210( width, height, 600, 300, 700 ) );
+
+  cv::Mat uyvy( height, width, CV_8UC2 );
+  for( int r = 0; r < height; ++r ) {
+    uint8_t *row = uyvy.ptr<uint8_t>(r);
+    for( int x = 0; x < width; x += 2 ) {
+      row[2*x] = 300 >> 2;  row[2*x+1] = 600 >> 2;
+      row[2*x+2] = 700 >> 2;  row[2*x+3] = 600 >> 2;
+    }
+  }
+
+  cv::Mat full;
+  ASSERT_TRUE( decodeV210( v210.data, v210.step, width, height, full, V210_BGR ) );
+  const uint8_t *ref = full.ptr<uint8_t>(0);
+
+  for( double scale : { 0.5, 0.25, 0.37, 1.0 } ) {
+    for( auto layout : { PACKED_V210, PACKED_UYVY } ) {
+      const cv::Mat &src( layout == PACKED_V210 ? v210 : uyvy );
+
+      cv::Mat out;
+      ASSERT_TRUE( decodeScaled( src.data, src.step, layout, width, height, scale, out, V210_BGR ) );
+      ASSERT_EQ( out.size(), scaledSize( width, height, scale ) );
+
+      for( int r = 0; r < out.rows; ++r ) {
+        const uint8_t *row = out.ptr<uint8_t>(r);
+        for( int i = 0; i < 3 * out.cols; ++i )
+          ASSERT_NEAR( row[i], ref[i % 3], 1 ) << "scale " << scale << " layout " << layout;
+      }
+    }
+  }
+
+}
+
+// Power-of-two luma matches a box filter of the full-size luma
+TEST(TestV210, scaledLumaIsBlockAverage) {
+
+  const int width = 96, height = 8;
+  cv::Mat src( makeRandomV210( width, height, 7 ) );
+
+  cv::Mat full, half;
+  ASSERT_TRUE( decodeV210( src.data, src.step, width, height, full, V210_Y ) );
+  ASSERT_TRUE( decodeScaled( src.data, src.step, PACKED_V210, width, height, 0.5, half, V210_Y ) );
+  ASSERT_EQ( half.cols, width / 2 );
+  ASSERT_EQ( half.rows, height / 2 );
+
+  for( int r = 0; r < half.rows; ++r ) {
+    for( int x = 0; x < half.cols; ++x ) {
+      const int sum = full.ptr<uint8_t>(2*r)[2*x] + full.ptr<uint8_t>(2*r)[2*x+1] +
+                      full.ptr<uint8_t>(2*r+1)[2*x] + full.ptr<uint8_t>(2*r+1)[2*x+1];
+      ASSERT_NEAR( half.ptr<uint8_t>(r)[x], sum / 4.0, 1.0 );
+    }
+  }
+
+  cv::Mat out;
+  ASSERT_FALSE( decodeScaled( src.data, src.step, PACKED_V210, width, height, 2.0, out ) );
+  ASSERT_FALSE( decodeScaled( src.data, src.step, PACKED_V210, width, height, 0.5, out, V210_UYVY ) );
+
+}
@@ -1,8 +1,12 @@
 
 // TODO:   Reduce the DRY
 
+#include <sys/resource.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <thread>
 using namespace std;
@@ -15,6 +19,8 @@ using namespace std;
 
 #include "libblackmagic/InputOutputClient.h"
 #include "libblackmagic/DataTypes.h"
+#include "libblackmagic/RecordingReader.h"
+#include "libblackmagic/SimulatedDeckLink.h"
 using namespace libblackmagic;
 
 #include "libbmsdi/helpers.h"
@@ -47,9 +53,7 @@ static void processKbInput( char c, InputOutputClient &client ) {
 	static uint8_t currentGain = 0x1;
 	static uint32_t currentExposure = 0;  // Start at 1/60
 
-	shared_ptr<SharedBMSDIBuffer> sdiBuffer( client.output().sdiProtocolBuffer() );
-
-	SDIBufferGuard guard( sdiBuffer );
+	SDIBufferGuard guard( client.output().commandQueue() );
 
 	switch(c) {
 		case 'f':
@@ -135,6 +139,47 @@ static void processKbInput( char c, InputOutputClient &client ) {
 }
 
 
+static double cpuSeconds()
+{
+	struct rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+					(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Summary printed at the end of a --bench run
+static void printBenchReport( InputHandler &input, SimulatedDeckLink *sim, const FrameRecorder *recorder,
+															int count, float seconds, double cpu )
+{
+	const CaptureStats::Snapshot stats( input.stats().snapshot() );
+	const LatencyHistogram::Snapshot &latency( stats.deliveryLatency );
+
+	// Frames the card had to drop because we were holding all of its
+	// buffers are only visible from the simulator
+	const unsigned long cardDropped = sim ? sim->stats().framesDropped : 0;
+
+	cout << "Delivered " << count << " frames in " << seconds << " s:  "
+			 << (seconds > 0 ? count / seconds : 0.0) << " FPS" << endl;
+	cout << "    Latency p50 " << latency.percentile(0.5) / 1000.0
+			 << " us, p99 " << latency.percentile(0.99) / 1000.0
+			 << " us, p99.9 " << latency.percentile(0.999) / 1000.0
+			 << " us, max " << latency.max / 1000.0 << " us" << endl;
+	cout << "    Dropped " << stats.dropped + input.deliveryQueueStats().dropped + cardDropped
+			 << " (capture " << stats.dropped << ", delivery queue " << input.deliveryQueueStats().dropped;
+	if( sim ) cout << ", card " << cardDropped;
+	cout << "), " << stats.noInput << " without input, " << stats.failed << " unreadable" << endl;
+	cout << "    CPU " << cpu << " s, " << (count > 0 ? 1e3 * cpu / count : 0.0) << " ms per frame"
+			 << (sim ? " (including the simulator)" : "") << endl;
+
+	if( recorder ) {
+		const FrameRecorder::Stats rs( recorder->stats() );
+		cout << "    Recorded " << rs.records << " eye frames, " << (seconds > 0 ? rs.bytes / (1e6 * seconds) : 0.0)
+				 << " MB/s;  " << rs.dropped << " frames dropped because the disk fell behind, "
+				 << rs.errors << " write errors" << endl;
+	}
+}
+
+
 using cv::Mat;
 
 int main( int argc, char** argv )
@@ -174,8 +219,26 @@ int main( int argc, char** argv )
 	int stopAfter = -1;
 	app.add_option("--stop-after", stopAfter, "Stop after N frames");
 
+	float duration = -1;
+	app.add_option("--duration", duration, "Stop after this many seconds");
+
+	bool bench = false;
+	app.add_flag("--bench", bench, "Don't display;  report frame rate, latency, drops and CPU time at exit");
+
+	bool simulate = false;
+	app.add_flag("--simulate", simulate, "Use a simulated card playing colour bars in the requested mode");
+
+	string recordPath;
+	app.add_option("--record", recordPath, "Record raw frames, before conversion, to this file");
+
+	string playPath;
+	app.add_option("--play", playPath, "Play a recording made with --record through a simulated card, in place of --simulate");
+
+	bool unthrottled = false;
+	app.add_flag("--unthrottled", unthrottled, "With --simulate or --play, deliver frames as fast as they're taken rather than at the frame rate");
+
 	float scale = 0.5;
-	app.add_option("--scale", scale, "Scale");
+	app.add_option("--scale", scale, "Scale for display, decoded directly from the input (0,1]");
 
 	CLI11_PARSE(app, argc, argv);
 
@@ -199,15 +262,19 @@ int main( int argc, char** argv )
 	}
 
 
+	if( bench ) noDisplay = true;
+
 	// Help string
-	cout << "Commands" << endl;
-	cout << "    q       quit" << endl;
-	cout << "   [ ]     Adjust focus" << endl;
-	cout << "    f      Set autofocus" << endl;
-	cout << "   ; '     Adjust aperture" << endl;
-	cout << "   . /     Adjust shutter speed" << endl;
-	cout << "   z x     Adjust sensor gain" << endl;
-	cout << "    s      Cycle through reference sources" << endl;
+	if( !noDisplay ) {
+		cout << "Commands" << endl;
+		cout << "    q       quit" << endl;
+		cout << "   [ ]     Adjust focus" << endl;
+		cout << "    f      Set autofocus" << endl;
+		cout << "   ; '     Adjust aperture" << endl;
+		cout << "   . /     Adjust shutter speed" << endl;
+		cout << "   z x     Adjust sensor gain" << endl;
+		cout << "    s      Cycle through reference sources" << endl;
+	}
 
 
 	if( doListInputModes ) {
@@ -216,8 +283,6 @@ int main( int argc, char** argv )
 		return 0;
 	}
 
-	InputOutputClient client( cardNum );
-
 	BMDDisplayMode mode = stringToDisplayMode( desiredModeString );
 	if( mode == bmdModeUnknown ) {
 		LOG(WARNING) << "Didn't understand mode \"" << desiredModeString << "\"";
@@ -229,7 +294,36 @@ int main( int argc, char** argv )
 		LOG(WARNING) << "Setting initial mode " << desiredModeString;
 	}
 
-	int count = 0, displayed = 0;
+	// A recording is played in the mode it was made in
+	std::shared_ptr<RecordingReader> reader;
+	if( !playPath.empty() ) {
+		reader = std::make_shared<RecordingReader>();
+		if( !reader->open( playPath ) ) return -1;
+		if( reader->size() == 0 ) {
+			LOG(WARNING) << playPath << " has no frames to play";
+			return -1;
+		}
+
+		mode = reader->displayMode();
+		do3D = reader->is3D();
+		LOG(INFO) << "Playing " << reader->size() << " frames in " << displayModeToString( mode );
+	}
+
+	SimulatedDeckLink *sim = nullptr;
+	if( simulate || reader ) {
+		SimulatedDeckLink::Options opts;
+		opts.mode = mode;
+		opts.is3D = do3D;
+		opts.realTime = !unthrottled;
+		opts.recording = reader;
+		sim = new SimulatedDeckLink( opts );
+	}
+
+	std::unique_ptr<InputOutputClient> clientPtr( sim ? new InputOutputClient( sim ) : new InputOutputClient( cardNum ) );
+	InputOutputClient &client( *clientPtr );
+
+	std::atomic<int> count( 0 );
+	int displayed = 0;
 
 	// OpenCV windows must be initialized in main thread...
 	if(!noDisplay) {
@@ -246,20 +340,8 @@ int main( int argc, char** argv )
 		// \TODO.  need to make threadsafe...
 		if( !keepGoing ) return;
 
-		LOG(DEBUG) << "In callback";
-
-		InputHandler::MatVector images;
-
-		if( scale == 1.0 ) {
-			images = rawImages;
-		} else {
-			std::transform( rawImages.begin(), rawImages.end(), back_inserter(images),
-											[scale]( const cv::Mat &input ) -> cv::Mat {
-														cv::Mat output;
-														cv::resize( input, output, cv::Size(), scale, scale);
-														return output; }
-										);
-		}
+		// Images arrive already scaled (see setDecodeScale below)
+		const InputHandler::MatVector &images( rawImages );
 
 		if( !noDisplay ) {
 
@@ -301,6 +383,21 @@ int main( int argc, char** argv )
 
 
 
+	// Decode straight to the display size rather than resizing full frames
+	if( scale <= 0.0 || scale > 1.0 ) {
+		LOG(WARNING) << "Scale must be in (0,1], not " << scale;
+		return -1;
+	}
+	client.input().setDecodeScale( scale );
+
+	if( reader ) client.input().setPixelFormat( reader->pixelFormat() );
+
+	FrameRecorder recorder;
+	if( !recordPath.empty() ) {
+		if( !recorder.open( recordPath ) ) return -1;
+		client.input().setRecorder( &recorder );
+	}
+
 	const bool doAutoConfig = !skipAutoConfig;
 	if( !client.input().enable( mode, doAutoConfig, do3D ) ) {
 		LOG(WARNING) << "Failed to enable input";
@@ -319,12 +416,15 @@ int main( int argc, char** argv )
 
 	LOG(INFO) << "Streams started!";
 
+	const std::chrono::steady_clock::time_point start( std::chrono::steady_clock::now() );
+	const double cpuStart = cpuSeconds();
+
 
 	if ( !skipConfigCamera ) {
 		LOG(INFO) << "Sending configuration to cameras";
 
 		// Be careful not to exceed 255 byte buffer length
-		SDIBufferGuard guard( client.output().sdiProtocolBuffer() );
+		SDIBufferGuard guard( client.output().commandQueue() );
 		guard( [mode]( BMSDIBuffer *buffer ) {
 
 			bmAddAutoExposureMode( buffer, CamNum, BM_AUTOEXPOSURE_SHUTTER );
@@ -346,24 +446,32 @@ int main( int argc, char** argv )
 
 	while( keepGoing ) {
 
-		std::chrono::steady_clock::time_point loopStart( std::chrono::steady_clock::now() );
-		//if( (duration > 0) && (loopStart > end) ) { keepGoing = false;  break; }
+		std::chrono::duration<float> elapsed( std::chrono::steady_clock::now() - start );
+		if( (duration > 0) && (elapsed.count() >= duration) ) { keepGoing = false;  break; }
+		if( reader && sim->playbackPosition() >= reader->size() ) break;
 
-		usleep(100000);
+		// Poll more often when benchmarking, so the run isn't overstated
+		usleep( bench ? 1000 : 100000 );
 
 	}
 
-	 //std::chrono::duration<float> dur( std::chrono::steady_clock::now()  - start );
+	const std::chrono::duration<float> dur( std::chrono::steady_clock::now() - start );
+	const double cpu = cpuSeconds() - cpuStart;
+	const int delivered = count;
 
 	LOG(INFO) << "End of main loop, stopping streams...";
 
 	client.stopStreams();
+	client.input().setRecorder( nullptr );
+	recorder.close();
+
+	if( bench )
+		printBenchReport( client.input(), sim, recordPath.empty() ? nullptr : &recorder, delivered, dur.count(), cpu );
 
+	LOG_IF( INFO, displayed > 0 ) << "   Displayed " << displayed << " frames";
 
-	// LOG(INFO) << "Recorded " << count << " frames in " <<   dur.count();
-	// LOG(INFO) << " Average of " << (float)count / dur.count() << " FPS";
-	// LOG(INFO) << "   " << miss << " / " << (miss+count) << " misses";
-	// LOG_IF( INFO, displayed > 0 ) << "   Displayed " << displayed << " frames";
+	clientPtr.reset();
+	if( sim ) sim->Release();
 
 
 